@@ -10,6 +10,44 @@ screen =
     debug_info = 0;
 }
 
+system =
+{
+    worker_threads = -1;                        -- Worker pool size: -1 - use all CPU cores, 0 - single threaded.
+    sim_thread = 0;                             -- Run game frame on own thread while previous frame is drawn (adds one frame of latency).
+}
+
+physics =
+{
+    multithreaded = 1;                          -- Run narrowphase and island solver on the worker pool.
+    hair_pbd = 1;                               -- Simulate hair chains in parallel by own solver instead of Bullet bodies.
+    lazy_shapes = 1;                            -- Build room collision on worker threads when bodies come near, not at level load.
+    bvh_cache = 1;                              -- Keep built collision trees in cache folder.
+    merge_statics = 1;                          -- Put static mesh collision into room collision mesh instead of own bodies.
+}
+
+rewind =
+{
+    length = 20.0;                              -- Seconds of gameplay history kept for rewind, 0 - disabled.
+    interval = 0.1;                             -- Seconds between snapshots.
+    keyframe_period = 32;                       -- Every N-th snapshot is stored whole, others as delta.
+}
+
+animation =
+{
+    lod = 1;                                    -- Reduce pose updates of far and out of view entities.
+    lod_near_distance = 8192.0;                 -- Full rate closer to camera or player.
+    lod_far_distance = 16384.0;                 -- Pose is updated every lod_reduced_period frames up to it, every lod_far_period behind.
+    lod_reduced_period = 2;
+    lod_far_period = 4;
+}
+
+residency =
+{
+    enabled = 1;                                -- Build room geometry in background, only near player and camera.
+    hops = 2;                                   -- Rooms within this many portals are kept resident.
+    budget = 64.0;                              -- MB of room geometry; rooms not needed now are released above it.
+}
+
 audio =
 {
     sound_volume = 0.8;
@@ -29,6 +67,9 @@ render =
     antialias_samples = 4;                      -- Maximum depends and is limited by hardware capabilities.
     z_depth = 24;                               -- Maximum and recommended is 24.
     texture_border = 16;
+    texture_packer = 0;                         -- Atlas layout: 0 - BSP tree, 1 - MaxRects (denser, slower).
+    texture_compression = 0;                    -- BC1 / BC3 compressed atlas; create "cache" folder to keep encoded pages.
+    texture_upscale = 1;                        -- Pixel art upscale of level textures: 1 - off, 2, 3 or 4 (Scale2x / Scale3x), cached in "cache" folder.
     fog_color = {r = 255, g = 255, b = 255};
 }
 
@@ -98,6 +139,7 @@ bind(act.screenshot, KEY_PRINTSCREEN);
 bind(act.console, KEY_BACKQUOTE);
 bind(act.savegame, KEY_F5);
 bind(act.loadgame, KEY_F6);
+bind(act.rewind, KEY_BACKSPACE);                -- needs rewind.length > 0
 
 bind(act.smallmedi, KEY_9);
 bind(act.bigmedi, KEY_0);
@@ -326,3 +326,4 @@ act.loadgame = 39;
 act.savegame = 40;
 act.console = 41;
 act.screenshot = 42;
+act.rewind = 43;
@@ -2032,6 +2032,7 @@ void Character_ApplyCommands(struct entity_s *ent)
         return;
     }
 
+    Physics_RequireRoomShapes(ent->self->room);
     Character_UpdateCurrentHeight(ent);
     Character_UpdatePlatformPreStep(ent);
 
@@ -2164,6 +2165,7 @@ int Character_SetParamMaximum(struct entity_s *ent, int parameter, float max_val
 
     max_value = (max_value < 0) ? (0) : (max_value);    // Clamp max. to at least zero
     ent->character->parameters.maximum[parameter] = max_value;
+    ent->state_dirty = 1;
     return 1;
 }
 
@@ -2180,6 +2182,7 @@ int Character_SetParam(struct entity_s *ent, int parameter, float value)
     value = (value <= maximum) ? (value) : (maximum);
 
     ent->character->parameters.param[parameter] = value;
+    ent->state_dirty = 1;
     return 1;
 }
 
@@ -2206,6 +2209,8 @@ int Character_ChangeParam(struct entity_s *ent, int parameter, float value)
     if((current == maximum) && (value > 0))
         return 0;
 
+    ent->state_dirty = 1;
+
     current += value;
 
     if(current < 0)
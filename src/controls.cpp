@@ -151,17 +151,21 @@ void Controls_Key(int32_t button, int state)
                     control_states.gui_inventory = state;
                     break;
 
+                case ACT_REWIND:
+                    control_states.rewind = state;
+                    break;
+
                 case ACT_SAVEGAME:
                     if(!state)
                     {
-                        Game_Save("qsave.lua");
+                        Game_Save("qsave.sav");
                     }
                     break;
 
                 case ACT_LOADGAME:
                     if(!state)
                     {
-                        Game_Load("qsave.lua");
+                        Game_Load("qsave.sav");
                     }
                     break;
 
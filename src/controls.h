@@ -63,8 +63,9 @@ enum ACTIONS {
     // Service keys
     ACT_CONSOLE,                // 41
     ACT_SCREENSHOT,             // 42
+    ACT_REWIND,                 // 43 Not in original, steps game state back while held
     // Last action index. This should ALWAYS remain last entry!
-    ACT_LASTINDEX               // 43
+    ACT_LASTINDEX               // 44
 };
 
 enum AXES {
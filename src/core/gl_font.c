@@ -6,6 +6,8 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL2/SDL_platform.h>
 #include <SDL2/SDL_opengl.h>
 #include <math.h>
@@ -21,6 +23,48 @@
 
 #define vec4_copy(x, y) {(x)[0] = (y)[0]; (x)[1] = (y)[1]; (x)[2] = (y)[2]; (x)[3] = (y)[3];}
 
+static const uint32_t glf_warmup_ranges[][2] =
+{
+    {0x0020, 0x007E},   // ASCII
+    {0x00A0, 0x00FF},   // Latin-1 supplement
+    {0x0400, 0x045F}    // Cyrillic
+};
+
+static char_info_p glf_get_glyph(gl_tex_font_p glf, uint32_t glyph_index);
+
+
+static void glf_init(gl_tex_font_p glf, FT_Library ft_library, uint16_t font_size)
+{
+    glf->ft_library = ft_library;
+    glf->face_glyphs_count = glf->ft_face->num_glyphs;
+    glf->glyph_slots = (uint16_t*)calloc(glf->face_glyphs_count, sizeof(uint16_t));
+    glf->glyphs = (char_info_p)malloc(GLF_CACHE_GLYPHS_MAX * sizeof(char_info_t));
+    glf->glyphs_count = 0;
+    glf->use_stamp = 0;
+    glf->lock_stamp = 0;
+    glf->atlas_epoch = 0;
+    glf->batch_lock = 0;
+    glf->layouts = (glf_layout_p)calloc(GLF_LAYOUT_CACHE_SETS * GLF_LAYOUT_CACHE_WAYS, sizeof(glf_layout_t));
+    glf->render_buffer = NULL;
+    glf->render_buffer_size = 0;
+    glf->shelves = NULL;
+    glf->shelves_count = 0;
+    glf->shelves_max = 0;
+
+    qglGetIntegerv(GL_MAX_TEXTURE_SIZE, &glf->gl_max_tex_width);
+    glf->gl_tex_width = 0;
+    glf->gl_tex_height = 0;
+    glf->gl_tex_index = 0;
+    glf->gl_font_color[0] = 0.0;
+    glf->gl_font_color[1] = 0.0;
+    glf->gl_font_color[2] = 0.0;
+    glf->gl_font_color[3] = 1.0;
+
+    FT_Select_Charmap(glf->ft_face, FT_ENCODING_UNICODE);
+    glf_resize(glf, font_size);
+}
+
+
 gl_tex_font_p glf_create_font(FT_Library ft_library, const char *file_name, uint16_t font_size)
 {
     if(ft_library != NULL)
@@ -34,21 +78,7 @@ gl_tex_font_p glf_create_font(FT_Library ft_library, const char *file_name, uint
             return NULL;
         }
 
-        glf->glyphs_count = glf->ft_face->num_glyphs;
-        glf->glyphs = (char_info_p)malloc(glf->glyphs_count * sizeof(char_info_t));
-
-        qglGetIntegerv(GL_MAX_TEXTURE_SIZE, &glf->gl_max_tex_width);
-        glf->gl_tex_width = glf->gl_max_tex_width;
-        glf->gl_tex_indexes = NULL;
-        glf->gl_tex_indexes_count = 0;
-        glf->gl_real_tex_indexes_count = 0;
-        glf->gl_font_color[0] = 0.0;
-        glf->gl_font_color[1] = 0.0;
-        glf->gl_font_color[2] = 0.0;
-        glf->gl_font_color[3] = 1.0;
-
-        glf_resize(glf, font_size);
-        FT_Select_Charmap(glf->ft_face, FT_ENCODING_UNICODE);
+        glf_init(glf, ft_library, font_size);
 
         return glf;
     }
@@ -77,16 +107,7 @@ gl_tex_font_p glf_create_font_mem(FT_Library ft_library, void *face_data, size_t
             return NULL;
         }
 
-        glf->glyphs_count = glf->ft_face->num_glyphs;
-        glf->glyphs = (char_info_p)malloc(glf->glyphs_count * sizeof(char_info_t));
-
-        qglGetIntegerv(GL_MAX_TEXTURE_SIZE, &glf->gl_max_tex_width);
-        glf->gl_tex_width = glf->gl_max_tex_width;
-        glf->gl_tex_indexes = NULL;
-        glf->gl_tex_indexes_count = 0;
-        glf->gl_real_tex_indexes_count = 0;
-        glf_resize(glf, font_size);
-        FT_Select_Charmap(glf->ft_face, FT_ENCODING_UNICODE);
+        glf_init(glf, ft_library, font_size);
 
         return glf;
     }
@@ -111,18 +132,43 @@ void glf_free_font(gl_tex_font_p glf)
             glf->glyphs = NULL;
         }
         glf->glyphs_count = 0;
-
-        glf->gl_real_tex_indexes_count = 0;
-        if(glf->gl_tex_indexes != NULL)
+        if(glf->glyph_slots != NULL)
         {
-            if(glf->gl_tex_indexes_count > 0)
+            free(glf->glyph_slots);
+            glf->glyph_slots = NULL;
+        }
+        glf->face_glyphs_count = 0;
+        if(glf->shelves != NULL)
+        {
+            free(glf->shelves);
+            glf->shelves = NULL;
+        }
+        glf->shelves_count = 0;
+        glf->shelves_max = 0;
+        if(glf->layouts != NULL)
+        {
+            glf_layout_p l = glf->layouts;
+            for(int i = 0; i < GLF_LAYOUT_CACHE_SETS * GLF_LAYOUT_CACHE_WAYS; i++, l++)
             {
-                qglDeleteTextures(glf->gl_tex_indexes_count, glf->gl_tex_indexes);
+                free(l->text);
+                free(l->quads);
+                free(l->quad_shelves);
             }
-            free(glf->gl_tex_indexes);
+            free(glf->layouts);
+            glf->layouts = NULL;
+        }
+        if(glf->render_buffer != NULL)
+        {
+            free(glf->render_buffer);
+            glf->render_buffer = NULL;
+        }
+        glf->render_buffer_size = 0;
+
+        if(glf->gl_tex_index != 0)
+        {
+            qglDeleteTextures(1, &glf->gl_tex_index);
+            glf->gl_tex_index = 0;
         }
-        glf->gl_tex_indexes_count = 0;
-        glf->gl_tex_indexes = NULL;
 
         free(glf);
     }
@@ -190,152 +236,309 @@ static __inline void bbox_add(float *x0, float *x1, float *y0, float *y1,
 }
 
 
-void glf_resize(gl_tex_font_p glf, uint16_t font_size)
+static void glf_clear_region(gl_tex_font_p glf, GLint y, GLint height)
 {
-    if((glf != NULL) && (glf->ft_face != NULL))
+    GLubyte *buffer = (GLubyte*)calloc(glf->gl_tex_width * height, sizeof(GLubyte));
+    qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_index);
+    qglTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, glf->gl_tex_width, height, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
+    free(buffer);
+}
+
+
+static __inline void glf_next_stamp(gl_tex_font_p glf)
+{
+    glf->use_stamp++;
+    if(!glf->batch_lock)
     {
-        const GLint padding = 2;
-        GLubyte *buffer;
-        GLint chars_in_row, chars_in_column;
-        size_t buffer_size;
-        int x, y, xx, yy;
-        int i, ii, i0 = 0;
+        glf->lock_stamp = glf->use_stamp;
+    }
+}
+
 
-        // clear old atlas, if exists
-        if(glf->gl_tex_indexes != NULL)
+static void glf_evict_shelf(gl_tex_font_p glf, int shelf)
+{
+    char_info_p g = glf->glyphs;
+    for(uint16_t i = 0; i < glf->glyphs_count; i++, g++)
+    {
+        if(g->shelf == shelf)
         {
-            if(glf->gl_tex_indexes_count > 0)
-            {
-                qglDeleteTextures(glf->gl_tex_indexes_count, glf->gl_tex_indexes);
-            }
-            free(glf->gl_tex_indexes);
+            g->tex_index = 0;
+            g->shelf = -1;
         }
-        glf->gl_tex_indexes = NULL;
-        glf->gl_real_tex_indexes_count = 0;
+    }
+    glf->shelves[shelf].x = 0;
+    glf->shelves[shelf].last_used = 0;
+    glf->atlas_epoch++;
+    glf_clear_region(glf, glf->shelves[shelf].y, glf->shelves[shelf].height);
+}
 
-        // resize base font
-        glf->font_size = font_size;
-        FT_Set_Char_Size(glf->ft_face, font_size << 6, font_size << 6, 0, 0);
 
-        // calculate texture atlas size
-        chars_in_row = 1 + sqrt(glf->glyphs_count);
-        glf->gl_tex_width = (font_size + padding) * chars_in_row;
-        glf->gl_tex_width = NextPowerOf2(glf->gl_tex_width);
-        if(glf->gl_tex_width > glf->gl_max_tex_width)
-        {
-            glf->gl_tex_width = glf->gl_max_tex_width;
-        }
+/*
+ * Finds place for w x h image: best fitting shelf, new shelf or evicted least
+ * recently used shelf. Returns shelf index or -1 if atlas is busy.
+ */
+static int glf_atlas_place(gl_tex_font_p glf, GLint w, GLint h, GLint *x, GLint *y)
+{
+    glf_shelf_p s;
+    int best = -1;
 
-        // create new atlas
-        chars_in_row = glf->gl_tex_width / (font_size + padding);
-        chars_in_column = glf->glyphs_count / chars_in_row + 1;
-        glf->gl_tex_indexes_count = (chars_in_column * (font_size + padding)) / glf->gl_tex_width + 1;
-        glf->gl_tex_indexes = (GLuint*)malloc(glf->gl_tex_indexes_count * sizeof(GLuint));
-        qglGenTextures(glf->gl_tex_indexes_count, glf->gl_tex_indexes);
+    w += GLF_PADDING;
+    h += GLF_PADDING;
+    if((w > glf->gl_tex_width) || (h > glf->gl_tex_height))
+    {
+        return -1;
+    }
 
-        buffer_size = glf->gl_tex_width * glf->gl_tex_width * sizeof(GLubyte);
-        buffer = (GLubyte*)malloc(buffer_size);
-        memset(buffer, 0x00, buffer_size);
+    s = glf->shelves;
+    for(int i = 0; i < glf->shelves_count; i++, s++)
+    {
+        if((s->x + w <= glf->gl_tex_width) && (h <= s->height) &&
+           ((best < 0) || (s->height < glf->shelves[best].height)))
+        {
+            best = i;
+        }
+    }
 
-        for(i = 0, x = 0, y = 0; i < glf->glyphs_count; i++)
+    if((best < 0) && (glf->shelves_count < glf->shelves_max))
+    {
+        GLint step = (glf->font_size / 4 > 4) ? (glf->font_size / 4) : (4);
+        GLint next_y = (glf->shelves_count) ? (glf->shelves[glf->shelves_count - 1].y + glf->shelves[glf->shelves_count - 1].height) : (0);
+        GLint height = (h + step - 1) / step * step;
+        height = (next_y + height > glf->gl_tex_height) ? (glf->gl_tex_height - next_y) : (height);
+        if(height >= h)
         {
-            FT_GlyphSlot g;
-            glf->glyphs[i].tex_index = 0;
+            best = glf->shelves_count++;
+            s = glf->shelves + best;
+            s->x = 0;
+            s->y = next_y;
+            s->height = height;
+            s->last_used = 0;
+        }
+    }
 
-            /* load glyph image into the slot (erase previous one) */
-            if(FT_Load_Glyph(glf->ft_face, i, FT_LOAD_RENDER))
-            {
-                continue;
-            }
-            /* convert to an anti-aliased bitmap */
-            if(FT_Render_Glyph(glf->ft_face->glyph, FT_RENDER_MODE_NORMAL))
+    if(best < 0)
+    {
+        s = glf->shelves;
+        for(int i = 0; i < glf->shelves_count; i++, s++)
+        {
+            if((h <= s->height) && (s->last_used < glf->lock_stamp) &&
+               ((best < 0) || (s->last_used < glf->shelves[best].last_used)))
             {
-                continue;
+                best = i;
             }
+        }
+        if(best >= 0)
+        {
+            glf_evict_shelf(glf, best);
+        }
+    }
 
-            g = glf->ft_face->glyph;
-            glf->glyphs[i].width = g->bitmap.width;
-            glf->glyphs[i].height = g->bitmap.rows;
-            glf->glyphs[i].advance_x = g->advance.x;
-            glf->glyphs[i].advance_y = g->advance.y;
-            glf->glyphs[i].left = g->bitmap_left;
-            glf->glyphs[i].top = g->bitmap_top;
+    if(best >= 0)
+    {
+        s = glf->shelves + best;
+        *x = s->x;
+        *y = s->y;
+        s->x += w;
+    }
 
-            if((g->bitmap.width == 0) || (g->bitmap.rows == 0))
-            {
-                continue;
-            }
+    return best;
+}
 
-            if(x + g->bitmap.width > glf->gl_tex_width)
+
+static void glf_rasterize_glyph(gl_tex_font_p glf, char_info_p glyph)
+{
+    FT_GlyphSlot g;
+    GLint x, y;
+    int shelf;
+
+    glyph->tex_index = 0;
+    glyph->shelf = -1;
+
+    /* load glyph image into the slot (erase previous one) */
+    if(FT_Load_Glyph(glf->ft_face, glyph->glyph_index, FT_LOAD_RENDER))
+    {
+        return;
+    }
+    /* convert to an anti-aliased bitmap */
+    if(FT_Render_Glyph(glf->ft_face->glyph, FT_RENDER_MODE_NORMAL))
+    {
+        return;
+    }
+
+    g = glf->ft_face->glyph;
+    glyph->width = g->bitmap.width;
+    glyph->height = g->bitmap.rows;
+    glyph->advance_x = g->advance.x;
+    glyph->advance_y = g->advance.y;
+    glyph->left = g->bitmap_left;
+    glyph->top = g->bitmap_top;
+
+    if((g->bitmap.width == 0) || (g->bitmap.rows == 0))
+    {
+        return;
+    }
+
+    shelf = glf_atlas_place(glf, g->bitmap.width, g->bitmap.rows, &x, &y);
+    if(shelf >= 0)
+    {
+        GLubyte *buffer = (GLubyte*)malloc(g->bitmap.width * g->bitmap.rows * sizeof(GLubyte));
+        GLint unpack_alignment = 4;
+        for(int yy = 0; yy < g->bitmap.rows; yy++)
+        {
+            memcpy(buffer + yy * g->bitmap.width, g->bitmap.buffer + yy * g->bitmap.pitch, g->bitmap.width);
+        }
+        qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_index);
+        qglGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+        qglPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        qglTexSubImage2D(GL_TEXTURE_2D, 0, x, y, g->bitmap.width, g->bitmap.rows, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
+        qglPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+        free(buffer);
+
+        glyph->tex_index = glf->gl_tex_index;
+        glyph->shelf = shelf;
+        glyph->tex_x0 = (GLfloat)x / (GLfloat)glf->gl_tex_width;
+        glyph->tex_y0 = (GLfloat)y / (GLfloat)glf->gl_tex_height;
+        glyph->tex_x1 = (GLfloat)(x + g->bitmap.width) / (GLfloat)glf->gl_tex_width;
+        glyph->tex_y1 = (GLfloat)(y + g->bitmap.rows) / (GLfloat)glf->gl_tex_height;
+    }
+}
+
+
+static char_info_p glf_get_glyph(gl_tex_font_p glf, uint32_t glyph_index)
+{
+    char_info_p ret;
+
+    if(glyph_index >= glf->face_glyphs_count)
+    {
+        glyph_index = 0;
+    }
+
+    if(glf->glyph_slots[glyph_index])
+    {
+        ret = glf->glyphs + glf->glyph_slots[glyph_index] - 1;
+        if((ret->tex_index == 0) && (ret->width > 0) && (ret->height > 0))
+        {
+            glf_rasterize_glyph(glf, ret);                                      // image was evicted
+        }
+    }
+    else
+    {
+        if(glf->glyphs_count < GLF_CACHE_GLYPHS_MAX)
+        {
+            ret = glf->glyphs + glf->glyphs_count++;
+        }
+        else
+        {
+            // reuse least recently used entry; its image stays in atlas until shelf eviction.
+            char_info_p g = glf->glyphs;
+            ret = NULL;
+            for(uint16_t i = 0; i < glf->glyphs_count; i++, g++)
             {
-                x = 0;
-                y += glf->font_size + padding;
-                if(y + glf->font_size > glf->gl_tex_width)
+                if((g->last_used < glf->lock_stamp) && (!ret || (g->last_used < ret->last_used)))
                 {
-                    int ii;
-                    qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_indexes[glf->gl_real_tex_indexes_count]);
-                    qglTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-                    qglTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-                    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-                    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-                    qglTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, glf->gl_tex_width, glf->gl_tex_width, 0, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
-                    for(ii = i0; ii < i; ii++)
-                    {
-                        glf->glyphs[ii].tex_x0 /= (GLfloat)glf->gl_tex_width;
-                        glf->glyphs[ii].tex_x1 /= (GLfloat)glf->gl_tex_width;
-                        glf->glyphs[ii].tex_y0 /= (GLfloat)glf->gl_tex_width;
-                        glf->glyphs[ii].tex_y1 /= (GLfloat)glf->gl_tex_width;
-                    }
-                    memset(buffer, 0x00, buffer_size);
-                    y = 0;
-                    i0 = i;
-                    glf->gl_real_tex_indexes_count++;
+                    ret = g;
                 }
             }
+            ret = (ret) ? (ret) : (glf->glyphs);
+            glf->glyph_slots[ret->glyph_index] = 0;
+        }
+        glf->glyph_slots[glyph_index] = ret - glf->glyphs + 1;
+        ret->glyph_index = glyph_index;
+        ret->width = 0;
+        ret->height = 0;
+        ret->left = 0;
+        ret->top = 0;
+        ret->advance_x = 0.0f;
+        ret->advance_y = 0.0f;
+        glf_rasterize_glyph(glf, ret);
+    }
+
+    ret->last_used = glf->use_stamp;
+    if(ret->shelf >= 0)
+    {
+        glf->shelves[ret->shelf].last_used = glf->use_stamp;
+    }
+
+    return ret;
+}
 
-            glf->glyphs[i].tex_x0 = (GLfloat)x;
-            glf->glyphs[i].tex_y0 = (GLfloat)y;
-            glf->glyphs[i].tex_x1 = (GLfloat)(x + g->bitmap.width);
-            glf->glyphs[i].tex_y1 = (GLfloat)(y + g->bitmap.rows);
 
-            glf->glyphs[i].tex_index = glf->gl_tex_indexes[glf->gl_real_tex_indexes_count];
-            for(xx = 0; xx < g->bitmap.width; xx++)
+void glf_resize(gl_tex_font_p glf, uint16_t font_size)
+{
+    if((glf != NULL) && (glf->ft_face != NULL))
+    {
+        GLint tex_width;
+
+        // resize base font
+        glf->font_size = font_size;
+        FT_Set_Char_Size(glf->ft_face, font_size << 6, font_size << 6, 0, 0);
+
+        // drop cache
+        glf->atlas_epoch++;
+        glf->glyphs_count = 0;
+        memset(glf->glyph_slots, 0, glf->face_glyphs_count * sizeof(uint16_t));
+        glf->shelves_count = 0;
+
+        // atlas size depends on font size only, not on face coverage
+        tex_width = NextPowerOf2((font_size + GLF_PADDING) * GLF_ATLAS_CHARS_IN_ROW);
+        tex_width = (tex_width > glf->gl_max_tex_width) ? (glf->gl_max_tex_width) : (tex_width);
+        if((glf->gl_tex_index == 0) || (tex_width != glf->gl_tex_width))
+        {
+            GLubyte *buffer = (GLubyte*)calloc(tex_width * tex_width, sizeof(GLubyte));
+            if(glf->gl_tex_index == 0)
             {
-                for(yy = 0; yy < g->bitmap.rows; yy++)
-                {
-                    buffer[(y+yy)*glf->gl_tex_width + (x+xx)] = g->bitmap.buffer[yy * g->bitmap.width + xx];
-                }
+                qglGenTextures(1, &glf->gl_tex_index);
             }
+            glf->gl_tex_width = tex_width;
+            glf->gl_tex_height = tex_width;
+            qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_index);
+            qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            qglTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, glf->gl_tex_width, glf->gl_tex_height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
+            free(buffer);
 
-            x += (g->bitmap.width + padding);
+            glf->shelves_max = glf->gl_tex_height / 4;
+            glf->shelves = (glf_shelf_p)realloc(glf->shelves, glf->shelves_max * sizeof(glf_shelf_t));
+        }
+        else
+        {
+            glf_clear_region(glf, 0, glf->gl_tex_height);
         }
 
-        qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_indexes[glf->gl_real_tex_indexes_count]);
-        qglTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-        qglTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-        qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        chars_in_column = NextPowerOf2(y + font_size + padding);
-        qglTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, glf->gl_tex_width, chars_in_column, 0, GL_ALPHA, GL_UNSIGNED_BYTE, buffer);
-        for(ii = i0; ii < glf->glyphs_count; ii++)
+        // warm up common glyphs
+        glf_next_stamp(glf);
+        for(uint32_t i = 0; i < sizeof(glf_warmup_ranges) / sizeof(glf_warmup_ranges[0]); i++)
         {
-            glf->glyphs[ii].tex_x0 /= (GLfloat)glf->gl_tex_width;
-            glf->glyphs[ii].tex_x1 /= (GLfloat)glf->gl_tex_width;
-            glf->glyphs[ii].tex_y0 /= (GLfloat)chars_in_column;
-            glf->glyphs[ii].tex_y1 /= (GLfloat)chars_in_column;
+            for(uint32_t ch = glf_warmup_ranges[i][0]; ch <= glf_warmup_ranges[i][1]; ch++)
+            {
+                uint32_t glyph_index = FT_Get_Char_Index(glf->ft_face, ch);
+                if(glyph_index)
+                {
+                    glf_get_glyph(glf, glyph_index);
+                }
+            }
         }
-        free(buffer);
-        glf->gl_real_tex_indexes_count++;
     }
 }
 
 
 void glf_reface(gl_tex_font_p glf, const char *file_name, uint16_t font_size)
 {
-    if(FT_New_Face(glf->ft_library, file_name, 0, &glf->ft_face))
+    FT_Face face = NULL;
+    if(FT_New_Face(glf->ft_library, file_name, 0, &face))
     {
         return;
     }
+    if(glf->ft_face != NULL)
+    {
+        FT_Done_Face(glf->ft_face);
+    }
+    glf->ft_face = face;
+    glf->face_glyphs_count = face->num_glyphs;
+    glf->glyph_slots = (uint16_t*)realloc(glf->glyph_slots, glf->face_glyphs_count * sizeof(uint16_t));
+    FT_Select_Charmap(glf->ft_face, FT_ENCODING_UNICODE);
     glf_resize(glf, font_size);
 }
 
@@ -373,12 +576,14 @@ float glf_get_string_len(gl_tex_font_p glf, const char *text, int n)
         uint8_t *nch, *nch2, *ch = (uint8_t*)text;
         uint32_t curr_utf32, next_utf32;
 
+        glf_next_stamp(glf);
         nch = utf8_to_utf32(ch, &curr_utf32);
         curr_utf32 = FT_Get_Char_Index(glf->ft_face, curr_utf32);
 
         for(int i = 0; (*ch != 0) && !((n >= 0) && (i >= n)); i++)
         {
             FT_Vector kern;
+            char_info_p g = glf_get_glyph(glf, curr_utf32);
 
             nch2 = utf8_to_utf32(nch, &next_utf32);
             next_utf32 = FT_Get_Char_Index(glf->ft_face, next_utf32);
@@ -387,7 +592,7 @@ float glf_get_string_len(gl_tex_font_p glf, const char *text, int n)
 
             FT_Get_Kerning(glf->ft_face, curr_utf32, next_utf32, FT_KERNING_UNSCALED, &kern);   // kern in 1/64 pixel
             curr_utf32 = next_utf32;
-            x += (GLfloat)(kern.x + glf->glyphs[curr_utf32].advance_x) / 64.0;
+            x += (GLfloat)(kern.x + g->advance_x) / 64.0;
         }
     }
 
@@ -411,13 +616,14 @@ void glf_get_string_bb(gl_tex_font_p glf, const char *text, int n, GLfloat *x0,
         float xx0, xx1, yy0, yy1;
         uint32_t curr_utf32, next_utf32;
 
+        glf_next_stamp(glf);
         nch = utf8_to_utf32(ch, &curr_utf32);
         curr_utf32 = FT_Get_Char_Index(glf->ft_face, curr_utf32);
 
         for(int i = 0; (*ch != 0) && !((n >= 0) && (i >= n)); i++)
         {
             FT_Vector kern;
-            char_info_p g = glf->glyphs + curr_utf32;
+            char_info_p g = glf_get_glyph(glf, curr_utf32);
 
             nch2 = utf8_to_utf32(nch, &next_utf32);
 
@@ -441,163 +647,189 @@ void glf_get_string_bb(gl_tex_font_p glf, const char *text, int n, GLfloat *x0,
 }
 
 
-void glf_render_str(gl_tex_font_p glf, GLfloat x, GLfloat y, const char *text)
+static uint32_t glf_hash_str(const char *text)
 {
-    if(glf && glf->ft_face && text && (text[0] != 0))
+    uint32_t ret = 2166136261u;                                                 // FNV-1a
+    for(; *text; text++)
+    {
+        ret = (ret ^ (uint8_t)*text) * 16777619u;
+    }
+    return ret;
+}
+
+
+static void glf_shape_layout(gl_tex_font_p glf, glf_layout_p layout, const char *text)
+{
+    uint8_t *nch, *ch = (uint8_t*)text;
+    uint32_t curr_utf32, next_utf32;
+    float x = 0.0;
+    float y = 0.0;
+    uint32_t len = utf8_strlen(text);
+
+    if(len > layout->quads_max)
+    {
+        layout->quads_max = (len > 0xFFFF) ? (0xFFFF) : (len);
+        layout->quads = (GLfloat*)realloc(layout->quads, 24 * layout->quads_max * sizeof(GLfloat));
+        layout->quad_shelves = (int16_t*)realloc(layout->quad_shelves, layout->quads_max * sizeof(int16_t));
+    }
+    layout->quads_count = 0;
+    layout->rect[0] = 0.0;
+    layout->rect[1] = 0.0;
+    layout->rect[2] = 0.0;
+    layout->rect[3] = 0.0;
+
+    nch = utf8_to_utf32(ch, &curr_utf32);
+    curr_utf32 = FT_Get_Char_Index(glf->ft_face, curr_utf32);
+    while(*ch && (layout->quads_count < layout->quads_max))
     {
-        uint8_t *nch, *ch = (uint8_t*)text;
         FT_Vector kern;
-        if(glf->gl_real_tex_indexes_count == 1)
+        char_info_p g = glf_get_glyph(glf, curr_utf32);
+        uint8_t *nch2 = utf8_to_utf32(nch, &next_utf32);
+        GLfloat x0 = x  + g->left;
+        GLfloat x1 = x0 + g->width;
+        GLfloat y0 = y  + g->top;
+        GLfloat y1 = y0 - g->height;
+
+        next_utf32 = FT_Get_Char_Index(glf->ft_face, next_utf32);
+        ch = nch;
+        nch = nch2;
+        FT_Get_Kerning(glf->ft_face, curr_utf32, next_utf32, FT_KERNING_UNSCALED, &kern);   // kern in 1/64 pixel
+        curr_utf32 = next_utf32;
+
+        bbox_add(&x0, &x1, &y0, &y1, layout->rect + 0, layout->rect + 2, layout->rect + 1, layout->rect + 3);
+        if(g->tex_index != 0)
         {
-            GLuint elements_count = 0;
-            uint32_t curr_utf32, next_utf32;
-            GLfloat *p, *buffer;
+            GLfloat *p = layout->quads + 24 * layout->quads_count;
+            *p++ = x0;  *p++ = y0;  *p++ = g->tex_x0;   *p++ = g->tex_y0;
+            *p++ = x1;  *p++ = y0;  *p++ = g->tex_x1;   *p++ = g->tex_y0;
+            *p++ = x1;  *p++ = y1;  *p++ = g->tex_x1;   *p++ = g->tex_y1;
+            *p++ = x0;  *p++ = y0;  *p++ = g->tex_x0;   *p++ = g->tex_y0;
+            *p++ = x1;  *p++ = y1;  *p++ = g->tex_x1;   *p++ = g->tex_y1;
+            *p++ = x0;  *p++ = y1;  *p++ = g->tex_x0;   *p++ = g->tex_y1;
+            layout->quad_shelves[layout->quads_count++] = g->shelf;
+        }
+        x += (GLfloat)(kern.x + g->advance_x) / 64.0;
+        y += (GLfloat)(kern.y + g->advance_y) / 64.0;
+    }
+    layout->atlas_epoch = glf->atlas_epoch;
+}
 
-            buffer = (GLfloat*)malloc(48 * utf8_strlen(text) * sizeof(GLfloat));
-            nch = utf8_to_utf32(ch, &curr_utf32);
-            curr_utf32 = FT_Get_Char_Index(glf->ft_face, curr_utf32);
 
-            qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-            for(p = buffer; *ch;)
-            {
-                char_info_p g;
-                uint8_t *nch2 = utf8_to_utf32(nch, &next_utf32);
+glf_layout_p glf_get_layout(gl_tex_font_p glf, const char *text)
+{
+    glf_layout_p set, ret = NULL;
+    uint32_t hash;
+    size_t len;
 
-                next_utf32 = FT_Get_Char_Index(glf->ft_face, next_utf32);
-                ch = nch;
-                nch = nch2;
+    if(!glf || !glf->ft_face || !text)
+    {
+        return NULL;
+    }
 
-                g = glf->glyphs + curr_utf32;
-                FT_Get_Kerning(glf->ft_face, curr_utf32, next_utf32, FT_KERNING_UNSCALED, &kern);   // kern in 1/64 pixel
-                curr_utf32 = next_utf32;
+    glf_next_stamp(glf);
+    hash = glf_hash_str(text);
+    set = glf->layouts + (hash % GLF_LAYOUT_CACHE_SETS) * GLF_LAYOUT_CACHE_WAYS;
+    for(int i = 0; i < GLF_LAYOUT_CACHE_WAYS; i++)
+    {
+        glf_layout_p l = set + i;
+        if(l->text && (l->hash == hash) && (l->font_size == glf->font_size) && !strcmp(l->text, text))
+        {
+            ret = l;
+            break;
+        }
+        if(!ret || (l->last_used < ret->last_used))
+        {
+            ret = l;                                                            // least recently used way
+        }
+    }
 
-                if(g->tex_index != 0)
-                {
-                    GLfloat x0 = x  + g->left;
-                    GLfloat x1 = x0 + g->width;
-                    GLfloat y0 = y  + g->top;
-                    GLfloat y1 = y0 - g->height;
-
-                    *p = x0;            p++;
-                    *p = y0;            p++;
-                    *p = g->tex_x0;     p++;
-                    *p = g->tex_y0;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x1;            p++;
-                    *p = y0;            p++;
-                    *p = g->tex_x1;     p++;
-                    *p = g->tex_y0;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x1;            p++;
-                    *p = y1;            p++;
-                    *p = g->tex_x1;     p++;
-                    *p = g->tex_y1;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-                    elements_count++;
-
-                    *p = x0;            p++;
-                    *p = y0;            p++;
-                    *p = g->tex_x0;     p++;
-                    *p = g->tex_y0;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x1;            p++;
-                    *p = y1;            p++;
-                    *p = g->tex_x1;     p++;
-                    *p = g->tex_y1;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x0;            p++;
-                    *p = y1;            p++;
-                    *p = g->tex_x0;     p++;
-                    *p = g->tex_y1;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-                    elements_count++;
-                }
-                x += (GLfloat)(kern.x + g->advance_x) / 64.0;
-                y += (GLfloat)(kern.y + g->advance_y) / 64.0;
-            }
-            ///RENDER
-            if(elements_count != 0)
-            {
-                qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_indexes[0]);
-                qglVertexPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+0);
-                qglTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+2);
-                qglColorPointer(4, GL_FLOAT, 8 * sizeof(GLfloat), buffer+4);
-                qglDrawArrays(GL_TRIANGLES, 0, elements_count * 3);
-            }
-            qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-            free(buffer);
+    if(!ret->text || (ret->hash != hash) || (ret->font_size != glf->font_size) || strcmp(ret->text, text))
+    {
+        len = strlen(text) + 1;
+        if(len > ret->text_size)
+        {
+            ret->text_size = len;
+            ret->text = (char*)realloc(ret->text, len * sizeof(char));
         }
-        else
+        memcpy(ret->text, text, len);
+        ret->hash = hash;
+        ret->font_size = glf->font_size;
+        glf_shape_layout(glf, ret, text);
+    }
+    else if(ret->atlas_epoch != glf->atlas_epoch)
+    {
+        glf_shape_layout(glf, ret, text);
+    }
+    else
+    {
+        // keep used glyphs in atlas
+        for(uint16_t i = 0; i < ret->quads_count; i++)
         {
-            GLfloat *p, buffer[32];
-            GLuint active_texture = 0;
-            uint32_t curr_utf32, next_utf32;
-            nch = utf8_to_utf32(ch, &curr_utf32);
-            curr_utf32 = FT_Get_Char_Index(glf->ft_face, curr_utf32);
-            qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-            for(; *ch;)
-            {
-                char_info_p g;
-                uint8_t *nch2 = utf8_to_utf32(nch, &next_utf32);
+            glf->shelves[ret->quad_shelves[i]].last_used = glf->use_stamp;
+        }
+    }
+    ret->last_used = glf->use_stamp;
 
-                next_utf32 = FT_Get_Char_Index(glf->ft_face, next_utf32);
-                ch = nch;
-                nch = nch2;
+    return ret;
+}
 
-                g = glf->glyphs + curr_utf32;
-                FT_Get_Kerning(glf->ft_face, curr_utf32, next_utf32, FT_KERNING_UNSCALED, &kern);   // kern in 1/64 pixel
-                curr_utf32 = next_utf32;
 
-                if(g->tex_index != 0)
-                {
-                    if(active_texture != g->tex_index)
-                    {
-                        qglBindTexture(GL_TEXTURE_2D, g->tex_index);
-                        active_texture = g->tex_index;
-                    }
-                    ///RENDER
-                    GLfloat x0 = x  + g->left;
-                    GLfloat x1 = x0 + g->width;
-                    GLfloat y0 = y  + g->top;
-                    GLfloat y1 = y0 - g->height;
-
-                    p = buffer;
-                    *p = x0;            p++;
-                    *p = y0;            p++;
-                    *p = g->tex_x0;     p++;
-                    *p = g->tex_y0;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x1;            p++;
-                    *p = y0;            p++;
-                    *p = g->tex_x1;     p++;
-                    *p = g->tex_y0;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x1;            p++;
-                    *p = y1;            p++;
-                    *p = g->tex_x1;     p++;
-                    *p = g->tex_y1;     p++;
-                    vec4_copy(p, glf->gl_font_color);   p += 4;
-
-                    *p = x0;            p++;
-                    *p = y1;            p++;
-                    *p = g->tex_x0;     p++;
-                    *p = g->tex_y1;     p++;
-                    vec4_copy(p, glf->gl_font_color);
-
-                    qglVertexPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+0);
-                    qglTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+2);
-                    qglColorPointer(4, GL_FLOAT, 8 * sizeof(GLfloat), buffer+4);
-                    qglDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-                }
-                x += (GLfloat)(kern.x + g->advance_x) / 64.0;
-                y += (GLfloat)(kern.y + g->advance_y) / 64.0;
-            }
+uint32_t glf_layout_vertices(glf_layout_p layout, GLfloat *buffer, GLfloat x, GLfloat y, const GLfloat color[4])
+{
+    GLfloat *src = layout->quads;
+    uint32_t count = 6 * layout->quads_count;
+
+    for(uint32_t i = 0; i < count; i++, src += 4)
+    {
+        *buffer++ = x + src[0];
+        *buffer++ = y + src[1];
+        *buffer++ = src[2];
+        *buffer++ = src[3];
+        vec4_copy(buffer, color);
+        buffer += 4;
+    }
+
+    return count;
+}
+
+
+void glf_begin_batch(gl_tex_font_p glf)
+{
+    glf->batch_lock = 1;
+    glf->lock_stamp = glf->use_stamp + 1;
+}
+
+
+void glf_end_batch(gl_tex_font_p glf)
+{
+    glf->batch_lock = 0;
+}
+
+
+void glf_render_str(gl_tex_font_p glf, GLfloat x, GLfloat y, const char *text)
+{
+    if(glf && glf->ft_face && text && (text[0] != 0))
+    {
+        glf_layout_p layout = glf_get_layout(glf, text);
+        uint32_t size = 48 * layout->quads_count;
+
+        if(size > glf->render_buffer_size)
+        {
+            glf->render_buffer_size = size;
+            glf->render_buffer = (GLfloat*)realloc(glf->render_buffer, size * sizeof(GLfloat));
+        }
+
+        ///RENDER
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+        if(layout->quads_count != 0)
+        {
+            GLfloat *buffer = glf->render_buffer;
+            GLuint vertices_count = glf_layout_vertices(layout, buffer, x, y, glf->gl_font_color);
+            qglBindTexture(GL_TEXTURE_2D, glf->gl_tex_index);
+            qglVertexPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+0);
+            qglTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), buffer+2);
+            qglColorPointer(4, GL_FLOAT, 8 * sizeof(GLfloat), buffer+4);
+            qglDrawArrays(GL_TRIANGLES, 0, vertices_count);
         }
     }
 }
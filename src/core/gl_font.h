@@ -12,6 +12,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include <SDL2/SDL_platform.h>
 #include <SDL2/SDL_opengl.h>
@@ -19,9 +20,15 @@ extern "C" {
 #include <freetype.h>
 
 
+#define GLF_CACHE_GLYPHS_MAX        (1024)     // glyphs metrics kept in cache
+#define GLF_ATLAS_CHARS_IN_ROW      (24)       // atlas width in font size cells
+#define GLF_PADDING                 (2)
+#define GLF_LAYOUT_CACHE_SETS       (64)
+#define GLF_LAYOUT_CACHE_WAYS       (4)
+
 typedef struct char_info_s
 {
-    GLuint          tex_index;
+    GLuint          tex_index;                  // 0 if glyph image is not in atlas
     GLint           width;
     GLint           height;
     GLint           left;
@@ -34,22 +41,70 @@ typedef struct char_info_s
 
     GLfloat         advance_x;
     GLfloat         advance_y;
+
+    uint32_t        glyph_index;                // index in face
+    uint32_t        last_used;
+    int16_t         shelf;                      // -1 if not in atlas
 }char_info_t, *char_info_p;
 
+// Atlas row; all glyphs of a shelf are evicted together.
+typedef struct glf_shelf_s
+{
+    GLint           x;
+    GLint           y;
+    GLint           height;
+    uint32_t        last_used;
+}glf_shelf_t, *glf_shelf_p;
+
+// Shaped string: glyph quads relative to pen origin and bounds, cached by text hash.
+typedef struct glf_layout_s
+{
+    uint32_t        hash;
+    uint32_t        last_used;
+    uint32_t        atlas_epoch;                // quads are valid while atlas is not changed
+    uint16_t        font_size;
+    size_t          text_size;
+    char           *text;
+
+    uint16_t        quads_count;
+    uint16_t        quads_max;
+    GLfloat        *quads;                      // x, y, u, v; 6 vertices per quad
+    int16_t        *quad_shelves;
+    GLfloat         rect[4];                    // x0, y0, x1, y1
+}glf_layout_t, *glf_layout_p;
+
+/*
+ * Glyphs are rasterized on first use into one shelf-packed atlas texture.
+ * When atlas is full, least recently used shelf is cleared; glyphs used by
+ * the string being drawn (or the whole batch) are never evicted.
+ */
 typedef struct gl_tex_font_s
 {
     FT_Library               ft_library;
     FT_Face                  ft_face;
     uint16_t                 font_size;
 
-    struct char_info_s      *glyphs;
+    struct char_info_s      *glyphs;            // cache entries
     uint16_t                 glyphs_count;
-
-    uint16_t                 gl_tex_indexes_count;
-    uint16_t                 gl_real_tex_indexes_count;
-    GLuint                  *gl_tex_indexes;
+    uint16_t                *glyph_slots;       // face glyph index -> cache entry + 1
+    uint32_t                 face_glyphs_count;
+    uint32_t                 use_stamp;
+    uint32_t                 lock_stamp;        // glyphs used since it are not evicted
+    uint32_t                 atlas_epoch;
+    uint8_t                  batch_lock;
+
+    struct glf_shelf_s      *shelves;
+    uint16_t                 shelves_count;
+    uint16_t                 shelves_max;
+
+    struct glf_layout_s     *layouts;           // GLF_LAYOUT_CACHE_SETS x GLF_LAYOUT_CACHE_WAYS
+    GLfloat                 *render_buffer;
+    uint32_t                 render_buffer_size;
+
+    GLuint                   gl_tex_index;
     GLint                    gl_max_tex_width;
     GLint                    gl_tex_width;
+    GLint                    gl_tex_height;
     GLfloat                  gl_font_color[4];
 }gl_tex_font_t, *gl_tex_font_p;
 
@@ -97,6 +152,13 @@ void     glf_get_string_bb(gl_tex_font_p glf, const char *text, int n, GLfloat *
 
 void     glf_render_str(gl_tex_font_p glf, GLfloat x, GLfloat y, const char *text);     // UTF-8
 
+glf_layout_p glf_get_layout(gl_tex_font_p glf, const char *text);                       // UTF-8
+// Writes layout quads as x, y, u, v, r, g, b, a vertices; returns vertices count.
+uint32_t glf_layout_vertices(glf_layout_p layout, GLfloat *buffer, GLfloat x, GLfloat y, const GLfloat color[4]);
+// Glyphs used between begin and end stay in atlas, so vertices may be drawn later.
+void     glf_begin_batch(gl_tex_font_p glf);
+void     glf_end_batch(gl_tex_font_p glf);
+
 
 #ifdef	__cplusplus
 }
@@ -22,6 +22,15 @@
 
 
 #define vec4_copy(x, y) {(x)[0] = (y)[0]; (x)[1] = (y)[1]; (x)[2] = (y)[2]; (x)[3] = (y)[3];}
+#define GLTEXT_MAX_BATCH_LINES  (GLTEXT_MAX_TEMP_LINES)
+
+// Vertices (x, y, u, v, r, g, b, a) of all lines of one atlas, drawn by one call.
+typedef struct gl_text_batch_s
+{
+    GLfloat                 *data;
+    uint32_t                 vertices_count;
+    uint32_t                 vertices_max;
+}gl_text_batch_t, *gl_text_batch_p;
 
 static struct
 {
@@ -34,6 +43,11 @@ static struct
 
     uint16_t                 max_fonts;
     struct gl_font_cont_s   *fonts;
+
+    GLuint                   vbo;                        // streaming buffer for all batches
+    struct gl_text_batch_s   batches[GLTEXT_MAX_FONTS + 1];  // per font + backgrounds
+    GLfloat                  batch_bounds[GLTEXT_MAX_BATCH_LINES][4];   // screen rects of batched lines
+    uint16_t                 batch_lines;
 } font_data;
 
 
@@ -84,6 +98,15 @@ void GLText_Init()
     }
     
     font_data.temp_lines_used = 0;
+
+    font_data.vbo = 0;
+    font_data.batch_lines = 0;
+    for(i = 0; i <= GLTEXT_MAX_FONTS; i++)
+    {
+        font_data.batches[i].data = NULL;
+        font_data.batches[i].vertices_count = 0;
+        font_data.batches[i].vertices_max = 0;
+    }
 }
 
 
@@ -116,6 +139,19 @@ void GLText_Destroy()
     font_data.max_fonts = 0;
     font_data.max_styles = 0;
 
+    for(i = 0; i <= GLTEXT_MAX_FONTS; i++)
+    {
+        free(font_data.batches[i].data);
+        font_data.batches[i].data = NULL;
+        font_data.batches[i].vertices_count = 0;
+        font_data.batches[i].vertices_max = 0;
+    }
+    if(font_data.vbo)
+    {
+        qglDeleteBuffersARB(1, &font_data.vbo);
+        font_data.vbo = 0;
+    }
+
     FT_Done_FreeType(font_data.font_library);
     font_data.font_library = NULL;
 }
@@ -136,19 +172,64 @@ void GLText_UpdateResize(float scale)
 }
 
 
-void GLText_RenderStringLine(gl_text_line_p l)
+static GLfloat *GLText_BatchAlloc(gl_text_batch_p batch, uint32_t vertices_count)
+{
+    GLfloat *ret;
+
+    if(batch->vertices_count + vertices_count > batch->vertices_max)
+    {
+        batch->vertices_max = (batch->vertices_count + vertices_count) * 3 / 2 + 64;
+        batch->data = (GLfloat*)realloc(batch->data, 8 * batch->vertices_max * sizeof(GLfloat));
+    }
+    ret = batch->data + 8 * batch->vertices_count;
+    batch->vertices_count += vertices_count;
+
+    return ret;
+}
+
+
+static void GLText_BeginBatches();
+static void GLText_FlushBatches();
+
+/*
+ * Batch draws all backgrounds before texts, so a line which overlaps one of
+ * already batched lines starts a new batch: drawing order of lines is kept.
+ */
+static int GLText_BatchOverlaps(const GLfloat bounds[4])
+{
+    if(font_data.batch_lines >= GLTEXT_MAX_BATCH_LINES)
+    {
+        return 1;
+    }
+
+    for(uint16_t i = 0; i < font_data.batch_lines; i++)
+    {
+        const GLfloat *b = font_data.batch_bounds[i];
+        if((bounds[0] < b[2]) && (b[0] < bounds[2]) && (bounds[1] < b[3]) && (b[1] < bounds[3]))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void GLText_BatchLine(gl_text_line_p l)
 {
     GLfloat real_x = 0.0, real_y = 0.0;
 
     gl_tex_font_p gl_font = NULL;
     gl_fontstyle_p style = NULL;
+    glf_layout_p layout = NULL;
 
-    if(!l->show || ((gl_font = GLText_GetFont(l->font_id)) == NULL) || ((style = GLText_GetFontStyle(l->style_id)) == NULL))
+    if(!l->show || ((gl_font = GLText_GetFont(l->font_id)) == NULL) || ((style = GLText_GetFontStyle(l->style_id)) == NULL) ||
+       ((layout = glf_get_layout(gl_font, l->text)) == NULL))
     {
         return;
     }
 
-    glf_get_string_bb(gl_font, l->text, -1, l->rect+0, l->rect+1, l->rect+2, l->rect+3);
+    vec4_copy(l->rect, layout->rect);
 
     switch(l->x_align)
     {
@@ -176,56 +257,143 @@ void GLText_RenderStringLine(gl_text_line_p l)
             break;
     }
 
+    {
+        GLfloat border_x = (style->rect) ? (style->rect_border * screen_info.w_unit) : (0.0f);
+        GLfloat border_y = (style->rect) ? (style->rect_border * screen_info.h_unit) : (0.0f);
+        GLfloat shift_x = (style->shadowed) ? (GUI_FONT_SHADOW_HORIZONTAL_SHIFT) : (0.0f);
+        GLfloat shift_y = (style->shadowed) ? (GUI_FONT_SHADOW_VERTICAL_SHIFT) : (0.0f);
+        GLfloat bounds[4];
+
+        bounds[0] = l->rect[0] + real_x - border_x + ((shift_x < 0.0f) ? (shift_x) : (0.0f));
+        bounds[1] = l->rect[1] + real_y - border_y + ((shift_y < 0.0f) ? (shift_y) : (0.0f));
+        bounds[2] = l->rect[2] + real_x + border_x + ((shift_x > 0.0f) ? (shift_x) : (0.0f));
+        bounds[3] = l->rect[3] + real_y + border_y + ((shift_y > 0.0f) ? (shift_y) : (0.0f));
+        if(GLText_BatchOverlaps(bounds))
+        {
+            GLText_FlushBatches();
+            GLText_BeginBatches();
+            if((layout = glf_get_layout(gl_font, l->text)) == NULL)             // glyphs must be kept by the new batch
+            {
+                return;
+            }
+        }
+        vec4_copy(font_data.batch_bounds[font_data.batch_lines], bounds);
+        font_data.batch_lines++;
+    }
+
     if(style->rect)
     {
-        BindWhiteTexture();
         GLfloat x0 = l->rect[0] + real_x - style->rect_border * screen_info.w_unit;
         GLfloat y0 = l->rect[1] + real_y - style->rect_border * screen_info.h_unit;
         GLfloat x1 = l->rect[2] + real_x + style->rect_border * screen_info.w_unit;
         GLfloat y1 = l->rect[3] + real_y + style->rect_border * screen_info.h_unit;
-        GLfloat *v, backgroundArray[32];
+        GLfloat corners[6][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y0}, {x1, y1}, {x0, y1}};
+        GLfloat *v = GLText_BatchAlloc(font_data.batches + GLTEXT_MAX_FONTS, 6);
+
+        for(int i = 0; i < 6; i++)
+        {
+           *v++ = corners[i][0]; *v++ = corners[i][1];
+           *v++ = 0.0; *v++ = 0.0;
+            vec4_copy(v, style->rect_color);
+            v += 4;
+        }
+    }
+
+    if(layout->quads_count)
+    {
+        gl_text_batch_p batch = font_data.batches + l->font_id;
+        if(style->shadowed)
+        {
+            GLfloat shadow_color[4] = {0.0f, 0.0f, 0.0f, (float)style->font_color[3] * GUI_FONT_SHADOW_TRANSPARENCY};    // Derive alpha from base color.
+            glf_layout_vertices(layout, GLText_BatchAlloc(batch, 6 * layout->quads_count),
+                                (real_x + GUI_FONT_SHADOW_HORIZONTAL_SHIFT),
+                                (real_y + GUI_FONT_SHADOW_VERTICAL_SHIFT  ),
+                                shadow_color);
+        }
+        glf_layout_vertices(layout, GLText_BatchAlloc(batch, 6 * layout->quads_count), real_x, real_y, style->font_color);
+    }
+}
 
-        v = backgroundArray;
-       *v++ = x0; *v++ = y0;
-        vec4_copy(v, style->rect_color);
-        v += 4;
-       *v++ = 0.0; *v++ = 0.0;
 
-       *v++ = x1; *v++ = y0;
-        vec4_copy(v, style->rect_color);
-        v += 4;
-       *v++ = 0.0; *v++ = 0.0;
+static void GLText_BeginBatches()
+{
+    for(uint16_t i = 0; i < font_data.max_fonts; i++)
+    {
+        if(font_data.fonts[i].gl_font)
+        {
+            glf_begin_batch(font_data.fonts[i].gl_font);
+        }
+    }
+}
+
+
+/*
+ * Uploads all batches into one streaming buffer; backgrounds are drawn first,
+ * then one draw call per font atlas. Batched lines do not overlap, so it does
+ * not change what is on top.
+ */
+static void GLText_FlushBatches()
+{
+    uint32_t vertices_count = 0;
+    uint32_t first = 0;
+
+    for(uint16_t i = 0; i <= GLTEXT_MAX_FONTS; i++)
+    {
+        vertices_count += font_data.batches[i].vertices_count;
+    }
 
-       *v++ = x1; *v++ = y1;
-        vec4_copy(v, style->rect_color);
-        v += 4;
-       *v++ = 0.0; *v++ = 0.0;
+    if(vertices_count > 0)
+    {
+        if(font_data.vbo == 0)
+        {
+            qglGenBuffersARB(1, &font_data.vbo);
+        }
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, font_data.vbo);
+        qglBufferDataARB(GL_ARRAY_BUFFER_ARB, 8 * vertices_count * sizeof(GLfloat), NULL, GL_STREAM_DRAW_ARB);
+        qglVertexPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)0);
+        qglTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)(2 * sizeof(GLfloat)));
+        qglColorPointer(4, GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)(4 * sizeof(GLfloat)));
 
-       *v++ = x0; *v++ = y1;
-        vec4_copy(v, style->rect_color);
-        v += 4;
-       *v++ = 0.0; *v++ = 0.0;
+        for(int i = GLTEXT_MAX_FONTS; i >= 0; i--)
+        {
+            gl_text_batch_p batch = font_data.batches + i;
+            if(batch->vertices_count == 0)
+            {
+                continue;
+            }
 
-        qglVertexPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), backgroundArray);
-        qglColorPointer(4, GL_FLOAT, 8 * sizeof(GLfloat), backgroundArray + 2);
-        qglTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), backgroundArray + 6);
-        qglDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            if(i == GLTEXT_MAX_FONTS)
+            {
+                BindWhiteTexture();
+            }
+            else if(font_data.fonts[i].gl_font)
+            {
+                qglBindTexture(GL_TEXTURE_2D, font_data.fonts[i].gl_font->gl_tex_index);
+            }
+            qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 8 * first * sizeof(GLfloat), 8 * batch->vertices_count * sizeof(GLfloat), batch->data);
+            qglDrawArrays(GL_TRIANGLES, first, batch->vertices_count);
+            first += batch->vertices_count;
+            batch->vertices_count = 0;
+        }
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
     }
 
-    if(style->shadowed)
+    font_data.batch_lines = 0;
+    for(uint16_t i = 0; i < font_data.max_fonts; i++)
     {
-        gl_font->gl_font_color[0] = 0.0f;
-        gl_font->gl_font_color[1] = 0.0f;
-        gl_font->gl_font_color[2] = 0.0f;
-        gl_font->gl_font_color[3] = (float)style->font_color[3] * GUI_FONT_SHADOW_TRANSPARENCY;// Derive alpha from base color.
-        glf_render_str(gl_font,
-                       (real_x + GUI_FONT_SHADOW_HORIZONTAL_SHIFT),
-                       (real_y + GUI_FONT_SHADOW_VERTICAL_SHIFT  ),
-                       l->text);
+        if(font_data.fonts[i].gl_font)
+        {
+            glf_end_batch(font_data.fonts[i].gl_font);
+        }
     }
+}
 
-    vec4_copy(gl_font->gl_font_color, style->font_color);
-    glf_render_str(gl_font, real_x, real_y, l->text);
+
+void GLText_RenderStringLine(gl_text_line_p l)
+{
+    GLText_BeginBatches();
+    GLText_BatchLine(l);
+    GLText_FlushBatches();
 }
 
 
@@ -235,10 +403,11 @@ void GLText_RenderStrings()
 
     qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
     qglBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
+
+    GLText_BeginBatches();
     while(l)
     {
-        GLText_RenderStringLine(l);
+        GLText_BatchLine(l);
         l = l->next;
     }
 
@@ -247,10 +416,11 @@ void GLText_RenderStrings()
     {
         if(l->show)
         {
-            GLText_RenderStringLine(l);
+            GLText_BatchLine(l);
             l->show = 0;
         }
     }
+    GLText_FlushBatches();
 
     font_data.temp_lines_used = 0;
 }
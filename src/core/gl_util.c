@@ -271,6 +271,8 @@ PFNGLISVERTEXARRAYPROC                  qglIsVertexArray = NULL;
 
 PFNGLGENERATEMIPMAPEXTPROC              qglGenerateMipmap = NULL;
 
+PFNGLCOMPRESSEDTEXIMAGE2DPROC           qglCompressedTexImage2D = NULL;
+
 static char *engine_gl_ext_str = NULL;
 static GLuint whiteTexture = 0;
 
@@ -518,6 +520,11 @@ void InitGLExtFuncs()
         fprintf(stderr, "VBOs not supported");
         abort();
     }
+    if(IsGLExtensionSupported("GL_EXT_texture_compression_s3tc"))
+    {
+        qglCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC)SDL_GL_GetProcAddress("glCompressedTexImage2D");
+    }
+
     if(IsGLExtensionSupported("GL_ARB_shading_language_100"))
     {
         qglDeleteObjectARB = (PFNGLDELETEOBJECTARBPROC)SDL_GL_GetProcAddress("glDeleteObjectARB");
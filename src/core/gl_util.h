@@ -428,6 +428,8 @@ extern PFNGLISVERTEXARRAYPROC qglIsVertexArray;
 
 extern PFNGLGENERATEMIPMAPPROC qglGenerateMipmap;
 
+extern PFNGLCOMPRESSEDTEXIMAGE2DPROC qglCompressedTexImage2D;   // NULL if S3TC is not supported
+
 void InitGLExtFuncs();
 int IsGLExtensionSupported(const char *ext);
 
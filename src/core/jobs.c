@@ -0,0 +1,198 @@
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "jobs.h"
+
+
+static struct
+{
+    SDL_Thread         *threads[JOBS_MAX_THREADS];
+    SDL_threadID        thread_ids[JOBS_MAX_THREADS + 1];                       // [0] is the owner (main or simulation) thread
+    int                 threads_count;
+
+    SDL_mutex          *mutex;
+    SDL_cond           *start_cond;
+    SDL_cond           *done_cond;
+    uint32_t            generation;
+    int                 working;
+    int                 shutdown;
+    int                 busy;
+
+    job_func_t          func;
+    void               *data;
+    int                 count;
+    SDL_atomic_t        next_index;
+} jobs;
+
+
+static void Jobs_RunCurrent(int thread)
+{
+    int i;
+    while((i = SDL_AtomicAdd(&jobs.next_index, 1)) < jobs.count)
+    {
+        jobs.func(jobs.data, i, thread);
+    }
+}
+
+
+static int SDLCALL Jobs_WorkerThread(void *arg)
+{
+    int thread = (int)(intptr_t)arg;
+    uint32_t generation = 0;
+
+    SDL_LockMutex(jobs.mutex);
+    jobs.thread_ids[thread] = SDL_ThreadID();
+    while(!jobs.shutdown)
+    {
+        if(generation == jobs.generation)
+        {
+            SDL_CondWait(jobs.start_cond, jobs.mutex);
+            continue;
+        }
+        generation = jobs.generation;
+        SDL_UnlockMutex(jobs.mutex);
+
+        Jobs_RunCurrent(thread);
+
+        SDL_LockMutex(jobs.mutex);
+        if(--jobs.working == 0)
+        {
+            SDL_CondSignal(jobs.done_cond);
+        }
+    }
+    SDL_UnlockMutex(jobs.mutex);
+
+    return 0;
+}
+
+
+void Jobs_Init(int threads_count)
+{
+    if(threads_count < 0)
+    {
+        threads_count = SDL_GetCPUCount() - 1;
+    }
+    threads_count = (threads_count < JOBS_MAX_THREADS) ? (threads_count) : (JOBS_MAX_THREADS);
+    threads_count = (threads_count > 0) ? (threads_count) : (0);
+
+    jobs.threads_count = 0;
+    jobs.generation = 0;
+    jobs.working = 0;
+    jobs.shutdown = 0;
+    jobs.busy = 0;
+    jobs.func = NULL;
+    jobs.data = NULL;
+    jobs.count = 0;
+    SDL_AtomicSet(&jobs.next_index, 0);
+    jobs.thread_ids[0] = SDL_ThreadID();
+
+    if(threads_count > 0)
+    {
+        jobs.mutex = SDL_CreateMutex();
+        jobs.start_cond = SDL_CreateCond();
+        jobs.done_cond = SDL_CreateCond();
+        for(int i = 0; i < threads_count; i++)
+        {
+            jobs.thread_ids[i + 1] = 0;
+            jobs.threads[i] = SDL_CreateThread(Jobs_WorkerThread, "jobs_worker", (void*)(intptr_t)(i + 1));
+            if(jobs.threads[i] == NULL)
+            {
+                break;
+            }
+            jobs.threads_count++;
+        }
+    }
+}
+
+
+void Jobs_Destroy()
+{
+    if(jobs.mutex)
+    {
+        SDL_LockMutex(jobs.mutex);
+        jobs.shutdown = 1;
+        SDL_CondBroadcast(jobs.start_cond);
+        SDL_UnlockMutex(jobs.mutex);
+
+        for(int i = 0; i < jobs.threads_count; i++)
+        {
+            SDL_WaitThread(jobs.threads[i], NULL);
+            jobs.threads[i] = NULL;
+        }
+
+        SDL_DestroyCond(jobs.done_cond);
+        SDL_DestroyCond(jobs.start_cond);
+        SDL_DestroyMutex(jobs.mutex);
+        jobs.done_cond = NULL;
+        jobs.start_cond = NULL;
+        jobs.mutex = NULL;
+    }
+    jobs.threads_count = 0;
+}
+
+
+int  Jobs_GetThreadsCount()
+{
+    return jobs.threads_count + 1;
+}
+
+
+int  Jobs_GetCurrentThread()
+{
+    SDL_threadID id = SDL_ThreadID();
+    for(int i = 1; i <= jobs.threads_count; i++)
+    {
+        if(jobs.thread_ids[i] == id)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+void Jobs_SetOwnerThread()
+{
+    jobs.thread_ids[0] = SDL_ThreadID();
+}
+
+
+void Jobs_ParallelFor(job_func_t func, void *data, int count)
+{
+    if((jobs.threads_count == 0) || (count < 2) || jobs.busy || (SDL_ThreadID() != jobs.thread_ids[0]))
+    {
+        int thread = Jobs_GetCurrentThread();
+        for(int i = 0; i < count; i++)
+        {
+            func(data, i, thread);
+        }
+        return;
+    }
+
+    SDL_LockMutex(jobs.mutex);
+    jobs.busy = 1;
+    jobs.func = func;
+    jobs.data = data;
+    jobs.count = count;
+    SDL_AtomicSet(&jobs.next_index, 0);
+    jobs.working = jobs.threads_count;
+    jobs.generation++;
+    SDL_CondBroadcast(jobs.start_cond);
+    SDL_UnlockMutex(jobs.mutex);
+
+    Jobs_RunCurrent(0);
+
+    SDL_LockMutex(jobs.mutex);
+    while(jobs.working > 0)
+    {
+        SDL_CondWait(jobs.done_cond, jobs.mutex);
+    }
+    jobs.busy = 0;
+    jobs.func = NULL;
+    jobs.data = NULL;
+    jobs.count = 0;
+    SDL_UnlockMutex(jobs.mutex);
+}
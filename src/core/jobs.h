@@ -0,0 +1,39 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define JOBS_MAX_THREADS            (16)
+
+/*
+ * Job callback: index is the job number in [0, count), thread is the index
+ * of the executing thread in [0, Jobs_GetThreadsCount()), 0 is the caller.
+ * Use thread index to select per-thread scratch data without locking.
+ */
+typedef void (*job_func_t)(void *data, int index, int thread);
+
+void Jobs_Init(int threads_count);
+void Jobs_Destroy();
+
+int  Jobs_GetThreadsCount();
+int  Jobs_GetCurrentThread();
+// Only owner thread (initializing one by default) runs jobs in parallel;
+// ownership may be passed only while no jobs are running.
+void Jobs_SetOwnerThread();
+
+/*
+ * Runs func for every index in [0, count) on the worker pool and returns
+ * when all of them are done. Calling thread participates in work; nested
+ * calls and calls from workers are executed serially in the calling thread.
+ */
+void Jobs_ParallelFor(job_func_t func, void *data, int count);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
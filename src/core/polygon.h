@@ -69,6 +69,7 @@ typedef struct anim_seq_s
     uint16_t    current_frame;          // Current frame for this sequence.
     GLfloat     frame_time;             // Time passed since last frame update.
     GLfloat     frame_rate;             // For types 0-1, specifies framerate, for type 3, should specify rotation speed.
+    uint32_t    change_tick;            // Renderer anim textures tick of the last frame or uvrotate change.
 
     struct tex_frame_s  *frames;
     uint32_t            *frame_list;    // Offset into anim textures frame list.
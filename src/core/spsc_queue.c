@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "spsc_queue.h"
+
+
+void SPSC_Init(spsc_queue_p q, uint32_t item_size, uint32_t capacity)
+{
+    uint32_t size = 2;
+    while(size < capacity)
+    {
+        size <<= 1;
+    }
+
+    q->item_size = item_size;
+    q->mask = size - 1;
+    q->items = (uint8_t*)malloc(size * item_size);
+    SDL_AtomicSet(&q->head, 0);
+    SDL_AtomicSet(&q->tail, 0);
+}
+
+
+void SPSC_Clear(spsc_queue_p q)
+{
+    free(q->items);
+    q->items = NULL;
+    q->item_size = 0;
+    q->mask = 0;
+    SDL_AtomicSet(&q->head, 0);
+    SDL_AtomicSet(&q->tail, 0);
+}
+
+
+int  SPSC_Push(spsc_queue_p q, const void *item)
+{
+    uint32_t head = (uint32_t)SDL_AtomicGet(&q->head);
+    uint32_t tail = (uint32_t)SDL_AtomicGet(&q->tail);
+
+    if(head - tail > q->mask)
+    {
+        return 0;
+    }
+
+    memcpy(q->items + (head & q->mask) * q->item_size, item, q->item_size);
+    // SDL atomics are full barriers, item is visible before the new head.
+    SDL_AtomicSet(&q->head, (int)(head + 1));
+
+    return 1;
+}
+
+
+int  SPSC_Pop(spsc_queue_p q, void *item)
+{
+    uint32_t tail = (uint32_t)SDL_AtomicGet(&q->tail);
+    uint32_t head = (uint32_t)SDL_AtomicGet(&q->head);
+
+    if(head == tail)
+    {
+        return 0;
+    }
+
+    memcpy(item, q->items + (tail & q->mask) * q->item_size, q->item_size);
+    SDL_AtomicSet(&q->tail, (int)(tail + 1));
+
+    return 1;
+}
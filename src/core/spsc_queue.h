@@ -0,0 +1,37 @@
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <SDL2/SDL_atomic.h>
+
+/*
+ * Lock-free ring of fixed size items for exactly one producer and one
+ * consumer thread. Head is written only by producer, tail only by consumer;
+ * capacity is rounded up to a power of two.
+ */
+typedef struct spsc_queue_s
+{
+    uint32_t        item_size;
+    uint32_t        mask;
+    uint8_t        *items;
+    SDL_atomic_t    head;
+    SDL_atomic_t    tail;
+}spsc_queue_t, *spsc_queue_p;
+
+void SPSC_Init(spsc_queue_p q, uint32_t item_size, uint32_t capacity);
+void SPSC_Clear(spsc_queue_p q);
+
+// Both return 0 if queue is full / empty.
+int  SPSC_Push(spsc_queue_p q, const void *item);
+int  SPSC_Pop(spsc_queue_p q, void *item);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -21,9 +21,11 @@
 #define INIT_TEMP_MEM_SIZE          (4096 * 1024)
 
 screen_info_t           screen_info;
+system_settings_t       system_settings;
 
 extern lua_State       *engine_lua;
 
+static SDL_atomic_t      sys_temp_files_count          = {0};
 static uint8_t         *engine_mem_buffer             = NULL;
 static size_t           engine_mem_buffer_size        = 0;
 static size_t           engine_mem_buffer_size_left   = 0;
@@ -50,6 +52,9 @@ void Sys_InitGlobals()
     screen_info.FS_flag = 0;
     screen_info.show_debuginfo = 0;
     screen_info.fov = 75.0;
+
+    system_settings.worker_threads = -1;
+    system_settings.sim_thread = 0;
 }
 
 
@@ -242,4 +247,24 @@ int Sys_FileFound(const char *name, int checkWrite)
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+
+FILE *Sys_OpenTempFile(const char *name, char *tmp_name, size_t tmp_name_size)
+{
+    snprintf(tmp_name, tmp_name_size, "%s.%lu_%d.tmp", name, (unsigned long)SDL_ThreadID(), SDL_AtomicAdd(&sys_temp_files_count, 1));
+    return fopen(tmp_name, "wb");
+}
+
+
+int Sys_CommitTempFile(FILE *f, const char *tmp_name, const char *name, int ok)
+{
+    ok = (fclose(f) == 0) && ok;
+    // rename does not replace existing file on some platforms, other writer made the same file then.
+    if(ok && (rename(tmp_name, name) == 0))
+    {
+        return 1;
+    }
+    remove(tmp_name);
+    return 0;
+}
@@ -6,6 +6,7 @@
 extern "C" {
 #endif
     
+#include <stdio.h>
 #include <stdint.h>
 #include <SDL2/SDL_platform.h>
 #include <SDL2/SDL_opengl.h>
@@ -33,7 +34,14 @@ typedef struct screen_info_s
     int8_t      show_debuginfo;
 } screen_info_t, *screen_info_p;
 
+typedef struct system_settings_s
+{
+    int8_t      worker_threads;     // < 0 - use all CPU cores, 0 - no worker threads.
+    int8_t      sim_thread;         // game frame runs on own thread while previous frame is drawn.
+} system_settings_t, *system_settings_p;
+
 extern screen_info_t screen_info;
+extern system_settings_t system_settings;
 
 void Sys_Init();
 void Sys_InitGlobals();
@@ -54,6 +62,10 @@ void Sys_DebugLog(const char *file, const char *fmt, ...);
 void Sys_TakeScreenShot();
 
 int Sys_FileFound(const char *name, int checkWrite);
+// Cache files: written into unique temp file and renamed into place when complete,
+// so concurrent writers of the same name and interrupted writes leave no partial file.
+FILE *Sys_OpenTempFile(const char *name, char *tmp_name, size_t tmp_name_size);
+int   Sys_CommitTempFile(FILE *f, const char *tmp_name, const char *name, int ok);
 
 #define Sys_LogCurrPlace Sys_DebugLog(SYS_LOG_FILENAME, "\"%s\" str = %d\n", __FILE__, __LINE__);
 #define Sys_extError(...) {Sys_LogCurrPlace Sys_Error(__VA_ARGS__);}
@@ -0,0 +1,608 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "system.h"
+#include "tex_compress.h"
+
+
+typedef struct tex_compress_header_s
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    format;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    levels;
+    uint32_t    size;
+}tex_compress_header_t, *tex_compress_header_p;
+
+
+static void TexCompress_FetchBlock(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t block[64])
+{
+    // partial blocks of small mip levels repeat the last row / column.
+    for(uint32_t y = 0; y < 4; y++)
+    {
+        uint32_t sy = (by + y < height) ? (by + y) : (height - 1);
+        const uint8_t *row = rgba + 4 * sy * width;
+        for(uint32_t x = 0; x < 4; x++)
+        {
+            uint32_t sx = (bx + x < width) ? (bx + x) : (width - 1);
+            memcpy(block + 4 * (4 * y + x), row + 4 * sx, 4);
+        }
+    }
+}
+
+
+static void TexCompress_StoreBlock(uint8_t *rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, const uint8_t block[64])
+{
+    for(uint32_t y = 0; (y < 4) && (by + y < height); y++)
+    {
+        for(uint32_t x = 0; (x < 4) && (bx + x < width); x++)
+        {
+            memcpy(rgba + 4 * ((by + y) * width + bx + x), block + 4 * (4 * y + x), 4);
+        }
+    }
+}
+
+
+static uint16_t TexCompress_Pack565(const float c[3])
+{
+    int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+    r = (r < 0) ? (0) : ((r > 31) ? (31) : (r));
+    g = (g < 0) ? (0) : ((g > 63) ? (63) : (g));
+    b = (b < 0) ? (0) : ((b > 31) ? (31) : (b));
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+
+static void TexCompress_Unpack565(uint16_t c, int rgb[3])
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+static void TexCompress_ColorPalette(uint16_t c0, uint16_t c1, int four_colors, int palette[4][3])
+{
+    TexCompress_Unpack565(c0, palette[0]);
+    TexCompress_Unpack565(c1, palette[1]);
+    for(int i = 0; i < 3; i++)
+    {
+        if(four_colors)
+        {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+        else
+        {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+}
+
+
+/*
+ * Endpoints are the extremes of the block colors projected on their principal
+ * axis (power iteration on covariance). With punch_through pixels with
+ * alpha < 128 are written as transparent index of 3-color mode.
+ */
+static void TexCompress_EncodeColorBlock(const uint8_t block[64], int punch_through, uint8_t dst[8])
+{
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    float axis[3], lo[3], hi[3];
+    float tmin = 0.0f, tmax = 0.0f, len;
+    int cmin[3] = {255, 255, 255}, cmax[3] = {0, 0, 0};
+    int palette[4][3];
+    uint8_t opaque[16];
+    uint32_t indices = 0;
+    uint16_t c0, c1;
+    int count = 0, transparent = 0, four_colors;
+
+    for(int i = 0; i < 16; i++)
+    {
+        opaque[i] = !punch_through || (block[4 * i + 3] >= 128);
+        if(opaque[i])
+        {
+            for(int j = 0; j < 3; j++)
+            {
+                mean[j] += block[4 * i + j];
+                cmin[j] = (block[4 * i + j] < cmin[j]) ? (block[4 * i + j]) : (cmin[j]);
+                cmax[j] = (block[4 * i + j] > cmax[j]) ? (block[4 * i + j]) : (cmax[j]);
+            }
+            count++;
+        }
+        else
+        {
+            transparent = 1;
+        }
+    }
+
+    if(count == 0)
+    {
+        // 3-color mode, all pixels are transparent.
+        memset(dst, 0, 4);
+        memset(dst + 4, 0xFF, 4);
+        return;
+    }
+
+    for(int j = 0; j < 3; j++)
+    {
+        mean[j] /= (float)count;
+        axis[j] = (float)(cmax[j] - cmin[j]);
+    }
+    for(int i = 0; i < 16; i++)
+    {
+        if(opaque[i])
+        {
+            float r = block[4 * i + 0] - mean[0];
+            float g = block[4 * i + 1] - mean[1];
+            float b = block[4 * i + 2] - mean[2];
+            cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+            cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+        }
+    }
+
+    for(int iter = 0; iter < 4; iter++)
+    {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float m = fabsf(x);
+        m = (fabsf(y) > m) ? (fabsf(y)) : (m);
+        m = (fabsf(z) > m) ? (fabsf(z)) : (m);
+        if(m < 1.0e-6f)
+        {
+            break;
+        }
+        axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+    }
+
+    len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if(len > 1.0e-6f)
+    {
+        axis[0] /= len; axis[1] /= len; axis[2] /= len;
+        tmin = 1.0e+6f;
+        tmax = -1.0e+6f;
+        for(int i = 0; i < 16; i++)
+        {
+            if(opaque[i])
+            {
+                float t = (block[4 * i + 0] - mean[0]) * axis[0] + (block[4 * i + 1] - mean[1]) * axis[1] + (block[4 * i + 2] - mean[2]) * axis[2];
+                tmin = (t < tmin) ? (t) : (tmin);
+                tmax = (t > tmax) ? (t) : (tmax);
+            }
+        }
+    }
+    for(int j = 0; j < 3; j++)
+    {
+        lo[j] = mean[j] + axis[j] * tmin;
+        hi[j] = mean[j] + axis[j] * tmax;
+    }
+
+    c0 = TexCompress_Pack565(hi);
+    c1 = TexCompress_Pack565(lo);
+    if(transparent)
+    {
+        // 3-color mode is selected by c0 <= c1.
+        uint16_t t = (c0 < c1) ? (c0) : (c1);
+        c1 = (c0 < c1) ? (c1) : (c0);
+        c0 = t;
+    }
+    else if(c0 < c1)
+    {
+        uint16_t t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+    four_colors = (c0 > c1);
+    TexCompress_ColorPalette(c0, c1, four_colors, palette);
+
+    for(int i = 15; i >= 0; i--)
+    {
+        uint32_t best = 3;
+        if(opaque[i])
+        {
+            int best_err = 0x7FFFFFFF;
+            // in 3-color mode index 3 is transparent.
+            for(uint32_t k = 0; k < ((four_colors) ? (4u) : (3u)); k++)
+            {
+                int dr = block[4 * i + 0] - palette[k][0];
+                int dg = block[4 * i + 1] - palette[k][1];
+                int db = block[4 * i + 2] - palette[k][2];
+                int err = dr * dr + dg * dg + db * db;
+                if(err < best_err)
+                {
+                    best_err = err;
+                    best = k;
+                }
+            }
+        }
+        indices = (indices << 2) | best;
+    }
+
+    dst[0] = c0 & 0xFF; dst[1] = c0 >> 8;
+    dst[2] = c1 & 0xFF; dst[3] = c1 >> 8;
+    dst[4] = indices & 0xFF; dst[5] = (indices >> 8) & 0xFF;
+    dst[6] = (indices >> 16) & 0xFF; dst[7] = indices >> 24;
+}
+
+
+static void TexCompress_AlphaPalette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if(a0 > a1)
+    {
+        for(int i = 1; i < 7; i++)
+        {
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+        }
+    }
+    else
+    {
+        for(int i = 1; i < 5; i++)
+        {
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+
+static int TexCompress_AlphaIndices(const uint8_t block[64], const int palette[8], uint8_t idx[16])
+{
+    int total = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        int best_err = 0x7FFFFFFF;
+        for(int k = 0; k < 8; k++)
+        {
+            int d = block[4 * i + 3] - palette[k];
+            if(d * d < best_err)
+            {
+                best_err = d * d;
+                idx[i] = k;
+            }
+        }
+        total += best_err;
+    }
+    return total;
+}
+
+
+/*
+ * Both alpha modes are tried: 8 interpolated values between min and max,
+ * or 6 values between min and max of the inner alphas plus exact 0 and 255.
+ */
+static void TexCompress_EncodeAlphaBlock(const uint8_t block[64], uint8_t dst[8])
+{
+    int amin = 255, amax = 0, imin = 255, imax = 0;
+    int palette[8];
+    uint8_t idx8[16], idx6[16], *idx = idx8;
+    uint64_t bits = 0;
+    int err8, err6;
+
+    for(int i = 0; i < 16; i++)
+    {
+        int a = block[4 * i + 3];
+        amin = (a < amin) ? (a) : (amin);
+        amax = (a > amax) ? (a) : (amax);
+        if((a > 0) && (a < 255))
+        {
+            imin = (a < imin) ? (a) : (imin);
+            imax = (a > imax) ? (a) : (imax);
+        }
+    }
+
+    dst[0] = amax;
+    dst[1] = amin;
+    if(amax == amin)
+    {
+        memset(dst + 2, 0, 6);
+        return;
+    }
+
+    TexCompress_AlphaPalette(amax, amin, palette);
+    err8 = TexCompress_AlphaIndices(block, palette, idx8);
+    if(imin > imax)
+    {
+        imin = imax = 0;
+    }
+    TexCompress_AlphaPalette(imin, imax, palette);
+    err6 = TexCompress_AlphaIndices(block, palette, idx6);
+    if(err6 < err8)
+    {
+        dst[0] = imin;
+        dst[1] = imax;
+        idx = idx6;
+    }
+
+    for(int i = 15; i >= 0; i--)
+    {
+        bits = (bits << 3) | idx[i];
+    }
+    for(int i = 0; i < 6; i++)
+    {
+        dst[2 + i] = (bits >> (8 * i)) & 0xFF;
+    }
+}
+
+
+static void TexCompress_DecodeColorBlock(const uint8_t src[8], int force_four_colors, int alpha, uint8_t block[64])
+{
+    int palette[4][3];
+    uint16_t c0 = src[0] | (src[1] << 8);
+    uint16_t c1 = src[2] | (src[3] << 8);
+    uint32_t indices = src[4] | (src[5] << 8) | (src[6] << 16) | ((uint32_t)src[7] << 24);
+    int four_colors = force_four_colors || (c0 > c1);
+
+    TexCompress_ColorPalette(c0, c1, four_colors, palette);
+    for(int i = 0; i < 16; i++)
+    {
+        uint32_t k = (indices >> (2 * i)) & 3;
+        block[4 * i + 0] = palette[k][0];
+        block[4 * i + 1] = palette[k][1];
+        block[4 * i + 2] = palette[k][2];
+        block[4 * i + 3] = (!four_colors && (k == 3) && alpha) ? (0) : (255);
+    }
+}
+
+
+static void TexCompress_DecodeAlphaBlock(const uint8_t src[8], uint8_t block[64])
+{
+    int palette[8];
+    uint64_t bits = 0;
+
+    TexCompress_AlphaPalette(src[0], src[1], palette);
+    for(int i = 5; i >= 0; i--)
+    {
+        bits = (bits << 8) | src[2 + i];
+    }
+    for(int i = 0; i < 16; i++)
+    {
+        block[4 * i + 3] = palette[(bits >> (3 * i)) & 7];
+    }
+}
+
+
+static uint32_t TexCompress_GetChainSize(uint32_t format, uint32_t width, uint32_t height, uint32_t max_levels, uint32_t *levels)
+{
+    uint32_t size = TexCompress_GetLevelSize(format, width, height);
+    *levels = 1;
+    while(((width > 1) || (height > 1)) && ((max_levels == 0) || (*levels < max_levels)))
+    {
+        width = (width > 1) ? (width / 2) : (1);
+        height = (height > 1) ? (height / 2) : (1);
+        size += TexCompress_GetLevelSize(format, width, height);
+        (*levels)++;
+    }
+    return size;
+}
+
+
+void TexCompress_Init(tex_compressed_p tex)
+{
+    memset(tex, 0, sizeof(tex_compressed_t));
+}
+
+
+void TexCompress_Clear(tex_compressed_p tex)
+{
+    free(tex->data);
+    TexCompress_Init(tex);
+}
+
+
+uint32_t TexCompress_GetLevelSize(uint32_t format, uint32_t width, uint32_t height)
+{
+    uint32_t blocks = ((width + 3) / 4) * ((height + 3) / 4);
+    return (format == TEX_COMPRESS_BC3) ? (16 * blocks) : (8 * blocks);
+}
+
+
+uint32_t TexCompress_ChooseFormat(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    uint32_t ret = TEX_COMPRESS_BC1;
+    for(uint32_t i = 0; i < width * height; i++)
+    {
+        uint8_t a = rgba[4 * i + 3];
+        if((a != 0) && (a != 255))
+        {
+            return TEX_COMPRESS_BC3;
+        }
+        if(a == 0)
+        {
+            ret = TEX_COMPRESS_BC1A;
+        }
+    }
+    return ret;
+}
+
+
+uint64_t TexCompress_Hash(const uint8_t *data, uint32_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    uint32_t i = 0;
+
+    for(; i + 4 <= size; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for(; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+void TexCompress_Setup(tex_compressed_p tex, uint32_t format, uint32_t width, uint32_t height, uint32_t max_levels)
+{
+    tex->format = format;
+    tex->width = width;
+    tex->height = height;
+    tex->size = TexCompress_GetChainSize(format, width, height, max_levels, &tex->levels);
+    if(tex->size > tex->buffer_size)
+    {
+        tex->data = (uint8_t*)realloc(tex->data, tex->size);
+        tex->buffer_size = tex->size;
+    }
+}
+
+
+uint8_t *TexCompress_GetLevel(tex_compressed_p tex, uint32_t level)
+{
+    uint8_t *ret = tex->data;
+    uint32_t w = tex->width, h = tex->height;
+
+    for(uint32_t i = 0; i < level; i++)
+    {
+        ret += TexCompress_GetLevelSize(tex->format, w, h);
+        w = (w > 1) ? (w / 2) : (1);
+        h = (h > 1) ? (h / 2) : (1);
+    }
+    return ret;
+}
+
+
+void TexCompress_EncodeBlockRows(uint32_t format, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t first_row, uint32_t last_row, uint8_t *dst)
+{
+    uint8_t block[64];
+
+    dst += TexCompress_GetLevelSize(format, width, 4 * first_row);
+    for(uint32_t by = 4 * first_row; (by < height) && (by < 4 * last_row); by += 4)
+    {
+        for(uint32_t bx = 0; bx < width; bx += 4)
+        {
+            TexCompress_FetchBlock(rgba, width, height, bx, by, block);
+            if(format == TEX_COMPRESS_BC3)
+            {
+                TexCompress_EncodeAlphaBlock(block, dst);
+                dst += 8;
+            }
+            TexCompress_EncodeColorBlock(block, format == TEX_COMPRESS_BC1A, dst);
+            dst += 8;
+        }
+    }
+}
+
+
+void TexCompress_Decode(uint32_t format, const uint8_t *src, uint32_t width, uint32_t height, uint8_t *rgba)
+{
+    uint8_t block[64];
+
+    for(uint32_t by = 0; by < height; by += 4)
+    {
+        for(uint32_t bx = 0; bx < width; bx += 4)
+        {
+            if(format == TEX_COMPRESS_BC3)
+            {
+                TexCompress_DecodeColorBlock(src + 8, 1, 0, block);
+                TexCompress_DecodeAlphaBlock(src, block);
+                src += 16;
+            }
+            else
+            {
+                TexCompress_DecodeColorBlock(src, 0, format == TEX_COMPRESS_BC1A, block);
+                src += 8;
+            }
+            TexCompress_StoreBlock(rgba, width, height, bx, by, block);
+        }
+    }
+}
+
+
+float TexCompress_PSNR(const uint8_t *rgba1, const uint8_t *rgba2, uint32_t width, uint32_t height)
+{
+    double mse = 0.0;
+    uint32_t count = 4 * width * height;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        double d = (double)rgba1[i] - (double)rgba2[i];
+        mse += d * d;
+    }
+    mse /= (count > 0) ? (count) : (1);
+
+    return (mse > 0.0) ? ((float)(10.0 * log10(255.0 * 255.0 / mse))) : (100.0f);
+}
+
+
+int TexCompress_Save(tex_compressed_p tex, const char *name)
+{
+    tex_compress_header_t header;
+    char tmp_name[256];
+    FILE *f = Sys_OpenTempFile(name, tmp_name, sizeof(tmp_name));              // pages of one group may be equal
+    int ok;
+
+    if(f == NULL)
+    {
+        return 0;
+    }
+
+    header.magic = TEX_COMPRESS_CACHE_MAGIC;
+    header.version = TEX_COMPRESS_CACHE_VERSION;
+    header.format = tex->format;
+    header.width = tex->width;
+    header.height = tex->height;
+    header.levels = tex->levels;
+    header.size = tex->size;
+    ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+    ok = ok && (fwrite(tex->data, 1, tex->size, f) == tex->size);
+
+    return Sys_CommitTempFile(f, tmp_name, name, ok);
+}
+
+
+int TexCompress_Load(tex_compressed_p tex, const char *name)
+{
+    tex_compress_header_t header;
+    FILE *f = fopen(name, "rb");
+    uint32_t levels = 0;
+    int ret = 0;
+
+    if(f == NULL)
+    {
+        return 0;
+    }
+
+    if((fread(&header, sizeof(header), 1, f) == 1) && (header.magic == TEX_COMPRESS_CACHE_MAGIC) &&
+       (header.version == TEX_COMPRESS_CACHE_VERSION) && (header.format >= TEX_COMPRESS_BC1) &&
+       (header.format <= TEX_COMPRESS_BC3) && (header.width > 0) && (header.height > 0) && (header.width <= 16384) && (header.height <= 16384) &&
+       (header.levels > 0) && (header.size == TexCompress_GetChainSize(header.format, header.width, header.height, header.levels, &levels)) &&
+       (header.levels == levels))
+    {
+        if(header.size > tex->buffer_size)
+        {
+            tex->data = (uint8_t*)realloc(tex->data, header.size);
+            tex->buffer_size = header.size;
+        }
+        if(fread(tex->data, 1, header.size, f) == header.size)
+        {
+            tex->format = header.format;
+            tex->width = header.width;
+            tex->height = header.height;
+            tex->levels = header.levels;
+            tex->size = header.size;
+            ret = 1;
+        }
+    }
+    fclose(f);
+
+    return ret;
+}
@@ -0,0 +1,60 @@
+
+#ifndef TEX_COMPRESS_H
+#define TEX_COMPRESS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * CPU block compression of RGBA8 images into S3TC / BC formats.
+ * Every 4x4 block is encoded independently, so images may be split between
+ * threads by block rows. Decoder and PSNR are here for checking encoder quality.
+ */
+
+#define TEX_COMPRESS_NONE           (0)
+#define TEX_COMPRESS_BC1            (1)     // opaque
+#define TEX_COMPRESS_BC1A           (2)     // 1-bit alpha (color key)
+#define TEX_COMPRESS_BC3            (3)     // smooth alpha
+
+#define TEX_COMPRESS_CACHE_MAGIC    (0x4354544F)    // "OTTC"
+#define TEX_COMPRESS_CACHE_VERSION  (2)
+
+typedef struct tex_compressed_s
+{
+    uint32_t    format;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    levels;                     // mip levels stored one after another
+    uint32_t    size;
+    uint32_t    buffer_size;
+    uint8_t    *data;
+}tex_compressed_t, *tex_compressed_p;
+
+void     TexCompress_Init(tex_compressed_p tex);
+void     TexCompress_Clear(tex_compressed_p tex);
+
+uint32_t TexCompress_GetLevelSize(uint32_t format, uint32_t width, uint32_t height);
+// The smallest format which keeps alpha of the image.
+uint32_t TexCompress_ChooseFormat(const uint8_t *rgba, uint32_t width, uint32_t height);
+uint64_t TexCompress_Hash(const uint8_t *data, uint32_t size);
+
+// Sets format and size of the mip chain (0 - full chain) and reserves data for it.
+void     TexCompress_Setup(tex_compressed_p tex, uint32_t format, uint32_t width, uint32_t height, uint32_t max_levels);
+uint8_t *TexCompress_GetLevel(tex_compressed_p tex, uint32_t level);
+
+// Encodes only block rows [first_row, last_row); dst is the start of the whole image data.
+void     TexCompress_EncodeBlockRows(uint32_t format, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t first_row, uint32_t last_row, uint8_t *dst);
+void     TexCompress_Decode(uint32_t format, const uint8_t *src, uint32_t width, uint32_t height, uint8_t *rgba);
+float    TexCompress_PSNR(const uint8_t *rgba1, const uint8_t *rgba2, uint32_t width, uint32_t height);
+
+int      TexCompress_Save(tex_compressed_p tex, const char *name);
+int      TexCompress_Load(tex_compressed_p tex, const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,8 @@ extern "C" {
 }
 
 #include "core/system.h"
+#include "core/jobs.h"
+#include "core/spsc_queue.h"
 #include "core/gl_util.h"
 #include "core/gl_font.h"
 #include "core/console.h"
@@ -40,6 +42,9 @@ extern "C" {
 #include "script.h"
 #include "engine.h"
 #include "physics.h"
+#include "rewind.h"
+#include "replay.h"
+#include "residency.h"
 #include "controls.h"
 #include "trigger.h"
 #include "character_controller.h"
@@ -69,6 +74,26 @@ lua_State                              *engine_lua = NULL;
 struct camera_s                         engine_camera;
 struct camera_state_s                   engine_camera_state;
 
+/*
+ * Game frame thread (system.sim_thread): main thread posts frame time into
+ * lock-free queue and submits renderer snapshot of the previous frame to GL,
+ * simulation thread runs the game frame and posts it back.
+ */
+typedef struct engine_sim_frame_s
+{
+    float                       time;
+    int                         quit;
+}engine_sim_frame_t;
+
+static struct
+{
+    SDL_Thread                 *thread;
+    SDL_sem                    *start_sem;                      // wakes sleeping threads, data goes through queues
+    SDL_sem                    *done_sem;
+    spsc_queue_t                frames;                         // main -> simulation
+    spsc_queue_t                done;                           // simulation -> main
+} engine_sim;
+
 
 engine_container_p Container_Create()
 {
@@ -91,7 +116,12 @@ void Engine_InitSDLVideo();
 void Engine_InitSDLControls();
 void Engine_InitDefaultGlobals();
 
+static void Engine_StopSimThread();
+
 void Engine_Display();
+void Engine_PrepareDisplay();
+void Engine_DrawWorld();
+void Engine_DrawOverlay();
 void Engine_PollSDLEvents();
 void Engine_Resize(int nominalW, int nominalH, int pixelsW, int pixelsH);
 
@@ -139,6 +169,7 @@ void Engine_Start(const char *config_name)
 
 void Engine_Shutdown(int val)
 {
+    Engine_StopSimThread();
     renderer.ResetWorld(NULL, 0, NULL, 0);
     World_Clear();
 
@@ -148,7 +179,10 @@ void Engine_Shutdown(int val)
         engine_lua = NULL;
     }
 
+    Replay_Stop();
+    Rewind_Destroy();
     Physics_Destroy();
+    Jobs_Destroy();
     Gui_Destroy();
     Con_Destroy();
     GLText_Destroy();
@@ -210,6 +244,10 @@ void Engine_InitDefaultGlobals()
     Sys_InitGlobals();
     Con_InitGlobals();
     Controls_InitGlobals();
+    Physics_InitGlobals();
+    Rewind_InitGlobals();
+    Residency_InitGlobals();
+    Entity_InitAnimLODGlobals();
     Game_InitGlobals();
     Audio_InitGlobals();
 }
@@ -221,6 +259,7 @@ void Engine_Init_Pre()
      * Rendering activation may be done later. */
 
     Sys_Init();
+    Jobs_Init(system_settings.worker_threads);
     GLText_Init();
     Con_Init();
     Con_SetExecFunction(Engine_ExecCmd);
@@ -493,6 +532,11 @@ void Engine_LoadConfig(const char *filename)
             luaL_dofile(lua, filename);
 
             Script_ParseScreen(lua, &screen_info);
+            Script_ParseSystem(lua, &system_settings);
+            Script_ParsePhysics(lua, &physics_settings);
+            Script_ParseRewind(lua, &rewind_settings);
+            Script_ParseAnimation(lua, &anim_lod_settings);
+            Script_ParseResidency(lua, &residency_settings);
             Script_ParseRender(lua, &renderer.settings);
             Script_ParseAudio(lua, &audio_settings);
             Script_ParseConsole(lua);
@@ -517,39 +561,64 @@ void Engine_Display()
 {
     if(!engine_done)
     {
-        qglClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);//| GL_ACCUM_BUFFER_BIT);
+        Engine_PrepareDisplay();
+        Engine_DrawWorld();
+        Engine_DrawOverlay();
+    }
+}
 
-        Cam_Apply(&engine_camera);
-        Cam_RecalcClipPlanes(&engine_camera);
-        // GL_VERTEX_ARRAY | GL_COLOR_ARRAY
 
-        screen_info.show_debuginfo %= 4;
-        if(screen_info.show_debuginfo)
-        {
-            ShowDebugInfo();
-        }
+// Reads the world, so game frame must not run at this time.
+void Engine_PrepareDisplay()
+{
+    entity_p player = World_GetPlayer();
+    Residency_Update((player) ? (player->self->room) : (NULL), engine_camera.current_room);
 
-        qglPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT); ///@PUSH <- GL_VERTEX_ARRAY | GL_COLOR_ARRAY
-        qglEnableClientState(GL_NORMAL_ARRAY);
-        qglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    Cam_Apply(&engine_camera);
+    Cam_RecalcClipPlanes(&engine_camera);
+    renderer.GenWorldList(&engine_camera);
+}
 
-        qglFrontFace(GL_CW);
 
-        renderer.GenWorldList(&engine_camera);
-        renderer.DrawList();
+// Uses only renderer snapshot, so it may overlap game frame.
+void Engine_DrawWorld()
+{
+    qglClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);//| GL_ACCUM_BUFFER_BIT);
+
+    qglPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT); ///@PUSH <- GL_VERTEX_ARRAY | GL_COLOR_ARRAY
+    qglEnableClientState(GL_NORMAL_ARRAY);
+    qglEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-        Gui_SwitchGLMode(1);
-        qglEnable(GL_ALPHA_TEST);
+    qglFrontFace(GL_CW);
 
-        Gui_DrawNotifier();
-        qglPopClientAttrib();        ///@POP -> GL_VERTEX_ARRAY | GL_COLOR_ARRAY
-        Gui_Render();
-        Gui_SwitchGLMode(0);
+    renderer.DrawList();
+    qglPopClientAttrib();        ///@POP -> GL_VERTEX_ARRAY | GL_COLOR_ARRAY
+}
 
-        renderer.DrawListDebugLines();
 
-        SDL_GL_SwapWindow(sdl_window);
+void Engine_DrawOverlay()
+{
+    screen_info.show_debuginfo %= 4;
+    if(screen_info.show_debuginfo)
+    {
+        ShowDebugInfo();
     }
+
+    qglPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT); ///@PUSH <- GL_VERTEX_ARRAY | GL_COLOR_ARRAY
+    qglEnableClientState(GL_NORMAL_ARRAY);
+    qglEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    Gui_SwitchGLMode(1);
+    qglEnable(GL_ALPHA_TEST);
+
+    Gui_DrawNotifier();
+    qglPopClientAttrib();        ///@POP -> GL_VERTEX_ARRAY | GL_COLOR_ARRAY
+    Gui_Render();
+    Gui_SwitchGLMode(0);
+
+    renderer.DrawListDebugLines();
+
+    SDL_GL_SwapWindow(sdl_window);
 }
 
 
@@ -754,6 +823,100 @@ void Engine_JoyRumble(float power, int time)
 }
 
 
+static void Engine_SimFrame(float *time)
+{
+    Replay_BeginFrame(time);
+    engine_frame_time = *time;
+    Game_Frame(*time);
+    Replay_EndFrame();
+}
+
+
+static int SDLCALL Engine_SimThread(void *data)
+{
+    engine_sim_frame_t frame;
+
+    for(;;)
+    {
+        SDL_SemWait(engine_sim.start_sem);
+        if(!SPSC_Pop(&engine_sim.frames, &frame))
+        {
+            continue;
+        }
+        if(frame.quit)
+        {
+            break;
+        }
+        Jobs_SetOwnerThread();                                                  // physics and animation jobs are posted from here
+        Engine_SimFrame(&frame.time);
+        SPSC_Push(&engine_sim.done, &frame);
+        SDL_SemPost(engine_sim.done_sem);
+    }
+
+    return 0;
+}
+
+
+static void Engine_StartSimThread()
+{
+    SPSC_Init(&engine_sim.frames, sizeof(engine_sim_frame_t), 4);
+    SPSC_Init(&engine_sim.done, sizeof(engine_sim_frame_t), 4);
+    engine_sim.start_sem = SDL_CreateSemaphore(0);
+    engine_sim.done_sem = SDL_CreateSemaphore(0);
+    engine_sim.thread = SDL_CreateThread(Engine_SimThread, "game_frame", NULL);
+    if(engine_sim.thread == NULL)
+    {
+        Sys_DebugLog(SYS_LOG_FILENAME, "Can not create game frame thread: %s", SDL_GetError());
+        Engine_StopSimThread();
+    }
+}
+
+
+static void Engine_StopSimThread()
+{
+    if(engine_sim.thread)
+    {
+        engine_sim_frame_t frame;
+        frame.time = 0.0f;
+        frame.quit = 1;
+        SPSC_Push(&engine_sim.frames, &frame);
+        SDL_SemPost(engine_sim.start_sem);
+        SDL_WaitThread(engine_sim.thread, NULL);
+        engine_sim.thread = NULL;
+        Jobs_SetOwnerThread();
+    }
+    if(engine_sim.start_sem)
+    {
+        SDL_DestroySemaphore(engine_sim.start_sem);
+        SDL_DestroySemaphore(engine_sim.done_sem);
+        engine_sim.start_sem = NULL;
+        engine_sim.done_sem = NULL;
+        SPSC_Clear(&engine_sim.frames);
+        SPSC_Clear(&engine_sim.done);
+    }
+}
+
+
+static void Engine_PostSimFrame(float time)
+{
+    engine_sim_frame_t frame;
+    frame.time = time;
+    frame.quit = 0;
+    SPSC_Push(&engine_sim.frames, &frame);
+    SDL_SemPost(engine_sim.start_sem);
+}
+
+
+static float Engine_WaitSimFrame()
+{
+    engine_sim_frame_t frame;
+    SDL_SemWait(engine_sim.done_sem);
+    SPSC_Pop(&engine_sim.done, &frame);
+    Jobs_SetOwnerThread();
+    return frame.time;
+}
+
+
 void Engine_MainLoop()
 {
     float time = 0.0f;
@@ -765,6 +928,11 @@ void Engine_MainLoop()
     int cycles = 0;
     char fps_str[32] = "0.0";
 
+    if(system_settings.sim_thread)
+    {
+        Engine_StartSimThread();
+    }
+
     while(!engine_done)
     {
         newtime = Sys_FloatTime();
@@ -801,11 +969,29 @@ void Engine_MainLoop()
 
         Sys_ResetTempMem();
         Engine_PollSDLEvents();
-        Game_Frame(time);
-        Gameflow_Do();
+        if(engine_sim.thread && !engine_done)
+        {
+            // world of the previous game frame is drawn while the next one is simulated.
+            Engine_PrepareDisplay();
+            Engine_PostSimFrame(time);
+            Engine_DrawWorld();
+            time = Engine_WaitSimFrame();
+            Gameflow_Do();
+
+            Audio_Update(time);
+            if(!engine_done)
+            {
+                Engine_DrawOverlay();
+            }
+        }
+        else
+        {
+            Engine_SimFrame(&time);
+            Gameflow_Do();
 
-        Audio_Update(time);
-        Engine_Display();
+            Audio_Update(time);
+            Engine_Display();
+        }
     }
 }
 
@@ -842,7 +1028,8 @@ void ShowDebugInfo()
                             char trig_func[64];
                             Trigger_TrigTypeToStr(trig_type, 64, rs->trigger->sub_function);
                             GLText_OutTextXY(30.0f, y += dy, "trig(sub = %s, val = 0x%X, mask = 0x%X)", trig_type, rs->trigger->function_value, rs->trigger->mask);
-                            for(trigger_command_p cmd = rs->trigger->commands; cmd; cmd = cmd->next)
+                            trigger_command_p cmd = rs->trigger->commands;
+                            for(uint16_t i = 0; i < rs->trigger->commands_count; i++, cmd++)
                             {
                                 entity_p trig_obj = World_GetEntityByID(cmd->operands);
                                 if(trig_obj)
@@ -872,6 +1059,11 @@ void ShowDebugInfo()
                     GLText_OutTextXY(30.0f, y += dy, "curr_anim = %03d, next_anim = %03d, curr_frame = %03d, next_frame = %03d", ent->bf->animations.current_animation, ent->bf->animations.next_animation, ent->bf->animations.current_frame, ent->bf->animations.next_frame);
                     GLText_OutTextXY(30.0f, y += dy, "posX = %f, posY = %f, posZ = %f", ent->transform[12], ent->transform[13], ent->transform[14]);
                 }
+                GLText_OutTextXY(30.0f, y += dy, "anim lod: full = %d, reduced = %d, skipped = %d, deferred = %d, refreshed = %d",
+                                 anim_lod_stats.full, anim_lod_stats.reduced, anim_lod_stats.skipped, anim_lod_stats.deferred, anim_lod_stats.refreshed);
+                GLText_OutTextXY(30.0f, y += dy, "rooms: resident = %d, %.1f / %.1f MB, built = %d, sync = %d, released = %d, latency = %.1f / %.1f ms",
+                                 residency_stats.resident_count, (float)residency_stats.resident_size / 1048576.0f, (float)residency_settings.budget / 1048576.0f,
+                                 residency_stats.built, residency_stats.built_sync, residency_stats.released, residency_stats.latency_last, residency_stats.latency_max);
             }
             break;
 
@@ -894,7 +1086,8 @@ void ShowDebugInfo()
                             char trig_func[64];
                             Trigger_TrigTypeToStr(trig_type, 64, rs->trigger->sub_function);
                             GLText_OutTextXY(30.0f, y += dy, "trig(sub = %s, val = 0x%X, mask = 0x%X)", trig_type, rs->trigger->function_value, rs->trigger->mask);
-                            for(trigger_command_p cmd = rs->trigger->commands; cmd; cmd = cmd->next)
+                            trigger_command_p cmd = rs->trigger->commands;
+                            for(uint16_t i = 0; i < rs->trigger->commands_count; i++, cmd++)
                             {
                                 entity_p trig_obj = World_GetEntityByID(cmd->operands);
                                 if(trig_obj)
@@ -1110,8 +1303,11 @@ int Engine_ExecCmd(char *ch)
             Con_AddLine("help - show help info\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("loadMap(\"file_name\") - load level \"file_name\"\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("save, load - save and load game state in \"file_name\"\0", FONTSTYLE_CONSOLE_NOTIFY);
+            Con_AddLine("record, replay - record and play back input from current state in \"file_name\"\0", FONTSTYLE_CONSOLE_NOTIFY);
+            Con_AddLine("stop_replay - stop input recording or playback\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("exit - close program\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("cls - clean console\0", FONTSTYLE_CONSOLE_NOTIFY);
+            Con_AddLine("mesh_bench [passes] - time face building of the largest room mesh\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("show_fps - switch show fps flag\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("spacing - read and write spacing\0", FONTSTYLE_CONSOLE_NOTIFY);
             Con_AddLine("showing_lines - read and write number of showing lines\0", FONTSTYLE_CONSOLE_NOTIFY);
@@ -1149,6 +1345,29 @@ int Engine_ExecCmd(char *ch)
             }
             return 1;
         }
+        else if(!strcmp(token, "record"))
+        {
+            ch = SC_ParseToken(ch, token);
+            if(NULL != ch)
+            {
+                Replay_StartRecording(token);
+            }
+            return 1;
+        }
+        else if(!strcmp(token, "replay"))
+        {
+            ch = SC_ParseToken(ch, token);
+            if(NULL != ch)
+            {
+                Replay_StartPlayback(token);
+            }
+            return 1;
+        }
+        else if(!strcmp(token, "stop_replay"))
+        {
+            Replay_Stop();
+            return 1;
+        }
         else if(!strcmp(token, "exit"))
         {
             Engine_Shutdown(0);
@@ -1254,6 +1473,35 @@ int Engine_ExecCmd(char *ch)
             renderer.r_flags ^= R_DRAW_TRIGGERS;
             return 1;
         }
+        else if(!strcmp(token, "mesh_bench"))
+        {
+            room_p rooms = NULL, largest = NULL;
+            uint32_t rooms_count = 0;
+            int passes = 10;
+
+            ch = SC_ParseToken(ch, token);
+            if(NULL != ch)
+            {
+                passes = atoi(token);
+            }
+            World_GetRoomInfo(&rooms, &rooms_count);
+            for(uint32_t i = 0; i < rooms_count; i++)
+            {
+                if(rooms[i].content->mesh && (!largest || (rooms[i].content->mesh->polygons_count > largest->content->mesh->polygons_count)))
+                {
+                    largest = rooms + i;
+                }
+            }
+            if(largest)
+            {
+                float hash_ms, linear_ms;
+                uint32_t vertex_count, linear_vertex_count;
+                BaseMesh_BenchmarkBuild(largest->content->mesh, passes, &hash_ms, &linear_ms, &vertex_count, &linear_vertex_count);
+                Con_Printf("version = %d, room = %d, polygons = %d, vertices = %d", World_GetVersion(), largest->id, largest->content->mesh->polygons_count, vertex_count);
+                Con_Printf("hash = %.3f ms, linear = %.3f ms, same vertices = %d", hash_ms, linear_ms, (int)(vertex_count == linear_vertex_count));
+            }
+            return 1;
+        }
         else if(!strcmp(token, "room_info"))
         {
             room_p r = engine_camera.current_room;
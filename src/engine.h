@@ -105,6 +105,8 @@ typedef struct engine_control_state_s
     int8_t      gui_pause;                         // GUI keys - not sure if it must be here.
     int8_t      gui_inventory;
 
+    int8_t      rewind;                            // Service keys.
+
 }engine_control_state_t, *engine_control_state_p;
 
 
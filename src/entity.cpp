@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 extern "C" {
@@ -29,6 +30,10 @@ extern "C" {
 #include "engine_string.h"
 
 
+struct anim_lod_settings_s  anim_lod_settings;
+struct anim_lod_stats_s     anim_lod_stats;
+
+
 entity_p Entity_Create()
 {
     entity_p ret = (entity_p)calloc(1, sizeof(entity_t));
@@ -60,6 +65,15 @@ entity_p Entity_Create()
 
     ret->character = NULL;
     ret->current_sector = NULL;
+    ret->lowest_sector = NULL;
+    ret->highest_sector = NULL;
+    ret->trigger_sector = NULL;
+    ret->trigger_epoch = 0;
+    ret->trigger_key = 0;
+    ret->bodies_pose_serial = 0;
+    Mat4_E(ret->bodies_transform);
+    ret->state_dirty = 1;
+    ret->state_key = 0;
 
     ret->bf = (ss_bone_frame_p)malloc(sizeof(ss_bone_frame_t));
     ret->bf->animations.model = NULL;
@@ -75,6 +89,8 @@ entity_p Entity_Create()
     ret->bf->animations.next = NULL;
     ret->bf->bone_tag_count = 0;
     ret->bf->bone_tags = 0;
+    ret->bf->pose_deferred = 0;
+    ret->bf->pose_lod_valid = 0;
     vec3_set_zero(ret->bf->bb_max);
     vec3_set_zero(ret->bf->bb_min);
     vec3_set_zero(ret->bf->centre);
@@ -243,6 +259,7 @@ void Entity_UpdateRoomPos(entity_p ent)
 void Entity_UpdateTransform(entity_p entity)
 {
     int32_t i = entity->angles[0] / 360.0;
+    entity->state_dirty = 1;
     i = (entity->angles[0] < 0.0)?(i-1):(i);
     entity->angles[0] -= 360.0 * i;
 
@@ -263,6 +280,7 @@ void Entity_UpdateRigidBody(struct entity_s *ent, int force)
     if(ent->type_flags & ENTITY_TYPE_DYNAMIC)
     {
         float tr[16];
+        ent->state_dirty = 1;
         Physics_GetBodyWorldTransform(ent->physics, ent->transform, 0);
         Entity_UpdateRoomPos(ent);
         switch(ent->self->collision_shape)
@@ -302,6 +320,7 @@ void Entity_UpdateRigidBody(struct entity_s *ent, int force)
                 Mat4_Copy(ent->bf->bone_tags[i].transform, ent->bf->bone_tags[i].full_transform);
             }
         }
+        ent->bf->pose_serial++;
 
         // recalculate visibility box
         if(ent->bf->bone_tag_count == 1)
@@ -388,6 +407,8 @@ void Entity_UpdateRigidBody(struct entity_s *ent, int force)
                     break;
 
                 default:
+                    if(force || (ent->bodies_pose_serial != ent->bf->pose_serial) ||
+                       memcmp(ent->bodies_transform, ent->transform, sizeof(ent->bodies_transform)))
                     {
                         float tr[16];
                         for(uint16_t i = 0; i < ent->bf->bone_tag_count; i++)
@@ -395,6 +416,8 @@ void Entity_UpdateRigidBody(struct entity_s *ent, int force)
                             Mat4_Mat4_mul(tr, ent->transform, ent->bf->bone_tags[i].full_transform);
                             Physics_SetBodyWorldTransform(ent->physics, tr, i);
                         }
+                        ent->bodies_pose_serial = ent->bf->pose_serial;
+                        Mat4_Copy(ent->bodies_transform, ent->transform);
                     }
                     break;
             };
@@ -884,8 +907,23 @@ void Entity_DoAnimCommands(entity_p entity, struct ss_animation_s *ss_anim, int
 }
 
 
+static inline uint32_t Entity_GetTriggerKey(entity_p ent)
+{
+    // Everything trigger header conditions depend on.
+    uint32_t ret = ent->trigger_layout | ((uint32_t)ent->move_type << 8) | ((uint32_t)ent->state_flags << 16);
+    if(ent->character && (ent->character->weapon_current_state > 0))
+    {
+        ret |= 0x1000;
+    }
+    return ret;
+}
+
+
 void Entity_ProcessSector(entity_p ent)
 {
+    uint32_t epoch = Trigger_GetEpoch();
+    int sector_changed;
+
     if(!ent->current_sector) return;
 
     // Calculate both above and below sectors for further usage.
@@ -893,9 +931,18 @@ void Entity_ProcessSector(entity_p ent)
     // as many triggers tend to be called from the lowest room in a row
     // (e.g. first trapdoor in The Great Wall, etc.)
     // Sector above primarily needed for paranoid cases of monkeyswing.
+    // Both are cached until sector is changed or rooms are flipped (epoch).
+
+    sector_changed = (ent->trigger_sector != ent->current_sector) || (ent->trigger_epoch != epoch);
+    if(sector_changed)
+    {
+        ent->trigger_sector = ent->current_sector;
+        ent->highest_sector = Sector_GetHighest(ent->current_sector);
+        ent->lowest_sector  = Sector_GetLowest(ent->current_sector);
+    }
 
-    room_sector_p highest_sector = Sector_GetHighest(ent->current_sector);
-    room_sector_p lowest_sector  = Sector_GetLowest(ent->current_sector);
+    room_sector_p highest_sector = ent->highest_sector;
+    room_sector_p lowest_sector  = ent->lowest_sector;
 
     if(ent->character)
     {
@@ -928,13 +975,21 @@ void Entity_ProcessSector(entity_p ent)
     }
 
     // If entity either marked as trigger activator (Lara) or heavytrigger activator (other entities),
-    // we try to execute a trigger for this sector.
+    // we try to execute a trigger for this sector. Trigger is re-evaluated only on sector entry,
+    // activator state change or trigger related world change, except continuous ones.
 
     if(ent->type_flags & (ENTITY_TYPE_TRIGGER_ACTIVATOR | ENTITY_TYPE_HEAVYTRIGGER_ACTIVATOR))
     {
-        // Look up trigger function table and run trigger if it exists.
-        Trigger_DoCommands(lowest_sector->trigger, ent);
+        trigger_header_p trigger = lowest_sector->trigger;
+        if(trigger && (sector_changed || trigger->continuous || (Entity_GetTriggerKey(ent) != ent->trigger_key)))
+        {
+            // Look up trigger function table and run trigger if it exists.
+            Trigger_DoCommands(trigger, ent);
+        }
+        ent->trigger_key = Entity_GetTriggerKey(ent);
     }
+    // Changes made by evaluation itself lead to one more pass, it settles then.
+    ent->trigger_epoch = epoch;
 }
 
 
@@ -947,6 +1002,7 @@ void Entity_SetAnimation(entity_p entity, int animation, int frame)
 
     animation = (animation < 0)?(0):(animation);
     entity->no_fix_all = 0x00;
+    entity->state_dirty = 1;
 
     entity->anim_linear_speed = entity->bf->animations.model->animations[animation].speed_x;
     SSBoneFrame_SetAnimation(entity->bf, animation, frame);
@@ -1048,6 +1104,8 @@ void Entity_Frame(entity_p entity, float time)
         ss_animation_p ss_anim = &entity->bf->animations;
         uint16_t is_base_anim = 1;
 
+        entity->state_dirty = 1;
+        Physics_RequireRoomShapes(entity->self->room);
         Entity_GhostUpdate(entity);
 
         while(ss_anim)
@@ -1130,7 +1188,7 @@ void Entity_Frame(entity_p entity, float time)
             ss_anim = ss_anim->next;
         }
 
-        SSBoneFrame_Update(entity->bf);
+        Entity_UpdatePose(entity);
         if(entity->character != NULL)
         {
             Entity_FixPenetrations(entity, NULL);
@@ -1138,6 +1196,99 @@ void Entity_Frame(entity_p entity, float time)
     }
 }
 
+
+void Entity_InitAnimLODGlobals()
+{
+    anim_lod_settings.enabled = 1;
+    anim_lod_settings.near_distance = 8192.0f;
+    anim_lod_settings.far_distance = 16384.0f;
+    anim_lod_settings.reduced_period = 2;
+    anim_lod_settings.far_period = 4;
+}
+
+
+/*
+ * Returns game frames per pose update, 0 - pose is deferred.
+ */
+static uint16_t Entity_GetAnimLODPeriod(entity_p entity)
+{
+    entity_p player = World_GetPlayer();
+    float dist;
+
+    if(!anim_lod_settings.enabled || entity->character || (entity == player) || !entity->self->room)
+    {
+        return 1;
+    }
+
+    dist = vec3_dist(entity->transform + 12, engine_camera.pos);
+    if(player)
+    {
+        float player_dist = vec3_dist(entity->transform + 12, player->transform + 12);
+        if((player->self->room == entity->self->room) || (player_dist < anim_lod_settings.near_distance))
+        {
+            return 1;                                                           // may collide with player
+        }
+    }
+
+    if(!entity->self->room->is_in_r_list)
+    {
+        return 0;
+    }
+    if(dist < anim_lod_settings.near_distance)
+    {
+        return 1;
+    }
+    return (dist < anim_lod_settings.far_distance) ? (anim_lod_settings.reduced_period) : (anim_lod_settings.far_period);
+}
+
+
+void Entity_UpdatePose(entity_p entity)
+{
+    uint16_t period = Entity_GetAnimLODPeriod(entity);
+
+    if(period == 0)
+    {
+        // bounding box is still needed for BV, activators and culling.
+        SSBoneFrame_UpdateBounds(entity->bf);
+        entity->bf->pose_deferred = 1;
+        entity->bf->pose_lod_valid = 0;
+        anim_lod_stats.deferred++;
+    }
+    else if((period > 1) && !entity->bf->pose_deferred && (++entity->anim_lod_frames < period))
+    {
+        // shown pose runs one update period behind: blend towards the last evaluated one.
+        SSBoneFrame_UpdateBounds(entity->bf);
+        SSBoneFrame_BlendLODPose(entity->bf, (float)(entity->anim_lod_frames + 1) / (float)period);
+        anim_lod_stats.skipped++;
+    }
+    else
+    {
+        entity->anim_lod_frames = 0;
+        SSBoneFrame_Update(entity->bf);
+        if(period > 1)
+        {
+            SSBoneFrame_StoreLODPose(entity->bf);
+            SSBoneFrame_BlendLODPose(entity->bf, 1.0f / (float)period);
+            anim_lod_stats.reduced++;
+        }
+        else
+        {
+            entity->bf->pose_lod_valid = 0;
+            anim_lod_stats.full++;
+        }
+    }
+}
+
+
+void Entity_RefreshPose(entity_p entity)
+{
+    if(entity->bf->pose_deferred && entity->bf->animations.model)
+    {
+        SSBoneFrame_Update(entity->bf);
+        anim_lod_stats.refreshed++;
+    }
+}
+
 /**
  * The function rebuild / renew entity's BV
  */
@@ -1225,6 +1376,9 @@ int  Entity_Activate(struct entity_s *entity_object, struct entity_s *entity_act
             event = 0;
         }
 
+        uint8_t old_layout = entity_object->trigger_layout;
+        float old_timer = entity_object->timer;
+
         // Update trigger layout.
         entity_object->trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_MASK);       // mask  - 00011111
         entity_object->trigger_layout ^= (uint8_t)mask;
@@ -1234,6 +1388,11 @@ int  Entity_Activate(struct entity_s *entity_object, struct entity_s *entity_act
         entity_object->trigger_layout ^= ((uint8_t)trigger_lock) << 6;
 
         entity_object->timer = trigger_timer;                                   // Engage timer.
+
+        if((old_layout != entity_object->trigger_layout) || (old_timer != entity_object->timer))
+        {
+            Trigger_Invalidate();
+        }
     }
 
     return 0;
@@ -1259,6 +1418,7 @@ int  Entity_Deactivate(struct entity_s *entity_object, struct entity_s *entity_a
             // Update trigger layout.
             entity_object->trigger_layout = 0x00U;
             entity_object->timer = 0.0f;
+            Trigger_Invalidate();
         }
 
         lua_settop(engine_lua, top);
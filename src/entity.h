@@ -56,6 +56,33 @@ struct physics_data_s;
 #define WEAPON_STATE_FIRE_TO_IDLE               (0x05)
 #define WEAPON_STATE_IDLE_TO_HIDE               (0x06)
 
+/*
+ * Animation LOD: pose of entities far from camera and player is evaluated
+ * every reduced_period / far_period game frames; entities in rooms out of the
+ * render list only advance animation state, pose is evaluated when needed.
+ */
+typedef struct anim_lod_settings_s
+{
+    int8_t      enabled;
+    float       near_distance;              // full rate closer to camera or player
+    float       far_distance;               // reduced_period up to it, far_period behind it
+    uint16_t    reduced_period;
+    uint16_t    far_period;
+}anim_lod_settings_t, *anim_lod_settings_p;
+
+// Per game frame counters of pose updates.
+typedef struct anim_lod_stats_s
+{
+    uint32_t    full;
+    uint32_t    reduced;
+    uint32_t    skipped;                    // held pose of reduced rate entities
+    uint32_t    deferred;                   // entities out of view
+    uint32_t    refreshed;                  // deferred poses evaluated on demand
+}anim_lod_stats_t, *anim_lod_stats_p;
+
+extern struct anim_lod_settings_s anim_lod_settings;
+extern struct anim_lod_stats_s anim_lod_stats;
+
 // Specific in-game entity structure.
 
 typedef struct entity_s
@@ -89,6 +116,16 @@ typedef struct entity_s
 
     struct room_sector_s               *current_sector;
     struct room_sector_s               *last_sector;
+    struct room_sector_s               *lowest_sector;      // cached for trigger_sector by Entity_ProcessSector
+    struct room_sector_s               *highest_sector;
+    struct room_sector_s               *trigger_sector;
+    uint32_t                            trigger_epoch;      // Trigger_GetEpoch() value of the last evaluation
+    uint32_t                            trigger_key;        // activator state of the last evaluation
+    uint16_t                            anim_lod_frames;    // game frames since the last pose update
+    uint32_t                            bodies_pose_serial; // bf->pose_serial of the last bones push to physics
+    float                               bodies_transform[16]; // entity transform of the last bones push to physics
+    uint8_t                             state_dirty;        // moved, animated or params changed since the last rewind keyframe
+    uint32_t                            state_key;          // flags hash of the last rewind keyframe
 
     struct engine_container_s          *self;
 
@@ -106,7 +143,10 @@ void Entity_EnableCollision(entity_p ent);
 void Entity_DisableCollision(entity_p ent);
 void Entity_UpdateRoomPos(entity_p ent);
 
+void Entity_InitAnimLODGlobals();
 void Entity_Frame(entity_p entity, float time);  // process frame + trying to change state
+void Entity_UpdatePose(entity_p entity);         // evaluates pose according to animation LOD
+void Entity_RefreshPose(entity_p entity);        // evaluates deferred pose before bones are used
 
 void Entity_RebuildBV(entity_p ent);
 void Entity_UpdateTransform(entity_p entity);
@@ -1,6 +1,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 extern "C" {
 #include <lua.h>
@@ -33,11 +34,11 @@ extern "C" {
 #include "gameflow.h"
 #include "gui.h"
 #include "inventory.h"
+#include "save_state.h"
+#include "rewind.h"
 
 extern lua_State *engine_lua;
 
-void Save_EntityTree(FILE **f, RedBlackNode_p n);
-void Save_Entity(FILE **f, entity_p ent);
 void Cam_PlayFlyBy(float time);
 
 
@@ -138,182 +139,106 @@ void Game_RegisterLuaFunctions(lua_State *lua)
 }
 
 
-/**
- * Load game state
- */
-int Game_Load(const char* name)
+static const char *Game_GetSavePath(const char *name, char *token, int token_size)
 {
-    FILE *f;
-    char *ch, local;
-
-    local = 1;
-    for(ch = (char*)name; *ch; ch++)
+    for(const char *ch = name; *ch; ch++)
     {
         if((*ch == '\\') || (*ch == '/'))
         {
-            local = 0;
-            break;
-        }
-    }
-
-    if(local)
-    {
-        char token[512];
-        snprintf(token, 512, "save/%s", name);
-        f = fopen(token, "rb");
-        if(f == NULL)
-        {
-            Sys_extWarn("Can not read file \"%s\"", token);
-            return 0;
+            return name;
         }
-        fclose(f);
-        Script_LuaClearTasks();
-        luaL_dofile(engine_lua, token);
-    }
-    else
-    {
-        f = fopen(name, "rb");
-        if(f == NULL)
-        {
-            Sys_extWarn("Can not read file \"%s\"", name);
-            return 0;
-        }
-        fclose(f);
-        Script_LuaClearTasks();
-        luaL_dofile(engine_lua, name);
-    }
-
-    return 1;
-}
-
-
-void Save_EntityTree(FILE **f, RedBlackNode_p n)
-{
-    if(n->left != NULL)
-    {
-        Save_EntityTree(f, n->left);
-    }
-    Save_Entity(f, (entity_p)n->data);
-    if(n->right != NULL)
-    {
-        Save_EntityTree(f, n->right);
     }
+    snprintf(token, token_size, "save/%s", name);
+    return token;
 }
 
 /**
- * Entity save function, based on engine lua scripts;
+ * Load game state: binary save state or lua commands file
  */
-void Save_Entity(FILE **f, entity_p ent)
+int Game_Load(const char* name)
 {
-    if(ent == NULL)
-    {
-        return;
-    }
+    FILE *f;
+    char token[512];
+    const char *path = Game_GetSavePath(name, token, sizeof(token));
+    uint8_t *data;
+    long size;
+    int ret;
 
-    if(ent->type_flags & ENTITY_TYPE_SPAWNED)
+    f = fopen(path, "rb");
+    if(f == NULL)
     {
-        uint32_t room_id = (ent->self->room)?(ent->self->room->id):(0xFFFFFFFF);
-        fprintf(*f, "\nspawnEntity(%d, 0x%X, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %d);", ent->bf->animations.model->id, room_id,
-                ent->transform[12+0], ent->transform[12+1], ent->transform[12+2],
-                ent->angles[0], ent->angles[1], ent->angles[2], ent->id);
+        Sys_extWarn("Can not read file \"%s\"", path);
+        return 0;
     }
-    else
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if((size < (long)sizeof(save_state_header_t)) || (size > 0x7FFFFFFF))
     {
-        fprintf(*f, "\nsetEntityPos(%d, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f);", ent->id,
-                ent->transform[12+0], ent->transform[12+1], ent->transform[12+2],
-                ent->angles[0], ent->angles[1], ent->angles[2]);
+        fclose(f);
+        Script_LuaClearTasks();
+        luaL_dofile(engine_lua, path);
+        return 1;
     }
 
-    fprintf(*f, "\nsetEntitySpeed(%d, %.2f, %.2f, %.2f);", ent->id, ent->speed[0], ent->speed[1], ent->speed[2]);
-    fprintf(*f, "\nsetEntityAnim(%d, %d, %d);", ent->id, ent->bf->animations.current_animation, ent->bf->animations.current_frame);
-    fprintf(*f, "\nsetEntityState(%d, %d, %d);", ent->id, ent->bf->animations.next_state, ent->bf->animations.last_state);
-
-    fprintf(*f, "\nsetEntityFlags(%d, 0x%.4X, 0x%.4X, 0x%.8X);", ent->id, ent->state_flags, ent->type_flags, ent->callback_flags);
-    fprintf(*f, "\nsetEntityCollisionFlags(%d, %d, %d);", ent->id, ent->self->collision_type, ent->self->collision_shape);
-    fprintf(*f, "\nsetEntityTriggerLayout(%d, 0x%.2X);", ent->id, ent->trigger_layout);
-    //setEntityMeshswap()
+    data = (uint8_t*)malloc(size);
+    size = fread(data, 1, size, f);
+    fclose(f);
 
-    if(ent->self->room != NULL)
-    {
-        fprintf(*f, "\nsetEntityRoomMove(%d, %d, %d, %d);", ent->id, ent->self->room->id, ent->move_type, ent->dir_flag);
-    }
-    else
+    if(((save_state_header_p)data)->magic != SAVE_STATE_MAGIC)
     {
-        fprintf(*f, "\nsetEntityRoomMove(%d, nil, %d, %d);", ent->id, ent->move_type, ent->dir_flag);
+        free(data);
+        Script_LuaClearTasks();
+        luaL_dofile(engine_lua, path);
+        return 1;
     }
 
-    if(ent->character != NULL)
+    // same level is restored in place, other one is loaded with its scripts.
+    Script_CallVoidFunc(engine_lua, "clearTasks");
+    ret = SaveState_Restore(data, size, 0);
+    free(data);
+    if(!ret)
     {
-        fprintf(*f, "\nremoveAllItems(%d);", ent->id);
-        for(inventory_node_p i = ent->character->inventory; i; i = i->next)
-        {
-            fprintf(*f, "\naddItem(%d, %d, %d);", ent->id, i->id, i->count);
-        }
-
-        for(int i = 0; i < PARAM_LASTINDEX; i++)
-        {
-            fprintf(*f, "\nsetCharacterParam(%d, %d, %.2f, %.2f);", ent->id, i, ent->character->parameters.param[i], ent->character->parameters.maximum[i]);
-        }
+        Sys_extWarn("Can not load save state \"%s\"", path);
     }
+
+    return ret;
 }
 
 /**
- * Save current game state
+ * Save current game state; "*.lua" names are exported as lua commands text.
  */
 int Game_Save(const char* name)
 {
     FILE *f;
-    char local, *ch, token[512];
-
-    local = 1;
-    for(ch = (char*)name; *ch; ch++)
-    {
-        if((*ch == '\\') || (*ch == '/'))
-        {
-            local = 0;
-            break;
-        }
-    }
-
-    if(local)
-    {
-        snprintf(token, 512, "save/%s", name);
-        f = fopen(token, "wb");
-    }
-    else
-    {
-        f = fopen(name, "wb");
-    }
+    char token[512];
+    const char *path = Game_GetSavePath(name, token, sizeof(token));
+    size_t len = strlen(path);
+    save_state_t state;
+    int ret;
 
+    f = fopen(path, "wb");
     if(!f)
     {
         Sys_extWarn("Can not create file \"%s\"", name);
         return 0;
     }
 
-    fprintf(f, "loadMap(\"%s\", %d, %d);\n", gameflow_manager.CurrentLevelPath, gameflow_manager.CurrentGameID, gameflow_manager.CurrentLevelID);
-
-    // Save flipmap and flipped room states.
-    uint8_t *flip_map;
-    uint8_t *flip_state;
-    uint32_t flip_count;
-    World_GetFlipInfo(&flip_map, &flip_state, &flip_count);
-    for(uint32_t i = 0; i < flip_count; i++)
+    SaveState_Init(&state);
+    SaveState_Capture(&state, 1);
+    if((len > 4) && !strcmp(path + len - 4, ".lua"))
     {
-        fprintf(f, "setFlipMap(%d, 0x%02X, 0);\n", i, flip_map[i]);
-        fprintf(f, "setFlipState(%d, %d);\n", i, flip_state[i]);
+        ret = SaveState_ExportLua(state.data, state.size, f);
     }
-
-    Save_Entity(&f, World_GetPlayer());    // Save Lara.
-
-    RedBlackNode_p root = World_GetEntityTreeRoot();
-    if(root)
+    else
     {
-        Save_EntityTree(&f, root);
+        ret = (fwrite(state.data, 1, state.size, f) == state.size);
     }
+    SaveState_Clear(&state);
     fclose(f);
 
-    return 1;
+    return ret;
 }
 
 
@@ -883,6 +808,18 @@ void Game_Frame(float time)
         return;
     }
 
+    // While rewind is held, game is not simulated, only history is played back.
+    if(control_states.rewind && Rewind_Step(time))
+    {
+        if(is_character)
+        {
+            Cam_FollowEntity(&engine_camera, player, 16.0, 128.0);
+        }
+        Controls_RefreshStates();
+        return;
+    }
+
+    memset(&anim_lod_stats, 0, sizeof(anim_lod_stats));
     Script_DoTasks(engine_lua, time);
     Game_UpdateAI();
     if(is_character)
@@ -942,7 +879,9 @@ void Game_Frame(float time)
         Game_UpdateAllEntities(World_GetEntityTreeRoot());
     }
 
+    Physics_UpdateActiveRooms((is_character) ? (player->self->room) : (NULL), engine_camera.current_room);
     Physics_StepSimulation(time);
+    Rewind_Frame(time);
 
     Controls_RefreshStates();
     renderer.UpdateAnimTextures();
@@ -989,6 +928,8 @@ void Game_Prepare()
         }
     }
 
+    Rewind_Reset();
+
     // Set gameflow parameters to default.
     // Reset secret trigger map.
     memset(gameflow_manager.SecretsTriggerMap, 0, sizeof(gameflow_manager.SecretsTriggerMap));
@@ -1,35 +1,19 @@
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/gl_util.h"
+#include "core/system.h"
 #include "core/vmath.h"
 #include "core/polygon.h"
 #include "mesh.h"
 
 
-void BaseMesh_GenVBO(struct base_mesh_s *mesh);
-void BaseMesh_AddPolygonToFaces(base_mesh_p mesh, struct polygon_s *p);
 void BaseMesh_AddAnimatedPolygonToFaces(base_mesh_p mesh, uint32_t *vertex_index, struct polygon_s *p);
 
 void BaseMesh_Clear(base_mesh_p mesh)
 {
-    if(qglIsBufferARB(mesh->vbo_vertex_array))
-    {
-        qglDeleteBuffersARB(1, &mesh->vbo_vertex_array);
-        mesh->vbo_vertex_array = 0;
-    }
-
-    if(qglIsBufferARB(mesh->vbo_animated_vertex_array))
-    {
-        qglDeleteBuffersARB(1, &mesh->vbo_animated_vertex_array);
-        mesh->vbo_animated_vertex_array = 0;
-    }
-    
-    if(qglIsBufferARB(mesh->vbo_animated_texcoord_array))
-    {
-        qglDeleteBuffersARB(1, &mesh->vbo_animated_texcoord_array);
-        mesh->vbo_animated_texcoord_array = 0;
-    }
+    BaseMesh_ReleaseFaces(mesh);
 
     mesh->transparency_polygons = NULL;
     mesh->animated_polygons = NULL;
@@ -45,25 +29,51 @@ void BaseMesh_Clear(base_mesh_p mesh)
         mesh->polygons_count = 0;
     }
 
+    if(mesh->skin_map)
+    {
+        free(mesh->skin_map);
+        mesh->skin_map = NULL;
+    }
+
+    if(mesh->skin)
+    {
+        free(mesh->skin);
+        mesh->skin = NULL;
+    }
+}
+
+
+/*
+ * Frees everything made by BaseMesh_GenFaces, polygons stay untouched.
+ */
+void BaseMesh_ReleaseFaces(base_mesh_p mesh)
+{
+    if(qglIsBufferARB(mesh->vbo_vertex_array))
+    {
+        qglDeleteBuffersARB(1, &mesh->vbo_vertex_array);
+    }
+    mesh->vbo_vertex_array = 0;
+
+    if(qglIsBufferARB(mesh->vbo_animated_vertex_array))
+    {
+        qglDeleteBuffersARB(1, &mesh->vbo_animated_vertex_array);
+    }
+    mesh->vbo_animated_vertex_array = 0;
+    mesh->animated_texcoord_offset = ~0U;
+
     if(mesh->vertices)
     {
         free(mesh->vertices);
         mesh->vertices = NULL;
-        mesh->vertex_count = 0;
     }
+    mesh->vertex_count = 0;
     
     if(mesh->animated_vertices)
     {
         free(mesh->animated_vertices);
         mesh->animated_vertices = NULL;
-        mesh->animated_vertex_count = 0;
-    }
-
-    if(mesh->skin_map)
-    {
-        free(mesh->skin_map);
-        mesh->skin_map = NULL;
     }
+    mesh->animated_vertex_count = 0;
 
     if(mesh->faces)
     {
@@ -78,8 +88,8 @@ void BaseMesh_Clear(base_mesh_p mesh)
         }
         free(mesh->faces);
         mesh->faces = NULL;
-        mesh->faces_count = 0;
     }
+    mesh->faces_count = 0;
 
     if(mesh->animated_faces)
     {
@@ -94,10 +104,8 @@ void BaseMesh_Clear(base_mesh_p mesh)
         }
         free(mesh->animated_faces);
         mesh->animated_faces = NULL;
-        mesh->animated_faces_count = 0;
     }
-    
-    mesh->vertex_count = 0;
+    mesh->animated_faces_count = 0;
 }
 
 
@@ -154,7 +162,7 @@ void BaseMesh_GenVBO(struct base_mesh_s *mesh)
 {
     mesh->vbo_vertex_array = 0;
     mesh->vbo_animated_vertex_array = 0;
-    mesh->vbo_animated_texcoord_array = 0;
+    mesh->animated_texcoord_offset = ~0U;
     
     /// now, begin VBO filling!
     qglGenBuffersARB(1, &mesh->vbo_vertex_array);
@@ -175,10 +183,7 @@ void BaseMesh_GenVBO(struct base_mesh_s *mesh)
         qglBufferDataARB(GL_ARRAY_BUFFER, mesh->animated_vertex_count * sizeof(vertex_t), mesh->animated_vertices, GL_STATIC_DRAW);
         free(mesh->animated_vertices);
         mesh->animated_vertices = NULL;
-        // Prepare empty buffer for tex coords
-        qglGenBuffersARB(1, &mesh->vbo_animated_texcoord_array);
-        qglBindBufferARB(GL_ARRAY_BUFFER, mesh->vbo_animated_texcoord_array);
-        qglBufferDataARB(GL_ARRAY_BUFFER, mesh->animated_vertex_count * sizeof(GLfloat [2]), 0, GL_STREAM_DRAW);
+        // tex coords live in the renderer's shared buffer, see CRender::AddAnimatedMesh
     }
     qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
     qglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
@@ -188,33 +193,60 @@ void BaseMesh_GenVBO(struct base_mesh_s *mesh)
 /*
  * FACES FUNCTIONS
  */
-uint32_t BaseMesh_AddVertex(base_mesh_p mesh, struct vertex_s *vertex)
+/*
+ * Vertices are welded by exact position and tex coord (color is not checked)
+ * through an open addressing hash of vertex indices. Capacities are known
+ * from polygons before filling, so the arrays are allocated once.
+ */
+typedef struct mesh_builder_s
+{
+    uint32_t    hash_mask;
+    uint32_t   *hash;                   // vertex index + 1, 0 - empty slot
+}mesh_builder_t, *mesh_builder_p;
+
+
+static uint32_t BaseMesh_VertexHash(const struct vertex_s *vertex)
+{
+    const float key[5] = {vertex->position[0] + 0.0f, vertex->position[1] + 0.0f, vertex->position[2] + 0.0f,   // +0.0f makes -0.0 equal to 0.0
+                          vertex->tex_coord[0] + 0.0f, vertex->tex_coord[1] + 0.0f};
+    uint32_t bits[5];
+    uint32_t h = 2166136261u;
+
+    memcpy(bits, key, sizeof(bits));
+    for(int i = 0; i < 5; i++)
+    {
+        h = (h ^ bits[i]) * 16777619u;
+    }
+
+    return h ^ (h >> 15);
+}
+
+
+static uint32_t BaseMesh_AddVertex(base_mesh_p mesh, mesh_builder_p builder, struct vertex_s *vertex)
 {
-    vertex_p v = mesh->vertices;
-    uint32_t vertex_index = 0;
+    uint32_t slot = BaseMesh_VertexHash(vertex) & builder->hash_mask;
+    vertex_p v;
 
-    for(vertex_index = 0; vertex_index < mesh->vertex_count; vertex_index++, v++)
+    for(; builder->hash[slot] != 0; slot = (slot + 1) & builder->hash_mask)
     {
+        v = mesh->vertices + builder->hash[slot] - 1;
         if(v->position[0] == vertex->position[0] && v->position[1] == vertex->position[1] && v->position[2] == vertex->position[2] &&
            v->tex_coord[0] == vertex->tex_coord[0] && v->tex_coord[1] == vertex->tex_coord[1])
             ///@QUESTION: color check?
         {
-            return vertex_index;
+            return builder->hash[slot] - 1;
         }
     }
 
-    vertex_index = mesh->vertex_count;
-    mesh->vertex_count++;
-    mesh->vertices = (vertex_p)realloc(mesh->vertices, mesh->vertex_count * sizeof(vertex_t));
-
-    v = mesh->vertices + vertex_index;
+    builder->hash[slot] = mesh->vertex_count + 1;
+    v = mesh->vertices + mesh->vertex_count;
     vec3_copy(v->position, vertex->position);
     vec3_copy(v->normal, vertex->normal);
     vec4_copy(v->color, vertex->color);
     v->tex_coord[0] = vertex->tex_coord[0];
     v->tex_coord[1] = vertex->tex_coord[1];
 
-    return vertex_index;
+    return mesh->vertex_count++;
 }
 
 
@@ -233,47 +265,46 @@ uint32_t BaseMesh_FindVertexIndex(base_mesh_p mesh, float v[3])
 }
 
 
-void BaseMesh_AddPolygonToFaces(base_mesh_p mesh, struct polygon_s *p)
+static mesh_face_p BaseMesh_GetFace(base_mesh_p mesh, struct polygon_s *p)
 {
-    mesh_face_p current_face = NULL;
-    uint32_t add_elements_count = (p->vertex_count - 2) * 3;
-    GLuint *current_index;
-    
-    if (p->double_side)
-    {
-        add_elements_count *= 2;
-    }
-    
     for(uint32_t i = 0; i < mesh->faces_count; i++)
     {
         if(mesh->faces[i].texture_index == p->texture_index)
         {
-            current_face = mesh->faces + i;
-            break;
+            return mesh->faces + i;
         }
     }
-    
-    if(current_face == NULL)
-    {
-        mesh->faces = (mesh_face_p)realloc(mesh->faces, (mesh->faces_count + 1) * sizeof(mesh_face_t));
-        current_face = mesh->faces + mesh->faces_count;
-        mesh->faces_count++;
-        current_face->elements = NULL;
-        current_face->elements_count = 0;
-        current_face->texture_index = p->texture_index;
-    }
-    
-    current_face->elements = (GLuint *)realloc(current_face->elements, (current_face->elements_count + add_elements_count) * sizeof(GLuint));
-    current_index = current_face->elements + current_face->elements_count;
-    current_face->elements_count += add_elements_count;
+
+    mesh->faces = (mesh_face_p)realloc(mesh->faces, (mesh->faces_count + 1) * sizeof(mesh_face_t));
+    mesh->faces[mesh->faces_count].elements = NULL;
+    mesh->faces[mesh->faces_count].elements_count = 0;
+    mesh->faces[mesh->faces_count].texture_index = p->texture_index;
+
+    return mesh->faces + mesh->faces_count++;
+}
+
+
+static uint32_t BaseMesh_GetPolygonElementsCount(struct polygon_s *p)
+{
+    return (p->double_side) ? ((p->vertex_count - 2) * 6) : ((p->vertex_count - 2) * 3);
+}
+
+
+// Face elements are allocated before by BaseMesh_GenFaces, elements_count is the fill position.
+static void BaseMesh_AddPolygonToFaces(base_mesh_p mesh, mesh_builder_p builder, struct polygon_s *p)
+{
+    mesh_face_p current_face = BaseMesh_GetFace(mesh, p);
+    GLuint *current_index = current_face->elements + current_face->elements_count;
+
+    current_face->elements_count += BaseMesh_GetPolygonElementsCount(p);
 
     // Render the face as a triangle array
-    uint32_t startElement = BaseMesh_AddVertex(mesh, p->vertices);
-    uint32_t previousElement = BaseMesh_AddVertex(mesh, p->vertices + 1);
+    uint32_t startElement = BaseMesh_AddVertex(mesh, builder, p->vertices);
+    uint32_t previousElement = BaseMesh_AddVertex(mesh, builder, p->vertices + 1);
 
     for(uint16_t j = 2; j < p->vertex_count; j++)
     {
-        uint32_t thisElement = BaseMesh_AddVertex(mesh, p->vertices + j);
+        uint32_t thisElement = BaseMesh_AddVertex(mesh, builder, p->vertices + j);
 
         *current_index++ = startElement;
         *current_index++ = previousElement;
@@ -357,8 +388,21 @@ void BaseMesh_AddAnimatedPolygonToFaces(base_mesh_p mesh, uint32_t *vertex_index
 
 
 void BaseMesh_GenFaces(base_mesh_p mesh)
+{
+    BaseMesh_BuildFaces(mesh);
+    BaseMesh_GenVBO(mesh);
+}
+
+
+/*
+ * Touches only the mesh's own memory and no GL state,
+ * so different meshes may be built from any thread.
+ */
+void BaseMesh_BuildFaces(base_mesh_p mesh)
 {
     polygon_p p = mesh->polygons;
+    mesh_builder_t builder;
+    uint32_t max_vertices = 0;
     
     mesh->faces_count = 0;
     mesh->faces = NULL;
@@ -370,12 +414,37 @@ void BaseMesh_GenFaces(base_mesh_p mesh)
     
     mesh->animated_polygons = NULL;
     mesh->transparency_polygons = NULL;
-    
+
+    // Count face elements and vertices first, then fill without reallocations.
     for(uint32_t i = 0; i < mesh->polygons_count; i++, p++)
     {
         if((p->transparency < 2) && (p->anim_id == 0) && !Polygon_IsBroken(p))
         {
-            BaseMesh_AddPolygonToFaces(mesh, p);
+            BaseMesh_GetFace(mesh, p)->elements_count += BaseMesh_GetPolygonElementsCount(p);
+            max_vertices += p->vertex_count;
+        }
+    }
+    for(uint32_t i = 0; i < mesh->faces_count; i++)
+    {
+        mesh->faces[i].elements = (GLuint*)malloc(mesh->faces[i].elements_count * sizeof(GLuint));
+        mesh->faces[i].elements_count = 0;
+    }
+
+    builder.hash_mask = 15;
+    while(builder.hash_mask + 1 < 2 * max_vertices)
+    {
+        builder.hash_mask = 2 * builder.hash_mask + 1;
+    }
+    builder.hash = (uint32_t*)calloc(builder.hash_mask + 1, sizeof(uint32_t));
+    mesh->vertex_count = 0;
+    mesh->vertices = (vertex_p)realloc(mesh->vertices, (max_vertices + 1) * sizeof(vertex_t));
+
+    p = mesh->polygons;
+    for(uint32_t i = 0; i < mesh->polygons_count; i++, p++)
+    {
+        if((p->transparency < 2) && (p->anim_id == 0) && !Polygon_IsBroken(p))
+        {
+            BaseMesh_AddPolygonToFaces(mesh, &builder, p);
         }
         else if(p->transparency >= 2)
         {
@@ -388,6 +457,17 @@ void BaseMesh_GenFaces(base_mesh_p mesh)
             mesh->animated_polygons = p;
         }
     }
+
+    free(builder.hash);
+    if(mesh->vertex_count > 0)
+    {
+        mesh->vertices = (vertex_p)realloc(mesh->vertices, mesh->vertex_count * sizeof(vertex_t));
+    }
+    else
+    {
+        free(mesh->vertices);
+        mesh->vertices = NULL;
+    }
     
     if(mesh->animated_polygons)
     {
@@ -403,6 +483,184 @@ void BaseMesh_GenFaces(base_mesh_p mesh)
             BaseMesh_AddAnimatedPolygonToFaces(mesh, &vertex_index, p);
         }
     }
-    
-    BaseMesh_GenVBO(mesh);
+}
+
+
+// Welding as it was before the vertex hash: linear search, one realloc per vertex.
+static uint32_t BaseMesh_AddVertexLinear(vertex_p *vertices, uint32_t *vertex_count, struct vertex_s *vertex)
+{
+    vertex_p v = *vertices;
+    uint32_t vertex_index;
+
+    for(vertex_index = 0; vertex_index < *vertex_count; vertex_index++, v++)
+    {
+        if(v->position[0] == vertex->position[0] && v->position[1] == vertex->position[1] && v->position[2] == vertex->position[2] &&
+           v->tex_coord[0] == vertex->tex_coord[0] && v->tex_coord[1] == vertex->tex_coord[1])
+        {
+            return vertex_index;
+        }
+    }
+
+    vertex_index = (*vertex_count)++;
+    *vertices = (vertex_p)realloc(*vertices, *vertex_count * sizeof(vertex_t));
+    (*vertices)[vertex_index] = *vertex;
+
+    return vertex_index;
+}
+
+
+void BaseMesh_BenchmarkBuild(base_mesh_p mesh, int passes, float *hash_ms, float *linear_ms, uint32_t *vertex_count, uint32_t *linear_vertex_count)
+{
+    base_mesh_t tmp;
+    float t;
+
+    // polygons are copied: BuildFaces links them into lists, and the mesh may be in use.
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.polygons_count = mesh->polygons_count;
+    tmp.polygons = (polygon_p)malloc(mesh->polygons_count * sizeof(polygon_t));
+    memcpy(tmp.polygons, mesh->polygons, mesh->polygons_count * sizeof(polygon_t));
+
+    passes = (passes > 0) ? (passes) : (1);
+    *vertex_count = 0;
+    t = Sys_FloatTime();
+    for(int i = 0; i < passes; i++)
+    {
+        BaseMesh_BuildFaces(&tmp);
+        *vertex_count = tmp.vertex_count;
+        BaseMesh_ReleaseFaces(&tmp);
+    }
+    *hash_ms = 1000.0f * (Sys_FloatTime() - t) / (float)passes;
+
+    *linear_vertex_count = 0;
+    t = Sys_FloatTime();
+    for(int i = 0; i < passes; i++)
+    {
+        vertex_p vertices = NULL;
+        uint32_t count = 0;
+        polygon_p p = mesh->polygons;
+        for(uint32_t j = 0; j < mesh->polygons_count; j++, p++)
+        {
+            if((p->transparency < 2) && (p->anim_id == 0) && !Polygon_IsBroken(p))
+            {
+                for(uint16_t k = 0; k < p->vertex_count; k++)
+                {
+                    BaseMesh_AddVertexLinear(&vertices, &count, p->vertices + k);
+                }
+            }
+        }
+        free(vertices);
+        *linear_vertex_count = count;
+    }
+    *linear_ms = 1000.0f * (Sys_FloatTime() - t) / (float)passes;
+
+    free(tmp.polygons);
+}
+
+
+void BaseMesh_GenSkin(base_mesh_p mesh)
+{
+    uint32_t dynamic_count = 0;
+    uint32_t padded_count;
+    mesh_skin_p skin;
+    uint8_t *buf;
+
+    free(mesh->skin);
+    mesh->skin = NULL;
+    if(!mesh->skin_map)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < mesh->vertex_count; i++)
+    {
+        dynamic_count += (mesh->skin_map[i] != 0xFFFFFFFF) ? (1) : (0);
+    }
+    padded_count = (dynamic_count + MESH_SKIN_BATCH - 1) / MESH_SKIN_BATCH * MESH_SKIN_BATCH;
+
+    buf = (uint8_t*)calloc(1, sizeof(mesh_skin_t) + 2 * padded_count * sizeof(uint32_t) +
+                              (3 * padded_count + 6 * mesh->vertex_count) * sizeof(float));
+    skin = (mesh_skin_p)buf;
+    skin->dynamic_count = dynamic_count;
+    skin->dynamic_index = (uint32_t*)(buf + sizeof(mesh_skin_t));
+    skin->parent_index = skin->dynamic_index + padded_count;
+    skin->dynamic_normals = (float*)(skin->parent_index + padded_count);
+    skin->base = skin->dynamic_normals + 3 * padded_count;
+
+    dynamic_count = 0;
+    for(uint32_t i = 0; i < mesh->vertex_count; i++)
+    {
+        vertex_p v = mesh->vertices + i;
+        vec3_copy(skin->base + 3 * i, v->position);
+        vec3_copy(skin->base + 3 * (mesh->vertex_count + i), v->normal);
+        if(mesh->skin_map[i] != 0xFFFFFFFF)
+        {
+            skin->dynamic_index[dynamic_count] = i;
+            skin->parent_index[dynamic_count] = mesh->skin_map[i];
+            skin->dynamic_normals[0 * padded_count + dynamic_count] = v->normal[0];
+            skin->dynamic_normals[1 * padded_count + dynamic_count] = v->normal[1];
+            skin->dynamic_normals[2 * padded_count + dynamic_count] = v->normal[2];
+            dynamic_count++;
+        }
+    }
+    mesh->skin = skin;
+}
+
+
+/*
+ * Dynamic vertices are moved from the parent bone space: position is
+ * M^-1 * parent_position, normal is rotated by M^-1. Batches are kept in
+ * structure of arrays form, so the inner loops are vectorized by compiler.
+ */
+void BaseMesh_Skin(base_mesh_p mesh, base_mesh_p parent_mesh, const float transform[16], float *dst)
+{
+    mesh_skin_p skin = mesh->skin;
+    uint32_t padded_count = (skin->dynamic_count + MESH_SKIN_BATCH - 1) / MESH_SKIN_BATCH * MESH_SKIN_BATCH;
+    const float *m = transform;
+    float *dst_n = dst + 3 * mesh->vertex_count;
+    float mov[3];
+
+    memcpy(dst, skin->base, 6 * mesh->vertex_count * sizeof(float));
+    mov[0] = m[0] * m[12] + m[1] * m[13] + m[2]  * m[14];
+    mov[1] = m[4] * m[12] + m[5] * m[13] + m[6]  * m[14];
+    mov[2] = m[8] * m[12] + m[9] * m[13] + m[10] * m[14];
+
+    for(uint32_t i = 0; i < skin->dynamic_count; i += MESH_SKIN_BATCH)
+    {
+        const float *nx = skin->dynamic_normals + i;
+        const float *ny = nx + padded_count;
+        const float *nz = ny + padded_count;
+        float px[MESH_SKIN_BATCH], py[MESH_SKIN_BATCH], pz[MESH_SKIN_BATCH];
+        float rp[3][MESH_SKIN_BATCH], rn[3][MESH_SKIN_BATCH];
+        uint32_t batch = skin->dynamic_count - i;
+
+        batch = (batch < MESH_SKIN_BATCH) ? (batch) : (MESH_SKIN_BATCH);
+        for(uint32_t j = 0; j < MESH_SKIN_BATCH; j++)
+        {
+            const float *p = parent_mesh->vertices[skin->parent_index[i + ((j < batch) ? (j) : (0))]].position;
+            px[j] = p[0];
+            py[j] = p[1];
+            pz[j] = p[2];
+        }
+
+        for(uint32_t j = 0; j < MESH_SKIN_BATCH; j++)
+        {
+            rp[0][j] = m[0] * px[j] + m[1] * py[j] + m[2]  * pz[j] - mov[0];
+            rp[1][j] = m[4] * px[j] + m[5] * py[j] + m[6]  * pz[j] - mov[1];
+            rp[2][j] = m[8] * px[j] + m[9] * py[j] + m[10] * pz[j] - mov[2];
+            rn[0][j] = m[0] * nx[j] + m[1] * ny[j] + m[2]  * nz[j];
+            rn[1][j] = m[4] * nx[j] + m[5] * ny[j] + m[6]  * nz[j];
+            rn[2][j] = m[8] * nx[j] + m[9] * ny[j] + m[10] * nz[j];
+        }
+
+        for(uint32_t j = 0; j < batch; j++)
+        {
+            uint32_t v = 3 * skin->dynamic_index[i + j];
+            dst[v + 0] = rp[0][j];
+            dst[v + 1] = rp[1][j];
+            dst[v + 2] = rp[2][j];
+            dst_n[v + 0] = rn[0][j];
+            dst_n[v + 1] = rn[1][j];
+            dst_n[v + 2] = rn[2][j];
+        }
+    }
 }
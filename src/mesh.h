@@ -8,6 +8,7 @@ extern "C" {
 
 #define MESH_FULL_OPAQUE      0x00  // Fully opaque object (all polygons are opaque: all t.flags < 0x02)
 #define MESH_HAS_TRANSPARENCY 0x01  // Fully transparency or has transparency and opaque polygon / object
+#define MESH_SKIN_BATCH       4     // vertices skinned together, dynamic arrays are padded to it
 
 #include <SDL2/SDL_platform.h>
 #include <SDL2/SDL_opengl.h>
@@ -23,6 +24,20 @@ typedef struct mesh_face_s
     GLuint                 *elements;    
 }mesh_face_t, *mesh_face_p;
 
+/*
+ * skin mesh vertices split: static ones never change and are kept in base
+ * ([positions][normals] layout of the skinned result), dynamic ones follow
+ * parent bone mesh vertices and are skinned in MESH_SKIN_BATCH groups.
+ */
+typedef struct mesh_skin_s
+{
+    uint32_t                dynamic_count;
+    uint32_t               *dynamic_index;                                      // skin mesh vertex index
+    uint32_t               *parent_index;                                       // parent mesh vertex index
+    float                  *dynamic_normals;                                    // x[], y[], z[], padded to MESH_SKIN_BATCH
+    float                  *base;
+}mesh_skin_t, *mesh_skin_p;
+
 /*
  * base mesh, uses everywhere
  */
@@ -51,10 +66,11 @@ typedef struct base_mesh_s
     float                   bb_max[3];                                          // AABB bounding volume
     float                   R;                                                  // radius of the bounding sphere
     uint32_t               *skin_map;                                           // vertices map for skin mesh
+    struct mesh_skin_s     *skin;                                               // skinning data made from skin_map
 
     GLuint                  vbo_vertex_array;
     GLuint                  vbo_animated_vertex_array;
-    GLuint                  vbo_animated_texcoord_array;
+    uint32_t                animated_texcoord_offset;                           // first texcoord in renderer's shared buffer, ~0 - not registered
 }base_mesh_t, *base_mesh_p;
 
 
@@ -109,9 +125,16 @@ typedef struct light_s
 void BaseMesh_Clear(base_mesh_p mesh);
 void BaseMesh_FindBB(base_mesh_p mesh);
 
-uint32_t BaseMesh_AddVertex(base_mesh_p mesh, struct vertex_s *vertex);
 uint32_t BaseMesh_FindVertexIndex(base_mesh_p mesh, float v[3]);
-void     BaseMesh_GenFaces(base_mesh_p mesh);
+void     BaseMesh_GenFaces(base_mesh_p mesh);                                   // BuildFaces + GenVBO
+void     BaseMesh_BuildFaces(base_mesh_p mesh);                                 // CPU part only: vertices, faces, polygon lists
+void     BaseMesh_GenVBO(base_mesh_p mesh);                                     // GL part, main thread only
+void     BaseMesh_ReleaseFaces(base_mesh_p mesh);
+// Times BuildFaces and the old linear search welding on a copy of the mesh polygons, ms per build.
+void     BaseMesh_BenchmarkBuild(base_mesh_p mesh, int passes, float *hash_ms, float *linear_ms, uint32_t *vertex_count, uint32_t *linear_vertex_count);
+void     BaseMesh_GenSkin(base_mesh_p mesh);
+// Writes 3 * vertex_count positions and then 3 * vertex_count normals of the skinned mesh into dst.
+void     BaseMesh_Skin(base_mesh_p mesh, base_mesh_p parent_mesh, const float transform[16], float *dst);
 
 
 #ifdef	__cplusplus
@@ -37,13 +37,26 @@ typedef struct collision_result_s
 }collision_result_t, *collision_result_p;
 
 
+typedef struct physics_settings_s
+{
+    int8_t                      multithreaded;  // parallel narrowphase and island solving on the engine worker pool
+    int8_t                      hair_pbd;       // hair chains are solved by own position based solver, not by Bullet world
+    int8_t                      lazy_shapes;    // room and static mesh collision is built when bodies come near
+    int8_t                      bvh_cache;      // trimesh BVH are loaded from / saved to cache folder
+    int8_t                      merge_statics;  // non moving static meshes are put into room trimesh, not into own bodies
+}physics_settings_t, *physics_settings_p;
+
+extern struct physics_settings_s physics_settings;
+
 struct physics_data_s;
 struct physics_object_s;
 
 /* Common physics functions */
+void Physics_InitGlobals();
 void Physics_Init();
 void Physics_Destroy();
 void Physics_StepSimulation(float time);
+void Physics_UpdateActiveRooms(struct room_s *r0, struct room_s *r1);
 void Physics_DebugDrawWorld();
 void Physics_CleanUpObjects();
 
@@ -63,6 +76,8 @@ int  Physics_IsGhostsInited(struct physics_data_s *physics);
 int  Physics_GetBodiesCount(struct physics_data_s *physics);
 void Physics_GetBodyWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index);
 void Physics_SetBodyWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index);
+void Physics_GetBodyVelocity(struct physics_data_s *physics, float linear[3], float angular[3], uint16_t index);
+void Physics_SetBodyVelocity(struct physics_data_s *physics, float linear[3], float angular[3], uint16_t index);
 void Physics_GetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index);
 void Physics_SetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index);
 int  Physics_GetGhostPenetrationFixVector(struct physics_data_s *physics, uint16_t index, float correction[3]);
@@ -70,8 +85,13 @@ int  Physics_GetGhostPenetrationFixVector(struct physics_data_s *physics, uint16
 // Bullet entity rigid body generating.
 void Physics_GenRigidBody(struct physics_data_s *physics, struct ss_bone_frame_s *bf);
 void Physics_CreateGhosts(struct physics_data_s *physics, struct ss_bone_frame_s *bf);
-void Physics_GenStaticMeshRigidBody(struct static_mesh_s *smesh);
-void Physics_GenRoomRigidBody(struct room_s *room, struct sector_tween_s *tweens, int num_tweens);
+// Room collision (heightmap and static meshes); without lazy_shapes all of it is built in init.
+// Lazy shapes are built for near rooms of bodies and for rooms crossed by ray / sphere tests;
+// they are not released until the level is unloaded, so memory grows up to the eager build.
+void Physics_InitRoomShapes(struct room_s *rooms, uint32_t rooms_count);
+void Physics_ClearRoomShapes();
+// Room and its near rooms must have collision now.
+void Physics_RequireRoomShapes(struct room_s *room);
 void Physics_DeleteObject(struct physics_object_s *obj);
 void Physics_EnableObject(struct physics_object_s *obj);
 void Physics_DisableObject(struct physics_object_s *obj);
@@ -119,6 +139,16 @@ void Ragdoll_DeleteSetup(struct rd_setup_s *setup);
 
 #define HAIR_VERTEX_MAP_LIMIT 8
 
+// Position based hair chains: owner bones used as collision spheres, solver
+// rate (substeps per second), constraint iterations and rest cone of the root element.
+
+#define HAIR_MAX_SPHERES        32
+#define HAIR_PBD_RATE           (120.0)
+#define HAIR_PBD_MAX_SUBSTEPS   4
+#define HAIR_PBD_ITERATIONS     4
+#define HAIR_PBD_ROOT_COS       (0.5)
+#define HAIR_PBD_ROOT_SIN       (0.8660254)
+
 // Since we apply TR4 hair scheme to TR2-3 as well, we need to discard
 // polygons which are unused. These are 0 and 5 in both TR2 and TR3.
 
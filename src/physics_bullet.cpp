@@ -17,12 +17,20 @@ extern "C" {
 #include <BulletCollision/CollisionDispatch/btGhostObject.h>
 #include <BulletCollision/BroadphaseCollision/btCollisionAlgorithm.h>
 #include <BulletCollision/NarrowPhaseCollision/btRaycastCallback.h>
-
+#include <BulletCollision/CollisionDispatch/btConvexConvexAlgorithm.h>
+#include <BulletCollision/CollisionDispatch/btSimulationIslandManager.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
+#include <LinearMath/btHashMap.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "core/system.h"
 #include "core/gl_util.h"
 #include "core/gl_font.h"
 #include "core/gl_text.h"
 #include "core/console.h"
 #include "core/obb.h"
+#include "core/jobs.h"
 #include "render/render.h"
 #include "engine.h"
 #include "mesh.h"
@@ -45,6 +53,7 @@ public:
     {
         m_cont = cont;
         m_skip_ghost = skip_ghost;
+        m_triangle_index = -1;
     }
 
     virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult,bool normalInWorldSpace) override
@@ -63,7 +72,7 @@ public:
 
         if(!r0 || !r1)
         {
-            return ClosestRayResultCallback::addSingleResult(rayResult, normalInWorldSpace);
+            return addClosestResult(rayResult, normalInWorldSpace);
         }
 
         if(r0 && r1)
@@ -78,7 +87,7 @@ public:
                (rs && rs->sector_above && Room_IsInNearRoomsList(r0, rs->sector_above->owner_room)) ||
                (rs && rs->sector_below && Room_IsInNearRoomsList(r0, rs->sector_below->owner_room)))
             {
-                return ClosestRayResultCallback::addSingleResult(rayResult, normalInWorldSpace);
+                return addClosestResult(rayResult, normalInWorldSpace);
             }
             else
             {
@@ -89,7 +98,14 @@ public:
         return 1.0;
     }
 
+    btScalar addClosestResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace)
+    {
+        m_triangle_index = (rayResult.m_localShapeInfo) ? (rayResult.m_localShapeInfo->m_triangleIndex) : (-1);
+        return ClosestRayResultCallback::addSingleResult(rayResult, normalInWorldSpace);
+    }
+
     bool               m_skip_ghost;
+    int                m_triangle_index;                // of the closest hit in triangle mesh, -1 - other shape
     engine_container_p m_cont;
 };
 
@@ -101,6 +117,7 @@ public:
     {
         m_cont = cont;
         m_skip_ghost = skip_ghost;
+        m_triangle_index = -1;
     }
 
     virtual btScalar addSingleResult(btCollisionWorld::LocalConvexResult& convexResult,bool normalInWorldSpace)
@@ -119,14 +136,14 @@ public:
 
         if(!r0 || !r1)
         {
-            return ClosestConvexResultCallback::addSingleResult(convexResult, normalInWorldSpace);
+            return addClosestResult(convexResult, normalInWorldSpace);
         }
 
         if(r0 && r1)
         {
             if(Room_IsInNearRoomsList(r0, r1))
             {
-                return ClosestConvexResultCallback::addSingleResult(convexResult, normalInWorldSpace);
+                return addClosestResult(convexResult, normalInWorldSpace);
             }
             else
             {
@@ -137,6 +154,14 @@ public:
         return 1.0;
     }
 
+    btScalar addClosestResult(btCollisionWorld::LocalConvexResult& convexResult, bool normalInWorldSpace)
+    {
+        m_triangle_index = (convexResult.m_localShapeInfo) ? (convexResult.m_localShapeInfo->m_triangleIndex) : (-1);
+        return ClosestConvexResultCallback::addSingleResult(convexResult, normalInWorldSpace);
+    }
+
+    int                m_triangle_index;                // of the closest hit in triangle mesh, -1 - other shape
+
 private:
     bool               m_skip_ghost;
     engine_container_p m_cont;
@@ -146,6 +171,8 @@ private:
 struct physics_object_s
 {
     btRigidBody    *bt_body;
+    uint16_t       *triangle_static;        // merged room shape: static mesh index + 1 of every triangle, 0 - room itself
+    uint32_t        triangles_count;
 };
 
 typedef struct physics_data_s
@@ -209,6 +236,416 @@ private:
     int32_t m_debugMode;
 };
 
+/*
+ * MULTITHREADED PHYSICS CLASSES
+ * Narrowphase and island solving are spread over the engine worker pool (core/jobs).
+ */
+
+// Default convex-convex algorithms share one simplex solver from the collision
+// configuration, so they can not run concurrently. This create function places
+// a private simplex solver right behind each algorithm in the same allocation.
+struct bt_engine_ConvexConvexCreateFuncMt : public btConvexConvexAlgorithm::CreateFunc
+{
+    bt_engine_ConvexConvexCreateFuncMt(btConvexPenetrationDepthSolver *pdSolver) : btConvexConvexAlgorithm::CreateFunc(NULL, pdSolver)
+    {
+    }
+
+    static int getAlgorithmOffset()
+    {
+        return (sizeof(btConvexConvexAlgorithm) + 15) & ~15;
+    }
+
+    static int getElementSize()
+    {
+        return getAlgorithmOffset() + ((sizeof(btVoronoiSimplexSolver) + 15) & ~15);
+    }
+
+    virtual btCollisionAlgorithm* CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo& ci, const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap) override
+    {
+        char *mem = (char*)ci.m_dispatcher1->allocateCollisionAlgorithm(getElementSize());
+        btVoronoiSimplexSolver *simplexSolver = new(mem + getAlgorithmOffset()) btVoronoiSimplexSolver();
+        return new(mem) btConvexConvexAlgorithm(ci.m_manifold, ci, body0Wrap, body1Wrap, simplexSolver, m_pdSolver, m_numPerturbationIterations, m_minimumPointsPerturbationThreshold);
+    }
+};
+
+
+class bt_engine_CollisionConfigurationMt : public btDefaultCollisionConfiguration
+{
+public:
+    bt_engine_CollisionConfigurationMt(const btDefaultCollisionConstructionInfo& constructionInfo) : btDefaultCollisionConfiguration(constructionInfo)
+    {
+        m_convexConvexCreateFuncMt = new bt_engine_ConvexConvexCreateFuncMt(m_pdSolver);
+    }
+
+    virtual ~bt_engine_CollisionConfigurationMt()
+    {
+        delete m_convexConvexCreateFuncMt;
+    }
+
+    virtual btCollisionAlgorithmCreateFunc* getCollisionAlgorithmCreateFunc(int proxyType0, int proxyType1) override
+    {
+        btCollisionAlgorithmCreateFunc *ret = btDefaultCollisionConfiguration::getCollisionAlgorithmCreateFunc(proxyType0, proxyType1);
+        return (ret == m_convexConvexCreateFunc) ? (m_convexConvexCreateFuncMt) : (ret);
+    }
+
+private:
+    btCollisionAlgorithmCreateFunc *m_convexConvexCreateFuncMt;
+};
+
+
+class bt_engine_CollisionDispatcherMt : public btCollisionDispatcher
+{
+public:
+    bt_engine_CollisionDispatcherMt(btCollisionConfiguration *collisionConfiguration) : btCollisionDispatcher(collisionConfiguration)
+    {
+        m_mutex = SDL_CreateMutex();
+    }
+
+    virtual ~bt_engine_CollisionDispatcherMt()
+    {
+        SDL_DestroyMutex(m_mutex);
+    }
+
+    // Pools and manifolds list are shared, narrowphase may call these from workers.
+    virtual btCollisionAlgorithm* findAlgorithm(const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap, btPersistentManifold* sharedManifold) override
+    {
+        SDL_LockMutex(m_mutex);
+        btCollisionAlgorithm *ret = btCollisionDispatcher::findAlgorithm(body0Wrap, body1Wrap, sharedManifold);
+        SDL_UnlockMutex(m_mutex);
+        return ret;
+    }
+
+    virtual btPersistentManifold* getNewManifold(const btCollisionObject* b0, const btCollisionObject* b1) override
+    {
+        SDL_LockMutex(m_mutex);
+        btPersistentManifold *ret = btCollisionDispatcher::getNewManifold(b0, b1);
+        SDL_UnlockMutex(m_mutex);
+        return ret;
+    }
+
+    virtual void releaseManifold(btPersistentManifold* manifold) override
+    {
+        SDL_LockMutex(m_mutex);
+        btCollisionDispatcher::releaseManifold(manifold);
+        SDL_UnlockMutex(m_mutex);
+    }
+
+    virtual void* allocateCollisionAlgorithm(int size) override
+    {
+        SDL_LockMutex(m_mutex);
+        void *ret = btCollisionDispatcher::allocateCollisionAlgorithm(size);
+        SDL_UnlockMutex(m_mutex);
+        return ret;
+    }
+
+    virtual void freeCollisionAlgorithm(void* ptr) override
+    {
+        SDL_LockMutex(m_mutex);
+        btCollisionDispatcher::freeCollisionAlgorithm(ptr);
+        SDL_UnlockMutex(m_mutex);
+    }
+
+    virtual void dispatchAllCollisionPairs(btOverlappingPairCache* pairCache, const btDispatcherInfo& dispatchInfo, btDispatcher* dispatcher) override
+    {
+        int pairs_count = pairCache->getNumOverlappingPairs();
+        if(!physics_settings.multithreaded || (Jobs_GetThreadsCount() < 2) || (pairs_count < 2 * Jobs_GetThreadsCount()))
+        {
+            btCollisionDispatcher::dispatchAllCollisionPairs(pairCache, dispatchInfo, dispatcher);
+            return;
+        }
+
+        // near callback never removes pairs, so pair array stays valid during dispatching.
+        m_pairs = pairCache->getOverlappingPairArrayPtr();
+        m_dispatchInfo = &dispatchInfo;
+        Jobs_ParallelFor(bt_engine_CollisionDispatcherMt::processPair, this, pairs_count);
+        m_pairs = NULL;
+        m_dispatchInfo = NULL;
+    }
+
+private:
+    static void processPair(void *data, int index, int thread)
+    {
+        bt_engine_CollisionDispatcherMt *self = (bt_engine_CollisionDispatcherMt*)data;
+        (*self->getNearCallback())(self->m_pairs[index], *self, *self->m_dispatchInfo);
+    }
+
+    SDL_mutex                  *m_mutex;
+    btBroadphasePair           *m_pairs;
+    const btDispatcherInfo     *m_dispatchInfo;
+};
+
+
+class bt_engine_DiscreteDynamicsWorldMt : public btDiscreteDynamicsWorld
+{
+public:
+    bt_engine_DiscreteDynamicsWorldMt(btDispatcher* dispatcher, btBroadphaseInterface* pairCache, btConstraintSolver* constraintSolver, btCollisionConfiguration* collisionConfiguration) :
+        btDiscreteDynamicsWorld(dispatcher, pairCache, constraintSolver, collisionConfiguration)
+    {
+        m_solvers_count = Jobs_GetThreadsCount();
+        m_solvers = new btSequentialImpulseConstraintSolver*[m_solvers_count];
+        for(int i = 0; i < m_solvers_count; i++)
+        {
+            m_solvers[i] = new btSequentialImpulseConstraintSolver();
+        }
+    }
+
+    virtual ~bt_engine_DiscreteDynamicsWorldMt()
+    {
+        for(int i = 0; i < m_solvers_count; i++)
+        {
+            delete m_solvers[i];
+        }
+        delete[] m_solvers;
+    }
+
+    virtual void solveConstraints(btContactSolverInfo& solverInfo) override
+    {
+        if(!physics_settings.multithreaded || (m_solvers_count < 2) || !getSimulationIslandManager()->getSplitIslands())
+        {
+            btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+            return;
+        }
+
+        m_sortedConstraints.resize(m_constraints.size());
+        for(int i = 0; i < m_constraints.size(); i++)
+        {
+            m_sortedConstraints[i] = m_constraints[i];
+        }
+        m_sortedConstraints.quickSort(bt_engine_DiscreteDynamicsWorldMt::constraintIslandLess);
+
+        m_islands.resize(0);
+        m_islandBodies.resize(0);
+        m_islandManifolds.resize(0);
+        m_collector.m_world = this;
+        m_collector.m_constraint = 0;
+        getSimulationIslandManager()->buildAndProcessIslands(getDispatcher(), getCollisionWorld(), &m_collector);
+
+        buildBatches(solverInfo);
+
+        m_solverInfo = &solverInfo;
+        Jobs_ParallelFor(bt_engine_DiscreteDynamicsWorldMt::solveBatch, this, m_batches.size());
+        m_solverInfo = NULL;
+    }
+
+private:
+    struct island_s
+    {
+        int     root;                       // islands sharing kinematic bodies are merged to one batch
+        int     bodies_offset;
+        int     bodies_count;
+        int     manifolds_offset;
+        int     manifolds_count;
+        int     constraints_offset;
+        int     constraints_count;
+    };
+
+    struct batch_s
+    {
+        btAlignedObjectArray<btCollisionObject*>        bodies;
+        btAlignedObjectArray<btPersistentManifold*>     manifolds;
+        btAlignedObjectArray<btTypedConstraint*>        constraints;
+    };
+
+    struct IslandCollector : public btSimulationIslandManager::IslandCallback
+    {
+        bt_engine_DiscreteDynamicsWorldMt  *m_world;
+        int                                 m_constraint;
+
+        virtual void processIsland(btCollisionObject** bodies, int numBodies, btPersistentManifold** manifolds, int numManifolds, int islandId) override
+        {
+            bt_engine_DiscreteDynamicsWorldMt *w = m_world;
+            island_s &island = w->m_islands.expandNonInitializing();
+
+            island.root = w->m_islands.size() - 1;
+            island.bodies_offset = w->m_islandBodies.size();
+            island.bodies_count = numBodies;
+            island.manifolds_offset = w->m_islandManifolds.size();
+            island.manifolds_count = numManifolds;
+            for(int i = 0; i < numBodies; i++)
+            {
+                w->m_islandBodies.push_back(bodies[i]);
+            }
+            for(int i = 0; i < numManifolds; i++)
+            {
+                w->m_islandManifolds.push_back(manifolds[i]);
+            }
+
+            // islands come in increasing id order, as the sorted constraints.
+            while((m_constraint < w->m_sortedConstraints.size()) && (getConstraintIslandId(w->m_sortedConstraints[m_constraint]) < islandId))
+            {
+                m_constraint++;
+            }
+            island.constraints_offset = m_constraint;
+            while((m_constraint < w->m_sortedConstraints.size()) && (getConstraintIslandId(w->m_sortedConstraints[m_constraint]) == islandId))
+            {
+                m_constraint++;
+            }
+            island.constraints_count = m_constraint - island.constraints_offset;
+        }
+    };
+
+    struct IslandRootLess
+    {
+        const island_s *m_islands;
+
+        IslandRootLess(const island_s *islands) : m_islands(islands)
+        {
+        }
+
+        bool operator()(const int& lhs, const int& rhs) const
+        {
+            return (m_islands[lhs].root < m_islands[rhs].root) ||
+                   ((m_islands[lhs].root == m_islands[rhs].root) && (lhs < rhs));
+        }
+    };
+
+    static int getConstraintIslandId(const btTypedConstraint *c)
+    {
+        const btCollisionObject &obj0 = c->getRigidBodyA();
+        const btCollisionObject &obj1 = c->getRigidBodyB();
+        return (obj0.getIslandTag() >= 0) ? (obj0.getIslandTag()) : (obj1.getIslandTag());
+    }
+
+    static bool constraintIslandLess(btTypedConstraint* const& lhs, btTypedConstraint* const& rhs)
+    {
+        return getConstraintIslandId(lhs) < getConstraintIslandId(rhs);
+    }
+
+    int findRoot(int i)
+    {
+        while(m_islands[i].root != i)
+        {
+            m_islands[i].root = m_islands[m_islands[i].root].root;
+            i = m_islands[i].root;
+        }
+        return i;
+    }
+
+    void linkKinematic(const btCollisionObject *obj, int island)
+    {
+        if(obj->isKinematicObject())
+        {
+            btHashPtr key(obj);
+            int *first = m_kinematicIsland.find(key);
+            if(first == NULL)
+            {
+                m_kinematicIsland.insert(key, island);
+            }
+            else
+            {
+                int r0 = findRoot(*first);
+                int r1 = findRoot(island);
+                m_islands[(r0 > r1) ? (r0) : (r1)].root = (r0 > r1) ? (r1) : (r0);
+            }
+        }
+    }
+
+    /*
+     * Kinematic bodies are not merged into islands by Bullet, but solver keeps
+     * their solver body id in the shared collision object, so all islands touching
+     * one kinematic body must be solved by one solver. Small islands are packed
+     * together up to m_minimumSolverBatchSize, as btDiscreteDynamicsWorld does.
+     */
+    void buildBatches(btContactSolverInfo& solverInfo)
+    {
+        m_kinematicIsland.clear();
+        for(int i = 0; i < m_islands.size(); i++)
+        {
+            island_s &island = m_islands[i];
+            for(int j = 0; j < island.manifolds_count; j++)
+            {
+                btPersistentManifold *manifold = m_islandManifolds[island.manifolds_offset + j];
+                linkKinematic(manifold->getBody0(), i);
+                linkKinematic(manifold->getBody1(), i);
+            }
+            for(int j = 0; j < island.constraints_count; j++)
+            {
+                btTypedConstraint *c = m_sortedConstraints[island.constraints_offset + j];
+                linkKinematic(&c->getRigidBodyA(), i);
+                linkKinematic(&c->getRigidBodyB(), i);
+            }
+        }
+
+        if(m_islands.size() == 0)
+        {
+            m_batches.resize(0);
+            return;
+        }
+
+        m_order.resize(m_islands.size());
+        for(int i = 0; i < m_islands.size(); i++)
+        {
+            m_islands[i].root = findRoot(i);
+            m_order[i] = i;
+        }
+        m_order.quickSort(IslandRootLess(&m_islands[0]));
+
+        int batches_count = 0;
+        int batch_size = 0;
+        int last_root = -1;
+        for(int k = 0; k < m_order.size(); k++)
+        {
+            int i = m_order[k];
+            int root = m_islands[i].root;
+            island_s &island = m_islands[i];
+
+            if((root != last_root) && ((batches_count == 0) || (batch_size > solverInfo.m_minimumSolverBatchSize)))
+            {
+                if(batches_count >= m_batches.size())
+                {
+                    m_batches.expand();
+                }
+                batch_s &batch = m_batches[batches_count++];
+                batch.bodies.resize(0);
+                batch.manifolds.resize(0);
+                batch.constraints.resize(0);
+                batch_size = 0;
+            }
+            last_root = root;
+
+            batch_s &batch = m_batches[batches_count - 1];
+            for(int j = 0; j < island.bodies_count; j++)
+            {
+                batch.bodies.push_back(m_islandBodies[island.bodies_offset + j]);
+            }
+            for(int j = 0; j < island.manifolds_count; j++)
+            {
+                batch.manifolds.push_back(m_islandManifolds[island.manifolds_offset + j]);
+            }
+            for(int j = 0; j < island.constraints_count; j++)
+            {
+                batch.constraints.push_back(m_sortedConstraints[island.constraints_offset + j]);
+            }
+            batch_size += island.manifolds_count + island.constraints_count;
+        }
+        m_batches.resize(batches_count);
+    }
+
+    static void solveBatch(void *data, int index, int thread)
+    {
+        bt_engine_DiscreteDynamicsWorldMt *self = (bt_engine_DiscreteDynamicsWorldMt*)data;
+        batch_s &batch = self->m_batches[index];
+        btCollisionObject **bodies = (batch.bodies.size()) ? (&batch.bodies[0]) : (NULL);
+        btPersistentManifold **manifolds = (batch.manifolds.size()) ? (&batch.manifolds[0]) : (NULL);
+        btTypedConstraint **constraints = (batch.constraints.size()) ? (&batch.constraints[0]) : (NULL);
+
+        self->m_solvers[thread]->solveGroup(bodies, batch.bodies.size(), manifolds, batch.manifolds.size(),
+                                            constraints, batch.constraints.size(), *self->m_solverInfo, self->getDebugDrawer(), self->getDispatcher());
+    }
+
+    btSequentialImpulseConstraintSolver       **m_solvers;
+    int                                         m_solvers_count;
+    btContactSolverInfo                        *m_solverInfo;
+
+    IslandCollector                             m_collector;
+    btAlignedObjectArray<island_s>              m_islands;
+    btAlignedObjectArray<btCollisionObject*>    m_islandBodies;
+    btAlignedObjectArray<btPersistentManifold*> m_islandManifolds;
+    btAlignedObjectArray<int>                   m_order;
+    btAlignedObjectArray<batch_s>               m_batches;
+    btHashMap<btHashPtr, int>                   m_kinematicIsland;
+};
+
 btDefaultCollisionConfiguration         *bt_engine_collisionConfiguration = NULL;
 btCollisionDispatcher                   *bt_engine_dispatcher = NULL;
 btGhostPairCallback                     *bt_engine_ghostPairCallback = NULL;
@@ -217,23 +654,32 @@ btSequentialImpulseConstraintSolver     *bt_engine_solver = NULL;
 btDiscreteDynamicsWorld                 *bt_engine_dynamicsWorld = NULL;
 
 CBulletDebugDrawer                       bt_debug_drawer;
+struct physics_settings_s                physics_settings;
+struct room_s                           *bt_engine_active_rooms[2] = {NULL, NULL};
+uint32_t                                 bt_engine_active_rooms_frames = 0;
+#define PHYSICS_ACTIVE_ROOMS_PERIOD             (30)    // calls between rechecks of not changed active rooms
 
 uint32_t                                 collision_nodes_pool_size = 0;
-uint32_t                                 collision_nodes_pool_used = 0;
+SDL_atomic_t                             collision_nodes_pool_used = {0};
 struct collision_node_s                 *collision_nodes_pool = NULL;
 
 struct collision_node_s *Physics_GetCollisionNode();
 
 void Physics_RoomNearCallback(btBroadphasePair& collisionPair, btCollisionDispatcher& dispatcher, const btDispatcherInfo& dispatchInfo);
 void Physics_InternalTickCallback(btDynamicsWorld *world, btScalar timeStep);
+static void Hair_SimulateChains(btScalar time);
+static void Physics_RequireQueryShapes(const float from[3], const float to[3], float R);
 
 /* bullet collision model calculation */
 btCollisionShape* BT_CSfromBBox(btScalar *bb_min, btScalar *bb_max);
 btCollisionShape* BT_CSfromMesh(struct base_mesh_s *mesh, bool useCompression, bool buildBvh, bool is_static = true);
-btCollisionShape* BT_CSfromHeightmap(struct room_sector_s *heightmap, struct sector_tween_s *tweens, int tweens_size, bool useCompression, bool buildBvh);
+static btCollisionShape *BT_CSfromTrimesh(btTriangleMesh *trimesh, bool useCompression, bool buildBvh);
+static void BT_DeleteShape(btCollisionShape *shape);
 
 uint32_t BT_AddFloorAndCeilingToTrimesh(btTriangleMesh *trimesh, struct room_sector_s *sector);
 uint32_t BT_AddSectorTweenToTrimesh(btTriangleMesh *trimesh, struct sector_tween_s *tween);
+uint32_t BT_AddHeightmapToTrimesh(btTriangleMesh *trimesh, struct room_sector_s *heightmap, struct sector_tween_s *tweens, int tweens_size);
+uint32_t BT_AddPolygonsToTrimesh(btTriangleMesh *trimesh, struct polygon_s *p, uint32_t polygons_count, const btTransform &tr);
 
 
 btScalar getInnerBBRadius(btScalar bb_min[3], btScalar bb_max[3])
@@ -245,18 +691,37 @@ btScalar getInnerBBRadius(btScalar bb_min[3], btScalar bb_max[3])
     return (t > r)?(r):(t);
 }
 
+void Physics_InitGlobals()
+{
+    physics_settings.multithreaded = 0;
+    physics_settings.hair_pbd = 1;
+    physics_settings.lazy_shapes = 1;
+    physics_settings.bvh_cache = 1;
+    physics_settings.merge_statics = 1;
+}
+
 // Bullet Physics initialization.
 void Physics_Init()
 {
     collision_nodes_pool = (struct collision_node_s*)malloc(DEFAULT_COLLSION_NODE_POOL_SIZE * sizeof(struct collision_node_s));
     collision_nodes_pool_size = DEFAULT_COLLSION_NODE_POOL_SIZE;
-    collision_nodes_pool_used = 0;
+    SDL_AtomicSet(&collision_nodes_pool_used, 0);
 
-    ///collision configuration contains default setup for memory, collision setup. Advanced users can create their own configuration.
-    bt_engine_collisionConfiguration = new btDefaultCollisionConfiguration();
-
-    ///use the default collision dispatcher. For parallel processing you can use a diffent dispatcher (see Extras/BulletMultiThreaded)
-    bt_engine_dispatcher = new btCollisionDispatcher(bt_engine_collisionConfiguration);
+    if(physics_settings.multithreaded && (Jobs_GetThreadsCount() > 1))
+    {
+        ///multithreaded setup: per-algorithm simplex solvers, locked dispatcher pools and per-thread island solvers.
+        btDefaultCollisionConstructionInfo info;
+        info.m_customCollisionAlgorithmMaxElementSize = bt_engine_ConvexConvexCreateFuncMt::getElementSize();
+        bt_engine_collisionConfiguration = new bt_engine_CollisionConfigurationMt(info);
+        bt_engine_dispatcher = new bt_engine_CollisionDispatcherMt(bt_engine_collisionConfiguration);
+    }
+    else
+    {
+        ///collision configuration contains default setup for memory, collision setup. Advanced users can create their own configuration.
+        bt_engine_collisionConfiguration = new btDefaultCollisionConfiguration();
+        ///use the default collision dispatcher.
+        bt_engine_dispatcher = new btCollisionDispatcher(bt_engine_collisionConfiguration);
+    }
     bt_engine_dispatcher->setNearCallback(Physics_RoomNearCallback);
 
     ///btDbvtBroadphase is a good general purpose broadphase. You can also try out btAxis3Sweep.
@@ -264,12 +729,22 @@ void Physics_Init()
     bt_engine_ghostPairCallback = new btGhostPairCallback();
     bt_engine_overlappingPairCache->getOverlappingPairCache()->setInternalGhostPairCallback(bt_engine_ghostPairCallback);
 
-    ///the default constraint solver. For parallel processing you can use a different solver (see Extras/BulletMultiThreaded)
+    ///the default constraint solver, multithreaded world uses it for not splitted islands only.
     bt_engine_solver = new btSequentialImpulseConstraintSolver;
 
-    bt_engine_dynamicsWorld = new btDiscreteDynamicsWorld(bt_engine_dispatcher, bt_engine_overlappingPairCache, bt_engine_solver, bt_engine_collisionConfiguration);
+    if(physics_settings.multithreaded && (Jobs_GetThreadsCount() > 1))
+    {
+        bt_engine_dynamicsWorld = new bt_engine_DiscreteDynamicsWorldMt(bt_engine_dispatcher, bt_engine_overlappingPairCache, bt_engine_solver, bt_engine_collisionConfiguration);
+    }
+    else
+    {
+        bt_engine_dynamicsWorld = new btDiscreteDynamicsWorld(bt_engine_dispatcher, bt_engine_overlappingPairCache, bt_engine_solver, bt_engine_collisionConfiguration);
+    }
     bt_engine_dynamicsWorld->setInternalTickCallback(Physics_InternalTickCallback);
     bt_engine_dynamicsWorld->setGravity(btVector3(0, 0, -4500.0));
+    // addRigidBody puts mass 0 bodies (rooms, statics, entities) to ISLAND_SLEEPING, so updateAabbs skips them;
+    // entity AABBs are updated by Physics_SetBodyWorldTransform, far entity bodies are DISABLE_SIMULATION.
+    bt_engine_dynamicsWorld->setForceUpdateAllAabbs(false);
 
     bt_debug_drawer.setDebugMode(btIDebugDraw::DBG_DrawWireframe | btIDebugDraw::DBG_DrawConstraints);
     bt_engine_dynamicsWorld->setDebugDrawer(&bt_debug_drawer);
@@ -297,7 +772,7 @@ void Physics_Destroy()
     free(collision_nodes_pool);
     collision_nodes_pool = NULL;
     collision_nodes_pool_size = 0;
-    collision_nodes_pool_used = 0;
+    SDL_AtomicSet(&collision_nodes_pool_used, 0);
 }
 
 
@@ -305,9 +780,77 @@ void Physics_StepSimulation(float time)
 {
     time = (time < 0.1f) ? (time) : (0.0f);
     bt_engine_dynamicsWorld->stepSimulation(time, 0);
-    collision_nodes_pool_used = 0;
+    Hair_SimulateChains(time);
+    SDL_AtomicSet(&collision_nodes_pool_used, 0);
+}
+
+static bool Physics_IsRoomActive(struct room_s *room)
+{
+    struct room_s *r0 = bt_engine_active_rooms[0];
+    struct room_s *r1 = bt_engine_active_rooms[1];
+    return (!r0 && !r1) || !room || Room_IsInNearRoomsList(r0, room) || Room_IsInNearRoomsList(r1, room);
+}
+
+/**
+ * Sleeps dynamic bodies out of near rooms of r0 and r1 (player's and camera's rooms)
+ * and wakes them up when their rooms come near again. Kinematic (entity) bodies out of
+ * near rooms are DISABLE_SIMULATION: no AABB updates and no pairs with sleeping bodies;
+ * near ones are ISLAND_SLEEPING like all mass 0 bodies. Bodies which never sleep
+ * (hairs) are not touched. Collision of near rooms is made here if it is missing.
+ * Bodies are rechecked when rooms are changed and every PHYSICS_ACTIVE_ROOMS_PERIOD
+ * calls, so bodies which moved to other rooms are caught too.
+ */
+void Physics_UpdateActiveRooms(struct room_s *r0, struct room_s *r1)
+{
+    if((r0 == bt_engine_active_rooms[0]) && (r1 == bt_engine_active_rooms[1]) &&
+       (++bt_engine_active_rooms_frames < PHYSICS_ACTIVE_ROOMS_PERIOD))
+    {
+        return;
+    }
+    bt_engine_active_rooms_frames = 0;
+    bt_engine_active_rooms[0] = r0;
+    bt_engine_active_rooms[1] = r1;
+    Physics_RequireRoomShapes(r0);
+    Physics_RequireRoomShapes(r1);
+
+    for(int i = bt_engine_dynamicsWorld->getNumCollisionObjects() - 1; i >= 0; i--)
+    {
+        btCollisionObject *obj = bt_engine_dynamicsWorld->getCollisionObjectArray()[i];
+        btRigidBody *body = btRigidBody::upcast(obj);
+        engine_container_p cont = (engine_container_p)obj->getUserPointer();
+        if(body && cont && cont->room && body->isStaticObject() &&
+           (obj->getBroadphaseHandle()->m_collisionFilterGroup == COLLISION_GROUP_KINEMATIC))
+        {
+            bool is_near = Physics_IsRoomActive(cont->room);
+            if(is_near && (body->getActivationState() == DISABLE_SIMULATION))
+            {
+                body->forceActivationState(ISLAND_SLEEPING);
+                bt_engine_dynamicsWorld->updateSingleAabb(body);                 // pushes were not applied while disabled
+            }
+            else if(!is_near && (body->getActivationState() != DISABLE_SIMULATION))
+            {
+                body->forceActivationState(DISABLE_SIMULATION);
+            }
+        }
+        else if(body && cont && cont->room && !body->isStaticOrKinematicObject() &&
+           (body->getActivationState() != DISABLE_DEACTIVATION) && (body->getActivationState() != DISABLE_SIMULATION))
+        {
+            bool is_near = Physics_IsRoomActive(cont->room);
+            if(is_near && (body->getActivationState() == ISLAND_SLEEPING))
+            {
+                body->activate(true);
+            }
+            else if(!is_near && (body->getActivationState() != ISLAND_SLEEPING))
+            {
+                body->setActivationState(ISLAND_SLEEPING);
+                body->setLinearVelocity(btVector3(0.0, 0.0, 0.0));
+                body->setAngularVelocity(btVector3(0.0, 0.0, 0.0));
+            }
+        }
+    }
 }
 
+
 void Physics_DebugDrawWorld()
 {
     bt_engine_dynamicsWorld->debugDrawWorld();
@@ -316,10 +859,10 @@ void Physics_DebugDrawWorld()
 struct collision_node_s *Physics_GetCollisionNode()
 {
     struct collision_node_s *ret = NULL;
-    if(collision_nodes_pool_used < collision_nodes_pool_size)
+    uint32_t index = (uint32_t)SDL_AtomicAdd(&collision_nodes_pool_used, 1);
+    if(index < collision_nodes_pool_size)
     {
-        ret = collision_nodes_pool + collision_nodes_pool_used;
-        collision_nodes_pool_used++;
+        ret = collision_nodes_pool + index;
     }
     return ret;
 }
@@ -327,6 +870,9 @@ struct collision_node_s *Physics_GetCollisionNode()
 
 void Physics_CleanUpObjects()
 {
+    bt_engine_active_rooms[0] = NULL;
+    bt_engine_active_rooms[1] = NULL;
+    bt_engine_active_rooms_frames = 0;
     if(bt_engine_dynamicsWorld != NULL)
     {
         int num_obj = bt_engine_dynamicsWorld->getNumCollisionObjects();
@@ -510,6 +1056,27 @@ void Physics_InternalTickCallback(btDynamicsWorld *world, btScalar timeStep)
 
 
 /* Common physics functions */
+/**
+ * Static meshes merged into room shape are reported as themselves.
+ */
+static struct engine_container_s *Physics_GetHitContainer(const btCollisionObject *obj, int triangle_index)
+{
+    engine_container_p cont = (engine_container_p)obj->getUserPointer();
+
+    if(cont && (cont->object_type == OBJECT_ROOM_BASE) && (triangle_index >= 0))
+    {
+        room_p room = (room_p)cont->object;
+        struct physics_object_s *body = room->content->physics_body;
+        if(body && body->triangle_static && ((uint32_t)triangle_index < body->triangles_count) && body->triangle_static[triangle_index])
+        {
+            return room->content->static_mesh[body->triangle_static[triangle_index] - 1].self;
+        }
+    }
+
+    return cont;
+}
+
+
 void Physics_GetGravity(float g[3])
 {
     btVector3 bt_g = bt_engine_dynamicsWorld->getGravity();
@@ -529,6 +1096,8 @@ int  Physics_RayTest(struct collision_result_s *result, float from[3], float to[
     bt_engine_ClosestRayResultCallback cb(cont, true);
     btVector3 vFrom(from[0], from[1], from[2]), vTo(to[0], to[1], to[2]);
 
+    Physics_RequireQueryShapes(from, to, 0.0f);
+
     cb.m_collisionFilterMask = btBroadphaseProxy::StaticFilter | btBroadphaseProxy::KinematicFilter;
     if(result)
     {
@@ -538,7 +1107,7 @@ int  Physics_RayTest(struct collision_result_s *result, float from[3], float to[
         bt_engine_dynamicsWorld->rayTest(vFrom, vTo, cb);
         if(cb.hasHit())
         {
-            result->obj      = (struct engine_container_s *)cb.m_collisionObject->getUserPointer();
+            result->obj      = Physics_GetHitContainer(cb.m_collisionObject, cb.m_triangle_index);
             result->hit      = 0x01;
             result->bone_num = cb.m_collisionObject->getUserIndex();
             vec3_copy(result->normale, cb.m_hitNormalWorld.m_floats);
@@ -563,6 +1132,8 @@ int  Physics_RayTestFiltered(struct collision_result_s *result, float from[3], f
     bt_engine_ClosestRayResultCallback cb(cont, true);
     btVector3 vFrom(from[0], from[1], from[2]), vTo(to[0], to[1], to[2]);
 
+    Physics_RequireQueryShapes(from, to, 0.0f);
+
     cb.m_flags |= btTriangleRaycastCallback::kF_FilterBackfaces;
     cb.m_flags |= btTriangleRaycastCallback::kF_KeepUnflippedNormal;
     cb.m_collisionFilterMask = btBroadphaseProxy::StaticFilter | btBroadphaseProxy::KinematicFilter;
@@ -574,7 +1145,7 @@ int  Physics_RayTestFiltered(struct collision_result_s *result, float from[3], f
         bt_engine_dynamicsWorld->rayTest(vFrom, vTo, cb);
         if(cb.hasHit())
         {
-            result->obj      = (struct engine_container_s *)cb.m_collisionObject->getUserPointer();
+            result->obj      = Physics_GetHitContainer(cb.m_collisionObject, cb.m_triangle_index);
             result->hit      = 0x01;
             result->bone_num = cb.m_collisionObject->getUserIndex();
             vec3_copy(result->normale, cb.m_hitNormalWorld.m_floats);
@@ -601,6 +1172,7 @@ int  Physics_SphereTest(struct collision_result_s *result, float from[3], float
     btTransform tFrom, tTo;
     btSphereShape sphere(R);
 
+    Physics_RequireQueryShapes(from, to, R);
     tFrom.setIdentity();
     tFrom.setOrigin(vFrom);
     tTo.setIdentity();
@@ -615,7 +1187,7 @@ int  Physics_SphereTest(struct collision_result_s *result, float from[3], float
         bt_engine_dynamicsWorld->convexSweepTest(&sphere, tFrom, tTo, cb);
         if(cb.hasHit())
         {
-            result->obj      = (struct engine_container_s *)cb.m_hitCollisionObject->getUserPointer();
+            result->obj      = Physics_GetHitContainer(cb.m_hitCollisionObject, cb.m_triangle_index);
             result->hit      = 0x01;
             result->bone_num = cb.m_hitCollisionObject->getUserIndex();
             vec3_copy(result->normale, cb.m_hitNormalWorld.m_floats);
@@ -661,25 +1233,61 @@ void Physics_GetBodyWorldTransform(struct physics_data_s *physics, float tr[16],
 
 void Physics_SetBodyWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index)
 {
-    if(physics->bt_body[index])
+    btRigidBody *body = physics->bt_body[index];
+    if(body)
     {
-        physics->bt_body[index]->getWorldTransform().setFromOpenGLMatrix(tr);
+        btTransform new_tr;
+        new_tr.setFromOpenGLMatrix(tr);
+        if(!(body->getWorldTransform() == new_tr))
+        {
+            body->setWorldTransform(new_tr);
+            // AABB of disabled (far) body is refreshed by Physics_UpdateActiveRooms
+            if(body->isInWorld() && (body->getActivationState() != DISABLE_SIMULATION))
+            {
+                bt_engine_dynamicsWorld->updateSingleAabb(body);
+            }
+        }
     }
 }
 
 
-void Physics_GetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index)
+void Physics_GetBodyVelocity(struct physics_data_s *physics, float linear[3], float angular[3], uint16_t index)
 {
-    if(physics->ghost_objects[index])
+    btRigidBody *body = physics->bt_body[index];
+    if(body)
     {
-        physics->ghost_objects[index]->getWorldTransform().getOpenGLMatrix(tr);
+        const btVector3 &lin = body->getLinearVelocity();
+        const btVector3 &ang = body->getAngularVelocity();
+        linear[0] = lin.x();  linear[1] = lin.y();  linear[2] = lin.z();
+        angular[0] = ang.x(); angular[1] = ang.y(); angular[2] = ang.z();
     }
 }
 
 
-void Physics_SetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index)
+void Physics_SetBodyVelocity(struct physics_data_s *physics, float linear[3], float angular[3], uint16_t index)
 {
-    if(physics->ghost_objects[index])
+    btRigidBody *body = physics->bt_body[index];
+    if(body && !body->isStaticOrKinematicObject())
+    {
+        body->setLinearVelocity(btVector3(linear[0], linear[1], linear[2]));
+        body->setAngularVelocity(btVector3(angular[0], angular[1], angular[2]));
+        body->activate();
+    }
+}
+
+
+void Physics_GetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index)
+{
+    if(physics->ghost_objects[index])
+    {
+        physics->ghost_objects[index]->getWorldTransform().getOpenGLMatrix(tr);
+    }
+}
+
+
+void Physics_SetGhostWorldTransform(struct physics_data_s *physics, float tr[16], uint16_t index)
+{
+    if(physics->ghost_objects[index])
     {
         physics->ghost_objects[index]->getWorldTransform().setFromOpenGLMatrix(tr);
     }
@@ -765,29 +1373,12 @@ int Physics_GetGhostPenetrationFixVector(struct physics_data_s *physics, uint16_
 btCollisionShape *BT_CSfromBBox(btScalar *bb_min, btScalar *bb_max)
 {
     obb_p obb = OBB_Create();
-    polygon_p p = obb->base_polygons;
     btTriangleMesh *trimesh = new btTriangleMesh;
-    btVector3 v0, v1, v2;
     btCollisionShape* ret;
-    int cnt = 0;
+    uint32_t cnt = 0;
 
     OBB_Rebuild(obb, bb_min, bb_max);
-    for(uint32_t i = 0; i < 6; i++, p++)
-    {
-        if(Polygon_IsBroken(p))
-        {
-            continue;
-        }
-        for(uint32_t j = 1; j + 1 < p->vertex_count; j++)
-        {
-            vec3_copy(v0.m_floats, p->vertices[j + 1].position);
-            vec3_copy(v1.m_floats, p->vertices[j].position);
-            vec3_copy(v2.m_floats, p->vertices[0].position);
-            trimesh->addTriangle(v0, v1, v2, true);
-        }
-        cnt ++;
-    }
-
+    cnt = BT_AddPolygonsToTrimesh(trimesh, obb->base_polygons, 6, btTransform::getIdentity());
     OBB_Clear(obb);
     free(obb);
 
@@ -806,29 +1397,10 @@ btCollisionShape *BT_CSfromBBox(btScalar *bb_min, btScalar *bb_max)
 btCollisionShape *BT_CSfromMesh(struct base_mesh_s *mesh, bool useCompression, bool buildBvh, bool is_static)
 {
     uint32_t cnt = 0;
-    polygon_p p;
     btTriangleMesh *trimesh = new btTriangleMesh;
     btCollisionShape* ret = NULL;
-    btVector3 v0, v1, v2;
-
-    p = mesh->polygons;
-    for(uint32_t i = 0; i < mesh->polygons_count; i++, p++)
-    {
-        if(Polygon_IsBroken(p))
-        {
-            continue;
-        }
-
-        for(uint32_t j = 1; j + 1 < p->vertex_count; j++)
-        {
-            vec3_copy(v0.m_floats, p->vertices[j + 1].position);
-            vec3_copy(v1.m_floats, p->vertices[j].position);
-            vec3_copy(v2.m_floats, p->vertices[0].position);
-            trimesh->addTriangle(v0, v1, v2, true);
-        }
-        cnt ++;
-    }
 
+    cnt = BT_AddPolygonsToTrimesh(trimesh, mesh->polygons, mesh->polygons_count, btTransform::getIdentity());
     if(cnt == 0)
     {
         delete trimesh;
@@ -837,7 +1409,7 @@ btCollisionShape *BT_CSfromMesh(struct base_mesh_s *mesh, bool useCompression, b
 
     if(is_static)
     {
-        ret = new btBvhTriangleMeshShape(trimesh, useCompression, buildBvh);
+        ret = BT_CSfromTrimesh(trimesh, useCompression, buildBvh);
     }
     else
     {
@@ -1111,12 +1683,10 @@ uint32_t BT_AddSectorTweenToTrimesh(btTriangleMesh *trimesh, struct sector_tween
 
 
 ///@TODO: resolve cases with floor >> ceiling (I.E. floor - ceiling >= 2048)
-btCollisionShape *BT_CSfromHeightmap(struct room_sector_s *heightmap, struct sector_tween_s *tweens, int tweens_size, bool useCompression, bool buildBvh)
+uint32_t BT_AddHeightmapToTrimesh(btTriangleMesh *trimesh, struct room_sector_s *heightmap, struct sector_tween_s *tweens, int tweens_size)
 {
     uint32_t cnt = 0;
     room_p r = heightmap->owner_room;
-    btTriangleMesh *trimesh = new btTriangleMesh;
-    btCollisionShape* ret = NULL;
 
     for(uint32_t i = 0; i < r->sectors_count; i++)
     {
@@ -1128,16 +1698,183 @@ btCollisionShape *BT_CSfromHeightmap(struct room_sector_s *heightmap, struct sec
         cnt += BT_AddSectorTweenToTrimesh(trimesh, tweens + i);
     }
 
-    if(cnt == 0)
+    return cnt;
+}
+
+
+uint32_t BT_AddPolygonsToTrimesh(btTriangleMesh *trimesh, struct polygon_s *p, uint32_t polygons_count, const btTransform &tr)
+{
+    uint32_t cnt = 0;
+    btVector3 v0, v1, v2;
+
+    for(uint32_t i = 0; i < polygons_count; i++, p++)
+    {
+        if(Polygon_IsBroken(p))
+        {
+            continue;
+        }
+
+        for(uint32_t j = 1; j + 1 < p->vertex_count; j++)
+        {
+            vec3_copy(v0.m_floats, p->vertices[j + 1].position);
+            vec3_copy(v1.m_floats, p->vertices[j].position);
+            vec3_copy(v2.m_floats, p->vertices[0].position);
+            trimesh->addTriangle(tr * v0, tr * v1, tr * v2, true);
+        }
+        cnt ++;
+    }
+
+    return cnt;
+}
+
+
+/*
+ * BVH cache: quantized trees are stored in place serialized form, file name
+ * is a hash of trimesh data, so identical geometry of any level hits it.
+ */
+#define BT_BVH_CACHE_NAME       "cache/bvh_%.16llX.bvh"
+#define BT_BVH_CACHE_MAGIC      (0x4842544F)    // "OTBH"
+#define BT_BVH_CACHE_VERSION    (1)
+
+typedef struct bt_bvh_cache_header_s
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    pointer_size;                   // in place layout depends on it
+    uint32_t    quantized;
+    uint32_t    size;
+}bt_bvh_cache_header_t;
+
+
+static uint64_t BT_TrimeshHash(btTriangleMesh *trimesh, bool useCompression)
+{
+    const unsigned char *vertices, *indices;
+    int vertices_count, vertex_stride, faces_count, index_stride;
+    PHY_ScalarType vertex_type, index_type;
+    uint64_t h = 14695981039346656037ULL;
+
+    trimesh->getLockedReadOnlyVertexIndexBase(&vertices, vertices_count, vertex_type, vertex_stride, &indices, index_stride, faces_count, index_type);
+    for(int i = 0; i < vertices_count * vertex_stride; i++)
+    {
+        h = (h ^ vertices[i]) * 1099511628211ULL;
+    }
+    for(int i = 0; i < faces_count * index_stride; i++)
+    {
+        h = (h ^ indices[i]) * 1099511628211ULL;
+    }
+    trimesh->unLockReadOnlyVertexBase(0);
+
+    return (useCompression) ? (h) : (~h);
+}
+
+
+static btOptimizedBvh *BT_LoadBvh(uint64_t hash, bool useCompression)
+{
+    bt_bvh_cache_header_t header;
+    btOptimizedBvh *ret = NULL;
+    char name[64];
+    FILE *f;
+
+    snprintf(name, sizeof(name), BT_BVH_CACHE_NAME, (unsigned long long)hash);
+    f = fopen(name, "rb");
+    if(f == NULL)
     {
-        delete trimesh;
         return NULL;
     }
 
-    ret = new btBvhTriangleMeshShape(trimesh, useCompression, buildBvh);
+    if((fread(&header, sizeof(header), 1, f) == 1) && (header.magic == BT_BVH_CACHE_MAGIC) && (header.version == BT_BVH_CACHE_VERSION) &&
+       (header.pointer_size == sizeof(void*)) && (header.quantized == (uint32_t)useCompression) && (header.size > sizeof(btOptimizedBvh)))
+    {
+        void *buffer = btAlignedAlloc(header.size, 16);
+        if(fread(buffer, 1, header.size, f) == header.size)
+        {
+            ret = btOptimizedBvh::deSerializeInPlace(buffer, header.size, false);
+        }
+        if(ret == NULL)
+        {
+            btAlignedFree(buffer);
+        }
+    }
+    fclose(f);
+
     return ret;
 }
 
+
+static void BT_SaveBvh(uint64_t hash, btOptimizedBvh *bvh, bool useCompression)
+{
+    bt_bvh_cache_header_t header;
+    char name[64];
+    char tmp_name[128];
+    void *buffer;
+    FILE *f;
+
+    header.magic = BT_BVH_CACHE_MAGIC;
+    header.version = BT_BVH_CACHE_VERSION;
+    header.pointer_size = sizeof(void*);
+    header.quantized = useCompression;
+    header.size = bvh->calculateSerializeBufferSize();
+    buffer = btAlignedAlloc(header.size, 16);
+    if(bvh->serializeInPlace(buffer, header.size, false))
+    {
+        snprintf(name, sizeof(name), BT_BVH_CACHE_NAME, (unsigned long long)hash);
+        f = Sys_OpenTempFile(name, tmp_name, sizeof(tmp_name));                 // workers may save the same shape
+        if(f)
+        {
+            int ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+            ok = ok && (fwrite(buffer, 1, header.size, f) == header.size);
+            Sys_CommitTempFile(f, tmp_name, name, ok);
+        }
+    }
+    btAlignedFree(buffer);
+}
+
+
+static btCollisionShape *BT_CSfromTrimesh(btTriangleMesh *trimesh, bool useCompression, bool buildBvh)
+{
+    btBvhTriangleMeshShape *ret;
+
+    if(buildBvh && physics_settings.bvh_cache)
+    {
+        uint64_t hash = BT_TrimeshHash(trimesh, useCompression);
+        btOptimizedBvh *bvh = BT_LoadBvh(hash, useCompression);
+        if(bvh)
+        {
+            ret = new btBvhTriangleMeshShape(trimesh, useCompression, false);
+            ret->setOptimizedBvh(bvh);                                          // shape does not own it, see BT_DeleteShape
+            return ret;
+        }
+
+        ret = new btBvhTriangleMeshShape(trimesh, useCompression, true);
+        BT_SaveBvh(hash, ret->getOptimizedBvh(), useCompression);
+        return ret;
+    }
+
+    return new btBvhTriangleMeshShape(trimesh, useCompression, buildBvh);
+}
+
+
+static void BT_DeleteShape(btCollisionShape *shape)
+{
+    if(shape->getShapeType() == TRIANGLE_MESH_SHAPE_PROXYTYPE)
+    {
+        btBvhTriangleMeshShape *mesh_shape = (btBvhTriangleMeshShape*)shape;
+        btStridingMeshInterface *trimesh = mesh_shape->getMeshInterface();
+        btOptimizedBvh *bvh = (mesh_shape->getOwnsBvh()) ? (NULL) : (mesh_shape->getOptimizedBvh());
+
+        delete shape;
+        delete trimesh;
+        if(bvh)
+        {
+            bvh->~btOptimizedBvh();                                             // lives in its cache buffer
+            btAlignedFree(bvh);
+        }
+        return;
+    }
+
+    delete shape;
+}
+
 /*
  * =============================================================================
  */
@@ -1248,155 +1985,454 @@ void Physics_GenRigidBody(struct physics_data_s *physics, struct ss_bone_frame_s
  * DO something with sticky 80% boxes!!!
  * first of all: convex offsetted boxes to avoid every frame offsets calculation.
  */
-void Physics_CreateGhosts(struct physics_data_s *physics, struct ss_bone_frame_s *bf)
+void Physics_CreateGhosts(struct physics_data_s *physics, struct ss_bone_frame_s *bf)
+{
+    if(physics->objects_count > 0)
+    {
+        btTransform tr;
+        btScalar gltr[16], v[3];
+
+        physics->manifoldArray = new btManifoldArray();
+
+        switch(physics->cont->collision_shape)
+        {
+            case COLLISION_SHAPE_SINGLE_BOX:
+                {
+                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
+                    physics->ghost_objects[0] = new btPairCachingGhostObject();
+                    physics->ghost_objects[0]->setIgnoreCollisionCheck(physics->bt_body[0], true);
+                    tr.setFromOpenGLMatrix(bf->transform);
+                    physics->ghost_objects[0]->setWorldTransform(tr);
+                    physics->ghost_objects[0]->setCollisionFlags(physics->ghost_objects[0]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
+                    physics->ghost_objects[0]->setUserPointer(physics->cont);
+                    physics->ghost_objects[0]->setUserIndex(-1);
+                    physics->ghost_objects[0]->setCollisionShape(BT_CSfromBBox(bf->bb_min, bf->bb_max));
+                    physics->ghost_objects[0]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
+                    bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[0], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
+                }
+                break;
+
+            case COLLISION_SHAPE_SINGLE_SPHERE:
+                {
+                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
+                    physics->ghost_objects[0] = new btPairCachingGhostObject();
+                    physics->ghost_objects[0]->setIgnoreCollisionCheck(physics->bt_body[0], true);
+                    btVector3 offset, centre(0.5f * (bf->bb_min[0] + bf->bb_max[0]), 0.5f * (bf->bb_min[1] + bf->bb_max[1]), 0.5f * (bf->bb_min[2] + bf->bb_max[2]));
+                    Mat4_vec3_rot_macro(offset.m_floats, bf->transform, centre);
+                    tr.setFromOpenGLMatrix(bf->transform);
+                    tr.getOrigin() += offset;
+                    physics->ghost_objects[0]->setWorldTransform(tr);
+                    physics->ghost_objects[0]->setCollisionFlags(physics->ghost_objects[0]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
+                    physics->ghost_objects[0]->setUserPointer(physics->cont);
+                    physics->ghost_objects[0]->setUserIndex(-1);
+                    physics->ghost_objects[0]->setCollisionShape(new btSphereShape(getInnerBBRadius(bf->bb_min, bf->bb_max)));
+                    physics->ghost_objects[0]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
+                    bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[0], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
+                }
+                break;
+
+            default:
+                {
+                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
+                    for(uint32_t i = 0; i < physics->objects_count; i++)
+                    {
+                        btVector3 box;
+                        box.m_floats[0] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[0] - bf->bone_tags[i].mesh_base->bb_min[0]);
+                        box.m_floats[1] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[1] - bf->bone_tags[i].mesh_base->bb_min[1]);
+                        box.m_floats[2] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[2] - bf->bone_tags[i].mesh_base->bb_min[2]);
+                        bf->bone_tags[i].mesh_base->R = (box.m_floats[0] < box.m_floats[1])?(box.m_floats[0]):(box.m_floats[1]);
+                        bf->bone_tags[i].mesh_base->R = (bf->bone_tags[i].mesh_base->R < box.m_floats[2])?(bf->bone_tags[i].mesh_base->R):(box.m_floats[2]);
+
+                        physics->ghost_objects[i] = new btPairCachingGhostObject();
+                        physics->ghost_objects[i]->setIgnoreCollisionCheck(physics->bt_body[i], true);
+                        Mat4_Mat4_mul(gltr, bf->transform, bf->bone_tags[i].full_transform);
+                        Mat4_vec3_mul(v, gltr, bf->bone_tags[i].mesh_base->centre);
+                        vec3_copy(gltr+12, v);
+                        tr.setFromOpenGLMatrix(gltr);
+                        physics->ghost_objects[i]->setWorldTransform(tr);
+                        physics->ghost_objects[i]->setCollisionFlags(physics->ghost_objects[i]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
+                        physics->ghost_objects[i]->setUserPointer(physics->cont);
+                        physics->ghost_objects[i]->setUserIndex(i);
+                        physics->ghost_objects[i]->setCollisionShape(new btBoxShape(box));
+                        physics->ghost_objects[i]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
+                        bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[i], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
+                    }
+                }
+        };
+    }
+}
+
+
+static btCollisionShape *Physics_GenStaticMeshShape(struct static_mesh_s *smesh)
+{
+    if(smesh->self->collision_type == COLLISION_TYPE_NONE)
+    {
+        return NULL;
+    }
+
+    switch(smesh->self->collision_shape)
+    {
+        case COLLISION_SHAPE_BOX:
+            return BT_CSfromBBox(smesh->cbb_min, smesh->cbb_max);
+
+        case COLLISION_SHAPE_BOX_BASE:
+            return BT_CSfromBBox(smesh->mesh->bb_min, smesh->mesh->bb_max);
+
+        case COLLISION_SHAPE_TRIMESH:
+            return BT_CSfromMesh(smesh->mesh, true, true, true);
+
+        case COLLISION_SHAPE_TRIMESH_CONVEX:
+            return BT_CSfromMesh(smesh->mesh, true, true, false);
+    };
+
+    return NULL;
+}
+
+
+static void Physics_AddStaticMeshBody(struct static_mesh_s *smesh, btCollisionShape *cshape)
+{
+    btVector3 localInertia(0, 0, 0);
+    btTransform startTransform;
+    startTransform.setFromOpenGLMatrix(smesh->transform);
+    smesh->physics_body = (struct physics_object_s*)malloc(sizeof(struct physics_object_s));
+    smesh->physics_body->triangle_static = NULL;
+    smesh->physics_body->triangles_count = 0;
+    btDefaultMotionState* motionState = new btDefaultMotionState(startTransform);
+    smesh->physics_body->bt_body = new btRigidBody(0.0, motionState, cshape, localInertia);
+    cshape->setMargin(COLLISION_MARGIN_DEFAULT);
+    smesh->physics_body->bt_body->setRestitution(1.0);
+    smesh->physics_body->bt_body->setFriction(1.0);
+    smesh->physics_body->bt_body->setUserPointer(smesh->self);
+    if(!smesh->self->room || smesh->self->room->active)                         // Room_Enable adds it later
+    {
+        bt_engine_dynamicsWorld->addRigidBody(smesh->physics_body->bt_body, COLLISION_GROUP_ALL, COLLISION_MASK_ALL);
+    }
+}
+
+
+static bool Physics_IsStaticMeshMergeable(struct static_mesh_s *smesh)
+{
+    return physics_settings.merge_statics && (smesh->self->collision_type == COLLISION_TYPE_STATIC) &&
+           ((smesh->self->collision_shape == COLLISION_SHAPE_BOX) ||
+            (smesh->self->collision_shape == COLLISION_SHAPE_BOX_BASE) ||
+            (smesh->self->collision_shape == COLLISION_SHAPE_TRIMESH));
+}
+
+
+static void Physics_AddStaticMeshToTrimesh(btTriangleMesh *trimesh, struct static_mesh_s *smesh, const btTransform &tr)
+{
+    if(smesh->self->collision_shape == COLLISION_SHAPE_TRIMESH)
+    {
+        BT_AddPolygonsToTrimesh(trimesh, smesh->mesh->polygons, smesh->mesh->polygons_count, tr);
+    }
+    else
+    {
+        obb_p obb = OBB_Create();
+        if(smesh->self->collision_shape == COLLISION_SHAPE_BOX)
+        {
+            OBB_Rebuild(obb, smesh->cbb_min, smesh->cbb_max);
+        }
+        else
+        {
+            OBB_Rebuild(obb, smesh->mesh->bb_min, smesh->mesh->bb_max);
+        }
+        BT_AddPolygonsToTrimesh(trimesh, obb->base_polygons, 6, tr);
+        OBB_Clear(obb);
+        free(obb);
+    }
+}
+
+
+/*
+ * Non moving static meshes go into the room trimesh (room local space),
+ * triangle_static maps triangles back to them for ray and sweep tests.
+ */
+static btCollisionShape *Physics_GenRoomShape(struct room_s *room, uint16_t **triangle_static, uint32_t *triangles_count)
+{
+    // Inbetween polygons array is later filled by loop which scans adjacent
+    // sector heightmaps and fills the gaps between them, thus creating inbetween
+    // polygon. Inbetweens can be either quad (if all four corner heights are
+    // different), triangle (if one corner height is similar to adjacent) or
+    // ghost (if corner heights are completely similar). In case of quad inbetween,
+    // two triangles are added to collisional trimesh, in case of triangle inbetween,
+    // we add only one, and in case of ghost inbetween, we ignore it.
+    int num_tweens = room->sectors_x * room->sectors_y * 4;
+    sector_tween_s *room_tween = new sector_tween_s[num_tweens];
+    btTriangleMesh *trimesh = new btTriangleMesh;
+    btTransform room_tr;
+    uint32_t filled = 0;
+
+    *triangle_static = NULL;
+    *triangles_count = 0;
+    for(int j = 0; j < num_tweens; j++)
+    {
+        room_tween[j].ceiling_tween_type = TR_SECTOR_TWEEN_TYPE_NONE;
+        room_tween[j].floor_tween_type   = TR_SECTOR_TWEEN_TYPE_NONE;
+    }
+
+    // Most difficult task with converting floordata collision to trimesh collision is
+    // building inbetween polygons which will block out gaps between sector heights.
+    Res_Sector_GenTweens(room, room_tween);
+    BT_AddHeightmapToTrimesh(trimesh, room->sectors, room_tween, num_tweens);
+    delete[] room_tween;
+
+    room_tr.setFromOpenGLMatrix(room->transform);
+    room_tr = room_tr.inverse();
+    for(uint32_t i = 0; i < room->content->static_mesh_count; i++)
+    {
+        static_mesh_p smesh = room->content->static_mesh + i;
+        if(Physics_IsStaticMeshMergeable(smesh))
+        {
+            btTransform tr;
+            uint32_t first = trimesh->getNumTriangles();
+            tr.setFromOpenGLMatrix(smesh->transform);
+            Physics_AddStaticMeshToTrimesh(trimesh, smesh, room_tr * tr);
+            if(trimesh->getNumTriangles() > (int)first)
+            {
+                *triangles_count = trimesh->getNumTriangles();
+                *triangle_static = (uint16_t*)realloc(*triangle_static, *triangles_count * sizeof(uint16_t));
+                for(; filled < *triangles_count; filled++)
+                {
+                    (*triangle_static)[filled] = (filled < first) ? (0) : (i + 1);
+                }
+            }
+        }
+    }
+
+    if(trimesh->getNumTriangles() == 0)
+    {
+        delete trimesh;
+        return NULL;
+    }
+
+    return BT_CSfromTrimesh(trimesh, true, true);
+}
+
+
+static void Physics_AddRoomBody(struct room_s *room, btCollisionShape *cshape, uint16_t *triangle_static, uint32_t triangles_count)
+{
+    btVector3 localInertia(0, 0, 0);
+    btTransform tr;
+    tr.setFromOpenGLMatrix(room->transform);
+    room->content->physics_body = (struct physics_object_s*)malloc(sizeof(struct physics_object_s));
+    room->content->physics_body->triangle_static = triangle_static;
+    room->content->physics_body->triangles_count = triangles_count;
+    btDefaultMotionState* motionState = new btDefaultMotionState(tr);
+    cshape->setMargin(COLLISION_MARGIN_DEFAULT);
+    room->content->physics_body->bt_body = new btRigidBody(0.0, motionState, cshape, localInertia);
+    room->content->physics_body->bt_body->setUserPointer(room->self);
+    room->content->physics_body->bt_body->setUserIndex(0);
+    room->content->physics_body->bt_body->setRestitution(1.0);
+    room->content->physics_body->bt_body->setFriction(1.0);
+    room->self->collision_type = COLLISION_TYPE_STATIC;                         // meshtree
+    room->self->collision_shape = COLLISION_SHAPE_TRIMESH;
+    if(room->active)                                                            // Room_Enable adds it later
+    {
+        bt_engine_dynamicsWorld->addRigidBody(room->content->physics_body->bt_body, COLLISION_GROUP_ALL, COLLISION_MASK_ALL);
+    }
+}
+
+
+/*
+ * Lazy room collision: shapes of a room (heightmap trimesh and static meshes)
+ * are made when the room or one of its near rooms is needed by some body.
+ * All missing rooms of a request are built together on the worker pool,
+ * bodies are made and added to the world by the calling thread.
+ */
+#define BT_ROOM_SHAPES_BUILT            (0x01)  // own shapes exist
+#define BT_ROOM_SHAPES_NEAR             (0x02)  // shapes of near rooms exist too
+
+typedef struct bt_engine_room_build_s
 {
-    if(physics->objects_count > 0)
-    {
-        btTransform tr;
-        btScalar gltr[16], v[3];
+    struct room_s                  *room;
+    btCollisionShape               *room_shape;
+    btCollisionShape              **static_shapes;                          // NULL for merged into room shape
+    uint16_t                       *triangle_static;
+    uint32_t                        triangles_count;
+}bt_engine_room_build_t, *bt_engine_room_build_p;
 
-        physics->manifoldArray = new btManifoldArray();
+static uint8_t                 *bt_engine_room_shapes = NULL;           // flags by room id
+static uint32_t                 bt_engine_room_shapes_count = 0;
+static uint32_t                 bt_engine_room_shapes_built = 0;        // rooms with own shapes
+static bt_engine_room_build_p   bt_engine_room_builds = NULL;           // every room is built once, so rooms count is enough
+static uint32_t                 bt_engine_room_builds_count = 0;
 
-        switch(physics->cont->collision_shape)
-        {
-            case COLLISION_SHAPE_SINGLE_BOX:
-                {
-                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
-                    physics->ghost_objects[0] = new btPairCachingGhostObject();
-                    physics->ghost_objects[0]->setIgnoreCollisionCheck(physics->bt_body[0], true);
-                    tr.setFromOpenGLMatrix(bf->transform);
-                    physics->ghost_objects[0]->setWorldTransform(tr);
-                    physics->ghost_objects[0]->setCollisionFlags(physics->ghost_objects[0]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
-                    physics->ghost_objects[0]->setUserPointer(physics->cont);
-                    physics->ghost_objects[0]->setUserIndex(-1);
-                    physics->ghost_objects[0]->setCollisionShape(BT_CSfromBBox(bf->bb_min, bf->bb_max));
-                    physics->ghost_objects[0]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
-                    bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[0], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
-                }
-                break;
 
-            case COLLISION_SHAPE_SINGLE_SPHERE:
-                {
-                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
-                    physics->ghost_objects[0] = new btPairCachingGhostObject();
-                    physics->ghost_objects[0]->setIgnoreCollisionCheck(physics->bt_body[0], true);
-                    btVector3 offset, centre(0.5f * (bf->bb_min[0] + bf->bb_max[0]), 0.5f * (bf->bb_min[1] + bf->bb_max[1]), 0.5f * (bf->bb_min[2] + bf->bb_max[2]));
-                    Mat4_vec3_rot_macro(offset.m_floats, bf->transform, centre);
-                    tr.setFromOpenGLMatrix(bf->transform);
-                    tr.getOrigin() += offset;
-                    physics->ghost_objects[0]->setWorldTransform(tr);
-                    physics->ghost_objects[0]->setCollisionFlags(physics->ghost_objects[0]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
-                    physics->ghost_objects[0]->setUserPointer(physics->cont);
-                    physics->ghost_objects[0]->setUserIndex(-1);
-                    physics->ghost_objects[0]->setCollisionShape(new btSphereShape(getInnerBBRadius(bf->bb_min, bf->bb_max)));
-                    physics->ghost_objects[0]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
-                    bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[0], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
-                }
-                break;
+static void Physics_QueueRoomShapes(struct room_s *room)
+{
+    if(room && !(bt_engine_room_shapes[room->id] & BT_ROOM_SHAPES_BUILT))
+    {
+        bt_engine_room_build_p build = bt_engine_room_builds + bt_engine_room_builds_count++;
+        bt_engine_room_shapes[room->id] |= BT_ROOM_SHAPES_BUILT;
+        bt_engine_room_shapes_built++;
+        build->room = room;
+        build->room_shape = NULL;
+        build->static_shapes = (room->content->static_mesh_count) ? ((btCollisionShape**)calloc(room->content->static_mesh_count, sizeof(btCollisionShape*))) : (NULL);
+    }
+}
 
-            default:
-                {
-                    physics->ghost_objects = (btPairCachingGhostObject**)malloc(bf->bone_tag_count * sizeof(btPairCachingGhostObject*));
-                    for(uint32_t i = 0; i < physics->objects_count; i++)
-                    {
-                        btVector3 box;
-                        box.m_floats[0] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[0] - bf->bone_tags[i].mesh_base->bb_min[0]);
-                        box.m_floats[1] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[1] - bf->bone_tags[i].mesh_base->bb_min[1]);
-                        box.m_floats[2] = 0.40 * (bf->bone_tags[i].mesh_base->bb_max[2] - bf->bone_tags[i].mesh_base->bb_min[2]);
-                        bf->bone_tags[i].mesh_base->R = (box.m_floats[0] < box.m_floats[1])?(box.m_floats[0]):(box.m_floats[1]);
-                        bf->bone_tags[i].mesh_base->R = (bf->bone_tags[i].mesh_base->R < box.m_floats[2])?(bf->bone_tags[i].mesh_base->R):(box.m_floats[2]);
 
-                        physics->ghost_objects[i] = new btPairCachingGhostObject();
-                        physics->ghost_objects[i]->setIgnoreCollisionCheck(physics->bt_body[i], true);
-                        Mat4_Mat4_mul(gltr, bf->transform, bf->bone_tags[i].full_transform);
-                        Mat4_vec3_mul(v, gltr, bf->bone_tags[i].mesh_base->centre);
-                        vec3_copy(gltr+12, v);
-                        tr.setFromOpenGLMatrix(gltr);
-                        physics->ghost_objects[i]->setWorldTransform(tr);
-                        physics->ghost_objects[i]->setCollisionFlags(physics->ghost_objects[i]->getCollisionFlags() | btCollisionObject::CF_CHARACTER_OBJECT);
-                        physics->ghost_objects[i]->setUserPointer(physics->cont);
-                        physics->ghost_objects[i]->setUserIndex(i);
-                        physics->ghost_objects[i]->setCollisionShape(new btBoxShape(box));
-                        physics->ghost_objects[i]->getCollisionShape()->setMargin(COLLISION_MARGIN_DEFAULT);
-                        bt_engine_dynamicsWorld->addCollisionObject(physics->ghost_objects[i], COLLISION_GROUP_CHARACTERS, COLLISION_GROUP_ALL);
-                    }
-                }
-        };
+static void Physics_BuildRoomShapesJob(void *data, int index, int thread)
+{
+    bt_engine_room_build_p build = (bt_engine_room_build_p)data + index;
+    room_content_p content = build->room->content;
+
+    build->room_shape = Physics_GenRoomShape(build->room, &build->triangle_static, &build->triangles_count);
+    for(uint32_t i = 0; i < content->static_mesh_count; i++)
+    {
+        if(!Physics_IsStaticMeshMergeable(content->static_mesh + i))
+        {
+            build->static_shapes[i] = Physics_GenStaticMeshShape(content->static_mesh + i);
+        }
     }
 }
 
 
-void Physics_GenStaticMeshRigidBody(struct static_mesh_s *smesh)
+static void Physics_BuildQueuedRoomShapes()
 {
-    btCollisionShape *cshape = NULL;
+    Jobs_ParallelFor(Physics_BuildRoomShapesJob, bt_engine_room_builds, bt_engine_room_builds_count);
+    for(uint32_t i = 0; i < bt_engine_room_builds_count; i++)
+    {
+        bt_engine_room_build_p build = bt_engine_room_builds + i;
+        room_content_p content = build->room->content;
+        if(build->room_shape)
+        {
+            Physics_AddRoomBody(build->room, build->room_shape, build->triangle_static, build->triangles_count);
+        }
+        else
+        {
+            free(build->triangle_static);
+        }
+        for(uint32_t j = 0; j < content->static_mesh_count; j++)
+        {
+            if(build->static_shapes[j])
+            {
+                Physics_AddStaticMeshBody(content->static_mesh + j, build->static_shapes[j]);
+            }
+        }
+        free(build->static_shapes);
+        build->static_shapes = NULL;
+    }
+    bt_engine_room_builds_count = 0;
+}
 
-    if(smesh->self->collision_type == COLLISION_TYPE_NONE)
+
+void Physics_InitRoomShapes(struct room_s *rooms, uint32_t rooms_count)
+{
+    Physics_ClearRoomShapes();
+    if(rooms_count == 0)
     {
         return;
     }
 
-    smesh->physics_body = NULL;
-    switch(smesh->self->collision_shape)
+    bt_engine_room_shapes = (uint8_t*)calloc(rooms_count, sizeof(uint8_t));
+    bt_engine_room_shapes_count = rooms_count;
+    bt_engine_room_builds = (bt_engine_room_build_p)malloc(rooms_count * sizeof(bt_engine_room_build_t));
+    bt_engine_room_builds_count = 0;
+
+    if(!physics_settings.lazy_shapes)
     {
-        case COLLISION_SHAPE_BOX:
-            cshape = BT_CSfromBBox(smesh->cbb_min, smesh->cbb_max);
-            break;
+        for(uint32_t i = 0; i < rooms_count; i++)
+        {
+            Physics_QueueRoomShapes(rooms + i);
+            bt_engine_room_shapes[i] |= BT_ROOM_SHAPES_NEAR;
+        }
+        Physics_BuildQueuedRoomShapes();
+    }
+}
 
-        case COLLISION_SHAPE_BOX_BASE:
-            cshape = BT_CSfromBBox(smesh->mesh->bb_min, smesh->mesh->bb_max);
-            break;
 
-        case COLLISION_SHAPE_TRIMESH:
-            cshape = BT_CSfromMesh(smesh->mesh, true, true, true);
-            break;
+void Physics_ClearRoomShapes()
+{
+    free(bt_engine_room_shapes);
+    bt_engine_room_shapes = NULL;
+    bt_engine_room_shapes_count = 0;
+    bt_engine_room_shapes_built = 0;
+    free(bt_engine_room_builds);
+    bt_engine_room_builds = NULL;
+    bt_engine_room_builds_count = 0;
+}
 
-        case COLLISION_SHAPE_TRIMESH_CONVEX:
-            cshape = BT_CSfromMesh(smesh->mesh, true, true, false);
-            break;
 
-        default:
-            cshape = NULL;
-            break;
-    };
+void Physics_RequireRoomShapes(struct room_s *room)
+{
+    if(!room || !bt_engine_room_shapes || (room->id >= bt_engine_room_shapes_count) ||
+       (bt_engine_room_shapes[room->id] & BT_ROOM_SHAPES_NEAR))
+    {
+        return;
+    }
 
-    if(cshape)
+    Physics_QueueRoomShapes(room);
+    Physics_QueueRoomShapes(room->base_room);
+    Physics_QueueRoomShapes(room->alternate_room);
+    for(uint16_t i = 0; i < room->near_room_list_size; i++)
     {
-        btVector3 localInertia(0, 0, 0);
-        btTransform startTransform;
-        startTransform.setFromOpenGLMatrix(smesh->transform);
-        smesh->physics_body = (struct physics_object_s*)malloc(sizeof(struct physics_object_s));
-        btDefaultMotionState* motionState = new btDefaultMotionState(startTransform);
-        smesh->physics_body->bt_body = new btRigidBody(0.0, motionState, cshape, localInertia);
-        cshape->setMargin(COLLISION_MARGIN_DEFAULT);
-        smesh->physics_body->bt_body->setRestitution(1.0);
-        smesh->physics_body->bt_body->setFriction(1.0);
-        bt_engine_dynamicsWorld->addRigidBody(smesh->physics_body->bt_body, COLLISION_GROUP_ALL, COLLISION_MASK_ALL);
-        smesh->physics_body->bt_body->setUserPointer(smesh->self);
+        Physics_QueueRoomShapes(room->near_room_list[i]);
     }
+    Physics_BuildQueuedRoomShapes();
+    bt_engine_room_shapes[room->id] |= BT_ROOM_SHAPES_NEAR;
 }
 
 
-void Physics_GenRoomRigidBody(struct room_s *room, struct sector_tween_s *tweens, int num_tweens)
+static bool BT_SegmentHitsBox(const float from[3], const float to[3], float R, const float bb_min[3], const float bb_max[3])
+{
+    float t0 = 0.0f, t1 = 1.0f;
+    for(int i = 0; i < 3; i++)
+    {
+        float lo = bb_min[i] - R;
+        float hi = bb_max[i] + R;
+        float d = to[i] - from[i];
+        if(fabsf(d) < 0.0001f)
+        {
+            if((from[i] < lo) || (from[i] > hi))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            float ta = (lo - from[i]) / d;
+            float tb = (hi - from[i]) / d;
+            float t_in = (ta < tb) ? (ta) : (tb);
+            float t_out = (ta < tb) ? (tb) : (ta);
+            t0 = (t_in > t0) ? (t_in) : (t0);
+            t1 = (t_out < t1) ? (t_out) : (t1);
+            if(t0 > t1)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Ray and sphere tests may reach rooms no body has come near yet (camera,
+ * line of sight, shooting): shapes of every room crossed by the swept
+ * segment are built before the test. Free when all rooms are built.
+ */
+static void Physics_RequireQueryShapes(const float from[3], const float to[3], float R)
 {
-    btCollisionShape *cshape = BT_CSfromHeightmap(room->sectors, tweens, num_tweens, true, true);
-    room->content->physics_body = NULL;
+    room_p rooms = NULL;
+    uint32_t rooms_count = 0;
 
-    if(cshape)
+    if(!bt_engine_room_shapes || (bt_engine_room_shapes_built >= bt_engine_room_shapes_count))
     {
-        btVector3 localInertia(0, 0, 0);
-        btTransform tr;
-        tr.setFromOpenGLMatrix(room->transform);
-        room->content->physics_body = (struct physics_object_s*)malloc(sizeof(struct physics_object_s));
-        btDefaultMotionState* motionState = new btDefaultMotionState(tr);
-        cshape->setMargin(COLLISION_MARGIN_DEFAULT);
-        room->content->physics_body->bt_body = new btRigidBody(0.0, motionState, cshape, localInertia);
-        bt_engine_dynamicsWorld->addRigidBody(room->content->physics_body->bt_body, COLLISION_GROUP_ALL, COLLISION_MASK_ALL);
-        room->content->physics_body->bt_body->setUserPointer(room->self);
-        room->content->physics_body->bt_body->setUserIndex(0);
-        room->content->physics_body->bt_body->setRestitution(1.0);
-        room->content->physics_body->bt_body->setFriction(1.0);
-        room->self->collision_type = COLLISION_TYPE_STATIC;                     // meshtree
-        room->self->collision_shape = COLLISION_SHAPE_TRIMESH;
+        return;
+    }
+
+    World_GetRoomInfo(&rooms, &rooms_count);
+    rooms_count = (rooms_count < bt_engine_room_shapes_count) ? (rooms_count) : (bt_engine_room_shapes_count);
+    for(uint32_t i = 0; i < rooms_count; i++)
+    {
+        if(!(bt_engine_room_shapes[i] & BT_ROOM_SHAPES_BUILT) && BT_SegmentHitsBox(from, to, R, rooms[i].bb_min, rooms[i].bb_max))
+        {
+            Physics_QueueRoomShapes(rooms + i);
+        }
+    }
+    if(bt_engine_room_builds_count > 0)
+    {
+        Physics_BuildQueuedRoomShapes();
     }
 }
 
@@ -1413,12 +2449,13 @@ void Physics_DeleteObject(struct physics_object_s *obj)
         }
         if(obj->bt_body->getCollisionShape())
         {
-            delete obj->bt_body->getCollisionShape();
+            BT_DeleteShape(obj->bt_body->getCollisionShape());
             obj->bt_body->setCollisionShape(NULL);
         }
 
         bt_engine_dynamicsWorld->removeRigidBody(obj->bt_body);
         delete obj->bt_body;
+        free(obj->triangle_static);
         free(obj);
     }
 }
@@ -1504,6 +2541,10 @@ void Physics_SetBodyMass(struct physics_data_s *physics, float mass, uint16_t in
 
     bt_engine_dynamicsWorld->addRigidBody(physics->bt_body[index]);
 
+    if(mass > 0.0)
+    {
+        physics->bt_body[index]->forceActivationState(ACTIVE_TAG);              // may be disabled as far kinematic body
+    }
     physics->bt_body[index]->activate();
 }
 
@@ -1617,8 +2658,30 @@ typedef struct hair_s
     uint32_t                 *hair_vertex_map;    // Hair vertex indices to link
     uint32_t                 *head_vertex_map;    // Head vertex indices to link
 
+    /*
+     * Position based chain (physics_settings.hair_pbd): element i goes from
+     * point i to point i + 1 along its Y axis, point 0 is pinned to the head.
+     * Owner state is copied by Hair_Update, so chains are solved in parallel.
+     */
+    btVector3                *points;
+    btVector3                *prev_points;
+    btScalar                 *inv_mass;
+    btScalar                 *lengths;
+    btTransform              *element_transforms;
+    btScalar                  radius;             // Chain thickness for collisions.
+    btScalar                  damping;
+    btScalar                  prev_dt;            // Last substep time, prev_points velocity is scaled by dt / prev_dt.
+    btTransform               root_local;         // Pivot and rest basis of the first element in owner body space.
+    btTransform               root_transform;     // Pivot and rest basis of the first element in world.
+    uint16_t                  spheres_count;
+    btVector3                 spheres[HAIR_MAX_SPHERES];      // Owner bones in world, w is radius.
+    int8_t                    pending;            // Owner state is updated, chain must be solved.
 }hair_t, *hair_p;
 
+static hair_p                 *bt_engine_hairs = NULL;            // position based chains
+static uint16_t                bt_engine_hairs_count = 0;
+static uint16_t                bt_engine_hairs_size = 0;
+
 typedef struct hair_setup_s
 {
     uint32_t     model_id;           // Hair model ID
@@ -1647,6 +2710,216 @@ typedef struct hair_setup_s
 }hair_setup_t, *hair_setup_p;
 
 
+static void Hair_UpdateElementTransforms(hair_p hair);
+
+static void Hair_CreateChain(hair_p hair, hair_setup_p setup, skeletal_model_p model, const btTransform &owner_transform)
+{
+    btScalar weight_step = ((setup->root_weight - setup->tail_weight) / hair->element_count);
+    btScalar current_weight = setup->root_weight;
+    btMatrix3x3 twist;
+    btVector3 dir;
+
+    hair->points = (btVector3*)btAlignedAlloc((hair->element_count + 1) * sizeof(btVector3), 16);
+    hair->prev_points = (btVector3*)btAlignedAlloc((hair->element_count + 1) * sizeof(btVector3), 16);
+    hair->element_transforms = (btTransform*)btAlignedAlloc(hair->element_count * sizeof(btTransform), 16);
+    hair->inv_mass = (btScalar*)malloc((hair->element_count + 1) * sizeof(btScalar));
+    hair->lengths = (btScalar*)malloc(hair->element_count * sizeof(btScalar));
+    hair->damping = setup->hair_damping[0];
+    hair->prev_dt = 0.0;
+    hair->radius = 0.0;
+
+    // Same rest frame as the first 6DOF joint: root angle, then quarter turn around Y.
+    hair->root_local.setIdentity();
+    hair->root_local.setOrigin(btVector3(setup->head_offset[0], setup->head_offset[1], setup->head_offset[2]));
+    hair->root_local.getBasis().setEulerZYX(setup->root_angle[0], setup->root_angle[1], setup->root_angle[2]);
+    twist.setEulerZYX(0.0, SIMD_HALF_PI, 0.0);
+    hair->root_local.getBasis() *= twist;
+    hair->root_transform = owner_transform * hair->root_local;
+
+    hair->inv_mass[0] = 0.0;
+    hair->points[0] = hair->root_transform.getOrigin();
+    dir = hair->root_transform.getBasis().getColumn(1);
+    for(uint32_t i = 0; i < hair->element_count; i++)
+    {
+        base_mesh_p mesh = model->mesh_tree[i].mesh_base;
+        btScalar r = 0.5 * (mesh->bb_max[0] - mesh->bb_min[0]);
+
+        hair->elements[i].mesh = mesh;
+        hair->lengths[i] = fabs(mesh->bb_max[1] - mesh->bb_min[1]) * setup->joint_overlap;
+        hair->radius = (r > hair->radius) ? (r) : (hair->radius);
+        current_weight -= weight_step;
+        hair->inv_mass[i + 1] = (current_weight > 0.0) ? (1.0 / current_weight) : (1.0);
+        hair->points[i + 1] = hair->points[i] + dir * hair->lengths[i];
+    }
+    for(uint32_t i = 0; i <= hair->element_count; i++)
+    {
+        hair->prev_points[i] = hair->points[i];
+    }
+    Hair_UpdateElementTransforms(hair);
+
+    if(bt_engine_hairs_count >= bt_engine_hairs_size)
+    {
+        bt_engine_hairs_size += 8;
+        bt_engine_hairs = (hair_p*)realloc(bt_engine_hairs, bt_engine_hairs_size * sizeof(hair_p));
+    }
+    bt_engine_hairs[bt_engine_hairs_count++] = hair;
+}
+
+
+/*
+ * Element frames: Y along the chain, X is carried from the previous element
+ * (from the root rest frame for the first one), so chain does not twist.
+ */
+static void Hair_UpdateElementTransforms(hair_p hair)
+{
+    btVector3 x = hair->root_transform.getBasis().getColumn(0);
+
+    for(uint32_t i = 0; i < hair->element_count; i++)
+    {
+        btVector3 y = hair->points[i + 1] - hair->points[i];
+        btVector3 z;
+        btScalar len = y.length();
+
+        y = (len > SIMD_EPSILON) ? (y / len) : (hair->root_transform.getBasis().getColumn(1));
+        x -= y * x.dot(y);
+        if(x.length2() < SIMD_EPSILON)
+        {
+            btPlaneSpace1(y, x, z);
+        }
+        x.normalize();
+        z = x.cross(y);
+        hair->element_transforms[i].setOrigin(hair->points[i]);
+        hair->element_transforms[i].getBasis().setValue(x.x(), y.x(), z.x(),
+                                                        x.y(), y.y(), z.y(),
+                                                        x.z(), y.z(), z.z());
+    }
+}
+
+
+/*
+ * Verlet integration with distance constraints, rest cone of the first
+ * element and collisions with owner bone spheres, a few fixed substeps.
+ */
+static void Hair_SolveChain(hair_p hair, const btVector3 &gravity, btScalar time)
+{
+    int substeps = (int)(time * HAIR_PBD_RATE) + 1;
+    btScalar dt = time / (btScalar)substeps;
+    btScalar keep = 1.0 - hair->damping;
+    btVector3 root_dir = hair->root_transform.getBasis().getColumn(1);
+    const uint32_t points_count = hair->element_count + 1;
+
+    keep = (keep < 0.0) ? (0.0) : ((keep > 1.0) ? (1.0) : (keep));
+    substeps = (substeps > HAIR_PBD_MAX_SUBSTEPS) ? (HAIR_PBD_MAX_SUBSTEPS) : (substeps);
+    for(int step = 0; step < substeps; step++)
+    {
+        // frame time varies: x - x_prev was made over prev_dt, not dt.
+        btScalar scale = (hair->prev_dt > 0.0) ? (keep * dt / hair->prev_dt) : (keep);
+        hair->prev_dt = dt;
+        hair->points[0] = hair->prev_points[0] = hair->root_transform.getOrigin();
+        for(uint32_t i = 1; i < points_count; i++)
+        {
+            btVector3 v = (hair->points[i] - hair->prev_points[i]) * scale;
+            hair->prev_points[i] = hair->points[i];
+            hair->points[i] += v + gravity * (dt * dt);
+        }
+
+        for(int iter = 0; iter < HAIR_PBD_ITERATIONS; iter++)
+        {
+            for(uint32_t i = 0; i < hair->element_count; i++)
+            {
+                btVector3 d = hair->points[i + 1] - hair->points[i];
+                btScalar len = d.length();
+                btScalar w = hair->inv_mass[i] + hair->inv_mass[i + 1];
+                if((len > SIMD_EPSILON) && (w > 0.0))
+                {
+                    d *= (len - hair->lengths[i]) / (len * w);
+                    hair->points[i] += d * hair->inv_mass[i];
+                    hair->points[i + 1] -= d * hair->inv_mass[i + 1];
+                }
+            }
+
+            // keeps the first element in the rest cone, as the first 6DOF joint limits did.
+            {
+                btVector3 d = hair->points[1] - hair->points[0];
+                btScalar len = d.length();
+                if((len > SIMD_EPSILON) && (d.dot(root_dir) < len * HAIR_PBD_ROOT_COS))
+                {
+                    btVector3 side = d - root_dir * d.dot(root_dir);
+                    btScalar side_len = side.length();
+                    side = (side_len > SIMD_EPSILON) ? (side / side_len) : (hair->root_transform.getBasis().getColumn(0));
+                    hair->points[1] = hair->points[0] + (root_dir * HAIR_PBD_ROOT_COS + side * HAIR_PBD_ROOT_SIN) * len;
+                }
+            }
+
+            for(uint32_t i = 1; i < points_count; i++)
+            {
+                for(uint16_t j = 0; j < hair->spheres_count; j++)
+                {
+                    btVector3 d = hair->points[i] - hair->spheres[j];
+                    btScalar r = hair->spheres[j].w() + hair->radius;
+                    btScalar len2 = d.x() * d.x() + d.y() * d.y() + d.z() * d.z();
+                    if((len2 < r * r) && (len2 > SIMD_EPSILON))
+                    {
+                        btScalar len = btSqrt(len2);
+                        hair->points[i].setX(hair->spheres[j].x() + d.x() * r / len);
+                        hair->points[i].setY(hair->spheres[j].y() + d.y() * r / len);
+                        hair->points[i].setZ(hair->spheres[j].z() + d.z() * r / len);
+                    }
+                }
+            }
+        }
+    }
+
+    Hair_UpdateElementTransforms(hair);
+}
+
+
+static btVector3 hair_jobs_gravity;
+static btScalar  hair_jobs_time;
+
+static void Hair_SolveChainJob(void *data, int index, int thread)
+{
+    Hair_SolveChain(((hair_p*)data)[index], hair_jobs_gravity, hair_jobs_time);
+}
+
+
+static void Hair_SimulateChains(btScalar time)
+{
+    uint16_t count = 0;
+
+    if((bt_engine_hairs_count == 0) || (time <= 0.0))
+    {
+        return;
+    }
+
+    // pending chains are moved to the start of the list.
+    for(uint16_t i = 0; i < bt_engine_hairs_count; i++)
+    {
+        if(bt_engine_hairs[i]->pending)
+        {
+            hair_p h = bt_engine_hairs[i];
+            bt_engine_hairs[i] = bt_engine_hairs[count];
+            bt_engine_hairs[count++] = h;
+            h->pending = 0;
+        }
+    }
+
+    hair_jobs_gravity = bt_engine_dynamicsWorld->getGravity();
+    hair_jobs_time = time;
+    if(physics_settings.multithreaded && (count > 1) && (Jobs_GetThreadsCount() > 1))
+    {
+        Jobs_ParallelFor(Hair_SolveChainJob, bt_engine_hairs, count);
+    }
+    else
+    {
+        for(uint16_t i = 0; i < count; i++)
+        {
+            Hair_SolveChain(bt_engine_hairs[i], hair_jobs_gravity, time);
+        }
+    }
+}
+
+
 struct hair_s *Hair_Create(struct hair_setup_s *setup, struct physics_data_s *physics)
 {
     // No setup or parent to link to - bypass function.
@@ -1694,6 +2967,12 @@ struct hair_s *Hair_Create(struct hair_setup_s *setup, struct physics_data_s *ph
     btScalar weight_step = ((setup->root_weight - setup->tail_weight) / hair->element_count);
     btScalar current_weight = setup->root_weight;
 
+    if(physics_settings.hair_pbd)
+    {
+        Hair_CreateChain(hair, setup, model, startTransform);
+        return hair;
+    }
+
     for(uint32_t i = 0; i < hair->element_count; i++)
     {
         // Point to corresponding mesh.
@@ -1832,6 +3111,24 @@ void Hair_Delete(struct hair_s *hair)
 {
     if(hair)
     {
+        if(hair->points)
+        {
+            for(uint16_t i = 0; i < bt_engine_hairs_count; i++)
+            {
+                if(bt_engine_hairs[i] == hair)
+                {
+                    bt_engine_hairs[i] = bt_engine_hairs[--bt_engine_hairs_count];
+                    break;
+                }
+            }
+            btAlignedFree(hair->points);
+            btAlignedFree(hair->prev_points);
+            btAlignedFree(hair->element_transforms);
+            free(hair->inv_mass);
+            free(hair->lengths);
+            hair->points = NULL;
+        }
+
         for(int i = 0; i < hair->element_count; i++)
         {
             if(hair->elements[i].joint)
@@ -1916,6 +3213,30 @@ void Hair_Update(struct hair_s *hair, struct physics_data_s *physics)
         }*/
 
         hair->container->room = physics->cont->room;
+        if(hair->points && physics->bt_body[hair->owner_body])
+        {
+            btTransform owner_transform = physics->bt_body[hair->owner_body]->getWorldTransform();
+            hair->root_transform = owner_transform * hair->root_local;
+            hair->spheres_count = 0;
+            if(physics->cont->object_type == OBJECT_ENTITY)
+            {
+                entity_p ent = (entity_p)physics->cont->object;
+                for(uint16_t i = 0; (i < ent->bf->bone_tag_count) && (hair->spheres_count < HAIR_MAX_SPHERES); i++)
+                {
+                    base_mesh_p mesh = ent->bf->bone_tags[i].mesh_base;
+                    if(mesh && (mesh->vertex_count > 0))
+                    {
+                        float tr[16], v[3];
+                        Mat4_Mat4_mul(tr, ent->transform, ent->bf->bone_tags[i].full_transform);
+                        Mat4_vec3_mul(v, tr, mesh->centre);
+                        hair->spheres[hair->spheres_count].setValue(v[0], v[1], v[2]);
+                        hair->spheres[hair->spheres_count].setW(0.5 * getInnerBBRadius(mesh->bb_min, mesh->bb_max));
+                        hair->spheres_count++;
+                    }
+                }
+            }
+            hair->pending = 1;
+        }
     }
 }
 
@@ -2078,7 +3399,14 @@ int Hair_GetElementsCount(struct hair_s *hair)
 
 void Hair_GetElementInfo(struct hair_s *hair, int element, struct base_mesh_s **mesh, float tr[16])
 {
-    hair->elements[element].body->getWorldTransform().getOpenGLMatrix(tr);
+    if(hair->points)
+    {
+        hair->element_transforms[element].getOpenGLMatrix(tr);
+    }
+    else
+    {
+        hair->elements[element].body->getWorldTransform().getOpenGLMatrix(tr);
+    }
     *mesh = hair->elements[element].mesh;
 }
 
@@ -2196,6 +3524,7 @@ bool Ragdoll_Create(struct physics_data_s *physics, struct ss_bone_frame_s *bf,
     for(uint32_t i = 0; i < setup->body_count; i++)
     {
         bt_engine_dynamicsWorld->addRigidBody(physics->bt_body[i]);
+        physics->bt_body[i]->forceActivationState(ACTIVE_TAG);                   // may be disabled as far kinematic body
         physics->bt_body[i]->activate();
         physics->bt_body[i]->setLinearVelocity(btVector3(0.0, 0.0, 0.0));
         if(physics->ghost_objects[i])
@@ -16,8 +16,12 @@
 #include <string.h>
 
 #include "../core/gl_util.h"
+#include "../core/jobs.h"
+#include "../core/system.h"
+#include "../core/tex_compress.h"
 #include "../core/polygon.h"
 #include "bsp_tree_2d.h"
+#include "max_rects_2d.h"
 #include "../vt/vt_level.h"
 
 #ifndef __APPLE__
@@ -49,6 +53,18 @@ static __inline GLuint NextPowerOf2(GLuint in)
 
 #define ARRAY_CAPACITY_INCREASE_STEP (32)
 #define WHITE_TEXTURE_INDEX          (0x8000)
+#define COMPOSE_MEMORY_MAX           (128 * 1024 * 1024)
+#define COMPRESSED_CACHE_NAME        "cache/atlas_%.16llX.tc"
+#define COMPRESSED_MIN_PSNR          (30.0f)                                    // dB of the base level
+#define MIPS_CACHE_NAME              "cache/atlas_%.16llX.mip"                  // RGBA levels from 1 of uncompressed pages
+#define MIPS_CACHE_MAGIC             (0x504D544F)                               // "OTMP"
+#define MIPS_CACHE_VERSION           (1)
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT  0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#endif
 
 /*!
  * The bordered texture atlas used by the borderedTextureAtlas_CompareCanonicalTextureSizes function. Sadly, qsort does not allow passing this context through as a parameter, and the nonstandard extensions qsort_r/qsort_s which do are not supported on MinGW, so this has to be done as a global variable.
@@ -84,12 +100,39 @@ int bordered_texture_atlas::compareCanonicalTextureSizes(const void *parameter1,
     return 0;
 }
 
+/*!
+ * Free space of one result page, kept by the selected packer.
+ */
+static void *PagePacker_Create(int packer, unsigned width, unsigned height)
+{
+    if (packer == TEXTURE_PACKER_MAX_RECTS)
+        return MaxRects2D_Create(width, height);
+    return BSPTree2D_Create(width, height);
+}
+
+static int PagePacker_FindSpaceFor(int packer, void *page, unsigned width, unsigned height, unsigned *x, unsigned *y)
+{
+    if (packer == TEXTURE_PACKER_MAX_RECTS)
+        return MaxRects2D_FindSpaceFor((max_rects_2d_p) page, width, height, x, y);
+    return BSPTree2D_FindSpaceFor((bsp_tree_2d_p) page, width, height, x, y);
+}
+
+static void PagePacker_Destroy(int packer, void *page)
+{
+    if (packer == TEXTURE_PACKER_MAX_RECTS)
+        MaxRects2D_Destroy((max_rects_2d_p) page);
+    else
+        BSPTree2D_Destroy((bsp_tree_2d_p) page);
+}
+
 /*!
  * Lays out the texture data and switches the atlas to laid out mode. This makes
- * use of a bsp_tree_2d to handle all the really annoying stuff.
+ * use of a bsp_tree_2d or max_rects_2d to handle all the really annoying stuff.
  */
 void bordered_texture_atlas::layOutTextures()
 {
+    float start_time = Sys_FloatTime();
+
     // First step: Sort the canonical textures by size.
     unsigned long *sorted_indices = new unsigned long[number_canonical_object_textures];
     for (unsigned long i = 0; i < number_canonical_object_textures; i++)
@@ -102,7 +145,7 @@ void bordered_texture_atlas::layOutTextures()
     // Find positions for the canonical textures
     number_result_pages = 0;
     result_page_height = NULL;
-    bsp_tree_2d_p *result_pages = NULL;
+    void **result_pages = NULL;
 
     for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
     {
@@ -112,7 +155,7 @@ void bordered_texture_atlas::layOutTextures()
         bool found_place = 0;
         for (unsigned long page = 0; page < number_result_pages; page++)
         {
-            found_place = BSPTree2D_FindSpaceFor(result_pages[page],
+            found_place = PagePacker_FindSpaceFor(packer, result_pages[page],
                                                  canonical.width + 2*border_width,
                                                  canonical.height + 2*border_width,
                                                  &(canonical.new_x_with_border),
@@ -133,11 +176,11 @@ void bordered_texture_atlas::layOutTextures()
         if (!found_place)
         {
             number_result_pages += 1;
-            result_pages = (bsp_tree_2d_p *) realloc(result_pages, sizeof(bsp_tree_2d_p) * number_result_pages);
-            result_pages[number_result_pages - 1] = BSPTree2D_Create(result_page_width, result_page_width);
+            result_pages = (void **) realloc(result_pages, sizeof(void *) * number_result_pages);
+            result_pages[number_result_pages - 1] = PagePacker_Create(packer, result_page_width, result_page_width);
             result_page_height = (unsigned *) realloc(result_page_height, sizeof(unsigned) * number_result_pages);
 
-            BSPTree2D_FindSpaceFor(result_pages[number_result_pages - 1],
+            PagePacker_FindSpaceFor(packer, result_pages[number_result_pages - 1],
                                    canonical.width + 2*border_width,
                                    canonical.height + 2*border_width,
                                    &(canonical.new_x_with_border),
@@ -150,38 +193,62 @@ void bordered_texture_atlas::layOutTextures()
     }
 
     // Fix up heights if necessary
+    double pages_area = 0.0;
     for (unsigned page = 0; page < number_result_pages; page++)
     {
         result_page_height[page] = NextPowerOf2(result_page_height[page]);
+        pages_area += (double) result_page_width * result_page_height[page];
     }
 
     // Cleanup
     delete [] sorted_indices;
     for (unsigned long i = 0; i < number_result_pages; i++)
-        BSPTree2D_Destroy(result_pages[i]);
+        PagePacker_Destroy(packer, result_pages[i]);
     free(result_pages);
+
+    // Metrics: fill ratio counts borders as used space.
+    double used_area = 0.0;
+    for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
+    {
+        const canonical_object_texture &canonical = canonical_object_textures[texture];
+        used_area += (double) (canonical.width + 2 * border_width) * (canonical.height + 2 * border_width);
+    }
+    packing_fill_ratio = (pages_area > 0.0) ? ((float) (used_area / pages_area)) : (0.0f);
+    packing_time = Sys_FloatTime() - start_time;
+
+    bucketTexturesByPage();
 }
 
 bordered_texture_atlas::bordered_texture_atlas(int border,
+                                               int texture_packer,
                                                size_t page_count,
                                                const tr4_textile32_t *pages,
                                                size_t object_texture_count,
                                                const tr4_object_texture_t *object_textures,
                                                size_t sprite_texture_count,
-                                               const tr_sprite_texture_t *sprite_textures)
+                                               const tr_sprite_texture_t *sprite_textures,
+                                               const uint32_t *upscaled_pages,
+                                               int upscale)
 : border_width(border),
+packer(texture_packer),
+packing_fill_ratio(0.0f),
+packing_time(0.0f),
 number_result_pages(0),
 result_page_width(0),
 result_page_height(NULL),
 number_original_pages(page_count),
 original_pages(pages),
+scaled_pages((upscale > 1) ? (upscaled_pages) : (NULL)),
+page_scale((scaled_pages != NULL) ? (upscale) : (1)),
 number_file_object_textures(0),
 file_object_textures(NULL),
 number_sprite_textures(0),
 canonical_textures_for_sprite_textures(NULL),
 number_canonical_object_textures(0),
 canonical_object_textures(NULL),
-textures_indexes(NULL)
+textures_indexes(NULL),
+page_textures_offsets(NULL),
+page_textures(NULL)
 {
     GLint max_texture_edge_length = 0;
     qglGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_edge_length);
@@ -221,7 +288,10 @@ bordered_texture_atlas::~bordered_texture_atlas()
     delete [] canonical_textures_for_sprite_textures;
     delete [] canonical_object_textures;
     original_pages = NULL;
+    scaled_pages = NULL;
     free(result_page_height);
+    free(page_textures_offsets);
+    free(page_textures);
 }
 
 void bordered_texture_atlas::addObjectTexture(const tr4_object_texture_t &texture)
@@ -240,8 +310,10 @@ void bordered_texture_atlas::addObjectTexture(const tr4_object_texture_t &textur
         if (texture.vertices[i].ypixel < min[1])
             min[1] = texture.vertices[i].ypixel;
     }
-    uint8_t width = max[0] - min[0];
-    uint8_t height = max[1] - min[1];
+    uint16_t width = (max[0] - min[0]) * page_scale;
+    uint16_t height = (max[1] - min[1]) * page_scale;
+    uint16_t x = min[0] * page_scale;
+    uint16_t y = min[1] * page_scale;
 
     // See whether it already exists
     long canonical_index = -1;
@@ -250,8 +322,8 @@ void bordered_texture_atlas::addObjectTexture(const tr4_object_texture_t &textur
         canonical_object_texture *canonical_candidate = &(canonical_object_textures[i]);
 
         if (canonical_candidate->original_page == (texture.tile_and_flag & TR_TEXTURE_INDEX_MASK_TR4)
-            && canonical_candidate->original_x == min[0]
-            && canonical_candidate->original_y == min[1]
+            && canonical_candidate->original_x == x
+            && canonical_candidate->original_y == y
             && canonical_candidate->width == width
             && canonical_candidate->height == height)
         {
@@ -270,8 +342,8 @@ void bordered_texture_atlas::addObjectTexture(const tr4_object_texture_t &textur
         canonical.width = width;
         canonical.height = height;
         canonical.original_page = texture.tile_and_flag & TR_TEXTURE_INDEX_MASK_TR4;
-        canonical.original_x = min[0];
-        canonical.original_y = min[1];
+        canonical.original_x = x;
+        canonical.original_y = y;
     }
 
     // Create file object texture.
@@ -301,10 +373,10 @@ void bordered_texture_atlas::addObjectTexture(const tr4_object_texture_t &textur
 void bordered_texture_atlas::addSpriteTexture(const tr_sprite_texture_t &texture)
 {
     // Determine the canonical texture for this texture.
-    unsigned x = texture.x0;
-    unsigned y = texture.y0;
-    unsigned width = texture.x1 - texture.x0;
-    unsigned height = texture.y1 - texture.y0;
+    unsigned x = texture.x0 * page_scale;
+    unsigned y = texture.y0 * page_scale;
+    unsigned width = (texture.x1 - texture.x0) * page_scale;
+    unsigned height = (texture.y1 - texture.y0) * page_scale;
 
     // See whether it already exists
     long canonical_index = -1;
@@ -493,202 +565,602 @@ unsigned long bordered_texture_atlas::getNumAtlasPages() const
     return number_result_pages;
 }
 
-void bordered_texture_atlas::createTextures(GLuint *textureNames)
+float bordered_texture_atlas::getPackingFillRatio() const
 {
-    GLubyte *data = (GLubyte *) malloc(4 * result_page_width * result_page_width);
+    return packing_fill_ratio;
+}
 
-    qglGenTextures((GLsizei) number_result_pages, textureNames);
+float bordered_texture_atlas::getPackingTime() const
+{
+    return packing_time;
+}
 
-    textures_indexes = textureNames;
+void bordered_texture_atlas::bucketTexturesByPage()
+{
+    page_textures_offsets = (unsigned long *) calloc(number_result_pages + 1, sizeof(unsigned long));
+    page_textures = (unsigned long *) malloc(sizeof(unsigned long) * (number_canonical_object_textures + 1));
+
+    for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
+        page_textures_offsets[canonical_object_textures[texture].new_page + 1]++;
 
     for (unsigned long page = 0; page < number_result_pages; page++)
+        page_textures_offsets[page + 1] += page_textures_offsets[page];
+
+    // Keeps textures of each page in the original order.
+    unsigned long *fill = (unsigned long *) malloc(sizeof(unsigned long) * (number_result_pages + 1));
+    memcpy(fill, page_textures_offsets, sizeof(unsigned long) * (number_result_pages + 1));
+    for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
+        page_textures[fill[canonical_object_textures[texture].new_page]++] = texture;
+    free(fill);
+}
+
+void bordered_texture_atlas::composeTexture(const canonical_object_texture &canonical, GLubyte *data) const
+{
+    const unsigned row_size = 4 * (canonical.width + 2 * border_width);
+    const unsigned stride = 4 * result_page_width;
+    GLubyte *first_row = &data[(canonical.new_y_with_border * result_page_width + canonical.new_x_with_border) * 4];
+
+    if(canonical.original_page == WHITE_TEXTURE_INDEX)
     {
-        for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
+        for (int line = 0; line < canonical.height + 2 * border_width; line++)
         {
-            const canonical_object_texture &canonical = canonical_object_textures[texture];
-            if (canonical.new_page != page)
-                continue;
+            memset(first_row + line * stride, 0xFF, row_size);
+        }
+        return;
+    }
 
-            if(canonical.original_page == WHITE_TEXTURE_INDEX)
-            {
-                uint32_t white_pixels[1] = {0xFFFFFFFFU};
-                // Add top border
-                for (int border = 0; border < border_width; border++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + border;
-
-                    // expand top-left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           white_pixels, 4 * border_width);
-                    // copy top line
-                    memset_pattern4(&data[(y*result_page_width + x + border_width) * 4],
-                           white_pixels, canonical.width * 4);
-                    // expand top-right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           white_pixels, 4 * border_width);
-                }
+    const unsigned original_width = 256 * page_scale;
+    const GLubyte *original = (scaled_pages != NULL) ?
+                              ((const GLubyte *) (scaled_pages + (size_t) canonical.original_page * original_width * original_width)) :
+                              ((const GLubyte *) original_pages[canonical.original_page].pixels);
+    GLubyte *content = first_row + border_width * stride;
+    GLubyte *bottom = content + canonical.height * stride;
 
-                // Copy main content
-                for (int line = 0; line < canonical.height; line++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + border_width + line;
-
-                    // expand left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           white_pixels, 4 * border_width);
-                    // copy line
-                    memset_pattern4(&data[(y*result_page_width + x + border_width) * 4],
-                           white_pixels, canonical.width * 4);
-                    // expand right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           white_pixels, 4 * border_width);
-                }
+    // Copy main content, expanding left and right pixels into the border.
+    // Line height is the source of the bottom border.
+    for (int line = 0; line <= canonical.height; line++)
+    {
+        const GLubyte *src = &original[((canonical.original_y + line) * original_width + canonical.original_x) * 4];
+        GLubyte *dst = content + line * stride;
 
-                // Add bottom border
-                for (int border = 0; border < border_width; border++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + canonical.height + border_width + border;
-
-                    // expand bottom-left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           white_pixels, 4 * border_width);
-                    // copy bottom line
-                    memset_pattern4(&data[(y*result_page_width + x + border_width) * 4],
-                           white_pixels, canonical.width * 4);
-                    // expand bottom-right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           white_pixels, 4 * border_width);
-                }
-            }
-            else
-            {
-                const char *original = (char *) original_pages[canonical.original_page].pixels;
-                // Add top border
-                for (int border = 0; border < border_width; border++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + border;
-                    unsigned old_x = canonical.original_x;
-                    unsigned old_y = canonical.original_y;
-
-                    // expand top-left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           &(original[(old_y * 256 + old_x) * 4]),
-                           4 * border_width);
-                    // copy top line
-                    memcpy(&data[(y*result_page_width + x + border_width) * 4],
-                           &original[(old_y * 256 + old_x) * 4],
-                           canonical.width * 4);
-                    // expand top-right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           &(original[(old_y * 256 + old_x + canonical.width) * 4]),
-                           4 * border_width);
-                }
+        if ((line == canonical.height) && (border_width == 0))
+            break;
 
-                // Copy main content
-                for (int line = 0; line < canonical.height; line++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + border_width + line;
-                    unsigned old_x = canonical.original_x;
-                    unsigned old_y = canonical.original_y + line;
-
-                    // expand left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           &(original[(old_y * 256 + old_x) * 4]),
-                           4 * border_width);
-                    // copy line
-                    memcpy(&data[(y*result_page_width + x + border_width) * 4],
-                           &original[(old_y * 256 + old_x) * 4],
-                           canonical.width * 4);
-                    // expand right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           &(original[(old_y * 256 + old_x + canonical.width) * 4]),
-                           4 * border_width);
-                }
+        memset_pattern4(dst, src, 4 * border_width);
+        memcpy(dst + 4 * border_width, src, canonical.width * 4);
+        memset_pattern4(dst + 4 * (border_width + canonical.width), src + 4 * canonical.width, 4 * border_width);
+    }
 
-                // Add bottom border
-                for (int border = 0; border < border_width; border++)
-                {
-                    unsigned x = canonical.new_x_with_border;
-                    unsigned y = canonical.new_y_with_border + canonical.height + border_width + border;
-                    unsigned old_x = canonical.original_x;
-                    unsigned old_y = canonical.original_y + canonical.height;
-
-                    // expand bottom-left pixel
-                    memset_pattern4(&data[(y*result_page_width + x) * 4],
-                           &(original[(old_y * 256 + old_x) * 4]),
-                           4 * border_width);
-                    // copy bottom line
-                    memcpy(&data[(y*result_page_width + x + border_width) * 4],
-                           &original[(old_y * 256 + old_x) * 4],
-                           canonical.width * 4);
-                    // expand bottom-right pixel
-                    memset_pattern4(&data[(y*result_page_width + x + border_width + canonical.width) * 4],
-                           &(original[(old_y * 256 + old_x + canonical.width) * 4]),
-                           4 * border_width);
-                }
-            }
+    // Top border repeats the first line, bottom border repeats line height.
+    for (int border = 0; border < border_width; border++)
+    {
+        memcpy(first_row + border * stride, content, row_size);
+    }
+    for (int border = 1; border < border_width; border++)
+    {
+        memcpy(bottom + border * stride, bottom, row_size);
+    }
+}
+
+/*!
+ * Rectangles of a texture at a mip level, as x0, y0, x1, y1. The owned
+ * rectangle is the bordered one scaled with rounding down: owned rectangles
+ * of different textures never overlap at any level. Content is kept at least
+ * one pixel wide inside of it. Returns false if the texture has vanished.
+ */
+bool bordered_texture_atlas::textureLevelRects(const canonical_object_texture &canonical, int level, unsigned owned[4], unsigned content[4]) const
+{
+    unsigned bordered[4] = {canonical.new_x_with_border,
+                            canonical.new_y_with_border,
+                            canonical.new_x_with_border + canonical.width + 2 * border_width,
+                            canonical.new_y_with_border + canonical.height + 2 * border_width};
+
+    for (int i = 0; i < 2; i++)
+    {
+        owned[i] = bordered[i] >> level;
+        owned[i + 2] = bordered[i + 2] >> level;
+        if (owned[i + 2] <= owned[i])
+            return false;
+
+        content[i] = (bordered[i] + border_width) >> level;
+        content[i + 2] = (bordered[i + 2] - border_width) >> level;
+        content[i] = (content[i] < owned[i + 2] - 1) ? (content[i]) : (owned[i + 2] - 1);
+        content[i + 2] = (content[i + 2] > content[i]) ? (content[i + 2]) : (content[i] + 1);
+        content[i + 2] = (content[i + 2] < owned[i + 2]) ? (content[i + 2]) : (owned[i + 2]);
+    }
+
+    return true;
+}
+
+/*!
+ * Filters a texture into the next mip level only from its own content of the
+ * previous level, then re-extrudes its border from the new content.
+ */
+void bordered_texture_atlas::filterTextureLevel(const canonical_object_texture &canonical, int level, const GLubyte *src, unsigned src_width, GLubyte *dst, unsigned dst_width) const
+{
+    unsigned owned[4], content[4], src_owned[4], src_content[4];
+
+    if (!textureLevelRects(canonical, level, owned, content) ||
+        !textureLevelRects(canonical, level - 1, src_owned, src_content))
+        return;
+
+    for (unsigned y = owned[1]; y < owned[3]; y++)
+    {
+        unsigned cy = (y < content[1]) ? (content[1]) : ((y >= content[3]) ? (content[3] - 1) : (y));
+        unsigned sy0 = (2 * cy < src_content[1]) ? (src_content[1]) : ((2 * cy >= src_content[3]) ? (src_content[3] - 1) : (2 * cy));
+        unsigned sy1 = (2 * cy + 1 < src_content[3]) ? ((2 * cy + 1 > sy0) ? (2 * cy + 1) : (sy0)) : (src_content[3] - 1);
+        const GLubyte *row0 = src + 4 * sy0 * src_width;
+        const GLubyte *row1 = src + 4 * sy1 * src_width;
+        GLubyte *out = dst + 4 * y * dst_width;
+
+        for (unsigned x = owned[0]; x < owned[2]; x++)
+        {
+            unsigned cx = (x < content[0]) ? (content[0]) : ((x >= content[2]) ? (content[2] - 1) : (x));
+            unsigned sx0 = (2 * cx < src_content[0]) ? (src_content[0]) : ((2 * cx >= src_content[2]) ? (src_content[2] - 1) : (2 * cx));
+            unsigned sx1 = (2 * cx + 1 < src_content[2]) ? ((2 * cx + 1 > sx0) ? (2 * cx + 1) : (sx0)) : (src_content[2] - 1);
+
+            for (int c = 0; c < 4; c++)
+                out[4 * x + c] = (row0[4 * sx0 + c] + row0[4 * sx1 + c] + row1[4 * sx0 + c] + row1[4 * sx1 + c] + 2) / 4;
         }
+    }
+}
 
-        qglBindTexture(GL_TEXTURE_2D, textureNames[page]);
-        qglTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)result_page_width, (GLsizei) result_page_height[page], 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        if(qglGenerateMipmap != NULL)
+static __inline unsigned MipSize(unsigned size, int level)
+{
+    size >>= level;
+    return (size > 0) ? (size) : (1);
+}
+
+static __inline int MipLevelsCount(unsigned width, unsigned height)
+{
+    int levels = 1;
+    while ((width > 1) || (height > 1))
+    {
+        width = (width > 1) ? (width / 2) : (1);
+        height = (height > 1) ? (height / 2) : (1);
+        levels++;
+    }
+    return levels;
+}
+
+/*!
+ * Level 0 is the composed page itself, levels from 1 are stored one after
+ * another in the mips buffer.
+ */
+static GLubyte *MipLevel(GLubyte *level0, GLubyte *mips, unsigned width, unsigned height, int level)
+{
+    if (level == 0)
+        return level0;
+
+    for (int i = 1; i < level; i++)
+        mips += 4 * MipSize(width, i) * MipSize(height, i);
+    return mips;
+}
+
+static size_t MipChainSize(unsigned width, unsigned height, int levels)
+{
+    size_t size = 0;
+    for (int i = 1; i < levels; i++)
+        size += 4 * (size_t)MipSize(width, i) * MipSize(height, i);
+    return size;
+}
+
+static bool MipsCacheLoad(const char *name, GLubyte *mips, unsigned width, unsigned height, int levels)
+{
+    uint32_t header[5];
+    uint32_t expected[5] = {MIPS_CACHE_MAGIC, MIPS_CACHE_VERSION, width, height, (uint32_t) levels};
+    size_t size = MipChainSize(width, height, levels);
+    FILE *f = fopen(name, "rb");
+    bool ret;
+
+    if (f == NULL)
+        return false;
+    ret = (fread(header, sizeof(header), 1, f) == 1) && (memcmp(header, expected, sizeof(header)) == 0) &&
+          (fread(mips, 1, size, f) == size);
+    fclose(f);
+
+    return ret;
+}
+
+static void MipsCacheSave(const char *name, const GLubyte *mips, unsigned width, unsigned height, int levels)
+{
+    uint32_t header[5] = {MIPS_CACHE_MAGIC, MIPS_CACHE_VERSION, width, height, (uint32_t) levels};
+    size_t size = MipChainSize(width, height, levels);
+    char tmp_name[256];
+    FILE *f = Sys_OpenTempFile(name, tmp_name, sizeof(tmp_name));
+    bool ok;
+
+    if (f == NULL)
+        return;
+    ok = (fwrite(header, sizeof(header), 1, f) == 1) && (fwrite(mips, 1, size, f) == size);
+    Sys_CommitTempFile(f, tmp_name, name, ok);
+}
+
+void bordered_texture_atlas::uploadPage(unsigned long page, const GLubyte *data, const GLubyte *mips, int levels, const tex_compressed_s *compressed) const
+{
+    qglBindTexture(GL_TEXTURE_2D, textures_indexes[page]);
+    if (compressed != NULL)
+    {
+        GLenum internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        GLsizei w = compressed->width;
+        GLsizei h = compressed->height;
+        const uint8_t *level_data = compressed->data;
+
+        if (compressed->format == TEX_COMPRESS_BC1)
+            internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        else if (compressed->format == TEX_COMPRESS_BC1A)
+            internal_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+
+        for (uint32_t level = 0; level < compressed->levels; level++)
         {
-            qglGenerateMipmap(GL_TEXTURE_2D);
+            GLsizei level_size = TexCompress_GetLevelSize(compressed->format, w, h);
+            qglCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, level_size, level_data);
+            level_data += level_size;
+            w = (w > 1) ? (w / 2) : (1);
+            h = (h > 1) ? (h / 2) : (1);
         }
-        else
+    }
+    else
+    {
+        qglTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)result_page_width, (GLsizei) result_page_height[page], 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        for (int level = 1; level < levels; level++)
         {
-            int mip_level = 1;
-            int w = result_page_width / 2;
-            int h = result_page_height[page] / 2;
-            GLubyte *mip_data = (GLubyte *) malloc(4 * w * h);
+            GLsizei w = MipSize(result_page_width, level);
+            GLsizei h = MipSize(result_page_height[page], level);
+            qglTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, mips);
+            mips += 4 * w * h;
+        }
+    }
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
 
-            assert(w > 0 && h > 0);
-            for(int i = 0; i < h; i++)
+/*!
+ * Pages are processed in groups on the worker pool, in stages; every stage
+ * runs a job per page or per chunk (of textures or rows) of every page. Group
+ * buffers are double buffered: while one group is processed, the calling (GL)
+ * thread uploads the previous one between its jobs.
+ */
+enum compose_stage
+{
+    COMPOSE_STAGE_TEXTURES,             // copy textures with borders
+    COMPOSE_STAGE_CACHE,                // per page: look up compressed or mips cache
+    COMPOSE_STAGE_MIP_BOX,              // box filter rows of the level (background)
+    COMPOSE_STAGE_MIP_TEXTURES,         // filter textures of the level from their own pixels
+    COMPOSE_STAGE_ENCODE,               // block compress rows of all levels
+    COMPOSE_STAGE_SAVE                  // per page: check quality, store compressed or mips cache
+};
+
+struct bordered_texture_atlas::compose_state
+{
+    bordered_texture_atlas *atlas;
+    GLubyte **buffers;
+    GLubyte **mips;
+    tex_compressed_t *compressed;       // NULL if pages are uploaded as RGBA, format NONE for rejected pages
+    bool *cached;                       // compressed page or mips are loaded from cache
+    unsigned long group_size;
+    unsigned long chunks;               // jobs per page
+    unsigned long first_page;           // group being processed
+    unsigned long upload_page;          // pages waiting for upload
+    unsigned long upload_end;
+    int upload_thread;
+    int stage;
+    int level;
+    int levels;                         // made mip levels, up to the configured max level
+};
+
+static uint32_t PageHash(const GLubyte *data, size_t words_count)
+{
+    const uint32_t *words = (const uint32_t *) data;
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < words_count; i++)
+        hash = (hash ^ words[i]) * 16777619U;
+
+    return hash;
+}
+
+static __inline unsigned long ComposeSlot(unsigned long group_size, unsigned long page)
+{
+    return ((page / group_size) % 2) * group_size + page % group_size;
+}
+
+void bordered_texture_atlas::uploadComposedPages(compose_state *state)
+{
+    const bordered_texture_atlas *atlas = state->atlas;
+    for (; state->upload_page < state->upload_end; state->upload_page++)
+    {
+        unsigned long page = state->upload_page;
+        unsigned long slot = ComposeSlot(state->group_size, page);
+        GLubyte *data = state->buffers[slot];
+        tex_compressed_p compressed = (state->compressed) ? (state->compressed + slot) : (NULL);
+        atlas->uploadPage(page, data, state->mips[slot], state->levels, (compressed && (compressed->format != TEX_COMPRESS_NONE)) ? (compressed) : (NULL));
+        // Buffers are kept zeroed outside of textures.
+        memset(data, 0, 4 * atlas->result_page_width * atlas->result_page_height[page]);
+    }
+}
+
+/*!
+ * Round trip of the base level: pages which lose too much on compression
+ * are uploaded as RGBA, and are not stored in cache.
+ */
+static bool CompressedPageQualityCheck(tex_compressed_p compressed, const GLubyte *rgba)
+{
+    GLubyte *decoded = (GLubyte *) malloc(4 * compressed->width * compressed->height);
+    float psnr;
+
+    TexCompress_Decode(compressed->format, TexCompress_GetLevel(compressed, 0), compressed->width, compressed->height, decoded);
+    psnr = TexCompress_PSNR(rgba, decoded, compressed->width, compressed->height);
+    free(decoded);
+
+    return psnr >= COMPRESSED_MIN_PSNR;
+}
+
+void bordered_texture_atlas::composeJob(void *data, int index, int thread)
+{
+    compose_state *state = (compose_state *) data;
+    const bordered_texture_atlas *atlas = state->atlas;
+    bool per_page = (state->stage == COMPOSE_STAGE_CACHE) || (state->stage == COMPOSE_STAGE_SAVE);
+    unsigned long page = state->first_page + ((per_page) ? (index) : (index / state->chunks));
+    unsigned long chunk = (per_page) ? (0) : (index % state->chunks);
+    unsigned long slot = ComposeSlot(state->group_size, page);
+    unsigned long first = atlas->page_textures_offsets[page];
+    unsigned long count = atlas->page_textures_offsets[page + 1] - first;
+    unsigned width = atlas->result_page_width;
+    unsigned height = atlas->result_page_height[page];
+    GLubyte *buffer = state->buffers[slot];
+    tex_compressed_p compressed = (state->compressed) ? (state->compressed + slot) : (NULL);
+    char name[64];
+
+    if (thread == state->upload_thread)
+        uploadComposedPages(state);
+
+    if (state->cached[slot] && (state->stage != COMPOSE_STAGE_TEXTURES) && (state->stage != COMPOSE_STAGE_CACHE))
+        return;
+
+    switch (state->stage)
+    {
+        case COMPOSE_STAGE_TEXTURES:
+            for (unsigned long i = first + chunk * count / state->chunks; i < first + (chunk + 1) * count / state->chunks; i++)
+                atlas->composeTexture(atlas->canonical_object_textures[atlas->page_textures[i]], buffer);
+            break;
+
+        case COMPOSE_STAGE_CACHE:
+            if (compressed == NULL)
             {
-                for(int j = 0; j < w; j++)
-                {
-                    mip_data[i * w * 4 + j * 4 + 0] = 0.25 * ((int)data[i * w * 16 + j * 8 + 0] + (int)data[i * w * 16 + j * 8 + 4 + 0] + (int)data[i * w * 16 + w * 8 + j * 8 + 0] + (int)data[i * w * 16 + w * 8 + j * 8 + 4 + 0]);
-                    mip_data[i * w * 4 + j * 4 + 1] = 0.25 * ((int)data[i * w * 16 + j * 8 + 1] + (int)data[i * w * 16 + j * 8 + 4 + 1] + (int)data[i * w * 16 + w * 8 + j * 8 + 1] + (int)data[i * w * 16 + w * 8 + j * 8 + 4 + 1]);
-                    mip_data[i * w * 4 + j * 4 + 2] = 0.25 * ((int)data[i * w * 16 + j * 8 + 2] + (int)data[i * w * 16 + j * 8 + 4 + 2] + (int)data[i * w * 16 + w * 8 + j * 8 + 2] + (int)data[i * w * 16 + w * 8 + j * 8 + 4 + 2]);
-                    mip_data[i * w * 4 + j * 4 + 3] = 0.25 * ((int)data[i * w * 16 + j * 8 + 3] + (int)data[i * w * 16 + j * 8 + 4 + 3] + (int)data[i * w * 16 + w * 8 + j * 8 + 3] + (int)data[i * w * 16 + w * 8 + j * 8 + 4 + 3]);
-                }
+                snprintf(name, sizeof(name), MIPS_CACHE_NAME, (unsigned long long) TexCompress_Hash(buffer, 4 * width * height));
+                state->cached[slot] = MipsCacheLoad(name, state->mips[slot], width, height, state->levels);
+                break;
             }
+            snprintf(name, sizeof(name), COMPRESSED_CACHE_NAME, (unsigned long long) TexCompress_Hash(buffer, 4 * width * height));
+            state->cached[slot] = TexCompress_Load(compressed, name) && (compressed->width == width) && (compressed->height == height) &&
+                                  (compressed->levels == (uint32_t) state->levels);
+            if (!state->cached[slot])
+                TexCompress_Setup(compressed, TexCompress_ChooseFormat(buffer, width, height), width, height, state->levels);
+            break;
 
-            //char tgan[128];
-            //WriteTGAfile("mip_00.tga", data, result_page_width, result_page_height[page], 0);
-            //sprintf(tgan, "mip_%0.2d.tga", mip_level);
-            //WriteTGAfile(tgan, mip_data, w, h, 0);
-            qglTexImage2D(GL_TEXTURE_2D, mip_level, GL_RGBA, (GLsizei)w, (GLsizei)h, 0, GL_RGBA, GL_UNSIGNED_BYTE, mip_data);
-
-            while((w > 1) && (h > 1) /*&& (mip_level < 4)*/)
+        case COMPOSE_STAGE_MIP_BOX:
             {
-                mip_level++;
-                w /= 2; w = (w==0)?1:w;
-                h /= 2; h = (h==0)?1:h;
-                for(int i = 0; i < h; i++)
+                unsigned src_width = MipSize(width, state->level - 1);
+                unsigned src_height = MipSize(height, state->level - 1);
+                unsigned dst_width = MipSize(width, state->level);
+                unsigned dst_height = MipSize(height, state->level);
+                const GLubyte *src = MipLevel(buffer, state->mips[slot], width, height, state->level - 1);
+                GLubyte *dst = MipLevel(buffer, state->mips[slot], width, height, state->level);
+
+                for (unsigned y = chunk * dst_height / state->chunks; y < (chunk + 1) * dst_height / state->chunks; y++)
                 {
-                    for(int j = 0; j < w; j++)
+                    const GLubyte *row0 = src + 4 * src_width * (2 * y);
+                    const GLubyte *row1 = src + 4 * src_width * ((2 * y + 1 < src_height) ? (2 * y + 1) : (2 * y));
+                    GLubyte *out = dst + 4 * dst_width * y;
+                    for (unsigned x = 0; x < dst_width; x++)
                     {
-                        mip_data[i * w * 4 + j * 4 + 0] = 0.25 * ((int)mip_data[i * w * 16 + j * 8 + 0] + (int)mip_data[i * w * 16 + j * 8 + 4 + 0] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 0] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 4 + 0]);
-                        mip_data[i * w * 4 + j * 4 + 1] = 0.25 * ((int)mip_data[i * w * 16 + j * 8 + 1] + (int)mip_data[i * w * 16 + j * 8 + 4 + 1] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 1] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 4 + 1]);
-                        mip_data[i * w * 4 + j * 4 + 2] = 0.25 * ((int)mip_data[i * w * 16 + j * 8 + 2] + (int)mip_data[i * w * 16 + j * 8 + 4 + 2] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 2] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 4 + 2]);
-                        mip_data[i * w * 4 + j * 4 + 3] = 0.25 * ((int)mip_data[i * w * 16 + j * 8 + 3] + (int)mip_data[i * w * 16 + j * 8 + 4 + 3] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 3] + (int)mip_data[i * w * 16 + w * 8 + j * 8 + 4 + 3]);
+                        unsigned x0 = 8 * x;
+                        unsigned x1 = (2 * x + 1 < src_width) ? (x0 + 4) : (x0);
+                        for (int c = 0; c < 4; c++)
+                            out[4 * x + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
                     }
                 }
-                //sprintf(tgan, "mip_%0.2d.tga", mip_level);
-                //WriteTGAfile(tgan, mip_data, w, h, 0);
-                qglTexImage2D(GL_TEXTURE_2D, mip_level, GL_RGBA, (GLsizei)w, (GLsizei)h, 0, GL_RGBA, GL_UNSIGNED_BYTE, mip_data);
             }
-            free(mip_data);
+            break;
+
+        case COMPOSE_STAGE_MIP_TEXTURES:
+            {
+                const GLubyte *src = MipLevel(buffer, state->mips[slot], width, height, state->level - 1);
+                GLubyte *dst = MipLevel(buffer, state->mips[slot], width, height, state->level);
+                for (unsigned long i = first + chunk * count / state->chunks; i < first + (chunk + 1) * count / state->chunks; i++)
+                    atlas->filterTextureLevel(atlas->canonical_object_textures[atlas->page_textures[i]], state->level,
+                                              src, MipSize(width, state->level - 1), dst, MipSize(width, state->level));
+            }
+            break;
+
+        case COMPOSE_STAGE_ENCODE:
+            for (uint32_t level = 0; level < compressed->levels; level++)
+            {
+                unsigned w = MipSize(width, level);
+                unsigned rows = (MipSize(height, level) + 3) / 4;
+                TexCompress_EncodeBlockRows(compressed->format, MipLevel(buffer, state->mips[slot], width, height, level), w, MipSize(height, level),
+                                            chunk * rows / state->chunks, (chunk + 1) * rows / state->chunks, TexCompress_GetLevel(compressed, level));
+            }
+            break;
+
+        case COMPOSE_STAGE_SAVE:
+            if (compressed == NULL)
+            {
+                snprintf(name, sizeof(name), MIPS_CACHE_NAME, (unsigned long long) TexCompress_Hash(buffer, 4 * width * height));
+                MipsCacheSave(name, state->mips[slot], width, height, state->levels);
+                break;
+            }
+            if (!CompressedPageQualityCheck(compressed, buffer))
+            {
+                compressed->format = TEX_COMPRESS_NONE;
+                break;
+            }
+            snprintf(name, sizeof(name), COMPRESSED_CACHE_NAME, (unsigned long long) TexCompress_Hash(buffer, 4 * width * height));
+            TexCompress_Save(compressed, name);
+            break;
+    }
+}
+
+void bordered_texture_atlas::runComposeStage(compose_state *state, int stage, unsigned long pages_count)
+{
+    bool per_page = (stage == COMPOSE_STAGE_CACHE) || (stage == COMPOSE_STAGE_SAVE);
+    state->stage = stage;
+    Jobs_ParallelFor(composeJob, state, (int)((per_page) ? (pages_count) : (pages_count * state->chunks)));
+}
+
+void bordered_texture_atlas::createTextures(GLuint *textureNames, bool compress, int max_level)
+{
+    compose_state state;
+    size_t page_size = 4 * (size_t)result_page_width * result_page_width;
+    int levels = MipLevelsCount(result_page_width, result_page_width);
+    unsigned long buffers_count;
+
+    // Levels above GL_TEXTURE_MAX_LEVEL are never sampled.
+    levels = ((max_level >= 0) && (max_level + 1 < levels)) ? (max_level + 1) : (levels);
+
+    qglGenTextures((GLsizei) number_result_pages, textureNames);
+
+    textures_indexes = textureNames;
+    if (number_result_pages == 0)
+        return;
+
+    state.atlas = this;
+    state.levels = levels;
+    state.upload_thread = Jobs_GetCurrentThread();
+    state.chunks = Jobs_GetThreadsCount();
+    state.group_size = COMPOSE_MEMORY_MAX / (2 * page_size);
+    state.group_size = (state.group_size > 0) ? (state.group_size) : (1);
+    state.group_size = (state.group_size < number_result_pages) ? (state.group_size) : (number_result_pages);
+    buffers_count = (2 * state.group_size < number_result_pages) ? (2 * state.group_size) : (number_result_pages);
+    state.buffers = (GLubyte **) malloc(buffers_count * sizeof(GLubyte *));
+    state.mips = (GLubyte **) malloc(buffers_count * sizeof(GLubyte *));
+    state.cached = (bool *) calloc(buffers_count, sizeof(bool));
+    for (unsigned long i = 0; i < buffers_count; i++)
+    {
+        state.buffers[i] = (GLubyte *) calloc(page_size, 1);
+        state.mips[i] = (GLubyte *) malloc(page_size / 3 + 4 * levels);
+    }
+    state.compressed = NULL;
+    if (compress && (qglCompressedTexImage2D != NULL))
+    {
+        state.compressed = (tex_compressed_t *) malloc(buffers_count * sizeof(tex_compressed_t));
+        for (unsigned long i = 0; i < buffers_count; i++)
+            TexCompress_Init(state.compressed + i);
+    }
+    state.upload_page = 0;
+    state.upload_end = 0;
+
+    for (state.first_page = 0; state.first_page < number_result_pages; state.first_page += state.group_size)
+    {
+        unsigned long pages_count = number_result_pages - state.first_page;
+        pages_count = (pages_count < state.group_size) ? (pages_count) : (state.group_size);
+
+        runComposeStage(&state, COMPOSE_STAGE_TEXTURES, pages_count);
+#ifndef NDEBUG
+        // Parallel composition must give the same bytes as the old serial loop.
+        for (unsigned long page = state.first_page; page < state.first_page + pages_count; page++)
+            assert(PageHash(state.buffers[ComposeSlot(state.group_size, page)], (size_t)result_page_width * result_page_height[page]) == getReferencePageHash(page));
+#endif
+        if (state.compressed || (levels > 1))
+            runComposeStage(&state, COMPOSE_STAGE_CACHE, pages_count);
+        for (state.level = 1; state.level < levels; state.level++)
+        {
+            runComposeStage(&state, COMPOSE_STAGE_MIP_BOX, pages_count);
+            runComposeStage(&state, COMPOSE_STAGE_MIP_TEXTURES, pages_count);
+        }
+        if (state.compressed)
+            runComposeStage(&state, COMPOSE_STAGE_ENCODE, pages_count);
+        if (state.compressed || (levels > 1))
+            runComposeStage(&state, COMPOSE_STAGE_SAVE, pages_count);
+
+        // The calling thread may have got no jobs at all.
+        uploadComposedPages(&state);
+        state.upload_end = state.first_page + pages_count;
+    }
+    uploadComposedPages(&state);
+
+    for (unsigned long i = 0; i < buffers_count; i++)
+    {
+        free(state.buffers[i]);
+        free(state.mips[i]);
+        if (state.compressed)
+            TexCompress_Clear(state.compressed + i);
+    }
+    free(state.buffers);
+    free(state.mips);
+    free(state.cached);
+    free(state.compressed);
+}
+
+/*!
+ * The composition loop as it was before pages were composed in parallel:
+ * scan of all textures per page, per line border expansion. It is kept only
+ * as the reference for createTextures output, so it is not optimized. Source
+ * of upscaled pages is the only addition.
+ */
+uint32_t bordered_texture_atlas::getReferencePageHash(unsigned long page) const
+{
+    size_t words_count = (size_t)result_page_width * result_page_height[page];
+    GLubyte *data = (GLubyte *) calloc(words_count, sizeof(uint32_t));
+    const unsigned original_width = 256 * page_scale;
+    uint32_t hash;
+
+    for (unsigned long texture = 0; texture < number_canonical_object_textures; texture++)
+    {
+        const canonical_object_texture &canonical = canonical_object_textures[texture];
+        if (canonical.new_page != page)
+            continue;
+
+        if (canonical.original_page == WHITE_TEXTURE_INDEX)
+        {
+            uint32_t white_pixels[1] = {0xFFFFFFFFU};
+            for (int line = 0; line < canonical.height + 2 * border_width; line++)
+            {
+                unsigned x = canonical.new_x_with_border;
+                unsigned y = canonical.new_y_with_border + line;
+
+                memset_pattern4(&data[(y * result_page_width + x) * 4], white_pixels, 4 * border_width);
+                memset_pattern4(&data[(y * result_page_width + x + border_width) * 4], white_pixels, canonical.width * 4);
+                memset_pattern4(&data[(y * result_page_width + x + border_width + canonical.width) * 4], white_pixels, 4 * border_width);
+            }
+        }
+        else
+        {
+            const GLubyte *original = (scaled_pages != NULL) ?
+                                      ((const GLubyte *) (scaled_pages + (size_t) canonical.original_page * original_width * original_width)) :
+                                      ((const GLubyte *) original_pages[canonical.original_page].pixels);
+            for (int line = 0; line < canonical.height + 2 * border_width; line++)
+            {
+                unsigned x = canonical.new_x_with_border;
+                unsigned y = canonical.new_y_with_border + line;
+                unsigned old_x = canonical.original_x;
+                unsigned old_y = canonical.original_y;
+
+                // top border repeats the first line, bottom border repeats line height.
+                if (line >= border_width + canonical.height)
+                    old_y += canonical.height;
+                else if (line >= border_width)
+                    old_y += line - border_width;
+
+                // expand left pixel
+                memset_pattern4(&data[(y * result_page_width + x) * 4],
+                                &original[(old_y * original_width + old_x) * 4],
+                                4 * border_width);
+                // copy line
+                memcpy(&data[(y * result_page_width + x + border_width) * 4],
+                       &original[(old_y * original_width + old_x) * 4],
+                       canonical.width * 4);
+                // expand right pixel
+                memset_pattern4(&data[(y * result_page_width + x + border_width + canonical.width) * 4],
+                                &original[(old_y * original_width + old_x + canonical.width) * 4],
+                                4 * border_width);
+            }
         }
-        qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
+    hash = PageHash(data, words_count);
     free(data);
+
+    return hash;
 }
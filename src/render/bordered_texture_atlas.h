@@ -32,6 +32,12 @@
 #include "../core/polygon.h"
 #include "../vt/tr_types.h"
 
+struct tex_compressed_s;
+
+// Packers of canonical textures into result pages.
+#define TEXTURE_PACKER_BSP          (0)
+#define TEXTURE_PACKER_MAX_RECTS    (1)
+
 class bordered_texture_atlas
 {
     /*!
@@ -60,14 +66,14 @@ class bordered_texture_atlas
      */
     struct canonical_object_texture
     {
-        // The unadjusted size
-        uint8_t width;
-        uint8_t height;
+        // The unadjusted size, in pixels of the (possibly upscaled) original pages
+        uint16_t width;
+        uint16_t height;
         
         // Original origin
         uint16_t original_page;
-        uint8_t original_x;
-        uint8_t original_y;
+        uint16_t original_x;
+        uint16_t original_y;
         
         // New origin
         unsigned long new_page;
@@ -78,6 +84,11 @@ class bordered_texture_atlas
     // How much border to add.
     int border_width;
     
+    // Layout algorithm and its results.
+    int packer;
+    float packing_fill_ratio;
+    float packing_time;
+    
     // Result pages
     // Note: No capacity here, this is handled internally by the layout method. Also, all result pages have the same width, which will always be less than or equal to the height.
     unsigned long number_result_pages;
@@ -87,6 +98,8 @@ class bordered_texture_atlas
     // Original data
     unsigned long number_original_pages;
     const tr4_textile32_t *original_pages;
+    const uint32_t *scaled_pages;           // upscaled copy of original pages or NULL
+    unsigned page_scale;
     
     // Object textures in the file.
     unsigned long number_file_object_textures;
@@ -103,9 +116,40 @@ class bordered_texture_atlas
     
     GLuint *textures_indexes;
     
+    // Canonical textures bucketed by result page: indices of page p textures are page_textures[page_textures_offsets[p] .. page_textures_offsets[p + 1]).
+    unsigned long *page_textures_offsets;
+    unsigned long *page_textures;
+    
     /*! Lays out the texture data and switches the atlas to laid out mode. */
     void layOutTextures();
     
+    /*! Fills page_textures and page_textures_offsets with one counting pass. */
+    void bucketTexturesByPage();
+    
+    /*! Copies one canonical texture with its borders into the page data. Textures on a page never overlap, so this may run concurrently for one page. */
+    void composeTexture(const canonical_object_texture &canonical, GLubyte *data) const;
+    
+    /*! Rectangles owned by a texture at a mip level and its content inside of them; false if the texture is smaller than a pixel there. */
+    bool textureLevelRects(const canonical_object_texture &canonical, int level, unsigned owned[4], unsigned content[4]) const;
+    
+    /*! Filters one texture into a mip level from its own content only, and extrudes its border again. Textures never share owned pixels, so this may run concurrently for one page. */
+    void filterTextureLevel(const canonical_object_texture &canonical, int level, const GLubyte *src, unsigned src_width, GLubyte *dst, unsigned dst_width) const;
+    
+    /*! Uploads page data with levels - 1 mip levels (or its compressed version, if not NULL) to its texture name. Must run on the GL thread. */
+    void uploadPage(unsigned long page, const GLubyte *data, const GLubyte *mips, int levels, const tex_compressed_s *compressed) const;
+    
+    /*! Pipeline state of createTextures, defined in the implementation. */
+    struct compose_state;
+    
+    /*! Uploads composed pages which are waiting for it and clears their buffers for reuse. */
+    static void uploadComposedPages(compose_state *state);
+    
+    /*! Worker pool callback of createTextures: runs the current stage for one page or one chunk of a page. */
+    static void composeJob(void *data, int index, int thread);
+    
+    /*! Runs one stage of createTextures for all pages of the current group. */
+    static void runComposeStage(compose_state *state, int stage, unsigned long pages_count);
+    
     /*! For sorting: Compares two different textures and sorts them by size. */
     static int compareCanonicalTextureSizes(const void *parameter1, const void *parameter2);
     
@@ -119,14 +163,19 @@ public:
     /*!
      * Create a new Bordered texture atlas with the specified border width and textures. This lays out all the data for the textures, but does not upload anything to OpenGL yet.
      * @param border The border width around each texture.
+     * @param texture_packer TEXTURE_PACKER_BSP or TEXTURE_PACKER_MAX_RECTS (best short side fit, denser but slower).
+     * @param upscaled_pages Optional copy of pages upscaled by upscale, (256 * upscale)^2 pixels each. If given, textures are taken from it.
      */
     bordered_texture_atlas(int border,
+                           int texture_packer,
                            size_t page_count,
                            const tr4_textile32_t *pages,
                            size_t object_texture_count,
                            const tr4_object_texture_t *object_textures,
                            size_t sprite_texture_count,
-                           const tr_sprite_texture_t *sprite_textures);
+                           const tr_sprite_texture_t *sprite_textures,
+                           const uint32_t *upscaled_pages = NULL,
+                           int upscale = 1);
     
     /*!
      * Destroy all contents of a bordered texture atlas. Using the atlas afterwards
@@ -167,6 +216,12 @@ public:
      */
     unsigned long getNumAtlasPages() const;
     
+    /*!
+     * Layout metrics: used area (textures with borders) to total area of the pages, and time of layout in seconds.
+     */
+    float getPackingFillRatio() const;
+    float getPackingTime() const;
+    
     /*!
      * Returns height of specified file object texture.
      */
@@ -179,8 +234,15 @@ public:
      * @param atlas The atlas.
      * @param textureNames The names of the textures.
      * @param additionalTextureNames How many texture names to create in addition to the needed ones.
+     * @param compress Upload pages block compressed (BC1 / BC3), if the driver supports S3TC.
+     * @param max_level The last mip level to make (GL_TEXTURE_MAX_LEVEL), negative - full chain.
+     */
+    void createTextures(GLuint *textureNames, bool compress = false, int max_level = -1);
+    
+    /*!
+     * Composes the specified page into a temporary buffer with the old serial composition loop (not with composeTexture) and returns FNV-1a hash of its pixels. Pixels outside of the textures are zero. Debug builds check every page composed by createTextures against it.
      */
-    void createTextures(GLuint *textureNames);
+    uint32_t getReferencePageHash(unsigned long page) const;
 
 };
 
@@ -0,0 +1,170 @@
+
+#include "max_rects_2d.h"
+
+#include <stdlib.h>
+
+typedef struct max_rects_2d_rect_s
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+}max_rects_2d_rect_t, *max_rects_2d_rect_p;
+
+/*!
+ * The free list contains only maximal rectangles: no one of them lies inside another.
+ */
+struct max_rects_2d_s
+{
+    max_rects_2d_rect_p free_rects;
+    unsigned free_count;
+    unsigned free_capacity;
+};
+
+#define MAX_RECTS_CAPACITY_GROWTH 64
+
+
+static void maxRects2D_AddFree(max_rects_2d_p rects, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+    max_rects_2d_rect_p r;
+
+    if(rects->free_count >= rects->free_capacity)
+    {
+        rects->free_capacity += MAX_RECTS_CAPACITY_GROWTH;
+        rects->free_rects = realloc(rects->free_rects, rects->free_capacity * sizeof(max_rects_2d_rect_t));
+    }
+    r = rects->free_rects + rects->free_count++;
+    r->x = x;
+    r->y = y;
+    r->width = width;
+    r->height = height;
+}
+
+
+static int maxRects2D_Contains(const max_rects_2d_rect_t *outer, const max_rects_2d_rect_t *inner)
+{
+    return (inner->x >= outer->x) && (inner->y >= outer->y) &&
+           (inner->x + inner->width <= outer->x + outer->width) &&
+           (inner->y + inner->height <= outer->y + outer->height);
+}
+
+
+max_rects_2d_p MaxRects2D_Create(unsigned width, unsigned height)
+{
+    max_rects_2d_p result = malloc(sizeof(struct max_rects_2d_s));
+    result->free_rects = NULL;
+    result->free_count = 0;
+    result->free_capacity = 0;
+    maxRects2D_AddFree(result, 0, 0, width, height);
+
+    return result;
+}
+
+
+void MaxRects2D_Destroy(max_rects_2d_p rects)
+{
+    free(rects->free_rects);
+    free(rects);
+}
+
+
+int MaxRects2D_FindSpaceFor(max_rects_2d_p rects, unsigned width, unsigned height, unsigned *x, unsigned *y)
+{
+    max_rects_2d_rect_t used = {0, 0, 0, 0};
+    unsigned best_short = (unsigned)-1;
+    unsigned best_long = (unsigned)-1;
+    unsigned old_count, i;
+    int found = 0;
+
+    for(i = 0; i < rects->free_count; i++)
+    {
+        max_rects_2d_rect_p r = rects->free_rects + i;
+        if((r->width >= width) && (r->height >= height))
+        {
+            unsigned dw = r->width - width;
+            unsigned dh = r->height - height;
+            unsigned s = (dw < dh) ? (dw) : (dh);
+            unsigned l = (dw < dh) ? (dh) : (dw);
+            if((s < best_short) || ((s == best_short) && (l < best_long)))
+            {
+                best_short = s;
+                best_long = l;
+                used.x = r->x;
+                used.y = r->y;
+                found = 1;
+            }
+        }
+    }
+
+    if(!found)
+    {
+        return 0;
+    }
+
+    used.width = width;
+    used.height = height;
+    *x = used.x;
+    *y = used.y;
+
+    // Split every free rectangle intersecting the used one into up to four maximal parts.
+    old_count = rects->free_count;
+    for(i = 0; i < old_count;)
+    {
+        max_rects_2d_rect_t f = rects->free_rects[i];
+        if((used.x >= f.x + f.width) || (used.x + used.width <= f.x) ||
+           (used.y >= f.y + f.height) || (used.y + used.height <= f.y))
+        {
+            i++;
+            continue;
+        }
+
+        if(used.x > f.x)
+        {
+            maxRects2D_AddFree(rects, f.x, f.y, used.x - f.x, f.height);
+        }
+        if(used.x + used.width < f.x + f.width)
+        {
+            maxRects2D_AddFree(rects, used.x + used.width, f.y, f.x + f.width - used.x - used.width, f.height);
+        }
+        if(used.y > f.y)
+        {
+            maxRects2D_AddFree(rects, f.x, f.y, f.width, used.y - f.y);
+        }
+        if(used.y + used.height < f.y + f.height)
+        {
+            maxRects2D_AddFree(rects, f.x, used.y + used.height, f.width, f.y + f.height - used.y - used.height);
+        }
+
+        // Remove split rectangle; the last old one takes its place, new ones are moved down.
+        old_count--;
+        rects->free_rects[i] = rects->free_rects[old_count];
+        rects->free_count--;
+        rects->free_rects[old_count] = rects->free_rects[rects->free_count];
+    }
+
+    // Old rectangles are maximal already, so only the new ones may be redundant.
+    for(i = old_count; i < rects->free_count;)
+    {
+        unsigned j;
+        int redundant = 0;
+        for(j = 0; j < rects->free_count; j++)
+        {
+            if((j != i) && maxRects2D_Contains(rects->free_rects + j, rects->free_rects + i))
+            {
+                redundant = 1;
+                break;
+            }
+        }
+
+        if(redundant)
+        {
+            rects->free_rects[i] = rects->free_rects[--rects->free_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return 1;
+}
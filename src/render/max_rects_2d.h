@@ -0,0 +1,41 @@
+#ifndef MAX_RECTS_2D_H
+#define MAX_RECTS_2D_H
+
+/*!
+ * @header max_rects_2d
+ * @abstract Manage the fill state of a 2D rectangle with the MaxRects algorithm.
+ * @discussion Alternative to bsp_tree_2d for the bordered texture atlas, with the same contract of FindSpaceFor. It keeps the list of maximal free rectangles (they may overlap each other) and places every new area into the free rectangle where it leaves the shortest side leftover (best short side fit). Rotation is never done. This packs denser than the BSP tree, at the cost of more work per insertion.
+ * @see bsp_tree_2d
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * The struct that defines this type. Its contents are not relevant for or accessible to clients.
+ */
+typedef struct max_rects_2d_s *max_rects_2d_p;
+
+/*!
+ * Creates a new area with the given dimensions.
+ */
+max_rects_2d_p MaxRects2D_Create(unsigned width, unsigned height);
+
+/*!
+ * Destroys an area and releases all allocated resources.
+ */
+void MaxRects2D_Destroy(max_rects_2d_p rects);
+
+/*!
+ * @abstract Find space for a given rectangle within the area.
+ * @discussion Same as BSPTree2D_FindSpaceFor: produces the start of an area that has the passed in size, and does not overlap any area returned by previous calls. If no such area can be found, it returns 0 and leaves the internal state untouched.
+ * @result 1 if such an area was found, or 0 if no area was found.
+ */
+int MaxRects2D_FindSpaceFor(max_rects_2d_p rects, unsigned width, unsigned height, unsigned *x, unsigned *y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAX_RECTS_2D_H */
@@ -27,6 +27,7 @@
 #include "../character_controller.h"
 #include "../engine.h"
 #include "../physics.h"
+#include "../residency.h"
 
 CRender renderer;
 
@@ -44,12 +45,48 @@ m_rooms(NULL),
 m_rooms_count(0),
 m_anim_sequences(NULL),
 m_anim_sequences_count(0),
+m_anim_textures_tick(1),
+m_anim_textures_time(0.0f),
+m_anim_meshes_count(0),
+m_anim_meshes_size(0),
+m_anim_meshes(NULL),
+m_anim_texcoords_count(0),
+m_anim_texcoords_size(0),
+m_anim_texcoords(NULL),
+m_anim_texcoords_dirty_first(0),
+m_anim_texcoords_dirty_last(0),
+m_anim_texcoords_vbo_size(0),
+m_anim_texcoords_vbo(0),
 m_active_transparency(0),
 m_active_texture(0),
 r_list_size(0),
 r_list_active_count(0),
 r_list(NULL),
 frustumManager(NULL),
+m_sprites_count(0),
+m_sprites_size(0),
+m_sprites(NULL),
+m_sprites_vertices(NULL),
+m_sprites_vbo(0),
+m_player_item(-1),
+m_entity_items_count(0),
+m_entity_items_size(0),
+m_entity_items(NULL),
+m_bone_items_count(0),
+m_bone_items_size(0),
+m_bone_items(NULL),
+m_statics_count(0),
+m_statics_size(0),
+m_statics(NULL),
+m_stencil_vertices_size(0),
+m_stencil_vertices(NULL),
+m_skin_count(0),
+m_skin_size(0),
+m_skin_items(NULL),
+m_skin_data_count(0),
+m_skin_data_size(0),
+m_skin_data(NULL),
+m_skin_vbo(0),
 shaderManager(NULL),
 debugDrawer(NULL),
 dynamicBSP(NULL),
@@ -79,6 +116,63 @@ CRender::~CRender()
         frustumManager = NULL;
     }
 
+    free(m_sprites);
+    m_sprites = NULL;
+    free(m_sprites_vertices);
+    m_sprites_vertices = NULL;
+    m_sprites_count = 0;
+    m_sprites_size = 0;
+    if(m_sprites_vbo != 0)
+    {
+        qglDeleteBuffersARB(1, &m_sprites_vbo);
+        m_sprites_vbo = 0;
+    }
+
+    free(m_entity_items);
+    m_entity_items = NULL;
+    free(m_bone_items);
+    m_bone_items = NULL;
+    free(m_statics);
+    m_statics = NULL;
+    free(m_stencil_vertices);
+    m_stencil_vertices = NULL;
+    m_entity_items_count = 0;
+    m_entity_items_size = 0;
+    m_bone_items_count = 0;
+    m_bone_items_size = 0;
+    m_statics_count = 0;
+    m_statics_size = 0;
+    m_stencil_vertices_size = 0;
+
+    free(m_skin_items);
+    m_skin_items = NULL;
+    free(m_skin_data);
+    m_skin_data = NULL;
+    m_skin_count = 0;
+    m_skin_size = 0;
+    m_skin_data_count = 0;
+    m_skin_data_size = 0;
+    if(m_skin_vbo != 0)
+    {
+        qglDeleteBuffersARB(1, &m_skin_vbo);
+        m_skin_vbo = 0;
+    }
+
+    free(m_anim_meshes);
+    m_anim_meshes = NULL;
+    free(m_anim_texcoords);
+    m_anim_texcoords = NULL;
+    m_anim_meshes_count = 0;
+    m_anim_meshes_size = 0;
+    m_anim_texcoords_count = 0;
+    m_anim_texcoords_size = 0;
+    if(m_anim_texcoords_vbo != 0)
+    {
+        qglDeleteBuffersARB(1, &m_anim_texcoords_vbo);
+        m_anim_texcoords_vbo = 0;
+    }
+    m_anim_texcoords_vbo_size = 0;
+
     if(debugDrawer)
     {
         delete debugDrawer;
@@ -107,6 +201,9 @@ void CRender::InitSettings()
     settings.mipmaps = 3;
     settings.mipmap_mode = 3;
     settings.texture_border = 8;
+    settings.texture_packer = 0;
+    settings.texture_compression = 0;
+    settings.texture_upscale = 1;
     settings.z_depth = 16;
     settings.fog_enabled = 1;
     settings.fog_color[0] = 0.0f;
@@ -133,6 +230,13 @@ void CRender::ResetWorld(struct room_s *rooms, uint32_t rooms_count, struct anim
     m_rooms_count = rooms_count;
     m_anim_sequences = anim_sequences;
     m_anim_sequences_count = anim_sequences_count;
+    m_anim_textures_time = 0.0f;
+
+    // meshes of the old world are gone, they register again on first draw
+    m_anim_meshes_count = 0;
+    m_anim_texcoords_count = 0;
+    m_anim_texcoords_dirty_first = 0;
+    m_anim_texcoords_dirty_last = 0;
 
     if(m_rooms)
     {
@@ -159,25 +263,46 @@ void CRender::ResetWorld(struct room_s *rooms, uint32_t rooms_count, struct anim
     }
 }
 
-// This function is used for updating global animated texture frame
+// Called by game frame; time is applied to sequences by GenWorldList, so DrawList
+// never sees them changing, even if the game frame runs on its own thread.
 void CRender::UpdateAnimTextures()
 {
+    m_anim_textures_time += engine_frame_time;
+}
+
+// This function is used for updating global animated texture frame
+// Sequences which really changed are marked with the new tick, so meshes rewrite their texcoords only after that.
+void CRender::AdvanceAnimTextures()
+{
+    if(m_anim_textures_time <= 0.0f)
+    {
+        return;
+    }
+
+    m_anim_textures_tick++;
     if(m_anim_sequences)
     {
         anim_seq_p seq = m_anim_sequences;
         for(uint16_t i = 0; i < m_anim_sequences_count; i++, seq++)
         {
+            uint16_t old_frame = seq->current_frame;
+
             if(seq->frame_lock)
             {
                 continue;
             }
 
-            seq->frame_time += engine_frame_time;
+            seq->frame_time += m_anim_textures_time;
             if(seq->uvrotate)
             {
                 int j = (seq->frame_time / seq->frame_rate);
+                GLfloat uvrotate = seq->frames[seq->current_frame].current_uvrotate;
                 seq->frame_time -= (float)j * seq->frame_rate;
                 seq->frames[seq->current_frame].current_uvrotate = seq->frame_time * seq->frames[seq->current_frame].uvrotate_max / seq->frame_rate;
+                if(uvrotate != seq->frames[seq->current_frame].current_uvrotate)
+                {
+                    seq->change_tick = m_anim_textures_tick;
+                }
             }
             else if(seq->frame_time >= seq->frame_rate)
             {
@@ -220,21 +345,116 @@ void CRender::UpdateAnimTextures()
                         seq->current_frame %= seq->frames_count;
                         break;
                 };
+
+                if(seq->current_frame != old_frame)
+                {
+                    seq->change_tick = m_anim_textures_tick;
+                }
+            }
+        }
+
+        for(uint32_t i = 0; i < m_anim_meshes_count; i++)
+        {
+            this->FillAnimatedTexCoords(m_anim_meshes[i], true);
+        }
+    }
+    m_anim_textures_time = 0.0f;
+}
+
+
+void CRender::AddAnimatedMesh(struct base_mesh_s *mesh)
+{
+    if(m_anim_meshes_count >= m_anim_meshes_size)
+    {
+        m_anim_meshes_size += 64;
+        m_anim_meshes = (struct base_mesh_s**)realloc(m_anim_meshes, m_anim_meshes_size * sizeof(struct base_mesh_s*));
+    }
+    if(m_anim_texcoords_count + mesh->animated_vertex_count > m_anim_texcoords_size)
+    {
+        m_anim_texcoords_size = m_anim_texcoords_count + mesh->animated_vertex_count + 1024;
+        m_anim_texcoords = (GLfloat*)realloc(m_anim_texcoords, m_anim_texcoords_size * sizeof(GLfloat [2]));
+    }
+
+    m_anim_meshes[m_anim_meshes_count++] = mesh;
+    mesh->animated_texcoord_offset = m_anim_texcoords_count;
+    m_anim_texcoords_count += mesh->animated_vertex_count;
+    this->FillAnimatedTexCoords(mesh, false);
+}
+
+
+void CRender::FillAnimatedTexCoords(struct base_mesh_s *mesh, bool changed_only)
+{
+    uint32_t offset = mesh->animated_texcoord_offset;
+    for(polygon_p p = mesh->animated_polygons; p; p = p->next)
+    {
+        anim_seq_p seq = m_anim_sequences + p->anim_id - 1;
+        if(!changed_only || (seq->change_tick == m_anim_textures_tick))
+        {
+            uint16_t frame = (seq->current_frame + p->frame_offset) % seq->frames_count;
+            tex_frame_p tf = seq->frames + frame;
+            GLfloat *data = m_anim_texcoords + 2 * offset;
+            for(uint16_t i = 0; i < p->vertex_count; i++, data += 2)
+            {
+                ApplyAnimTextureTransformation(data, p->vertices[i].tex_coord, tf);
+            }
+
+            if(m_anim_texcoords_dirty_last <= m_anim_texcoords_dirty_first)
+            {
+                m_anim_texcoords_dirty_first = offset;
+                m_anim_texcoords_dirty_last = offset + p->vertex_count;
+            }
+            else
+            {
+                m_anim_texcoords_dirty_first = (offset < m_anim_texcoords_dirty_first) ? (offset) : (m_anim_texcoords_dirty_first);
+                m_anim_texcoords_dirty_last = (offset + p->vertex_count > m_anim_texcoords_dirty_last) ? (offset + p->vertex_count) : (m_anim_texcoords_dirty_last);
             }
         }
+        offset += p->vertex_count;
     }
 }
 
+
+// One upload for all texcoords changed since the last flush; the buffer is only reallocated when it grows.
+void CRender::FlushAnimatedTexCoords()
+{
+    if(m_anim_texcoords_dirty_last <= m_anim_texcoords_dirty_first)
+    {
+        return;
+    }
+
+    if(m_anim_texcoords_vbo == 0)
+    {
+        qglGenBuffersARB(1, &m_anim_texcoords_vbo);
+    }
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, m_anim_texcoords_vbo);
+    if(m_anim_texcoords_count > m_anim_texcoords_vbo_size)
+    {
+        m_anim_texcoords_vbo_size = m_anim_texcoords_size;
+        qglBufferDataARB(GL_ARRAY_BUFFER_ARB, m_anim_texcoords_vbo_size * sizeof(GLfloat [2]), NULL, GL_DYNAMIC_DRAW_ARB);
+        qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, m_anim_texcoords_count * sizeof(GLfloat [2]), m_anim_texcoords);
+    }
+    else
+    {
+        qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, m_anim_texcoords_dirty_first * sizeof(GLfloat [2]),
+                            (m_anim_texcoords_dirty_last - m_anim_texcoords_dirty_first) * sizeof(GLfloat [2]),
+                            m_anim_texcoords + 2 * m_anim_texcoords_dirty_first);
+    }
+    m_anim_texcoords_dirty_first = 0;
+    m_anim_texcoords_dirty_last = 0;
+}
+
 /**
  * Renderer list generation by current world and camera
  */
 void CRender::GenWorldList(struct camera_s *cam)
 {
     this->CleanList();                                                          // clear old render list
+    this->AdvanceAnimTextures();
     this->dynamicBSP->Reset(m_anim_sequences);
     this->frustumManager->Reset();
     cam->frustum->next = NULL;
-    m_camera = cam;
+    m_camera_state = *cam;
+    m_camera = &m_camera_state;
 
     if(m_rooms == NULL)
     {
@@ -244,6 +464,7 @@ void CRender::GenWorldList(struct camera_s *cam)
     room_p curr_room = World_FindRoomByPosCogerrence(cam->pos, cam->current_room);     // find room that contains camera
 
     cam->current_room = curr_room;                                              // set camera's cuttent room pointer
+    m_camera_state.current_room = curr_room;
     if(curr_room != NULL)                                                       // camera located in some room
     {
         const float eps = 1.0f;
@@ -333,6 +554,9 @@ void CRender::GenWorldList(struct camera_s *cam)
             }
         }
     }
+
+    this->GenEntityList();
+    this->GenTransparencyList();
 }
 
 /**
@@ -363,11 +587,10 @@ void CRender::DrawList()
 
         m_active_texture = 0;
         this->DrawSkyBox(m_camera->gl_view_proj_mat);
-        entity_p player = World_GetPlayer();
 
-        if(player)
+        if(m_player_item >= 0)
         {
-            this->DrawEntity(player, m_camera->gl_view_mat, m_camera->gl_view_proj_mat);
+            this->DrawEntityItem(m_entity_items + m_player_item, m_camera->gl_view_mat, m_camera->gl_view_proj_mat);
         }
 
         /*
@@ -375,75 +598,20 @@ void CRender::DrawList()
          */
         for(uint32_t i = 0; i < r_list_active_count; i++)
         {
-            this->DrawRoom(r_list[i].room, m_camera->gl_view_mat, m_camera->gl_view_proj_mat);
+            this->DrawRoom(r_list + i, m_camera->gl_view_mat, m_camera->gl_view_proj_mat);
         }
+        m_skin_count = 0;                                                       // entities are drawn, skin cache is not valid anymore
 
         qglDisable(GL_CULL_FACE);
         for(uint32_t i = 0; i < r_list_active_count; i++)
         {
             this->DrawRoomSprites(r_list[i].room);
         }
+        this->DrawSprites();
 
         /*
-         * NOW render transparency polygons
+         * NOW render transparency polygons, BSP is built by GenWorldList
          */
-        /*First generate BSP from base room mesh - it has good for start splitter polygons*/
-        for(uint32_t i = 0; i < r_list_active_count; i++)
-        {
-            room_p r = r_list[i].room;
-            if((r->content->mesh != NULL) && (r->content->mesh->transparency_polygons != NULL))
-            {
-                dynamicBSP->AddNewPolygonList(r->content->mesh->transparency_polygons, r->transform, m_camera->frustum);
-            }
-        }
-
-        for(uint32_t i = 0; i < r_list_active_count; i++)
-        {
-            room_p r = r_list[i].room;
-            // Add transparency polygons from static meshes (if they exists)
-            for(uint16_t j = 0; j < r->content->static_mesh_count; j++)
-            {
-                if((r->content->static_mesh[j].mesh->transparency_polygons != NULL) && Frustum_IsOBBVisibleInFrustumList(r->content->static_mesh[j].obb, (r->frustum) ? (r->frustum) : (m_camera->frustum)))
-                {
-                    dynamicBSP->AddNewPolygonList(r->content->static_mesh[j].mesh->transparency_polygons, r->content->static_mesh[j].transform, m_camera->frustum);
-                }
-            }
-
-            // Add transparency polygons from all entities (if they exists) // yes, entities may be animated and intersects with each others;
-            for(engine_container_p cont = r->content->containers; cont; cont = cont->next)
-            {
-                if(cont->object_type == OBJECT_ENTITY)
-                {
-                    entity_p ent = (entity_p)cont->object;
-                    if((ent->bf->animations.model->transparency_flags == MESH_HAS_TRANSPARENCY) && (ent->state_flags & ENTITY_STATE_VISIBLE) && Frustum_IsOBBVisibleInFrustumList(ent->obb, (r->frustum) ? (r->frustum) : (m_camera->frustum)))
-                    {
-                        float tr[16];
-                        for(uint16_t j = 0; j < ent->bf->bone_tag_count; j++)
-                        {
-                            if(ent->bf->bone_tags[j].mesh_base->transparency_polygons != NULL)
-                            {
-                                Mat4_Mat4_mul(tr, ent->transform, ent->bf->bone_tags[j].full_transform);
-                                dynamicBSP->AddNewPolygonList(ent->bf->bone_tags[j].mesh_base->transparency_polygons, tr, m_camera->frustum);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        if(player && (player->bf->animations.model->transparency_flags == MESH_HAS_TRANSPARENCY))
-        {
-            float tr[16];
-            for(uint16_t j = 0; j < player->bf->bone_tag_count; j++)
-            {
-                if(player->bf->bone_tags[j].mesh_base->transparency_polygons != NULL)
-                {
-                    Mat4_Mat4_mul(tr, player->transform, player->bf->bone_tags[j].full_transform);
-                    dynamicBSP->AddNewPolygonList(player->bf->bone_tags[j].mesh_base->transparency_polygons, tr, m_camera->frustum);
-                }
-            }
-        }
-
         if(dynamicBSP->m_root->polygons_front && (dynamicBSP->m_vbo != 0))
         {
             const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(false, false);
@@ -490,12 +658,11 @@ void CRender::DrawListDebugLines()
         if((r_flags & R_DRAW_NORMALS) && skybox)
         {
             GLfloat tr[16];
-            float *p;
+            float offset[3], q[4];
             Mat4_E_macro(tr);
-            p = skybox->animations->frames->bone_tags->offset;
-            vec3_add(tr+12, m_camera->pos, p);
-            p = skybox->animations->frames->bone_tags->qrotate;
-            Mat4_set_qrotation(tr, p);
+            SkeletalModel_GetBoneKey(skybox, 0, 0, 0, offset, q);
+            vec3_add(tr+12, m_camera->pos, offset);
+            Mat4_set_qrotation(tr, q);
             debugDrawer->DrawMeshDebugLines(skybox->mesh_tree->mesh_base, tr, NULL, NULL);
         }
 
@@ -579,6 +746,12 @@ void CRender::CleanList()
 
     r_flags &= ~R_DRAW_SKYBOX;
     r_list_active_count = 0;
+    m_player_item = -1;
+    m_entity_items_count = 0;
+    m_bone_items_count = 0;
+    m_statics_count = 0;
+    m_skin_count = 0;
+    m_skin_data_count = 0;
 }
 
 /*
@@ -724,31 +897,20 @@ void CRender::DrawBSPBackToFront(struct bsp_node_s *root)
     }
 }
 
-void CRender::DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices, const float *overrideNormals)
+void CRender::DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices, const float *overrideNormals, GLuint overrideVBO)
 {
     if(mesh->animated_vertex_count)
     {
-        // Respecify the tex coord buffer
-        qglBindBufferARB(GL_ARRAY_BUFFER, mesh->vbo_animated_texcoord_array);
-        // Tell OpenGL to discard the old values
-        qglBufferDataARB(GL_ARRAY_BUFFER, mesh->animated_vertex_count * sizeof(GLfloat [2]), 0, GL_STREAM_DRAW);
-        // Get writable data (to avoid copy)
-        GLfloat *data = (GLfloat *) qglMapBufferARB(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-
-        for(polygon_p p = mesh->animated_polygons; p; p = p->next)
+        // Texcoords are kept up to date by AdvanceAnimTextures, a new mesh is only filled once.
+        if(mesh->animated_texcoord_offset == ~0U)
         {
-            anim_seq_p seq = m_anim_sequences + p->anim_id - 1;
-            uint16_t frame = (seq->current_frame + p->frame_offset) % seq->frames_count;
-            tex_frame_p tf = seq->frames + frame;
-            for(uint16_t i = 0; i < p->vertex_count; i++, data += 2)
-            {
-                ApplyAnimTextureTransformation(data, p->vertices[i].tex_coord, tf);
-            }
+            this->AddAnimatedMesh(mesh);
         }
-        qglUnmapBufferARB(GL_ARRAY_BUFFER);
+        this->FlushAnimatedTexCoords();
 
         // Setup altered buffer
-        qglTexCoordPointer(2, GL_FLOAT, sizeof(GLfloat [2]), 0);
+        qglBindBufferARB(GL_ARRAY_BUFFER, m_anim_texcoords_vbo);
+        qglTexCoordPointer(2, GL_FLOAT, sizeof(GLfloat [2]), (void*)(mesh->animated_texcoord_offset * sizeof(GLfloat [2])));
         // Setup static data
         qglBindBufferARB(GL_ARRAY_BUFFER, mesh->vbo_animated_vertex_array);
         qglVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)offsetof(vertex_t, position));
@@ -785,8 +947,8 @@ void CRender::DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices,
     if (overrideVertices != NULL)
     {
         // Standard normals are always float. Overridden normals (from skinning)
-        // are float.
-        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+        // are float; with overrideVBO they are offsets in that buffer.
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, overrideVBO);
         qglVertexPointer(3, GL_FLOAT, 0, overrideVertices);
         qglNormalPointer(GL_FLOAT, 0, overrideNormals);
     }
@@ -805,40 +967,30 @@ void CRender::DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices,
 
 void CRender::DrawSkinMesh(struct base_mesh_s *mesh, struct base_mesh_s *parent_mesh, float transform[16])
 {
-    uint32_t i;
-    vertex_p v;
-    float *p_vertex, *src_v, *dst_v;
-    GLfloat *p_normale, *src_n, *dst_n;
-    uint32_t *ch = mesh->skin_map;
-    size_t buf_size = mesh->vertex_count * 3 * sizeof(GLfloat);
-
-    p_vertex  = (GLfloat*)Sys_GetTempMem(buf_size);
-    p_normale = (GLfloat*)Sys_GetTempMem(buf_size);
-    dst_v = p_vertex;
-    dst_n = p_normale;
-    v = mesh->vertices;
-    for(i = 0; i < mesh->vertex_count; i++, v++, ch++)
-    {
-        src_v = v->position;
-        src_n = v->normal;
-        if(*ch == 0xFFFFFFFF)
-        {
-            vec3_copy(dst_v, src_v);
-            vec3_copy(dst_n, src_n);
-        }
-        else
+    size_t buf_size = 6 * mesh->vertex_count * sizeof(GLfloat);
+    GLfloat *data;
+
+    if(!mesh->skin)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < m_skin_count; i++)
+    {
+        if((m_skin_items[i].transform == transform) && (m_skin_items[i].mesh == mesh))
         {
-            Mat4_vec3_mul_inv(dst_v, transform, parent_mesh->vertices[*ch].position);
-            dst_n[0]  = transform[0] * src_n[0] + transform[1] * src_n[1] + transform[2]  * src_n[2];             // (M^-1 * src).x
-            dst_n[1]  = transform[4] * src_n[0] + transform[5] * src_n[1] + transform[6]  * src_n[2];             // (M^-1 * src).y
-            dst_n[2]  = transform[8] * src_n[0] + transform[9] * src_n[1] + transform[10] * src_n[2];             // (M^-1 * src).z
+            const GLfloat *v = (const GLfloat*)(m_skin_items[i].offset * sizeof(GLfloat));
+            const GLfloat *n = (const GLfloat*)((m_skin_items[i].offset + 3 * mesh->vertex_count) * sizeof(GLfloat));
+            this->DrawMesh(mesh, v, n, m_skin_vbo);
+            return;
         }
-        dst_v += 3;
-        dst_n += 3;
     }
 
-    this->DrawMesh(mesh, p_vertex, p_normale);
-    Sys_ReturnTempMem(2 * buf_size);
+    // not skinned in this frame (GUI models), use client side arrays.
+    data = (GLfloat*)Sys_GetTempMem(buf_size);
+    BaseMesh_Skin(mesh, parent_mesh, transform, data);
+    this->DrawMesh(mesh, data, data + 3 * mesh->vertex_count);
+    Sys_ReturnTempMem(buf_size);
 }
 
 void CRender::DrawSkyBox(const float modelViewProjectionMatrix[16])
@@ -847,13 +999,12 @@ void CRender::DrawSkyBox(const float modelViewProjectionMatrix[16])
     if((r_flags & R_DRAW_SKYBOX) && (skybox = World_GetSkybox()))
     {
         float tr[16];
-        float *p;
+        float offset[3], q[4];
         qglDepthMask(GL_FALSE);
         tr[15] = 1.0;
-        p = skybox->animations->frames->bone_tags->offset;
-        vec3_add(tr+12, m_camera->pos, p);
-        p = skybox->animations->frames->bone_tags->qrotate;
-        Mat4_set_qrotation(tr, p);
+        SkeletalModel_GetBoneKey(skybox, 0, 0, 0, offset, q);
+        vec3_add(tr+12, m_camera->pos, offset);
+        Mat4_set_qrotation(tr, q);
         float fullView[16];
         Mat4_Mat4_mul(fullView, modelViewProjectionMatrix, tr);
 
@@ -901,128 +1052,109 @@ void CRender::DrawSkeletalModel(const lit_shader_description *shader, struct ss_
     }
 }
 
-void CRender::DrawEntity(struct entity_s *entity, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16])
+void CRender::DrawEntityItem(const struct entity_item_s *item, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16])
 {
-    if(!(entity->state_flags & ENTITY_STATE_VISIBLE) || (entity->bf->animations.model->hide && !(r_flags & R_DRAW_NULLMESHES)))
-    {
-        return;
-    }
+    const struct bone_item_s *bone = m_bone_items + item->bones_first;
+    float subModelView[16];
+    float subModelViewProjection[16];
 
     // Calculate lighting
-    const lit_shader_description *shader = this->SetupEntityLight(entity, modelViewMatrix);
+    const lit_shader_description *shader = this->SetupEntityLight(item->room, item->transform + 12, modelViewMatrix);
 
-    if(entity->bf->animations.model && entity->bf->animations.model->animations)
+    Mat4_Mat4_mul(subModelView, modelViewMatrix, item->transform);
+    Mat4_Mat4_mul(subModelViewProjection, modelViewProjectionMatrix, item->transform);
+    for(uint16_t i = 0; i < item->bones_count; i++, bone++)
     {
-        float subModelView[16];
-        float subModelViewProjection[16];
-        if(entity->bf->bone_tag_count == 1)
+        float mvTransform[16];
+        Mat4_Mat4_mul(mvTransform, subModelView, bone->transform);
+        qglUniformMatrix4fvARB(shader->model_view, 1, false, mvTransform);
+
+        float mvpTransform[16];
+        Mat4_Mat4_mul(mvpTransform, subModelViewProjection, bone->transform);
+        qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, mvpTransform);
+
+        this->DrawMesh(bone->mesh_base, NULL, NULL);
+        if(bone->mesh_slot)
         {
-            float scaledTransform[16];
-            memcpy(scaledTransform, entity->transform, sizeof(float) * 16);
-            Mat4_Scale(scaledTransform, entity->scaling[0], entity->scaling[1], entity->scaling[2]);
-            Mat4_Mat4_mul(subModelView, modelViewMatrix, scaledTransform);
-            Mat4_Mat4_mul(subModelViewProjection, modelViewProjectionMatrix, scaledTransform);
+            this->DrawMesh(bone->mesh_slot, NULL, NULL);
         }
-        else
+        if(bone->mesh_skin)
         {
-            Mat4_Mat4_mul(subModelView, modelViewMatrix, entity->transform);
-            Mat4_Mat4_mul(subModelViewProjection, modelViewProjectionMatrix, entity->transform);
+            const GLfloat *v = (const GLfloat*)(bone->skin_offset * sizeof(GLfloat));
+            const GLfloat *n = (const GLfloat*)((bone->skin_offset + 3 * bone->mesh_skin->vertex_count) * sizeof(GLfloat));
+            this->DrawMesh(bone->mesh_skin, v, n, m_skin_vbo);
         }
+    }
 
-        this->DrawSkeletalModel(shader, entity->bf, subModelView, subModelViewProjection);
-
-        if(entity->character && entity->character->hair_count)
-        {
-            base_mesh_p mesh;
-            float transform[16];
-            for(int h = 0; h < entity->character->hair_count; h++)
-            {
-                int num_elements = Hair_GetElementsCount(entity->character->hairs[h]);
-                for(uint16_t i = 0; i < num_elements; i++)
-                {
-                    Hair_GetElementInfo(entity->character->hairs[h], i, &mesh, transform);
-                    Mat4_Mat4_mul(subModelView, modelViewMatrix, transform);
-                    Mat4_Mat4_mul(subModelViewProjection, modelViewProjectionMatrix, transform);
-
-                    qglUniformMatrix4fvARB(shader->model_view, 1, GL_FALSE, subModelView);
-                    qglUniformMatrix4fvARB(shader->model_view_projection, 1, GL_FALSE, subModelViewProjection);
-                    this->DrawMesh(mesh, NULL, NULL);
-                }
-            }
-        }
+    for(uint16_t i = 0; i < item->hair_count; i++, bone++)
+    {
+        Mat4_Mat4_mul(subModelView, modelViewMatrix, bone->transform);
+        Mat4_Mat4_mul(subModelViewProjection, modelViewProjectionMatrix, bone->transform);
+        qglUniformMatrix4fvARB(shader->model_view, 1, GL_FALSE, subModelView);
+        qglUniformMatrix4fvARB(shader->model_view_projection, 1, GL_FALSE, subModelViewProjection);
+        this->DrawMesh(bone->mesh_base, NULL, NULL);
     }
 }
 
-void CRender::DrawRoom(struct room_s *room, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16])
+void CRender::DrawRoom(const struct render_list_s *r, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16])
 {
     float transform[16];
-    engine_container_p cont;
-    entity_p ent;
 
     const shader_description *lastShader = 0;
 
 #if STENCIL_FRUSTUM
     ////start test stencil test code
-    bool need_stencil = false;
-    if(room->frustum != NULL)
+    bool need_stencil = r->need_stencil;
+    if(need_stencil)
     {
-        for(uint16_t i = 0; i < room->overlapped_room_list_size; i++)
-        {
-            if(room->overlapped_room_list[i]->is_in_r_list)
+        const int elem_size = (3 + 3 + 4 + 2) * sizeof(GLfloat);
+        const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(false, false);
+        size_t buf_size;
+
+        qglUseProgramObjectARB(shader->program);
+        qglUniform1iARB(shader->sampler, 0);
+        qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, m_camera->gl_view_proj_mat);
+        qglEnable(GL_STENCIL_TEST);
+        qglClear(GL_STENCIL_BUFFER_BIT);
+        qglStencilFunc(GL_NEVER, 1, 0x00);
+        qglStencilOp(GL_REPLACE, GL_KEEP, GL_KEEP);
+        for(frustum_p f = r->frustum; f; f = f->next)
+        {
+            buf_size = f->vertex_count * elem_size;
+            if(buf_size > m_stencil_vertices_size)
             {
-                need_stencil = true;
-                break;
+                m_stencil_vertices_size = buf_size;
+                m_stencil_vertices = (GLfloat*)realloc(m_stencil_vertices, buf_size);
             }
-        }
-
-        if(need_stencil)
-        {
-            const int elem_size = (3 + 3 + 4 + 2) * sizeof(GLfloat);
-            const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(false, false);
-            size_t buf_size;
-
-            qglUseProgramObjectARB(shader->program);
-            qglUniform1iARB(shader->sampler, 0);
-            qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, engine_camera.gl_view_proj_mat);
-            qglEnable(GL_STENCIL_TEST);
-            qglClear(GL_STENCIL_BUFFER_BIT);
-            qglStencilFunc(GL_NEVER, 1, 0x00);
-            qglStencilOp(GL_REPLACE, GL_KEEP, GL_KEEP);
-            for(frustum_p f = room->frustum; f; f = f->next)
+            GLfloat *v, *buf = m_stencil_vertices;                          // not temp mem, game frame may use it now
+            v=buf;
+            for(int16_t i = f->vertex_count - 1; i >= 0; i--)
             {
-                buf_size = f->vertex_count * elem_size;
-                GLfloat *v, *buf = (GLfloat*)Sys_GetTempMem(buf_size);
-                v=buf;
-                for(int16_t i = f->vertex_count - 1; i >= 0; i--)
-                {
-                    vec3_copy(v, f->vertex+3*i);                    v+=3;
-                    vec3_copy_inv(v, engine_camera.view_dir);       v+=3;
-                    vec4_set_one(v);                                v+=4;
-                    v[0] = v[1] = 0.0;                              v+=2;
-                }
-
-                m_active_texture = 0;
-                BindWhiteTexture();
-                qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-                qglVertexPointer(3, GL_FLOAT, elem_size, buf+0);
-                qglNormalPointer(GL_FLOAT, elem_size, buf+3);
-                qglColorPointer(4, GL_FLOAT, elem_size, buf+3+3);
-                qglTexCoordPointer(2, GL_FLOAT, elem_size, buf+3+3+4);
-                qglDrawArrays(GL_TRIANGLE_FAN, 0, f->vertex_count);
-
-                Sys_ReturnTempMem(buf_size);
+                vec3_copy(v, f->vertex+3*i);                    v+=3;
+                vec3_copy_inv(v, m_camera->view_dir);           v+=3;
+                vec4_set_one(v);                                v+=4;
+                v[0] = v[1] = 0.0;                              v+=2;
             }
-            qglStencilFunc(GL_EQUAL, 1, 0xFF);
+
+            m_active_texture = 0;
+            BindWhiteTexture();
+            qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+            qglVertexPointer(3, GL_FLOAT, elem_size, buf+0);
+            qglNormalPointer(GL_FLOAT, elem_size, buf+3);
+            qglColorPointer(4, GL_FLOAT, elem_size, buf+3+3);
+            qglTexCoordPointer(2, GL_FLOAT, elem_size, buf+3+3+4);
+            qglDrawArrays(GL_TRIANGLE_FAN, 0, f->vertex_count);
         }
+        qglStencilFunc(GL_EQUAL, 1, 0xFF);
     }
 #endif
 
-    if(!(r_flags & R_SKIP_ROOM) && room->content->mesh)
+    if(!(r_flags & R_SKIP_ROOM) && r->mesh)
     {
         float modelViewProjectionTransform[16];
-        Mat4_Mat4_mul(modelViewProjectionTransform, modelViewProjectionMatrix, room->transform);
+        Mat4_Mat4_mul(modelViewProjectionTransform, modelViewProjectionMatrix, r->transform);
 
-        const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(room->content->light_mode == 1, room->flags & 1);
+        const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(r->light_mode == 1, r->flags & 1);
 
         GLfloat tint[4];
         CalculateWaterTint(tint, 1);
@@ -1036,153 +1168,447 @@ void CRender::DrawRoom(struct room_s *room, const float modelViewMatrix[16], con
         qglUniform1fARB(shader->current_tick, (GLfloat) SDL_GetTicks());
         qglUniform1iARB(shader->sampler, 0);
         qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, modelViewProjectionTransform);
-        this->DrawMesh(room->content->mesh, NULL, NULL);
+        this->DrawMesh(r->mesh, NULL, NULL);
+    }
+
+    for(uint32_t i = 0; i < r->entities_count; i++)
+    {
+        this->DrawEntityItem(m_entity_items + r->entities_first + i, modelViewMatrix, modelViewProjectionMatrix);
     }
 
-    if (room->content->static_mesh_count > 0)
+    if(r->statics_count > 0)
     {
-        qglUseProgramObjectARB(shaderManager->getStaticMeshShader()->program);
-        for(uint32_t i = 0; i < room->content->static_mesh_count; i++)
+        const unlit_tinted_shader_description *shader = shaderManager->getStaticMeshShader();
+        qglUseProgramObjectARB(shader->program);
+        for(uint32_t i = 0; i < r->statics_count; i++)
         {
-            if(Frustum_IsOBBVisibleInFrustumList(room->content->static_mesh[i].obb, (room->frustum) ? (room->frustum) : (m_camera->frustum)) &&
-               (!room->content->static_mesh[i].hide || (r_flags & R_DRAW_DUMMY_STATICS)))
-            {
-                Mat4_Mat4_mul(transform, modelViewProjectionMatrix, room->content->static_mesh[i].transform);
-                qglUniformMatrix4fvARB(shaderManager->getStaticMeshShader()->model_view_projection, 1, false, transform);
-                base_mesh_s *mesh = room->content->static_mesh[i].mesh;
-                GLfloat tint[4];
+            const struct static_item_s *item = m_statics + r->statics_first + i;
+            GLfloat tint[4];
 
-                vec4_copy(tint, room->content->static_mesh[i].tint);
+            Mat4_Mat4_mul(transform, modelViewProjectionMatrix, item->transform);
+            qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, transform);
+            vec4_copy(tint, item->tint);
 
-                //If this static mesh is in a water room
-                if(room->flags & TR_ROOM_FLAG_WATER)
-                {
-                    CalculateWaterTint(tint, 0);
-                }
-                qglUniform4fvARB(shaderManager->getStaticMeshShader()->tint_mult, 1, tint);
-                this->DrawMesh(mesh, NULL, NULL);
+            //If this static mesh is in a water room
+            if(item->water)
+            {
+                CalculateWaterTint(tint, 0);
             }
+            qglUniform4fvARB(shader->tint_mult, 1, tint);
+            this->DrawMesh(item->mesh, NULL, NULL);
         }
     }
 
-    for(cont = room->content->containers; cont; cont = cont->next)
+#if STENCIL_FRUSTUM
+    if(need_stencil)
     {
-        switch(cont->object_type)
+        qglDisable(GL_STENCIL_TEST);
+    }
+#endif
+}
+
+
+void CRender::DrawRoomSprites(struct room_s *room)
+{
+    for(uint32_t i = 0; i < room->content->sprites_count; i++)
+    {
+        room_sprite_p s = room->content->sprites + i;
+        if(s->sprite)
         {
-        case OBJECT_ENTITY:
-            ent = (entity_p)cont->object;
-            if(Frustum_IsOBBVisibleInFrustumList(ent->obb, (room->frustum) ? (room->frustum) : (m_camera->frustum)))
-            {
-                this->DrawEntity(ent, modelViewMatrix, modelViewProjectionMatrix);
-            }
-            break;
-        };
+            this->AddSprite(s->sprite, s->pos);
+        }
+    }
+}
+
+
+void CRender::AddSprite(struct sprite_s *sprite, const float pos[3])
+{
+    if(m_sprites_count >= m_sprites_size)
+    {
+        m_sprites_size = (m_sprites_size > 0) ? (2 * m_sprites_size) : (256);
+        m_sprites = (struct sprite_batch_item_s*)realloc(m_sprites, m_sprites_size * sizeof(struct sprite_batch_item_s));
+        m_sprites_vertices = (GLfloat*)realloc(m_sprites_vertices, m_sprites_size * 4 * 9 * sizeof(GLfloat));
+    }
+    m_sprites[m_sprites_count].sprite = sprite;
+    vec3_copy(m_sprites[m_sprites_count].pos, pos);
+    m_sprites_count++;
+}
+
+
+static int CompareSpritesByTexture(const void *a, const void *b)
+{
+    GLuint ta = ((const struct sprite_s* const*)a)[0]->texture_index;
+    GLuint tb = ((const struct sprite_s* const*)b)[0]->texture_index;
+    return (ta > tb) - (ta < tb);
+}
+
+
+/*
+ * Expands all collected billboards into one streaming buffer (position,
+ * tex coord, color) and draws one range per atlas page.
+ */
+void CRender::DrawSprites()
+{
+    const unlit_tinted_shader_description *shader;
+    GLfloat *up = m_camera->up_dir;
+    GLfloat *right = m_camera->right_dir;
+    GLfloat *v = m_sprites_vertices;
+    uint32_t first = 0;
+
+    if(m_sprites_count == 0)
+    {
+        return;
+    }
+
+    // sprite pointer is the first field of the item.
+    qsort(m_sprites, m_sprites_count, sizeof(struct sprite_batch_item_s), CompareSpritesByTexture);
+    for(uint32_t i = 0; i < m_sprites_count; i++)
+    {
+        sprite_p sp = m_sprites[i].sprite;
+        const float *pos = m_sprites[i].pos;
+        const float corners[4][2] = {{sp->right, sp->top}, {sp->left, sp->top}, {sp->left, sp->bottom}, {sp->right, sp->bottom}};
+
+        for(int j = 0; j < 4; j++, v += 9)
+        {
+            v[0] = pos[0] + corners[j][0] * right[0] + corners[j][1] * up[0];
+            v[1] = pos[1] + corners[j][0] * right[1] + corners[j][1] * up[1];
+            v[2] = pos[2] + corners[j][0] * right[2] + corners[j][1] * up[2];
+            v[3] = sp->tex_coord[2 * j + 0];
+            v[4] = sp->tex_coord[2 * j + 1];
+            vec4_set_one(v + 5);
+        }
+    }
+
+    if(m_sprites_vbo == 0)
+    {
+        qglGenBuffersARB(1, &m_sprites_vbo);
+    }
+    shader = shaderManager->getRoomShader(false, false);
+    qglUseProgramObjectARB(shader->program);
+    qglUniform1iARB(shader->sampler, 0);
+    qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, m_camera->gl_view_proj_mat);
+
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, m_sprites_vbo);
+    qglBufferDataARB(GL_ARRAY_BUFFER_ARB, m_sprites_count * 4 * 9 * sizeof(GLfloat), m_sprites_vertices, GL_STREAM_DRAW);
+    qglVertexPointer(3, GL_FLOAT, 9 * sizeof(GLfloat), (void*)0);
+    qglTexCoordPointer(2, GL_FLOAT, 9 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+    qglColorPointer(4, GL_FLOAT, 9 * sizeof(GLfloat), (void*)(5 * sizeof(GLfloat)));
+    qglDisableClientState(GL_NORMAL_ARRAY);                                     // sprite vertices have no normals
+    for(uint32_t i = 1; i <= m_sprites_count; i++)
+    {
+        if((i == m_sprites_count) || (m_sprites[i].sprite->texture_index != m_sprites[first].sprite->texture_index))
+        {
+            qglBindTexture(GL_TEXTURE_2D, m_sprites[first].sprite->texture_index);
+            qglDrawArrays(GL_QUADS, 4 * first, 4 * (i - first));
+            first = i;
+        }
+    }
+    qglEnableClientState(GL_NORMAL_ARRAY);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    m_sprites_count = 0;
+}
+
+
+/*
+ * Skins the bone skin mesh into m_skin_data, if it is not skinned in this
+ * frame yet, and returns its offset there.
+ */
+uint32_t CRender::SkinBone(struct ss_bone_tag_s *btag)
+{
+    base_mesh_p mesh = btag->mesh_skin;
+    uint32_t size = 6 * mesh->vertex_count;
+
+    for(uint32_t i = 0; i < m_skin_count; i++)
+    {
+        if((m_skin_items[i].transform == btag->transform) && (m_skin_items[i].mesh == mesh))
+        {
+            return m_skin_items[i].offset;
+        }
     }
 
-    for(uint16_t ni = 0; ni < room->near_room_list_size; ni++)
+    if(m_skin_count >= m_skin_size)
     {
-        room_p near_room = room->near_room_list[ni];
-        near_room = (!near_room->active && near_room->alternate_room) ? (near_room->alternate_room) : (near_room);
-        if(near_room->active && !room->near_room_list[ni]->is_in_r_list)
+        m_skin_size = (m_skin_size > 0) ? (2 * m_skin_size) : (32);
+        m_skin_items = (struct skin_cache_item_s*)realloc(m_skin_items, m_skin_size * sizeof(struct skin_cache_item_s));
+    }
+    if(m_skin_data_count + size > m_skin_data_size)
+    {
+        m_skin_data_size = 2 * (m_skin_data_count + size);
+        m_skin_data = (GLfloat*)realloc(m_skin_data, m_skin_data_size * sizeof(GLfloat));
+    }
+    m_skin_items[m_skin_count].transform = btag->transform;
+    m_skin_items[m_skin_count].mesh = mesh;
+    m_skin_items[m_skin_count].offset = m_skin_data_count;
+    BaseMesh_Skin(mesh, btag->parent->mesh_base, btag->transform, m_skin_data + m_skin_data_count);
+    m_skin_data_count += size;
+
+    return m_skin_items[m_skin_count++].offset;
+}
+
+
+/*
+ * Copies entity transform, bones and hair into the snapshot; bone transforms
+ * are refreshed here if animation LOD deferred them.
+ */
+void CRender::AddEntityItem(struct entity_s *entity, struct room_s *room)
+{
+    struct entity_item_s *item;
+    ss_bone_tag_p btag = entity->bf->bone_tags;
+    uint32_t hair_count = 0;
+
+    if(!(entity->state_flags & ENTITY_STATE_VISIBLE) || (entity->bf->animations.model->hide && !(r_flags & R_DRAW_NULLMESHES)) ||
+       !entity->bf->animations.model->animations)
+    {
+        return;
+    }
+
+    Entity_RefreshPose(entity);
+    if(entity->character)
+    {
+        for(int h = 0; h < entity->character->hair_count; h++)
         {
-            if (near_room->content->static_mesh_count > 0)
+            hair_count += Hair_GetElementsCount(entity->character->hairs[h]);
+        }
+    }
+
+    if(m_entity_items_count >= m_entity_items_size)
+    {
+        m_entity_items_size = (m_entity_items_size > 0) ? (2 * m_entity_items_size) : (64);
+        m_entity_items = (struct entity_item_s*)realloc(m_entity_items, m_entity_items_size * sizeof(struct entity_item_s));
+    }
+    if(m_bone_items_count + entity->bf->bone_tag_count + hair_count > m_bone_items_size)
+    {
+        m_bone_items_size = 2 * (m_bone_items_count + entity->bf->bone_tag_count + hair_count);
+        m_bone_items = (struct bone_item_s*)realloc(m_bone_items, m_bone_items_size * sizeof(struct bone_item_s));
+    }
+
+    item = m_entity_items + m_entity_items_count++;
+    item->room = room;
+    item->bones_first = m_bone_items_count;
+    item->bones_count = entity->bf->bone_tag_count;
+    item->hair_count = hair_count;
+    memcpy(item->transform, entity->transform, sizeof(float) * 16);
+    if(entity->bf->bone_tag_count == 1)
+    {
+        Mat4_Scale(item->transform, entity->scaling[0], entity->scaling[1], entity->scaling[2]);
+    }
+
+    for(uint16_t i = 0; i < entity->bf->bone_tag_count; i++, btag++)
+    {
+        struct bone_item_s *bone = m_bone_items + m_bone_items_count++;
+        memcpy(bone->transform, btag->full_transform, sizeof(float) * 16);
+        bone->mesh_base = btag->mesh_base;
+        bone->mesh_slot = btag->mesh_slot;
+        bone->mesh_skin = NULL;
+        bone->skin_offset = 0;
+        if(btag->mesh_skin && btag->mesh_skin->skin && btag->parent)
+        {
+            bone->mesh_skin = btag->mesh_skin;
+            bone->skin_offset = this->SkinBone(btag);
+        }
+    }
+
+    for(int h = 0; (hair_count > 0) && (h < entity->character->hair_count); h++)
+    {
+        int num_elements = Hair_GetElementsCount(entity->character->hairs[h]);
+        for(int i = 0; i < num_elements; i++)
+        {
+            struct bone_item_s *bone = m_bone_items + m_bone_items_count++;
+            Hair_GetElementInfo(entity->character->hairs[h], i, &bone->mesh_base, bone->transform);
+            bone->mesh_slot = NULL;
+            bone->mesh_skin = NULL;
+            bone->skin_offset = 0;
+        }
+    }
+}
+
+
+/*
+ * Collects entities and near static meshes of every visible room, the same
+ * way as rooms are drawn, and uploads all skinned meshes with one call.
+ */
+void CRender::AddStaticItem(struct static_mesh_s *sm, struct room_s *room)
+{
+    if(m_statics_count >= m_statics_size)
+    {
+        m_statics_size = (m_statics_size > 0) ? (2 * m_statics_size) : (64);
+        m_statics = (struct static_item_s*)realloc(m_statics, m_statics_size * sizeof(struct static_item_s));
+    }
+
+    struct static_item_s *item = m_statics + m_statics_count++;
+    Mat4_Copy(item->transform, sm->transform);
+    vec4_copy(item->tint, sm->tint);
+    item->mesh = sm->mesh;
+    item->water = (room->flags & TR_ROOM_FLAG_WATER) ? (1) : (0);
+}
+
+
+void CRender::GenEntityList()
+{
+    entity_p player = World_GetPlayer();
+
+    if(player)
+    {
+        m_player_item = m_entity_items_count;
+        this->AddEntityItem(player, player->self->room);
+        m_player_item = (m_entity_items_count > (uint32_t)m_player_item) ? (m_player_item) : (-1);
+    }
+
+    for(uint32_t ri = 0; ri < r_list_active_count; ri++)
+    {
+        struct render_list_s *r = r_list + ri;
+        room_p room = r->room;
+        frustum_p frus = (room->frustum) ? (room->frustum) : (m_camera->frustum);
+
+        r->frustum = room->frustum;
+        r->mesh = room->content->mesh;
+        r->flags = room->flags;
+        r->light_mode = room->content->light_mode;
+        Mat4_Copy(r->transform, room->transform);
+        r->need_stencil = 0;
+        if(room->frustum)
+        {
+            for(uint16_t i = 0; i < room->overlapped_room_list_size; i++)
             {
-                for(uint32_t si = 0; si < near_room->content->static_mesh_count; si++)
+                if(room->overlapped_room_list[i]->is_in_r_list)
                 {
-                    if(OBB_OBB_Test(near_room->content->static_mesh[si].obb, room->obb) &&
-                       Frustum_IsOBBVisibleInFrustumList(near_room->content->static_mesh[si].obb, (room->frustum) ? (room->frustum) : (m_camera->frustum)) &&
-                       (!near_room->content->static_mesh[si].hide || (r_flags & R_DRAW_DUMMY_STATICS)))
-                    {
-                        qglUseProgramObjectARB(shaderManager->getStaticMeshShader()->program);
-                        Mat4_Mat4_mul(transform, modelViewProjectionMatrix, near_room->content->static_mesh[si].transform);
-                        qglUniformMatrix4fvARB(shaderManager->getStaticMeshShader()->model_view_projection, 1, false, transform);
-                        base_mesh_s *mesh = near_room->content->static_mesh[si].mesh;
-                        GLfloat tint[4];
+                    r->need_stencil = 1;
+                    break;
+                }
+            }
+        }
 
-                        vec4_copy(tint, near_room->content->static_mesh[si].tint);
+        r->entities_first = m_entity_items_count;
+        r->statics_first = m_statics_count;
+        for(uint32_t si = 0; si < room->content->static_mesh_count; si++)
+        {
+            static_mesh_p sm = room->content->static_mesh + si;
+            if(Frustum_IsOBBVisibleInFrustumList(sm->obb, frus) && (!sm->hide || (r_flags & R_DRAW_DUMMY_STATICS)))
+            {
+                this->AddStaticItem(sm, room);
+            }
+        }
 
-                        //If this static mesh is in a water near_room
-                        if(near_room->flags & TR_ROOM_FLAG_WATER)
-                        {
-                            CalculateWaterTint(tint, 0);
-                        }
-                        qglUniform4fvARB(shaderManager->getStaticMeshShader()->tint_mult, 1, tint);
-                        this->DrawMesh(mesh, NULL, NULL);
-                    }
+        for(engine_container_p cont = room->content->containers; cont; cont = cont->next)
+        {
+            if(cont->object_type == OBJECT_ENTITY)
+            {
+                entity_p ent = (entity_p)cont->object;
+                if(Frustum_IsOBBVisibleInFrustumList(ent->obb, frus))
+                {
+                    this->AddEntityItem(ent, ent->self->room);
                 }
             }
+        }
 
-            for(cont = near_room->content->containers; cont; cont=cont->next)
+        for(uint16_t ni = 0; ni < room->near_room_list_size; ni++)
+        {
+            room_p near_room = room->near_room_list[ni];
+            near_room = (!near_room->active && near_room->alternate_room) ? (near_room->alternate_room) : (near_room);
+            if(near_room->active && !room->near_room_list[ni]->is_in_r_list)
             {
-                switch(cont->object_type)
+                for(uint32_t si = 0; si < near_room->content->static_mesh_count; si++)
                 {
-                case OBJECT_ENTITY:
-                    ent = (entity_p)cont->object;
-                    if(OBB_OBB_Test(ent->obb, room->obb) &&
-                       Frustum_IsOBBVisibleInFrustumList(ent->obb, (room->frustum) ? (room->frustum) : (m_camera->frustum)))
+                    static_mesh_p sm = near_room->content->static_mesh + si;
+                    if(OBB_OBB_Test(sm->obb, room->obb) && Frustum_IsOBBVisibleInFrustumList(sm->obb, frus) &&
+                       (!sm->hide || (r_flags & R_DRAW_DUMMY_STATICS)))
                     {
-                        this->DrawEntity(ent, modelViewMatrix, modelViewProjectionMatrix);
+                        this->AddStaticItem(sm, near_room);
                     }
-                    break;
-                };
+                }
+
+                for(engine_container_p cont = near_room->content->containers; cont; cont = cont->next)
+                {
+                    if(cont->object_type == OBJECT_ENTITY)
+                    {
+                        entity_p ent = (entity_p)cont->object;
+                        if(OBB_OBB_Test(ent->obb, room->obb) && Frustum_IsOBBVisibleInFrustumList(ent->obb, frus))
+                        {
+                            this->AddEntityItem(ent, ent->self->room);
+                        }
+                    }
+                }
             }
         }
+        r->entities_count = m_entity_items_count - r->entities_first;
+        r->statics_count = m_statics_count - r->statics_first;
     }
 
-#if STENCIL_FRUSTUM
-    if(need_stencil)
+    if(m_skin_data_count > 0)
     {
-        qglDisable(GL_STENCIL_TEST);
+        if(m_skin_vbo == 0)
+        {
+            qglGenBuffersARB(1, &m_skin_vbo);
+        }
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, m_skin_vbo);
+        qglBufferDataARB(GL_ARRAY_BUFFER_ARB, m_skin_data_count * sizeof(GLfloat), m_skin_data, GL_STREAM_DRAW);
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
     }
-#endif
+
+    this->FlushAnimatedTexCoords();
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 }
 
 
-void CRender::DrawRoomSprites(struct room_s *room)
+void CRender::GenTransparencyList()
 {
-    if (room->content->sprites_count > 0)
+    /*First generate BSP from base room mesh - it has good for start splitter polygons*/
+    for(uint32_t i = 0; i < r_list_active_count; i++)
     {
-        const unlit_tinted_shader_description *shader = shaderManager->getRoomShader(false, false);
-        GLfloat *up = m_camera->up_dir;
-        GLfloat *right = m_camera->right_dir;
-
-        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-        qglUseProgramObjectARB(shader->program);
-        qglUniform1iARB(shader->sampler, 0);
-        qglUniformMatrix4fvARB(shader->model_view_projection, 1, false, m_camera->gl_view_proj_mat);
-
-        for(uint32_t i = 0; i < room->content->sprites_count; i++)
+        room_p r = r_list[i].room;
+        if((r->content->mesh != NULL) && (r->content->mesh->transparency_polygons != NULL))
         {
-            room_sprite_p s = room->content->sprites + i;
-            vertex_p v = room->content->sprites_vertices + i * 4;
-            vec3_copy_inv(v[0].normal, m_camera->view_dir);
-            vec3_copy_inv(v[1].normal, m_camera->view_dir);
-            vec3_copy_inv(v[2].normal, m_camera->view_dir);
-            vec3_copy_inv(v[3].normal, m_camera->view_dir);
-
-            v[0].position[0] = s->pos[0] + s->sprite->right * right[0] + s->sprite->top * up[0];
-            v[0].position[1] = s->pos[1] + s->sprite->right * right[1] + s->sprite->top * up[1];
-            v[0].position[2] = s->pos[2] + s->sprite->right * right[2] + s->sprite->top * up[2];
-
-            v[1].position[0] = s->pos[0] + s->sprite->left * right[0] + s->sprite->top * up[0];
-            v[1].position[1] = s->pos[1] + s->sprite->left * right[1] + s->sprite->top * up[1];
-            v[1].position[2] = s->pos[2] + s->sprite->left * right[2] + s->sprite->top * up[2];
+            dynamicBSP->AddNewPolygonList(r->content->mesh->transparency_polygons, r->transform, m_camera->frustum);
+        }
+    }
 
-            v[2].position[0] = s->pos[0] + s->sprite->left * right[0] + s->sprite->bottom * up[0];
-            v[2].position[1] = s->pos[1] + s->sprite->left * right[1] + s->sprite->bottom * up[1];
-            v[2].position[2] = s->pos[2] + s->sprite->left * right[2] + s->sprite->bottom * up[2];
+    for(uint32_t i = 0; i < r_list_active_count; i++)
+    {
+        room_p r = r_list[i].room;
+        // Add transparency polygons from static meshes (if they exists)
+        for(uint16_t j = 0; j < r->content->static_mesh_count; j++)
+        {
+            if((r->content->static_mesh[j].mesh->transparency_polygons != NULL) && Frustum_IsOBBVisibleInFrustumList(r->content->static_mesh[j].obb, (r->frustum) ? (r->frustum) : (m_camera->frustum)))
+            {
+                dynamicBSP->AddNewPolygonList(r->content->static_mesh[j].mesh->transparency_polygons, r->content->static_mesh[j].transform, m_camera->frustum);
+            }
+        }
 
-            v[3].position[0] = s->pos[0] + s->sprite->right * right[0] + s->sprite->bottom * up[0];
-            v[3].position[1] = s->pos[1] + s->sprite->right * right[1] + s->sprite->bottom * up[1];
-            v[3].position[2] = s->pos[2] + s->sprite->right * right[2] + s->sprite->bottom * up[2];
+        // Add transparency polygons from all entities (if they exists) // yes, entities may be animated and intersects with each others;
+        for(engine_container_p cont = r->content->containers; cont; cont = cont->next)
+        {
+            if(cont->object_type == OBJECT_ENTITY)
+            {
+                entity_p ent = (entity_p)cont->object;
+                if((ent->bf->animations.model->transparency_flags == MESH_HAS_TRANSPARENCY) && (ent->state_flags & ENTITY_STATE_VISIBLE) && Frustum_IsOBBVisibleInFrustumList(ent->obb, (r->frustum) ? (r->frustum) : (m_camera->frustum)))
+                {
+                    float tr[16];
+                    for(uint16_t j = 0; j < ent->bf->bone_tag_count; j++)
+                    {
+                        if(ent->bf->bone_tags[j].mesh_base->transparency_polygons != NULL)
+                        {
+                            Mat4_Mat4_mul(tr, ent->transform, ent->bf->bone_tags[j].full_transform);
+                            dynamicBSP->AddNewPolygonList(ent->bf->bone_tags[j].mesh_base->transparency_polygons, tr, m_camera->frustum);
+                        }
+                    }
+                }
+            }
         }
+    }
 
-        qglBindTexture(GL_TEXTURE_2D, room->content->sprites->sprite->texture_index);
-        qglVertexPointer(3, GL_FLOAT, sizeof(vertex_t), room->content->sprites_vertices->position);
-        qglColorPointer(4, GL_FLOAT, sizeof(vertex_t), room->content->sprites_vertices->color);
-        qglNormalPointer(GL_FLOAT, sizeof(vertex_t), room->content->sprites_vertices->normal);
-        qglTexCoordPointer(2, GL_FLOAT, sizeof(vertex_t), room->content->sprites_vertices->tex_coord);
-        qglDrawArrays(GL_QUADS, 0, 4 * room->content->sprites_count);
+    entity_p player = World_GetPlayer();
+    if(player && (player->bf->animations.model->transparency_flags == MESH_HAS_TRANSPARENCY))
+    {
+        float tr[16];
+        for(uint16_t j = 0; j < player->bf->bone_tag_count; j++)
+        {
+            if(player->bf->bone_tags[j].mesh_base->transparency_polygons != NULL)
+            {
+                Mat4_Mat4_mul(tr, player->transform, player->bf->bone_tags[j].full_transform);
+                dynamicBSP->AddNewPolygonList(player->bf->bone_tags[j].mesh_base->transparency_polygons, tr, m_camera->frustum);
+            }
+        }
     }
 }
 
@@ -1226,6 +1652,7 @@ int  CRender::AddRoom(struct room_s *room)
 
         if(r_list_active_count < r_list_size)
         {
+            Residency_Require(room);
             r_list[r_list_active_count].room = room;
             r_list[r_list_active_count].active = 1;
             r_list[r_list_active_count].dist = dist;
@@ -1294,15 +1721,14 @@ int CRender::ProcessRoom(struct portal_s *portal, struct frustum_s *frus)
 }
 
 /**
- * Sets up the light calculations for the given entity based on its current
+ * Sets up the light calculations for the entity position in the given
  * room. Returns the used shader, which will have been made current already.
  */
-const lit_shader_description *CRender::SetupEntityLight(struct entity_s *entity, const float modelViewMatrix[16])
+const lit_shader_description *CRender::SetupEntityLight(struct room_s *room, const float pos[3], const float modelViewMatrix[16])
 {
     // Calculate lighting
     const lit_shader_description *shader;
 
-    room_s *room = entity->self->room;
     if(room != NULL)
     {
         GLfloat ambient_component[4];
@@ -1329,7 +1755,7 @@ const lit_shader_description *CRender::SetupEntityLight(struct entity_s *entity,
         memset(innerRadiuses, 0, sizeof(innerRadiuses));
         memset(outerRadiuses, 0, sizeof(outerRadiuses));
 
-        float *entity_pos = entity->transform + 12;
+        const float *entity_pos = pos;
 
         for(uint32_t i = 0; (i < room->content->lights_count) && (current_light_number < MAX_NUM_LIGHTS); i++)
         {
@@ -7,6 +7,7 @@
 #include <SDL2/SDL_opengl.h>
 
 #include "../core/vmath.h"
+#include "camera.h"
 
 #define R_DRAW_WIRE             0x00000001      // Wireframe rendering
 #define R_DRAW_ROOMBOXES        0x00000002      // Show room bounds
@@ -36,6 +37,7 @@ struct camera_s;
 struct entity_s;
 struct sprite_s;
 struct base_mesh_s;
+struct static_mesh_s;
 struct obb_s;
 struct lit_shader_description;
 
@@ -73,6 +75,9 @@ typedef struct render_settings_s
     int8_t    antialias;
     int8_t    antialias_samples;
     int8_t    texture_border;
+    int8_t    texture_packer;
+    int8_t    texture_compression;
+    int8_t    texture_upscale;
     int8_t    z_depth;
     int8_t    fog_enabled;
     GLfloat   fog_color[4];
@@ -139,6 +144,11 @@ class CRender
         void ResetWorld(struct room_s *rooms, uint32_t rooms_count, struct anim_seq_s *anim_sequences, uint32_t anim_sequences_count);
         void UpdateAnimTextures();
 
+        /*
+         * GenWorldList reads the world: visible rooms, camera copy, entity
+         * transforms and bones, skinning and transparency BSP. DrawList only
+         * submits that snapshot, so game frame may run at the same time.
+         */
         void GenWorldList(struct camera_s *cam);
         void DrawList();
         void DrawListDebugLines();
@@ -148,37 +158,115 @@ class CRender
         void DrawBSPFrontToBack(struct bsp_node_s *root);
         void DrawBSPBackToFront(struct bsp_node_s *root);
 
-        void DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices, const float *overrideNormals);
+        void DrawMesh(struct base_mesh_s *mesh, const float *overrideVertices, const float *overrideNormals, GLuint overrideVBO = 0);
         void DrawSkinMesh(struct base_mesh_s *mesh, struct base_mesh_s *parent_mesh, float transform[16]);
         void DrawSkyBox(const float matrix[16]);
 
         void DrawSkeletalModel(const struct lit_shader_description *shader, struct ss_bone_frame_s *bframe, const float mvMatrix[16], const float mvpMatrix[16]);
-        void DrawEntity(struct entity_s *entity, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16]);
 
-        void DrawRoom(struct room_s *room, const float matrix[16], const float modelViewProjectionMatrix[16]);
         void DrawRoomSprites(struct room_s *room);
+        void AddSprite(struct sprite_s *sprite, const float pos[3]);
+        void DrawSprites();
 
         struct gl_text_line_s *OutTextXYZ(GLfloat x, GLfloat y, GLfloat z, const char *fmt, ...);
         
     private:
+        // Room state copied by GenWorldList, game frame may swap rooms while the list is drawn.
         struct render_list_s
         {
             char               active;
+            char               need_stencil;                                    // overlapped room is in the list too
             struct room_s     *room;
             float              dist;
+            struct frustum_s  *frustum;                                         // NULL - camera frustum
+            struct base_mesh_s *mesh;
+            float              transform[16];
+            uint32_t           flags;
+            int16_t            light_mode;
+            uint32_t           entities_first;                                  // m_entity_items drawn with the room
+            uint32_t           entities_count;
+            uint32_t           statics_first;                                   // m_statics drawn with the room, own statics first
+            uint32_t           statics_count;
+        };
+
+        // Entity state copied by GenWorldList; hair elements follow bones and are in world space.
+        struct entity_item_s
+        {
+            struct room_s     *room;                                            // light source room
+            float              transform[16];
+            uint32_t           bones_first;
+            uint16_t           bones_count;
+            uint16_t           hair_count;
+        };
+
+        struct bone_item_s
+        {
+            float              transform[16];
+            struct base_mesh_s *mesh_base;
+            struct base_mesh_s *mesh_slot;
+            struct base_mesh_s *mesh_skin;
+            uint32_t           skin_offset;                                     // in floats of m_skin_data
+        };
+
+        // Visible static mesh of the room or of the near room, which crosses the drawn room.
+        struct static_item_s
+        {
+            float              transform[16];
+            GLfloat            tint[4];
+            struct base_mesh_s *mesh;
+            int                water;
+        };
+
+        struct sprite_batch_item_s
+        {
+            struct sprite_s   *sprite;
+            float              pos[3];
+        };
+
+        struct skin_cache_item_s
+        {
+            const float       *transform;
+            struct base_mesh_s *mesh;
+            uint32_t           offset;                                          // in floats of m_skin_data
         };
 
         void InitSettings();
+        void AdvanceAnimTextures();
+        void AddAnimatedMesh(struct base_mesh_s *mesh);
+        void FillAnimatedTexCoords(struct base_mesh_s *mesh, bool changed_only);
+        void FlushAnimatedTexCoords();
         int  AddRoom(struct room_s *room);
         int  ProcessRoom(struct portal_s *portal, struct frustum_s *frus);
-        const lit_shader_description *SetupEntityLight(struct entity_s *entity, const float modelViewMatrix[16]);
+        const lit_shader_description *SetupEntityLight(struct room_s *room, const float pos[3], const float modelViewMatrix[16]);
+        void AddEntityItem(struct entity_s *entity, struct room_s *room);
+        void AddStaticItem(struct static_mesh_s *sm, struct room_s *room);
+        void GenEntityList();
+        void GenTransparencyList();
+        uint32_t SkinBone(struct ss_bone_tag_s *btag);
+        void DrawEntityItem(const struct entity_item_s *item, const float modelViewMatrix[16], const float modelViewProjectionMatrix[16]);
+        void DrawRoom(const struct render_list_s *r, const float matrix[16], const float modelViewProjectionMatrix[16]);
         
         struct camera_s            *m_camera;
+        struct camera_s             m_camera_state;                             // copy of the camera used by GenWorldList
         
         struct room_s              *m_rooms;
         uint32_t                    m_rooms_count;
         struct anim_seq_s          *m_anim_sequences;
         uint32_t                    m_anim_sequences_count;
+        uint32_t                    m_anim_textures_tick;                       // counts AdvanceAnimTextures calls
+        float                       m_anim_textures_time;                       // game time not applied to sequences yet
+
+        // Texcoords of all drawn animated meshes, one buffer; only changed polygons are rewritten.
+        uint32_t                    m_anim_meshes_count;
+        uint32_t                    m_anim_meshes_size;
+        struct base_mesh_s        **m_anim_meshes;
+        uint32_t                    m_anim_texcoords_count;                     // in vertices
+        uint32_t                    m_anim_texcoords_size;
+        GLfloat                    *m_anim_texcoords;
+        uint32_t                    m_anim_texcoords_dirty_first;
+        uint32_t                    m_anim_texcoords_dirty_last;                // dirty range is empty if last <= first
+        uint32_t                    m_anim_texcoords_vbo_size;
+        GLuint                      m_anim_texcoords_vbo;
 
         uint16_t                    m_active_transparency;
         GLuint                      m_active_texture;
@@ -187,6 +275,36 @@ class CRender
         uint32_t                    r_list_active_count;
         struct render_list_s       *r_list;
         class CFrustumManager      *frustumManager;
+
+        // Sprites of the frame, drawn by DrawSprites with one call per texture page.
+        uint32_t                    m_sprites_count;
+        uint32_t                    m_sprites_size;
+        struct sprite_batch_item_s *m_sprites;
+        GLfloat                    *m_sprites_vertices;
+        GLuint                      m_sprites_vbo;
+
+        // Snapshot of visible entities, filled by GenWorldList.
+        int32_t                     m_player_item;
+        uint32_t                    m_entity_items_count;
+        uint32_t                    m_entity_items_size;
+        struct entity_item_s       *m_entity_items;
+        uint32_t                    m_bone_items_count;
+        uint32_t                    m_bone_items_size;
+        struct bone_item_s         *m_bone_items;
+        uint32_t                    m_statics_count;
+        uint32_t                    m_statics_size;
+        struct static_item_s       *m_statics;
+        uint32_t                    m_stencil_vertices_size;
+        GLfloat                    *m_stencil_vertices;
+
+        // Skin meshes of visible entities, skinned once per frame into one buffer.
+        uint32_t                    m_skin_count;
+        uint32_t                    m_skin_size;
+        struct skin_cache_item_s   *m_skin_items;
+        uint32_t                    m_skin_data_count;
+        uint32_t                    m_skin_data_size;
+        GLfloat                    *m_skin_data;
+        GLuint                      m_skin_vbo;
         
     public:
         struct render_settings_s    settings;
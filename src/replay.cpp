@@ -0,0 +1,312 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/system.h"
+#include "core/console.h"
+#include "engine.h"
+#include "game.h"
+#include "physics.h"
+#include "controls.h"
+#include "script.h"
+#include "save_state.h"
+#include "rewind.h"
+#include "replay.h"
+
+typedef struct replay_header_s
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    control_state_size;
+    uint32_t    seed;
+    uint32_t    state_size;             // starting save state blob size
+    float       frame_time;             // fixed game frame time
+}replay_header_t, *replay_header_p;
+
+// control state changes are stored as (uint8 offset, uint8 value) pairs.
+typedef char replay_control_state_size_check[(sizeof(engine_control_state_t) < 256) ? (1) : (-1)];
+
+static struct
+{
+    FILE                       *file;
+    uint8_t                    *data;
+    uint8_t                    *ptr;
+    uint8_t                    *end;
+    uint32_t                    seed;
+    uint32_t                    frame;
+    float                       frame_time;
+    uint32_t                    checksum;
+    uint32_t                    desync_frame;
+    int                         recording;
+    int                         playing;
+    int                         in_frame;
+    int8_t                      physics_multithreaded;  // setting to restore after replay
+    engine_control_state_t      last;
+    save_state_t                state;
+} replay_session;
+
+
+static void Replay_SeedFrame()
+{
+    // reseed every frame, so rand() calls outside of game frame (audio) do not break sequence.
+    srand(replay_session.seed + replay_session.frame * 2654435761u);
+}
+
+
+static void Replay_SetSerialPhysics()
+{
+    replay_session.physics_multithreaded = physics_settings.multithreaded;
+    physics_settings.multithreaded = 0;
+}
+
+
+static uint32_t Replay_StateChecksum()
+{
+    save_state_header_t header;
+    SaveState_Capture(&replay_session.state, 0);
+    memcpy(&header, replay_session.state.data, sizeof(header));
+    return header.checksum;
+}
+
+
+int Replay_StartRecording(const char *name)
+{
+    replay_header_t header;
+
+    Replay_Stop();
+    replay_session.file = fopen(name, "wb");
+    if(replay_session.file == NULL)
+    {
+        Sys_extWarn("Can not create file \"%s\"", name);
+        return 0;
+    }
+
+    // Playback starts from level reload, so does recording: Lua state is the same then.
+    SaveState_Init(&replay_session.state);
+    SaveState_Capture(&replay_session.state, 1);
+    Script_LuaClearTasks();
+    if(!SaveState_Restore(replay_session.state.data, replay_session.state.size, 1))
+    {
+        Con_Warning("can not restore replay starting state");
+        fclose(replay_session.file);
+        replay_session.file = NULL;
+        SaveState_Clear(&replay_session.state);
+        return 0;
+    }
+    Rewind_Reset();
+    SaveState_Capture(&replay_session.state, 1);
+    Replay_SetSerialPhysics();
+
+    header.magic = REPLAY_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.control_state_size = sizeof(engine_control_state_t);
+    header.seed = (uint32_t)time(NULL);
+    header.state_size = replay_session.state.size;
+    header.frame_time = GAME_LOGIC_REFRESH_INTERVAL;
+    fwrite(&header, sizeof(header), 1, replay_session.file);
+    fwrite(&control_states, sizeof(engine_control_state_t), 1, replay_session.file);
+    fwrite(replay_session.state.data, 1, replay_session.state.size, replay_session.file);
+
+    replay_session.seed = header.seed;
+    replay_session.frame = 0;
+    replay_session.frame_time = header.frame_time;
+    replay_session.last = control_states;
+    replay_session.recording = 1;
+    Con_Notify("recording replay \"%s\"", name);
+
+    return 1;
+}
+
+
+int Replay_StartPlayback(const char *name)
+{
+    replay_header_t header;
+    FILE *f;
+    long size;
+
+    Replay_Stop();
+    f = fopen(name, "rb");
+    if(f == NULL)
+    {
+        Sys_extWarn("Can not read file \"%s\"", name);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(size < (long)sizeof(header))
+    {
+        fclose(f);
+        return 0;
+    }
+    replay_session.data = (uint8_t*)malloc(size);
+    size = fread(replay_session.data, 1, size, f);
+    fclose(f);
+
+    memcpy(&header, replay_session.data, sizeof(header));
+    if((header.magic != REPLAY_MAGIC) || (header.version != REPLAY_VERSION) ||
+       (header.control_state_size != sizeof(engine_control_state_t)) || !(header.frame_time > 0.0f) ||
+       (sizeof(header) + header.control_state_size + header.state_size > (uint32_t)size))
+    {
+        Con_Warning("wrong replay file \"%s\"", name);
+        Replay_Stop();
+        return 0;
+    }
+
+    replay_session.ptr = replay_session.data + sizeof(header);
+    replay_session.end = replay_session.data + size;
+    memcpy(&replay_session.last, replay_session.ptr, sizeof(engine_control_state_t));
+    replay_session.ptr += sizeof(engine_control_state_t);
+
+    Script_LuaClearTasks();
+    if(!SaveState_Restore(replay_session.ptr, header.state_size, 1))
+    {
+        Con_Warning("can not restore replay starting state");
+        Replay_Stop();
+        return 0;
+    }
+    replay_session.ptr += header.state_size;
+    Rewind_Reset();
+
+    SaveState_Init(&replay_session.state);
+    control_states = replay_session.last;
+    replay_session.seed = header.seed;
+    replay_session.frame = 0;
+    replay_session.frame_time = header.frame_time;
+    replay_session.desync_frame = 0;
+    replay_session.playing = 1;
+    Replay_SetSerialPhysics();
+    Con_Notify("playing replay \"%s\"", name);
+
+    return 1;
+}
+
+
+void Replay_Stop()
+{
+    if(replay_session.file)
+    {
+        fclose(replay_session.file);
+        replay_session.file = NULL;
+        Con_Notify("replay recorded, %d frames", replay_session.frame);
+    }
+    if(replay_session.playing)
+    {
+        Con_Notify("replay finished, %d frames", replay_session.frame);
+    }
+    if(replay_session.recording || replay_session.playing)
+    {
+        physics_settings.multithreaded = replay_session.physics_multithreaded;
+    }
+    free(replay_session.data);
+    replay_session.data = NULL;
+    replay_session.ptr = NULL;
+    replay_session.end = NULL;
+    replay_session.recording = 0;
+    replay_session.playing = 0;
+    replay_session.in_frame = 0;
+    SaveState_Clear(&replay_session.state);
+}
+
+
+int Replay_IsRecording()
+{
+    return replay_session.recording;
+}
+
+
+int Replay_IsPlaying()
+{
+    return replay_session.playing;
+}
+
+
+void Replay_BeginFrame(float *time)
+{
+    uint8_t *cs = (uint8_t*)&control_states;
+    uint8_t *last = (uint8_t*)&replay_session.last;
+
+    replay_session.in_frame = 0;
+    // game is paused under console, such frames are not recorded.
+    if(Con_IsShown() || !(replay_session.recording || replay_session.playing))
+    {
+        return;
+    }
+
+    if(replay_session.recording)
+    {
+        uint8_t changes[2 * sizeof(engine_control_state_t)];
+        uint8_t changes_count = 0;
+        for(uint32_t i = 0; i < sizeof(engine_control_state_t); i++)
+        {
+            if(cs[i] != last[i])
+            {
+                changes[2 * changes_count + 0] = i;
+                changes[2 * changes_count + 1] = cs[i];
+                changes_count++;
+            }
+        }
+        fwrite(&changes_count, 1, 1, replay_session.file);
+        fwrite(changes, 2, changes_count, replay_session.file);
+        replay_session.last = control_states;
+    }
+    else
+    {
+        uint8_t changes_count;
+        if(replay_session.ptr + 1 > replay_session.end)
+        {
+            Replay_Stop();
+            return;
+        }
+        changes_count = *replay_session.ptr++;
+        if(replay_session.ptr + 2 * changes_count + sizeof(uint32_t) > replay_session.end)
+        {
+            Replay_Stop();
+            return;
+        }
+        for(uint8_t i = 0; i < changes_count; i++)
+        {
+            if(replay_session.ptr[0] >= sizeof(engine_control_state_t))
+            {
+                Con_Warning("replay is corrupted at frame %d", replay_session.frame);
+                Replay_Stop();
+                return;
+            }
+            last[replay_session.ptr[0]] = replay_session.ptr[1];
+            replay_session.ptr += 2;
+        }
+        memcpy(&replay_session.checksum, replay_session.ptr, sizeof(uint32_t));
+        replay_session.ptr += sizeof(uint32_t);
+        control_states = replay_session.last;
+    }
+
+    *time = replay_session.frame_time;
+    Replay_SeedFrame();
+    replay_session.in_frame = 1;
+}
+
+
+void Replay_EndFrame()
+{
+    uint32_t checksum;
+
+    if(!replay_session.in_frame)
+    {
+        return;
+    }
+
+    replay_session.in_frame = 0;
+    replay_session.frame++;
+    checksum = Replay_StateChecksum();
+    if(replay_session.recording)
+    {
+        fwrite(&checksum, sizeof(checksum), 1, replay_session.file);
+    }
+    else if(replay_session.playing && !replay_session.desync_frame && (checksum != replay_session.checksum))
+    {
+        replay_session.desync_frame = replay_session.frame;
+        Con_Warning("replay desync at frame %d", replay_session.frame);
+    }
+}
@@ -0,0 +1,33 @@
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+/*
+ * Input recording and replay. Record file starts with RNG seed, frame time and
+ * binary save state of the starting point, then for every game frame it keeps
+ * engine_control_state_t changes and checksum of game state after the frame.
+ * Both recording and replay run Game_Frame with the fixed frame time from the
+ * header, so the simulation steps are the same. Replay restores starting state
+ * and feeds recorded controls to Game_Frame one frame per loop; first checksum
+ * mismatch is reported, corrupted frame data stops the playback.
+ * Multithreaded physics is not order deterministic, so physics runs serially
+ * while recording or playing back.
+ */
+
+#define REPLAY_MAGIC            (0x50524F54)    // "OTRP"
+#define REPLAY_VERSION          (3)
+
+int  Replay_StartRecording(const char *name);
+int  Replay_StartPlayback(const char *name);
+void Replay_Stop();
+
+int  Replay_IsRecording();
+int  Replay_IsPlaying();
+
+// Called around Game_Frame; time is replaced by the fixed step, in playback control states by recorded ones.
+void Replay_BeginFrame(float *time);
+void Replay_EndFrame();
+
+#endif
@@ -0,0 +1,373 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "core/system.h"
+#include "core/spsc_queue.h"
+#include "core/polygon.h"
+#include "render/frustum.h"
+#include "mesh.h"
+#include "room.h"
+#include "residency.h"
+
+
+#define RESIDENCY_NONE          (0)
+#define RESIDENCY_QUEUED        (1)
+#define RESIDENCY_BUILDING      (2)
+#define RESIDENCY_BUILT         (3)
+#define RESIDENCY_RESIDENT      (4)
+
+#define RESIDENCY_KEEP_FRAMES   (8)         // rooms needed or drawn this recently are not released
+
+struct residency_settings_s residency_settings;
+struct residency_stats_s    residency_stats;
+
+/*
+ * Room state is the only thing shared with the builder: it builds a mesh
+ * only after QUEUED -> BUILDING switch, main thread touches the mesh
+ * only in NONE, BUILT and RESIDENT states.
+ */
+static struct
+{
+    struct room_s      *rooms;
+    uint32_t            rooms_count;
+    SDL_atomic_t       *state;
+    uint32_t           *needed_frame;
+    uint32_t           *size;
+    float              *request_time;
+    uint32_t           *search;             // room index and hops for portal search
+    uint32_t            frame;
+
+    SDL_Thread         *thread;
+    SDL_sem            *sem;
+    SDL_atomic_t        quit;
+    spsc_queue_t        requests;           // main -> builder
+    spsc_queue_t        built;              // builder -> main
+} residency = {NULL, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, {0}, {0, 0, NULL, {0}, {0}}, {0, 0, NULL, {0}, {0}}};
+
+
+void Residency_InitGlobals()
+{
+    residency_settings.enabled = 1;
+    residency_settings.hops = 2;
+    residency_settings.budget = 64 * 1024 * 1024;
+    memset(&residency_stats, 0, sizeof(residency_stats));
+}
+
+
+static int Residency_BuilderThread(void *data)
+{
+    uint32_t index;
+
+    while(!SDL_AtomicGet(&residency.quit))
+    {
+        SDL_SemWait(residency.sem);
+        while(!SDL_AtomicGet(&residency.quit) && SPSC_Pop(&residency.requests, &index))
+        {
+            if(SDL_AtomicCAS(residency.state + index, RESIDENCY_QUEUED, RESIDENCY_BUILDING))
+            {
+                BaseMesh_BuildFaces(residency.rooms[index].content->mesh);
+                SDL_AtomicSet(residency.state + index, RESIDENCY_BUILT);
+                while(!SPSC_Push(&residency.built, &index))
+                {
+                    SDL_Delay(1);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static uint32_t Residency_MeshSize(struct base_mesh_s *mesh)
+{
+    // vertices are kept in memory and in vbo, elements are client side.
+    uint32_t size = 2 * mesh->vertex_count * sizeof(vertex_t);
+    size += mesh->animated_vertex_count * (sizeof(vertex_t) + 2 * sizeof(GLfloat));
+    for(uint32_t i = 0; i < mesh->faces_count; i++)
+    {
+        size += mesh->faces[i].elements_count * sizeof(GLuint);
+    }
+    for(uint32_t i = 0; i < mesh->animated_faces_count; i++)
+    {
+        size += mesh->animated_faces[i].elements_count * sizeof(GLuint);
+    }
+
+    return size;
+}
+
+
+static void Residency_Upload(uint32_t index)
+{
+    struct base_mesh_s *mesh = residency.rooms[index].content->mesh;
+    float latency = 1000.0f * (Sys_FloatTime() - residency.request_time[index]);
+
+    BaseMesh_GenVBO(mesh);
+    residency.size[index] = Residency_MeshSize(mesh);
+    SDL_AtomicSet(residency.state + index, RESIDENCY_RESIDENT);
+
+    residency_stats.resident_count++;
+    residency_stats.resident_size += residency.size[index];
+    residency_stats.latency_last = latency;
+    residency_stats.latency_max = (latency > residency_stats.latency_max) ? (latency) : (residency_stats.latency_max);
+}
+
+
+static void Residency_Release(uint32_t index)
+{
+    BaseMesh_ReleaseFaces(residency.rooms[index].content->mesh);
+    SDL_AtomicSet(residency.state + index, RESIDENCY_NONE);
+
+    residency_stats.resident_count--;
+    residency_stats.resident_size -= residency.size[index];
+    residency_stats.released++;
+    residency.size[index] = 0;
+}
+
+
+static void Residency_Request(uint32_t index)
+{
+    if(SDL_AtomicCAS(residency.state + index, RESIDENCY_NONE, RESIDENCY_QUEUED))
+    {
+        residency.request_time[index] = Sys_FloatTime();
+        if(SPSC_Push(&residency.requests, &index))
+        {
+            SDL_SemPost(residency.sem);
+        }
+        else
+        {
+            SDL_AtomicSet(residency.state + index, RESIDENCY_NONE);             // try again next frame
+        }
+    }
+}
+
+
+static void Residency_StopBuilder()
+{
+    if(residency.thread)
+    {
+        SDL_AtomicSet(&residency.quit, 1);
+        SDL_SemPost(residency.sem);
+        SDL_WaitThread(residency.thread, NULL);
+        residency.thread = NULL;
+    }
+
+    if(residency.sem)
+    {
+        SDL_DestroySemaphore(residency.sem);
+        residency.sem = NULL;
+        SPSC_Clear(&residency.requests);
+        SPSC_Clear(&residency.built);
+    }
+}
+
+
+void Residency_Init(struct room_s *rooms, uint32_t rooms_count)
+{
+    Residency_Clear();
+
+    if(residency_settings.enabled && (rooms_count > 0))
+    {
+        residency.rooms = rooms;
+        residency.rooms_count = rooms_count;
+        residency.state = (SDL_atomic_t*)calloc(rooms_count, sizeof(SDL_atomic_t));
+        residency.needed_frame = (uint32_t*)calloc(rooms_count, sizeof(uint32_t));
+        residency.size = (uint32_t*)calloc(rooms_count, sizeof(uint32_t));
+        residency.request_time = (float*)calloc(rooms_count, sizeof(float));
+        residency.search = (uint32_t*)malloc(2 * rooms_count * sizeof(uint32_t));
+        residency.frame = 0;
+        for(uint32_t i = 0; i < rooms_count; i++)
+        {
+            SDL_AtomicSet(residency.state + i, (rooms[i].content->mesh) ? (RESIDENCY_NONE) : (RESIDENCY_RESIDENT));
+        }
+
+        // Stale requests of released and required again rooms may stay in queue.
+        SPSC_Init(&residency.requests, sizeof(uint32_t), 2 * rooms_count);
+        SPSC_Init(&residency.built, sizeof(uint32_t), 2 * rooms_count);
+        SDL_AtomicSet(&residency.quit, 0);
+        residency.sem = SDL_CreateSemaphore(0);
+        residency.thread = SDL_CreateThread(Residency_BuilderThread, "room_builder", NULL);
+        if(residency.thread)
+        {
+            return;
+        }
+        Sys_DebugLog(SYS_LOG_FILENAME, "Can not create room builder thread: %s", SDL_GetError());
+        Residency_Clear();
+    }
+
+    for(uint32_t i = 0; i < rooms_count; i++)
+    {
+        if(rooms[i].content->mesh)
+        {
+            BaseMesh_GenFaces(rooms[i].content->mesh);
+        }
+    }
+}
+
+
+void Residency_Clear()
+{
+    Residency_StopBuilder();
+
+    if(residency.rooms)
+    {
+        free(residency.state);
+        free(residency.needed_frame);
+        free(residency.size);
+        free(residency.request_time);
+        free(residency.search);
+        residency.state = NULL;
+        residency.needed_frame = NULL;
+        residency.size = NULL;
+        residency.request_time = NULL;
+        residency.search = NULL;
+        residency.rooms = NULL;
+        residency.rooms_count = 0;
+    }
+
+    memset(&residency_stats, 0, sizeof(residency_stats));
+}
+
+
+void Residency_Require(struct room_s *room)
+{
+    uint32_t index = room->id;
+
+    if(!residency.rooms || (index >= residency.rooms_count))
+    {
+        return;
+    }
+
+    residency.needed_frame[index] = residency.frame;
+    switch(SDL_AtomicGet(residency.state + index))
+    {
+        case RESIDENCY_RESIDENT:
+            return;
+
+        case RESIDENCY_NONE:
+            residency.request_time[index] = Sys_FloatTime();
+            SDL_AtomicSet(residency.state + index, RESIDENCY_BUILDING);
+            BaseMesh_BuildFaces(room->content->mesh);
+            residency_stats.built_sync++;
+            break;
+
+        case RESIDENCY_QUEUED:
+            if(SDL_AtomicCAS(residency.state + index, RESIDENCY_QUEUED, RESIDENCY_BUILDING))
+            {
+                BaseMesh_BuildFaces(room->content->mesh);
+                residency_stats.built_sync++;
+                break;
+            }
+            // fall through - builder has just taken it
+        case RESIDENCY_BUILDING:
+            while(SDL_AtomicGet(residency.state + index) != RESIDENCY_BUILT)
+            {
+                SDL_Delay(0);
+            }
+            residency_stats.built++;
+            break;
+
+        case RESIDENCY_BUILT:
+            residency_stats.built++;
+            break;
+    }
+
+    Residency_Upload(index);
+}
+
+
+void Residency_Update(struct room_s *player_room, struct room_s *camera_room)
+{
+    uint32_t index, first = 0, last = 0;
+
+    if(!residency.rooms)
+    {
+        return;
+    }
+
+    residency.frame++;
+    while(SPSC_Pop(&residency.built, &index))
+    {
+        if(SDL_AtomicGet(residency.state + index) == RESIDENCY_BUILT)           // not uploaded by Residency_Require yet
+        {
+            Residency_Upload(index);
+            residency_stats.built++;
+        }
+    }
+
+    /*
+     * Breadth first search through portals; flipped variants of every
+     * found room are requested too, so flipmap switch does not stall.
+     */
+    struct room_s *start[2] = {Room_CheckFlip(player_room), Room_CheckFlip(camera_room)};
+    for(int i = 0; i < 2; i++)
+    {
+        if(start[i] && (start[i]->id < residency.rooms_count) && (residency.needed_frame[start[i]->id] != residency.frame))
+        {
+            residency.needed_frame[start[i]->id] = residency.frame;
+            residency.search[2 * last + 0] = start[i]->id;
+            residency.search[2 * last + 1] = 0;
+            last++;
+        }
+    }
+
+    while(first < last)
+    {
+        struct room_s *r = residency.rooms + residency.search[2 * first + 0];
+        uint32_t hops = residency.search[2 * first + 1];
+        struct room_s *flipped[2] = {r->alternate_room, r->base_room};
+        first++;
+
+        Residency_Request(r->id);
+        for(int i = 0; i < 2; i++)
+        {
+            if(flipped[i] && (residency.needed_frame[flipped[i]->id] != residency.frame))
+            {
+                residency.needed_frame[flipped[i]->id] = residency.frame;
+                Residency_Request(flipped[i]->id);
+            }
+        }
+
+        if(hops < residency_settings.hops)
+        {
+            for(uint16_t i = 0; i < r->portals_count; i++)
+            {
+                struct room_s *dest = Room_CheckFlip(r->portals[i].dest_room);
+                if(dest && (residency.needed_frame[dest->id] != residency.frame))
+                {
+                    residency.needed_frame[dest->id] = residency.frame;
+                    residency.search[2 * last + 0] = dest->id;
+                    residency.search[2 * last + 1] = hops + 1;
+                    last++;
+                }
+            }
+        }
+    }
+
+    /*
+     * Over budget: release the longest unneeded rooms first. Rooms seen through
+     * portals beyond hops are marked by Residency_Require of the last render
+     * lists, they are kept so they are not rebuilt on the next frame.
+     */
+    while(residency_stats.resident_size > residency_settings.budget)
+    {
+        uint32_t oldest = residency.rooms_count;
+        for(uint32_t i = 0; i < residency.rooms_count; i++)
+        {
+            if((residency.size[i] > 0) && (residency.frame - residency.needed_frame[i] > RESIDENCY_KEEP_FRAMES) &&
+               (SDL_AtomicGet(residency.state + i) == RESIDENCY_RESIDENT) &&
+               ((oldest == residency.rooms_count) || (residency.needed_frame[i] < residency.needed_frame[oldest])))
+            {
+                oldest = i;
+            }
+        }
+
+        if(oldest == residency.rooms_count)
+        {
+            break;
+        }
+        Residency_Release(oldest);
+    }
+}
@@ -0,0 +1,49 @@
+
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <stdint.h>
+
+struct room_s;
+
+/*
+ * Room geometry residency: faces, vertices and GL buffers of room meshes are
+ * made only for rooms within few portal hops of the player and the camera.
+ * Approaching rooms are built on background thread and uploaded by main
+ * thread; rooms which were neither near nor drawn for few frames are released
+ * while budget is exceeded.
+ * Room polygons (collision, transparency) are always kept.
+ */
+
+typedef struct residency_settings_s
+{
+    int8_t      enabled;
+    uint16_t    hops;                       // portals from player / camera room
+    uint32_t    budget;                     // bytes of resident room geometry
+}residency_settings_t, *residency_settings_p;
+
+typedef struct residency_stats_s
+{
+    uint32_t    resident_count;
+    uint32_t    resident_size;              // bytes
+    uint32_t    built;                      // in background
+    uint32_t    built_sync;                 // room was drawn before it was built in background
+    uint32_t    released;
+    float       latency_last;               // ms from request to upload
+    float       latency_max;
+}residency_stats_t, *residency_stats_p;
+
+extern struct residency_settings_s residency_settings;
+extern struct residency_stats_s    residency_stats;
+
+void Residency_InitGlobals();
+// Call after rooms are generated; without residency all room meshes are built here.
+void Residency_Init(struct room_s *rooms, uint32_t rooms_count);
+void Residency_Clear();
+
+// Main thread, before render list is made.
+void Residency_Update(struct room_s *player_room, struct room_s *camera_room);
+// Room is going to be drawn, builds it now if it is not resident yet.
+void Residency_Require(struct room_s *room);
+
+#endif
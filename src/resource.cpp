@@ -898,43 +898,25 @@ int Res_Sector_TranslateFloorData(struct room_s *rooms, uint32_t rooms_count, st
                 {
                     fd_trigger_head_t fd_trigger_head = *((fd_trigger_head_p)entry);
 
-                    if(sector->trigger == NULL)
-                    {
-                        sector->trigger = (trigger_header_p)malloc(sizeof(trigger_header_t));
-                    }
-                    else
+                    if(sector->trigger != NULL)
                     {
                         Con_AddLine("SECTOR HAS TWO OR MORE TRIGGERS!!!", FONTSTYLE_CONSOLE_WARNING);
+                        Trigger_Delete(sector->trigger);
                     }
-                    sector->trigger->commands = NULL;
-                    sector->trigger->function_value = fd_command.function_value;
-                    sector->trigger->sub_function = fd_command.sub_function;
-                    sector->trigger->mask = fd_trigger_head.mask;
-                    sector->trigger->timer = fd_trigger_head.timer;
-                    sector->trigger->once = fd_trigger_head.once;
+                    sector->trigger = Trigger_Create(fd_command.function_value, fd_command.sub_function,
+                                                     fd_trigger_head.mask, fd_trigger_head.once, fd_trigger_head.timer);
 
                     // Now parse operand chain for trigger function!
                     fd_trigger_function_t fd_trigger_function;
                     do
                     {
-                        trigger_command_p command = (trigger_command_p)malloc(sizeof(trigger_command_t));
-                        trigger_command_p *last_command_ptr = &sector->trigger->commands;
-                        command->next = NULL;
-                        while(*last_command_ptr)
-                        {
-                            last_command_ptr = &((*last_command_ptr)->next);
-                        }
-                        *last_command_ptr = command;
+                        trigger_command_p command = Trigger_AddCommand(sector->trigger);
 
                         entry++;
                         current_offset++;
                         fd_trigger_function = *((fd_trigger_function_p)entry);
                         command->function = fd_trigger_function.function;
                         command->operands = fd_trigger_function.operands;
-                        command->once = 0;
-                        command->cam_index = 0;
-                        command->cam_timer = 0;
-                        command->cam_move = 0;
 
                         switch(command->function)
                         {
@@ -978,6 +960,7 @@ int Res_Sector_TranslateFloorData(struct room_s *rooms, uint32_t rooms_count, st
                         };
                     }
                     while(!fd_trigger_function.cont_bit && (current_offset < max_offset));
+                    Trigger_Compile(sector->trigger);
                 }
                 break;
 
@@ -1725,6 +1708,7 @@ void TR_GenSkeletalModel(struct skeletal_model_s *model, size_t model_id, struct
             vec4_SetZXYRotations(bone_tag->qrotate, rot);
             vec3_copy(bone_tag->offset, tree_tag->offset);
         }
+        SkeletalModel_InterpolateFrames(model);
         return;
     }
     //Sys_DebugLog(LOG_FILENAME, "model = %d, anims = %d", tr_moveable->object_id, GetNumAnimationsForMoveable(tr, model_num));
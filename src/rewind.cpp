@@ -0,0 +1,530 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/system.h"
+#include "core/console.h"
+#include "core/redblack.h"
+#include "engine.h"
+#include "physics.h"
+#include "world.h"
+#include "entity.h"
+#include "trigger.h"
+#include "save_state.h"
+#include "rewind.h"
+
+
+typedef struct rewind_slot_s
+{
+    uint8_t    *data;                       // whole snapshot (keyframe) or dirty records (delta)
+    uint32_t    size;
+    uint32_t    buffer_size;
+    uint32_t    keyframe;                   // slot of the keyframe this delta is based on
+}rewind_slot_t, *rewind_slot_p;
+
+typedef struct rewind_body_s
+{
+    float       transform[16];
+    float       linear[3];
+    float       angular[3];
+}rewind_body_t, *rewind_body_p;
+
+struct rewind_settings_s rewind_settings;
+
+static struct
+{
+    rewind_slot_p       slots;
+    uint32_t            slots_count;
+    uint32_t            first;
+    uint32_t            count;
+    uint32_t            since_keyframe;
+    uint32_t            keyframe_period;    // limited to half of slots, so ring always keeps two keyframes
+    float               time;
+    int                 scrubbing;
+    save_state_t        raw;                // snapshot being captured
+    save_state_t        world;              // world part of the last keyframe
+} rewind_history = {NULL, 0, 0, 0, 0, 1, 0.0f, 0, {NULL, 0, 0}, {NULL, 0, 0}};
+
+
+static void Rewind_SlotReserve(rewind_slot_p slot, uint32_t size)
+{
+    if(size > slot->buffer_size)
+    {
+        slot->data = (uint8_t*)realloc(slot->data, size);
+        slot->buffer_size = size;
+    }
+}
+
+
+/*
+ * Flags are changed by scripts and triggers in too many places to mark them,
+ * so they are compared by hash; movement, animation and params set state_dirty.
+ */
+static uint32_t Rewind_EntityKey(entity_p ent)
+{
+    uint32_t key = 2166136261u;
+    uint32_t timer;
+
+    memcpy(&timer, &ent->timer, sizeof(timer));
+    key = (key ^ ent->state_flags) * 16777619u;
+    key = (key ^ ent->type_flags) * 16777619u;
+    key = (key ^ ent->callback_flags) * 16777619u;
+    key = (key ^ ent->trigger_layout) * 16777619u;
+    key = (key ^ ent->self->collision_type) * 16777619u;
+    key = (key ^ ent->self->collision_shape) * 16777619u;
+    key = (key ^ ent->move_type) * 16777619u;
+    key = (key ^ timer) * 16777619u;
+
+    return key;
+}
+
+
+static int Rewind_IsEntityDirty(entity_p ent)
+{
+    if(!ent->state_dirty && (ent->state_key != Rewind_EntityKey(ent)))
+    {
+        ent->state_dirty = 1;                                                   // stays dirty up to the next keyframe
+    }
+    return ent->state_dirty;
+}
+
+
+static void Rewind_CleanTree(RedBlackNode_p n)
+{
+    entity_p ent = (entity_p)n->data;
+    if(n->left != NULL)
+    {
+        Rewind_CleanTree(n->left);
+    }
+    ent->state_dirty = 0;
+    ent->state_key = Rewind_EntityKey(ent);
+    if(n->right != NULL)
+    {
+        Rewind_CleanTree(n->right);
+    }
+}
+
+
+static void Rewind_PutEntitiesTree(RedBlackNode_p n, entity_p player, uint32_t *count)
+{
+    if(n->left != NULL)
+    {
+        Rewind_PutEntitiesTree(n->left, player, count);
+    }
+    if(((entity_p)n->data != player) && Rewind_IsEntityDirty((entity_p)n->data))
+    {
+        SaveState_PutEntity(&rewind_history.raw, (entity_p)n->data);
+        (*count)++;
+    }
+    if(n->right != NULL)
+    {
+        Rewind_PutEntitiesTree(n->right, player, count);
+    }
+}
+
+
+static void Rewind_PutBodies(entity_p ent, uint32_t *count)
+{
+    uint16_t bodies_count;
+
+    if(!(ent->type_flags & ENTITY_TYPE_DYNAMIC) || !Physics_IsBodyesInited(ent->physics))
+    {
+        return;
+    }
+
+    bodies_count = Physics_GetBodiesCount(ent->physics);
+    SaveState_Append(&rewind_history.raw, &ent->id, sizeof(ent->id));
+    SaveState_Append(&rewind_history.raw, &bodies_count, sizeof(bodies_count));
+    for(uint16_t i = 0; i < bodies_count; i++)
+    {
+        rewind_body_t body;
+        memset(&body, 0, sizeof(body));
+        Physics_GetBodyWorldTransform(ent->physics, body.transform, i);
+        Physics_GetBodyVelocity(ent->physics, body.linear, body.angular, i);
+        SaveState_Append(&rewind_history.raw, &body, sizeof(body));
+    }
+    (*count)++;
+}
+
+
+// dynamic bodies always mark their entities dirty, so deltas take dirty ones only.
+static void Rewind_PutBodiesTree(RedBlackNode_p n, entity_p player, int dirty_only, uint32_t *count)
+{
+    if(n->left != NULL)
+    {
+        Rewind_PutBodiesTree(n->left, player, dirty_only, count);
+    }
+    if(((entity_p)n->data != player) && (!dirty_only || ((entity_p)n->data)->state_dirty))
+    {
+        Rewind_PutBodies((entity_p)n->data, count);
+    }
+    if(n->right != NULL)
+    {
+        Rewind_PutBodiesTree(n->right, player, dirty_only, count);
+    }
+}
+
+
+static void Rewind_PutAllBodies(entity_p player, int dirty_only)
+{
+    RedBlackNode_p root = World_GetEntityTreeRoot();
+    uint32_t count = 0;
+    uint32_t count_offset = rewind_history.raw.size;
+
+    SaveState_Append(&rewind_history.raw, &count, sizeof(count));
+    if(player)
+    {
+        Rewind_PutBodies(player, &count);
+    }
+    if(root)
+    {
+        Rewind_PutBodiesTree(root, player, dirty_only, &count);
+    }
+    memcpy(rewind_history.raw.data + count_offset, &count, sizeof(count));
+}
+
+
+static const uint8_t *Rewind_RestoreBodies(const uint8_t *ptr, const uint8_t *end)
+{
+    uint32_t count;
+
+    if(ptr + sizeof(count) > end)
+    {
+        return NULL;
+    }
+    memcpy(&count, ptr, sizeof(count));
+    ptr += sizeof(count);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        uint32_t id;
+        uint16_t bodies_count;
+        entity_p ent;
+
+        if(ptr + sizeof(id) + sizeof(bodies_count) > end)
+        {
+            return NULL;
+        }
+        memcpy(&id, ptr, sizeof(id));
+        ptr += sizeof(id);
+        memcpy(&bodies_count, ptr, sizeof(bodies_count));
+        ptr += sizeof(bodies_count);
+        if(ptr + bodies_count * sizeof(rewind_body_t) > end)
+        {
+            return NULL;
+        }
+
+        ent = World_GetEntityByID(id);
+        if(ent && (ent->type_flags & ENTITY_TYPE_DYNAMIC) && (Physics_GetBodiesCount(ent->physics) == bodies_count))
+        {
+            for(uint16_t j = 0; j < bodies_count; j++)
+            {
+                rewind_body_t body;
+                memcpy(&body, ptr + j * sizeof(body), sizeof(body));
+                Physics_SetBodyWorldTransform(ent->physics, body.transform, j);
+                Physics_SetBodyVelocity(ent->physics, body.linear, body.angular, j);
+            }
+            Entity_UpdateRigidBody(ent, 1);
+        }
+        ptr += bodies_count * sizeof(rewind_body_t);
+    }
+
+    return ptr;
+}
+
+
+static int Rewind_RestoreKeyframe(rewind_slot_p slot)
+{
+    save_state_header_t header;
+    uint32_t blob_size;
+
+    memcpy(&header, slot->data, sizeof(header));
+    blob_size = header.header_size + header.data_size;
+    if((blob_size > slot->size) || !SaveState_Restore(slot->data, blob_size, 0))
+    {
+        return 0;
+    }
+
+    return Rewind_RestoreBodies(slot->data + blob_size, slot->data + slot->size) != NULL;
+}
+
+
+/*
+ * Delta: uint32 world part size (0 - same as in keyframe) and world part,
+ * uint32 count of entity records and records of entities dirty since the
+ * keyframe, then their dynamic bodies.
+ */
+static void Rewind_RestoreDelta(rewind_slot_p slot)
+{
+    const uint8_t *ptr = slot->data;
+    const uint8_t *end = slot->data + slot->size;
+    uint32_t size, count;
+
+    memcpy(&size, ptr, sizeof(size));
+    ptr += sizeof(size);
+    if(size && (SaveState_ApplyWorld(ptr, size) != size))
+    {
+        return;
+    }
+    ptr += size;
+
+    memcpy(&count, ptr, sizeof(count));
+    ptr += sizeof(count);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        size = SaveState_ApplyEntity(ptr, end - ptr);
+        if(size == 0)
+        {
+            return;
+        }
+        ptr += size;
+    }
+    Rewind_RestoreBodies(ptr, end);
+    Trigger_Invalidate();
+}
+
+
+static void Rewind_RestoreSlot(uint32_t index)
+{
+    rewind_slot_p slot = rewind_history.slots + index;
+
+    if(Rewind_RestoreKeyframe(rewind_history.slots + slot->keyframe) && (slot->keyframe != index))
+    {
+        Rewind_RestoreDelta(slot);
+    }
+}
+
+
+/*
+ * Frees the oldest slots: deltas left without keyframe, then the oldest keyframe
+ * with its deltas. The last keyframe is never dropped; returns 0 if nothing is freed.
+ */
+static int Rewind_DropFirst()
+{
+    uint32_t dropped = 0;
+    uint32_t next;
+
+    while(rewind_history.count && (rewind_history.slots[rewind_history.first].keyframe != rewind_history.first))
+    {
+        rewind_history.first = (rewind_history.first + 1) % rewind_history.slots_count;
+        rewind_history.count--;
+        dropped++;
+    }
+
+    for(next = 1; next < rewind_history.count; next++)
+    {
+        uint32_t index = (rewind_history.first + next) % rewind_history.slots_count;
+        if(rewind_history.slots[index].keyframe == index)
+        {
+            rewind_history.first = index;
+            rewind_history.count -= next;
+            return 1;
+        }
+    }
+
+    return dropped > 0;
+}
+
+
+static void Rewind_CaptureKeyframe(rewind_slot_p slot, uint32_t index)
+{
+    entity_p player = World_GetPlayer();
+    RedBlackNode_p root = World_GetEntityTreeRoot();
+
+    SaveState_Capture(&rewind_history.raw, 1);
+    Rewind_PutAllBodies(player, 0);
+    Rewind_SlotReserve(slot, rewind_history.raw.size);
+    memcpy(slot->data, rewind_history.raw.data, rewind_history.raw.size);
+    slot->size = rewind_history.raw.size;
+    slot->keyframe = index;
+
+    rewind_history.world.size = 0;
+    SaveState_PutWorld(&rewind_history.world);
+    if(player)
+    {
+        player->state_dirty = 0;
+        player->state_key = Rewind_EntityKey(player);
+    }
+    if(root)
+    {
+        Rewind_CleanTree(root);
+    }
+}
+
+
+static void Rewind_CaptureDelta(rewind_slot_p slot, uint32_t keyframe)
+{
+    entity_p player = World_GetPlayer();
+    RedBlackNode_p root = World_GetEntityTreeRoot();
+    uint32_t size = 0;
+    uint32_t count = 0;
+    uint32_t offset;
+
+    rewind_history.raw.size = 0;
+    SaveState_Append(&rewind_history.raw, &size, sizeof(size));
+    SaveState_PutWorld(&rewind_history.raw);
+    size = rewind_history.raw.size - sizeof(size);
+    if((size == rewind_history.world.size) && !memcmp(rewind_history.raw.data + sizeof(size), rewind_history.world.data, size))
+    {
+        size = 0;                                                               // flip maps and secrets are not changed
+        rewind_history.raw.size = sizeof(size);
+    }
+    memcpy(rewind_history.raw.data, &size, sizeof(size));
+
+    offset = rewind_history.raw.size;
+    SaveState_Append(&rewind_history.raw, &count, sizeof(count));
+    if(player)
+    {
+        player->state_dirty = 1;                                                // inventory is not tracked
+        SaveState_PutEntity(&rewind_history.raw, player);
+        count++;
+    }
+    if(root)
+    {
+        Rewind_PutEntitiesTree(root, player, &count);
+    }
+    memcpy(rewind_history.raw.data + offset, &count, sizeof(count));
+    Rewind_PutAllBodies(player, 1);
+
+    Rewind_SlotReserve(slot, rewind_history.raw.size);
+    memcpy(slot->data, rewind_history.raw.data, rewind_history.raw.size);
+    slot->size = rewind_history.raw.size;
+    slot->keyframe = keyframe;
+}
+
+
+static void Rewind_Capture()
+{
+    uint32_t index, keyframe;
+
+    if((rewind_history.count == rewind_history.slots_count) && !Rewind_DropFirst())
+    {
+        Rewind_Reset();                                                         // can not happen with keyframe_period <= slots_count / 2
+    }
+    keyframe = (rewind_history.count) ? (rewind_history.slots[(rewind_history.first + rewind_history.count - 1) % rewind_history.slots_count].keyframe) : (0);
+    index = (rewind_history.first + rewind_history.count) % rewind_history.slots_count;
+    rewind_history.count++;
+
+    if((rewind_history.count == 1) || (rewind_history.since_keyframe >= rewind_history.keyframe_period))
+    {
+        Rewind_CaptureKeyframe(rewind_history.slots + index, index);
+        rewind_history.since_keyframe = 1;
+    }
+    else
+    {
+        Rewind_CaptureDelta(rewind_history.slots + index, keyframe);
+        rewind_history.since_keyframe++;
+    }
+}
+
+
+void Rewind_InitGlobals()
+{
+    rewind_settings.length = 20.0f;
+    rewind_settings.interval = 0.1f;
+    rewind_settings.keyframe_period = 32;
+}
+
+
+void Rewind_Destroy()
+{
+    if(rewind_history.slots)
+    {
+        for(uint32_t i = 0; i < rewind_history.slots_count; i++)
+        {
+            free(rewind_history.slots[i].data);
+        }
+        free(rewind_history.slots);
+        rewind_history.slots = NULL;
+    }
+    rewind_history.slots_count = 0;
+    SaveState_Clear(&rewind_history.raw);
+    SaveState_Clear(&rewind_history.world);
+    Rewind_Reset();
+}
+
+
+void Rewind_Reset()
+{
+    rewind_history.first = 0;
+    rewind_history.count = 0;
+    rewind_history.since_keyframe = 0;
+    rewind_history.time = 0.0f;
+    rewind_history.scrubbing = 0;
+}
+
+
+void Rewind_Frame(float time)
+{
+    if((rewind_settings.length <= 0.0f) || (rewind_settings.interval <= 0.0f))
+    {
+        return;
+    }
+
+    if(rewind_history.slots == NULL)
+    {
+        rewind_history.slots_count = (uint32_t)(rewind_settings.length / rewind_settings.interval) + 1;
+        rewind_history.slots_count = (rewind_history.slots_count > 2) ? (rewind_history.slots_count) : (2);
+        rewind_history.slots = (rewind_slot_p)calloc(rewind_history.slots_count, sizeof(rewind_slot_t));
+        rewind_history.keyframe_period = (rewind_settings.keyframe_period < rewind_history.slots_count / 2) ? (rewind_settings.keyframe_period) : (rewind_history.slots_count / 2);
+        rewind_history.keyframe_period = (rewind_history.keyframe_period > 1) ? (rewind_history.keyframe_period) : (1);
+        Rewind_Reset();
+    }
+
+    if(rewind_history.scrubbing)
+    {
+        // restore marked all entities dirty, start the new branch of history from keyframe.
+        rewind_history.scrubbing = 0;
+        rewind_history.time = 0.0f;
+        rewind_history.since_keyframe = rewind_history.keyframe_period;
+    }
+
+    rewind_history.time += time;
+    if((rewind_history.count == 0) || (rewind_history.time >= rewind_settings.interval))
+    {
+        rewind_history.time = 0.0f;
+        Rewind_Capture();
+    }
+}
+
+
+int Rewind_Step(float time)
+{
+    uint32_t index;
+
+    if(rewind_history.count == 0)
+    {
+        return 0;
+    }
+
+    rewind_history.time += time;
+    if(!rewind_history.scrubbing || (rewind_history.time >= rewind_settings.interval))
+    {
+        rewind_history.time = 0.0f;
+        if(rewind_history.scrubbing && (rewind_history.count > 1))
+        {
+            rewind_history.count--;
+        }
+        rewind_history.scrubbing = 1;
+        index = (rewind_history.first + rewind_history.count - 1) % rewind_history.slots_count;
+        Rewind_RestoreSlot(index);
+    }
+
+    return 1;
+}
+
+
+uint32_t Rewind_GetSnapshotsCount()
+{
+    return rewind_history.count;
+}
+
+
+uint32_t Rewind_GetMemoryUsed()
+{
+    uint32_t ret = rewind_history.raw.buffer_size + rewind_history.world.buffer_size;
+    for(uint32_t i = 0; i < rewind_history.slots_count; i++)
+    {
+        ret += rewind_history.slots[i].buffer_size;
+    }
+    return ret;
+}
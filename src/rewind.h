@@ -0,0 +1,37 @@
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+
+/*
+ * Rewind history: ring buffer of game state snapshots, taken every interval
+ * seconds. Every keyframe_period-th one is a full capture (save state blob +
+ * dynamic physics bodies); others keep only the world part (secrets, flip maps)
+ * if it differs from the keyframe and records of entities which were moved,
+ * animated or had flags or params changed since the keyframe.
+ * Restore applies the keyframe, then the delta on top of it.
+ */
+
+typedef struct rewind_settings_s
+{
+    float       length;                     // seconds of history kept, 0 - disabled
+    float       interval;                   // seconds between snapshots
+    uint16_t    keyframe_period;            // snapshots per keyframe
+}rewind_settings_t, *rewind_settings_p;
+
+extern struct rewind_settings_s rewind_settings;
+
+void Rewind_InitGlobals();
+void Rewind_Destroy();
+void Rewind_Reset();
+
+// Takes snapshot when interval is passed since the last one.
+void Rewind_Frame(float time);
+// Steps history back at snapshot rate and restores state; returns 0 if nothing to rewind.
+int  Rewind_Step(float time);
+
+uint32_t Rewind_GetSnapshotsCount();
+uint32_t Rewind_GetMemoryUsed();
+
+#endif
@@ -70,12 +70,6 @@ void Room_Clear(struct room_s *room)
             room->content->sprites_count = 0;
         }
 
-        if(room->content->sprites_vertices)
-        {
-            free(room->content->sprites_vertices);
-            room->content->sprites_vertices = NULL;
-        }
-
         if(room->content->lights_count)
         {
             free(room->content->lights);
@@ -111,14 +105,7 @@ void Room_Clear(struct room_s *room)
         {
             if(s->trigger)
             {
-                for(trigger_command_p current_command = s->trigger->commands; current_command; )
-                {
-                    trigger_command_p next_command = current_command->next;
-                    current_command->next = NULL;
-                    free(current_command);
-                    current_command = next_command;
-                }
-                free(s->trigger);
+                Trigger_Delete(s->trigger);
                 s->trigger = NULL;
             }
         }
@@ -554,37 +541,6 @@ struct room_s *Room_CheckFlip(struct room_s *r)
 }
 
 
-void Room_GenSpritesBuffer(struct room_s *room)
-{
-    room->content->sprites_vertices = NULL;
-
-    if(room->content->sprites_count > 0)
-    {
-        room->content->sprites_vertices = (vertex_p)malloc(room->content->sprites_count * 4 * sizeof(vertex_t));
-        for(uint32_t i = 0; i < room->content->sprites_count; i++)
-        {
-            room_sprite_p s = room->content->sprites + i;
-            if(s->sprite)
-            {
-                vertex_p v = room->content->sprites_vertices + i * 4;
-                vec4_set_one(v[0].color);
-                vec4_set_one(v[1].color);
-                vec4_set_one(v[2].color);
-                vec4_set_one(v[3].color);
-                v[0].tex_coord[0] = s->sprite->tex_coord[0];
-                v[0].tex_coord[1] = s->sprite->tex_coord[1];
-                v[1].tex_coord[0] = s->sprite->tex_coord[2];
-                v[1].tex_coord[1] = s->sprite->tex_coord[3];
-                v[2].tex_coord[0] = s->sprite->tex_coord[4];
-                v[2].tex_coord[1] = s->sprite->tex_coord[5];
-                v[3].tex_coord[0] = s->sprite->tex_coord[6];
-                v[3].tex_coord[1] = s->sprite->tex_coord[7];
-            }
-        }
-    }
-}
-
-
 /*
  *   Sectors functionality
  */
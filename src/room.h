@@ -203,7 +203,6 @@ typedef struct room_content_s
     struct static_mesh_s       *static_mesh;
     uint32_t                    sprites_count;
     struct room_sprite_s       *sprites;
-    struct vertex_s            *sprites_vertices;
     uint32_t                    lights_count;
     struct light_s             *lights;
 
@@ -274,7 +273,6 @@ struct room_s *Room_CheckFlip(struct room_s *r);
 // NOTE: Functions which take native TR level structures as argument will have
 // additional _TR_ prefix. Functions which doesn't use specific TR structures
 // should NOT use such prefix!
-void Room_GenSpritesBuffer(struct room_s *room);
 
 struct room_sector_s *Sector_CheckBaseRoom(struct room_sector_s *rs);
 struct room_sector_s *Sector_CheckAlternateRoom(struct room_sector_s *rs);
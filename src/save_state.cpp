@@ -0,0 +1,1167 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include "core/system.h"
+#include "core/console.h"
+#include "core/vmath.h"
+#include "core/redblack.h"
+#include "engine.h"
+#include "physics.h"
+#include "room.h"
+#include "world.h"
+#include "skeletal_model.h"
+#include "entity.h"
+#include "script.h"
+#include "character_controller.h"
+#include "gameflow.h"
+#include "gui.h"
+#include "inventory.h"
+#include "trigger.h"
+#include "save_state.h"
+
+/*
+ * Script globals are stored as tree of entries: uint8 key type (number or string)
+ * and key, uint8 value type and value; table value is followed by its entries
+ * and SAVE_LUA_END. Functions, userdata, threads and library tables are skipped.
+ */
+#define SAVE_LUA_END            (0xFF)
+#define SAVE_LUA_MAX_DEPTH      (8)
+#define SAVE_LUA_MAX_PATH       (1024)
+
+/*
+ * Fixed part of entity record; inventory (id, count pairs) and
+ * character params (param, maximum pairs) follow it.
+ * All fields are stored in native (little endian) byte order.
+ */
+typedef struct save_entity_s
+{
+    uint32_t    id;
+    uint32_t    model_id;
+    uint32_t    room_id;
+    uint32_t    callback_flags;
+    float       pos[3];
+    float       angles[3];
+    float       speed[3];
+    float       timer;
+    int16_t     current_animation;
+    int16_t     current_frame;
+    int16_t     next_state;
+    int16_t     last_state;
+    uint16_t    state_flags;
+    uint16_t    type_flags;
+    uint16_t    collision_type;
+    uint16_t    collision_shape;
+    uint8_t     trigger_layout;
+    uint8_t     move_type;
+    uint8_t     dir_flag;
+    uint8_t     has_character;
+    uint16_t    inventory_count;
+    uint16_t    params_count;
+}save_entity_t, *save_entity_p;
+
+typedef struct save_reader_s
+{
+    const uint8_t  *ptr;
+    const uint8_t  *end;
+    int             error;
+}save_reader_t, *save_reader_p;
+
+static uint32_t crc32_table[256];
+static int      crc32_table_ready = 0;
+
+
+void SaveState_Append(save_state_p state, const void *src, uint32_t size)
+{
+    if(state->size + size > state->buffer_size)
+    {
+        uint32_t new_size = (state->buffer_size) ? (state->buffer_size) : (16384);
+        while(state->size + size > new_size)
+        {
+            new_size *= 2;
+        }
+        state->data = (uint8_t*)realloc(state->data, new_size);
+        state->buffer_size = new_size;
+    }
+    memcpy(state->data + state->size, src, size);
+    state->size += size;
+}
+
+
+static void SaveState_Get(save_reader_p reader, void *dst, uint32_t size)
+{
+    if(reader->error || (reader->ptr + size > reader->end))
+    {
+        reader->error = 1;
+        memset(dst, 0, size);
+        return;
+    }
+    memcpy(dst, reader->ptr, size);
+    reader->ptr += size;
+}
+
+
+void SaveState_PutEntity(struct save_state_s *state, struct entity_s *ent)
+{
+    save_entity_t rec;
+    inventory_node_p i;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.id = ent->id;
+    rec.model_id = ent->bf->animations.model->id;
+    rec.room_id = (ent->self->room) ? (ent->self->room->id) : (0xFFFFFFFF);
+    rec.callback_flags = ent->callback_flags;
+    vec3_copy(rec.pos, ent->transform + 12);
+    vec3_copy(rec.angles, ent->angles);
+    vec3_copy(rec.speed, ent->speed);
+    rec.timer = ent->timer;
+    rec.current_animation = ent->bf->animations.current_animation;
+    rec.current_frame = ent->bf->animations.current_frame;
+    rec.next_state = ent->bf->animations.next_state;
+    rec.last_state = ent->bf->animations.last_state;
+    rec.state_flags = ent->state_flags;
+    rec.type_flags = ent->type_flags;
+    rec.collision_type = ent->self->collision_type;
+    rec.collision_shape = ent->self->collision_shape;
+    rec.trigger_layout = ent->trigger_layout;
+    rec.move_type = ent->move_type;
+    rec.dir_flag = ent->dir_flag;
+    if(ent->character)
+    {
+        rec.has_character = 1;
+        rec.params_count = PARAM_LASTINDEX;
+        for(i = ent->character->inventory; i; i = i->next)
+        {
+            rec.inventory_count++;
+        }
+    }
+
+    SaveState_Append(state, &rec, sizeof(rec));
+    if(ent->character)
+    {
+        for(i = ent->character->inventory; i; i = i->next)
+        {
+            int32_t item[2] = {(int32_t)i->id, i->count};
+            SaveState_Append(state, item, sizeof(item));
+        }
+        SaveState_Append(state, ent->character->parameters.param, PARAM_LASTINDEX * sizeof(float));
+        SaveState_Append(state, ent->character->parameters.maximum, PARAM_LASTINDEX * sizeof(float));
+    }
+}
+
+
+static void SaveState_PutEntityTree(save_state_p state, RedBlackNode_p n, entity_p player, uint32_t *count)
+{
+    if(n->left != NULL)
+    {
+        SaveState_PutEntityTree(state, n->left, player, count);
+    }
+    if((entity_p)n->data != player)
+    {
+        SaveState_PutEntity(state, (entity_p)n->data);
+        (*count)++;
+    }
+    if(n->right != NULL)
+    {
+        SaveState_PutEntityTree(state, n->right, player, count);
+    }
+}
+
+
+static void SaveState_DisableSpawned(RedBlackNode_p n)
+{
+    entity_p ent = (entity_p)n->data;
+    if(n->left != NULL)
+    {
+        SaveState_DisableSpawned(n->left);
+    }
+    if(ent->type_flags & ENTITY_TYPE_SPAWNED)
+    {
+        Entity_Disable(ent);
+    }
+    if(n->right != NULL)
+    {
+        SaveState_DisableSpawned(n->right);
+    }
+}
+
+
+static void SaveState_RestoreEntity(save_entity_p rec, save_reader_p reader)
+{
+    entity_p ent = NULL;
+
+    if(rec->type_flags & ENTITY_TYPE_SPAWNED)
+    {
+        ent = World_GetEntityByID(World_SpawnEntity(rec->model_id, rec->room_id, rec->pos, rec->angles, rec->id));
+    }
+    else if((ent = World_GetEntityByID(rec->id)) != NULL)
+    {
+        vec3_copy(ent->transform + 12, rec->pos);
+        vec3_copy(ent->angles, rec->angles);
+        Entity_UpdateTransform(ent);
+    }
+
+    if(ent == NULL)
+    {
+        Con_Warning("no entity with id = %d", rec->id);
+        if(rec->has_character)
+        {
+            reader->ptr += rec->inventory_count * 2 * sizeof(int32_t) + rec->params_count * 2 * sizeof(float);
+            reader->error = (reader->ptr > reader->end);
+        }
+        return;
+    }
+
+    if(ent->character)
+    {
+        Character_UpdatePlatformPreStep(ent);
+    }
+    if((ent->type_flags & ENTITY_TYPE_DYNAMIC) && !(rec->type_flags & ENTITY_TYPE_DYNAMIC))
+    {
+        Ragdoll_Delete(ent->physics);                                           // in place restore: bodies become kinematic again
+    }
+    vec3_copy(ent->speed, rec->speed);
+    Character_UpdateCurrentSpeed(ent);
+    Entity_SetAnimation(ent, rec->current_animation, rec->current_frame);
+    ent->bf->animations.next_state = rec->next_state;
+    ent->bf->animations.last_state = rec->last_state;
+    ent->state_flags = rec->state_flags;
+    ent->type_flags = rec->type_flags;
+    ent->callback_flags = rec->callback_flags;
+    ent->timer = rec->timer;
+
+    if((ent->self->collision_type & 0x0001) && !(rec->collision_type & 0x0001))
+    {
+        Entity_DisableCollision(ent);
+    }
+    else if(!(ent->self->collision_type & 0x0001) && (rec->collision_type & 0x0001))
+    {
+        Entity_EnableCollision(ent);
+    }
+    ent->self->collision_type = rec->collision_type;
+    ent->self->collision_shape = rec->collision_shape;
+    if(Physics_GetBodiesCount(ent->physics) != ent->bf->bone_tag_count)
+    {
+        ent->self->collision_shape = COLLISION_SHAPE_SINGLE_BOX;
+    }
+    ent->trigger_layout = rec->trigger_layout;
+
+    room_p room = (rec->room_id != 0xFFFFFFFF) ? (World_GetRoomByID(rec->room_id)) : (NULL);
+    if(room)
+    {
+        if(ent == World_GetPlayer())
+        {
+            ent->self->room = room;
+        }
+        else if(ent->self->room != room)
+        {
+            if(ent->self->room != NULL)
+            {
+                Room_RemoveObject(ent->self->room, ent->self);
+            }
+            Room_AddObject(room, ent->self);
+        }
+    }
+    Entity_UpdateRoomPos(ent);
+    ent->move_type = rec->move_type;
+    ent->dir_flag = rec->dir_flag;
+
+    if(rec->has_character)
+    {
+        character_param_t parameters;
+        if(ent->character)
+        {
+            Inventory_RemoveAllItems(&ent->character->inventory);
+        }
+        for(uint16_t i = 0; i < rec->inventory_count; i++)
+        {
+            int32_t item[2];
+            SaveState_Get(reader, item, sizeof(item));
+            if(ent->character && !reader->error)
+            {
+                Inventory_AddItem(&ent->character->inventory, item[0], item[1]);
+            }
+        }
+        for(uint16_t i = 0; i < rec->params_count; i++)
+        {
+            float value;
+            SaveState_Get(reader, &value, sizeof(value));
+            if(i < PARAM_LASTINDEX)
+            {
+                parameters.param[i] = value;
+            }
+        }
+        for(uint16_t i = 0; i < rec->params_count; i++)
+        {
+            float value;
+            SaveState_Get(reader, &value, sizeof(value));
+            if(i < PARAM_LASTINDEX)
+            {
+                parameters.maximum[i] = value;
+            }
+        }
+        if(ent->character && !reader->error)
+        {
+            for(uint16_t i = 0; (i < rec->params_count) && (i < PARAM_LASTINDEX); i++)
+            {
+                ent->character->parameters.param[i] = parameters.param[i];
+                ent->character->parameters.maximum[i] = parameters.maximum[i];
+            }
+        }
+    }
+}
+
+
+// Library and console variables tables are not game state.
+static int SaveState_IsLuaLibrary(lua_State *lua, int index)
+{
+    static const char *libs[] = {"_G", "package", "string", "table", "math", "io", "os",
+                                 "debug", "coroutine", "utf8", "bit32", CVAR_LUA_TABLE_NAME, NULL};
+    const char *name;
+
+    if(lua_type(lua, index) != LUA_TSTRING)
+    {
+        return 0;
+    }
+    name = lua_tostring(lua, index);
+    for(int i = 0; libs[i]; i++)
+    {
+        if(!strcmp(name, libs[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static int SaveState_IsLuaPlain(int type)
+{
+    return (type == LUA_TNUMBER) || (type == LUA_TBOOLEAN) || (type == LUA_TSTRING);
+}
+
+
+// Writes entries of the table on stack top.
+static void SaveState_PutLuaTable(save_state_p state, lua_State *lua, int depth)
+{
+    int table = lua_gettop(lua);
+    uint8_t end = SAVE_LUA_END;
+
+    lua_pushnil(lua);
+    while(lua_next(lua, table))
+    {
+        int key_type = lua_type(lua, -2);
+        int value_type = lua_type(lua, -1);
+        size_t key_len = 0;
+
+        if(key_type == LUA_TSTRING)
+        {
+            lua_tolstring(lua, -2, &key_len);
+        }
+        if(((key_type == LUA_TNUMBER) || ((key_type == LUA_TSTRING) && (key_len <= 0xFFFF))) &&
+           (SaveState_IsLuaPlain(value_type) || ((value_type == LUA_TTABLE) && (depth < SAVE_LUA_MAX_DEPTH) &&
+                                                 !((depth == 0) && SaveState_IsLuaLibrary(lua, -2)))))
+        {
+            uint8_t type = key_type;
+            SaveState_Append(state, &type, sizeof(type));
+            if(key_type == LUA_TNUMBER)
+            {
+                double key = lua_tonumber(lua, -2);
+                SaveState_Append(state, &key, sizeof(key));
+            }
+            else
+            {
+                uint16_t len = key_len;
+                SaveState_Append(state, &len, sizeof(len));
+                SaveState_Append(state, lua_tostring(lua, -2), len);
+            }
+
+            type = value_type;
+            SaveState_Append(state, &type, sizeof(type));
+            switch(value_type)
+            {
+                case LUA_TNUMBER:
+                    {
+                        double value = lua_tonumber(lua, -1);
+                        SaveState_Append(state, &value, sizeof(value));
+                    }
+                    break;
+
+                case LUA_TBOOLEAN:
+                    {
+                        uint8_t value = lua_toboolean(lua, -1);
+                        SaveState_Append(state, &value, sizeof(value));
+                    }
+                    break;
+
+                case LUA_TSTRING:
+                    {
+                        size_t value_len;
+                        const char *value = lua_tolstring(lua, -1, &value_len);
+                        uint32_t len = value_len;
+                        SaveState_Append(state, &len, sizeof(len));
+                        SaveState_Append(state, value, len);
+                    }
+                    break;
+
+                case LUA_TTABLE:
+                    SaveState_PutLuaTable(state, lua, depth + 1);
+                    break;
+            };
+        }
+        lua_pop(lua, 1);
+    }
+    SaveState_Append(state, &end, sizeof(end));
+}
+
+
+static void SaveState_PutGlobals(save_state_p state, int globals)
+{
+    uint8_t end = SAVE_LUA_END;
+
+    if(globals && engine_lua)
+    {
+        int top = lua_gettop(engine_lua);
+        lua_pushglobaltable(engine_lua);
+        SaveState_PutLuaTable(state, engine_lua, 0);
+        lua_settop(engine_lua, top);
+    }
+    else
+    {
+        SaveState_Append(state, &end, sizeof(end));
+    }
+}
+
+
+// Pushes stored key; returns 0 on wrong data.
+static int SaveState_GetLuaKey(save_reader_p reader, lua_State *lua, uint8_t type)
+{
+    if(type == LUA_TNUMBER)
+    {
+        double key;
+        SaveState_Get(reader, &key, sizeof(key));
+        if((key == (double)(lua_Integer)key))
+        {
+            lua_pushinteger(lua, (lua_Integer)key);
+        }
+        else
+        {
+            lua_pushnumber(lua, key);
+        }
+    }
+    else if(type == LUA_TSTRING)
+    {
+        uint16_t len;
+        SaveState_Get(reader, &len, sizeof(len));
+        if(reader->error || (reader->ptr + len > reader->end))
+        {
+            reader->error = 1;
+            return 0;
+        }
+        lua_pushlstring(lua, (const char*)reader->ptr, len);
+        reader->ptr += len;
+    }
+    else
+    {
+        reader->error = 1;
+    }
+    return !reader->error;
+}
+
+
+/*
+ * Merges stored entries into the table on stack top: tables are updated,
+ * not replaced, so functions in them are kept; plain values which were not
+ * stored (made after capture) are cleared.
+ */
+static void SaveState_RestoreLuaTable(save_reader_p reader, lua_State *lua, int depth)
+{
+    int table = lua_gettop(lua);
+    int seen = table + 1;
+
+    lua_newtable(lua);
+    while(!reader->error)
+    {
+        uint8_t type;
+        SaveState_Get(reader, &type, sizeof(type));
+        if(reader->error || (type == SAVE_LUA_END) || !SaveState_GetLuaKey(reader, lua, type))
+        {
+            break;
+        }
+        lua_pushvalue(lua, -1);
+        lua_pushboolean(lua, 1);
+        lua_rawset(lua, seen);
+
+        SaveState_Get(reader, &type, sizeof(type));
+        switch(type)
+        {
+            case LUA_TNUMBER:
+                {
+                    double value;
+                    SaveState_Get(reader, &value, sizeof(value));
+                    if(value == (double)(lua_Integer)value)
+                    {
+                        lua_pushinteger(lua, (lua_Integer)value);
+                    }
+                    else
+                    {
+                        lua_pushnumber(lua, value);
+                    }
+                }
+                break;
+
+            case LUA_TBOOLEAN:
+                {
+                    uint8_t value;
+                    SaveState_Get(reader, &value, sizeof(value));
+                    lua_pushboolean(lua, value);
+                }
+                break;
+
+            case LUA_TSTRING:
+                {
+                    uint32_t len;
+                    SaveState_Get(reader, &len, sizeof(len));
+                    if(reader->error || (reader->ptr + len > reader->end))
+                    {
+                        reader->error = 1;
+                        lua_pushnil(lua);
+                        break;
+                    }
+                    lua_pushlstring(lua, (const char*)reader->ptr, len);
+                    reader->ptr += len;
+                }
+                break;
+
+            case LUA_TTABLE:
+                lua_pushvalue(lua, -1);
+                lua_rawget(lua, table);
+                if(!lua_istable(lua, -1))
+                {
+                    lua_pop(lua, 1);
+                    lua_newtable(lua);
+                }
+                if(depth < SAVE_LUA_MAX_DEPTH)
+                {
+                    SaveState_RestoreLuaTable(reader, lua, depth + 1);
+                }
+                else
+                {
+                    reader->error = 1;
+                }
+                break;
+
+            default:
+                reader->error = 1;
+                lua_pushnil(lua);
+                break;
+        };
+
+        if(reader->error)
+        {
+            break;
+        }
+        lua_rawset(lua, table);
+    }
+
+    if(!reader->error)
+    {
+        lua_pushnil(lua);
+        while(lua_next(lua, table))
+        {
+            int key_type = lua_type(lua, -2);
+            lua_pop(lua, 1);
+            if(((key_type == LUA_TNUMBER) || (key_type == LUA_TSTRING)))
+            {
+                lua_pushvalue(lua, -1);
+                lua_rawget(lua, seen);
+                int stored = !lua_isnil(lua, -1);
+                lua_pop(lua, 1);
+                lua_pushvalue(lua, -1);
+                lua_rawget(lua, table);
+                int plain = SaveState_IsLuaPlain(lua_type(lua, -1));
+                lua_pop(lua, 1);
+                if(plain && !stored)
+                {
+                    lua_pushvalue(lua, -1);
+                    lua_pushnil(lua);
+                    lua_rawset(lua, table);                                     // clearing existing field is allowed by lua_next
+                }
+            }
+        }
+    }
+    lua_settop(lua, table);
+}
+
+
+static void SaveState_RestoreGlobals(save_reader_p reader)
+{
+    if(engine_lua)
+    {
+        int top = lua_gettop(engine_lua);
+        lua_pushglobaltable(engine_lua);
+        SaveState_RestoreLuaTable(reader, engine_lua, 0);
+        lua_settop(engine_lua, top);
+    }
+}
+
+
+static void SaveState_ExportLuaString(FILE *f, const char *str, uint32_t len)
+{
+    fputc('"', f);
+    for(uint32_t i = 0; i < len; i++)
+    {
+        uint8_t c = str[i];
+        if((c == '"') || (c == '\\'))
+        {
+            fprintf(f, "\\%c", c);
+        }
+        else if((c < 0x20) || (c >= 0x7F))
+        {
+            fprintf(f, "\\%03d", c);
+        }
+        else
+        {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+
+// Path of table is kept in path; entries with too long paths are read, but not written (quiet).
+static void SaveState_ExportLuaTable(save_reader_p reader, FILE *f, char *path, uint32_t path_len, int quiet, int depth)
+{
+    while(!reader->error)
+    {
+        char key[64];
+        const uint8_t *key_str = NULL;
+        uint32_t key_len = 0;
+        uint8_t type;
+
+        SaveState_Get(reader, &type, sizeof(type));
+        if(reader->error || (type == SAVE_LUA_END))
+        {
+            break;
+        }
+        if(type == LUA_TNUMBER)
+        {
+            double value;
+            SaveState_Get(reader, &value, sizeof(value));
+            snprintf(key, sizeof(key), "[%.17g]", value);
+        }
+        else if(type == LUA_TSTRING)
+        {
+            uint16_t len;
+            SaveState_Get(reader, &len, sizeof(len));
+            if(reader->error || (reader->ptr + len > reader->end))
+            {
+                reader->error = 1;
+                break;
+            }
+            key_str = reader->ptr;
+            key_len = len;
+            reader->ptr += len;
+        }
+        else
+        {
+            reader->error = 1;
+            break;
+        }
+
+        // string keys are written as ["..."] by path, number keys as [n]
+        uint32_t new_len = path_len;
+        int fits = !quiet;
+        if(key_str)
+        {
+            fits = fits && (path_len + 4 * key_len + 4 < SAVE_LUA_MAX_PATH);
+            if(fits)
+            {
+                path[new_len++] = '[';
+                path[new_len++] = '"';
+                for(uint32_t i = 0; i < key_len; i++)
+                {
+                    uint8_t c = key_str[i];
+                    if((c == '"') || (c == '\\'))
+                    {
+                        path[new_len++] = '\\';
+                        path[new_len++] = c;
+                    }
+                    else if((c < 0x20) || (c >= 0x7F))
+                    {
+                        new_len += snprintf(path + new_len, 5, "\\%03d", c);
+                    }
+                    else
+                    {
+                        path[new_len++] = c;
+                    }
+                }
+                path[new_len++] = '"';
+                path[new_len++] = ']';
+            }
+        }
+        else
+        {
+            uint32_t len = strlen(key);
+            fits = fits && (path_len + len < SAVE_LUA_MAX_PATH);
+            if(fits)
+            {
+                memcpy(path + new_len, key, len);
+                new_len += len;
+            }
+        }
+        if(fits)
+        {
+            path[new_len] = 0;
+        }
+
+        SaveState_Get(reader, &type, sizeof(type));
+        switch(type)
+        {
+            case LUA_TNUMBER:
+                {
+                    double value;
+                    SaveState_Get(reader, &value, sizeof(value));
+                    if(fits)
+                    {
+                        fprintf(f, "\n%s = %.17g;", path, value);
+                    }
+                }
+                break;
+
+            case LUA_TBOOLEAN:
+                {
+                    uint8_t value;
+                    SaveState_Get(reader, &value, sizeof(value));
+                    if(fits)
+                    {
+                        fprintf(f, "\n%s = %s;", path, (value) ? ("true") : ("false"));
+                    }
+                }
+                break;
+
+            case LUA_TSTRING:
+                {
+                    uint32_t len;
+                    SaveState_Get(reader, &len, sizeof(len));
+                    if(reader->error || (reader->ptr + len > reader->end))
+                    {
+                        reader->error = 1;
+                        break;
+                    }
+                    if(fits)
+                    {
+                        fprintf(f, "\n%s = ", path);
+                        SaveState_ExportLuaString(f, (const char*)reader->ptr, len);
+                        fputc(';', f);
+                    }
+                    reader->ptr += len;
+                }
+                break;
+
+            case LUA_TTABLE:
+                if(fits)
+                {
+                    fprintf(f, "\n%s = %s or {};", path, path);
+                }
+                if(depth < SAVE_LUA_MAX_DEPTH)
+                {
+                    SaveState_ExportLuaTable(reader, f, path, new_len, !fits, depth + 1);
+                }
+                else
+                {
+                    reader->error = 1;
+                }
+                break;
+
+            default:
+                reader->error = 1;
+                break;
+        };
+        if(!quiet)
+        {
+            path[path_len] = 0;
+        }
+    }
+}
+
+
+void SaveState_PutWorld(struct save_state_s *state)
+{
+    uint8_t *flip_map;
+    uint8_t *flip_state;
+    uint32_t flip_count;
+
+    SaveState_Append(state, gameflow_manager.SecretsTriggerMap, TR_GAMEFLOW_MAX_SECRETS);
+    World_GetFlipInfo(&flip_map, &flip_state, &flip_count);
+    SaveState_Append(state, &flip_count, sizeof(flip_count));
+    SaveState_Append(state, flip_map, flip_count);
+    SaveState_Append(state, flip_state, flip_count);
+}
+
+
+static void SaveState_RestoreWorld(save_reader_p reader)
+{
+    uint32_t count;
+
+    SaveState_Get(reader, gameflow_manager.SecretsTriggerMap, TR_GAMEFLOW_MAX_SECRETS);
+    SaveState_Get(reader, &count, sizeof(count));
+    if(reader->error || (reader->ptr + 2 * count > reader->end))
+    {
+        reader->error = 1;
+        return;
+    }
+    for(uint32_t i = 0; i < count; i++)
+    {
+        World_SetFlipMap(i, reader->ptr[i], 0);
+        World_SetFlipState(i, reader->ptr[count + i]);
+    }
+    reader->ptr += 2 * count;
+}
+
+
+uint32_t SaveState_ApplyWorld(const uint8_t *data, uint32_t size)
+{
+    save_reader_t reader;
+
+    reader.ptr = data;
+    reader.end = data + size;
+    reader.error = 0;
+    SaveState_RestoreWorld(&reader);
+
+    return (reader.error) ? (0) : (reader.ptr - data);
+}
+
+
+uint32_t SaveState_ApplyEntity(const uint8_t *data, uint32_t size)
+{
+    save_reader_t reader;
+    save_entity_t rec;
+
+    reader.ptr = data;
+    reader.end = data + size;
+    reader.error = 0;
+    SaveState_Get(&reader, &rec, sizeof(rec));
+    if(!reader.error)
+    {
+        SaveState_RestoreEntity(&rec, &reader);
+    }
+
+    return (reader.error) ? (0) : (reader.ptr - data);
+}
+
+
+void SaveState_Init(struct save_state_s *state)
+{
+    state->data = NULL;
+    state->size = 0;
+    state->buffer_size = 0;
+}
+
+
+void SaveState_Clear(struct save_state_s *state)
+{
+    free(state->data);
+    SaveState_Init(state);
+}
+
+
+uint32_t SaveState_CRC32(uint32_t crc, const void *data, uint32_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+
+    if(!crc32_table_ready)
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            crc32_table[i] = c;
+        }
+        crc32_table_ready = 1;
+    }
+
+    crc = ~crc;
+    for(uint32_t i = 0; i < size; i++)
+    {
+        crc = crc32_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+int SaveState_Capture(struct save_state_s *state, int globals)
+{
+    save_state_header_t header;
+    uint32_t entities_count = 0;
+    uint32_t entities_count_offset;
+    uint16_t len = strlen(gameflow_manager.CurrentLevelPath);
+    entity_p player = World_GetPlayer();
+    RedBlackNode_p root = World_GetEntityTreeRoot();
+
+    state->size = 0;
+    memset(&header, 0, sizeof(header));
+    SaveState_Append(state, &header, sizeof(header));
+
+    SaveState_Append(state, &len, sizeof(len));
+    SaveState_Append(state, gameflow_manager.CurrentLevelPath, len);
+    SaveState_Append(state, &gameflow_manager.CurrentGameID, sizeof(uint8_t));
+    SaveState_Append(state, &gameflow_manager.CurrentLevelID, sizeof(uint8_t));
+    SaveState_PutWorld(state);
+
+    entities_count_offset = state->size;
+    SaveState_Append(state, &entities_count, sizeof(entities_count));
+    if(player)
+    {
+        SaveState_PutEntity(state, player);
+        entities_count++;
+    }
+    if(root)
+    {
+        SaveState_PutEntityTree(state, root, player, &entities_count);
+    }
+    memcpy(state->data + entities_count_offset, &entities_count, sizeof(entities_count));
+    SaveState_PutGlobals(state, globals);
+
+    header.magic = SAVE_STATE_MAGIC;
+    header.version = SAVE_STATE_VERSION;
+    header.header_size = sizeof(header);
+    header.data_size = state->size - sizeof(header);
+    header.checksum = SaveState_CRC32(0, state->data + sizeof(header), header.data_size);
+    memcpy(state->data, &header, sizeof(header));
+
+    return 1;
+}
+
+
+int SaveState_Check(const uint8_t *data, uint32_t size)
+{
+    save_state_header_t header;
+
+    if(size < sizeof(header))
+    {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if((header.magic != SAVE_STATE_MAGIC) || (header.version < 1) || (header.version > SAVE_STATE_VERSION) ||
+       (header.header_size != sizeof(header)) || (header.data_size != size - sizeof(header)))
+    {
+        return 0;
+    }
+
+    return header.checksum == SaveState_CRC32(0, data + sizeof(header), header.data_size);
+}
+
+
+int SaveState_Restore(const uint8_t *data, uint32_t size, int reload)
+{
+    save_reader_t reader;
+    char level_path[MAX_ENGINE_PATH];
+    uint8_t game_id, level_id;
+    uint16_t len;
+    uint32_t count;
+    room_p rooms;
+    uint32_t rooms_count;
+    save_state_header_t header;
+
+    if(!SaveState_Check(data, size))
+    {
+        Con_Warning("wrong or damaged save state");
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    reader.ptr = data + sizeof(save_state_header_t);
+    reader.end = data + size;
+    reader.error = 0;
+
+    SaveState_Get(&reader, &len, sizeof(len));
+    if(len >= MAX_ENGINE_PATH)
+    {
+        return 0;
+    }
+    SaveState_Get(&reader, level_path, len);
+    level_path[len] = 0;
+    SaveState_Get(&reader, &game_id, sizeof(game_id));
+    SaveState_Get(&reader, &level_id, sizeof(level_id));
+    if(reader.error)
+    {
+        return 0;
+    }
+
+    // Reload resets level scripts, tasks and entity callbacks; in place restore keeps them.
+    World_GetRoomInfo(&rooms, &rooms_count);
+    gameflow_manager.CurrentGameID = game_id;
+    gameflow_manager.CurrentLevelID = level_id;
+    if(reload || (rooms_count == 0) || strcmp(level_path, gameflow_manager.CurrentLevelPath))
+    {
+        char file_path[MAX_ENGINE_PATH];
+        Script_GetLoadingScreen(engine_lua, gameflow_manager.CurrentLevelID, file_path);
+        if(!Gui_LoadScreenAssignPic(file_path))
+        {
+            Gui_LoadScreenAssignPic("resource/graphics/legal.png");
+        }
+        if(!Engine_LoadMap(level_path))
+        {
+            return 0;
+        }
+    }
+    else if(World_GetEntityTreeRoot())
+    {
+        SaveState_DisableSpawned(World_GetEntityTreeRoot());
+    }
+
+    SaveState_RestoreWorld(&reader);
+    if(reader.error)
+    {
+        return 0;
+    }
+
+    SaveState_Get(&reader, &count, sizeof(count));
+    for(uint32_t i = 0; (i < count) && !reader.error; i++)
+    {
+        save_entity_t rec;
+        SaveState_Get(&reader, &rec, sizeof(rec));
+        if(!reader.error)
+        {
+            SaveState_RestoreEntity(&rec, &reader);
+        }
+    }
+    if(!reader.error && (header.version >= 2))
+    {
+        SaveState_RestoreGlobals(&reader);
+    }
+    // trigger layouts are restored directly, re-evaluate all triggers.
+    Trigger_Invalidate();
+
+    return !reader.error;
+}
+
+
+int SaveState_ExportLua(const uint8_t *data, uint32_t size, FILE *f)
+{
+    save_reader_t reader;
+    char level_path[MAX_ENGINE_PATH];
+    uint8_t game_id, level_id;
+    uint8_t secrets[TR_GAMEFLOW_MAX_SECRETS];
+    uint16_t len;
+    uint32_t count;
+
+    if(!SaveState_Check(data, size))
+    {
+        return 0;
+    }
+
+    reader.ptr = data + sizeof(save_state_header_t);
+    reader.end = data + size;
+    reader.error = 0;
+
+    SaveState_Get(&reader, &len, sizeof(len));
+    if(len >= MAX_ENGINE_PATH)
+    {
+        return 0;
+    }
+    SaveState_Get(&reader, level_path, len);
+    level_path[len] = 0;
+    SaveState_Get(&reader, &game_id, sizeof(game_id));
+    SaveState_Get(&reader, &level_id, sizeof(level_id));
+    SaveState_Get(&reader, secrets, TR_GAMEFLOW_MAX_SECRETS);
+    fprintf(f, "loadMap(\"%s\", %d, %d);\n", level_path, game_id, level_id);
+    for(int i = 0; i < TR_GAMEFLOW_MAX_SECRETS; i++)
+    {
+        if(secrets[i])
+        {
+            fprintf(f, "setSecretStatus(%d, %d);\n", i, secrets[i]);
+        }
+    }
+
+    // Save flipmap and flipped room states.
+    SaveState_Get(&reader, &count, sizeof(count));
+    if(reader.error || (reader.ptr + 2 * count > reader.end))
+    {
+        return 0;
+    }
+    for(uint32_t i = 0; i < count; i++)
+    {
+        fprintf(f, "setFlipMap(%d, 0x%02X, 0);\n", i, reader.ptr[i]);
+        fprintf(f, "setFlipState(%d, %d);\n", i, reader.ptr[count + i]);
+    }
+    reader.ptr += 2 * count;
+
+    SaveState_Get(&reader, &count, sizeof(count));
+    for(uint32_t i = 0; (i < count) && !reader.error; i++)
+    {
+        save_entity_t rec;
+        SaveState_Get(&reader, &rec, sizeof(rec));
+        if(reader.error)
+        {
+            break;
+        }
+
+        if(rec.type_flags & ENTITY_TYPE_SPAWNED)
+        {
+            fprintf(f, "\nspawnEntity(%d, 0x%X, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %d);", rec.model_id, rec.room_id,
+                    rec.pos[0], rec.pos[1], rec.pos[2], rec.angles[0], rec.angles[1], rec.angles[2], rec.id);
+        }
+        else
+        {
+            fprintf(f, "\nsetEntityPos(%d, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f);", rec.id,
+                    rec.pos[0], rec.pos[1], rec.pos[2], rec.angles[0], rec.angles[1], rec.angles[2]);
+        }
+
+        fprintf(f, "\nsetEntitySpeed(%d, %.2f, %.2f, %.2f);", rec.id, rec.speed[0], rec.speed[1], rec.speed[2]);
+        fprintf(f, "\nsetEntityAnim(%d, %d, %d);", rec.id, rec.current_animation, rec.current_frame);
+        fprintf(f, "\nsetEntityState(%d, %d, %d);", rec.id, rec.next_state, rec.last_state);
+        fprintf(f, "\nsetEntityFlags(%d, 0x%.4X, 0x%.4X, 0x%.8X);", rec.id, rec.state_flags, rec.type_flags, rec.callback_flags);
+        fprintf(f, "\nsetEntityCollisionFlags(%d, %d, %d);", rec.id, rec.collision_type, rec.collision_shape);
+        fprintf(f, "\nsetEntityTriggerLayout(%d, 0x%.2X);", rec.id, rec.trigger_layout);
+        if(rec.room_id != 0xFFFFFFFF)
+        {
+            fprintf(f, "\nsetEntityRoomMove(%d, %d, %d, %d);", rec.id, rec.room_id, rec.move_type, rec.dir_flag);
+        }
+        else
+        {
+            fprintf(f, "\nsetEntityRoomMove(%d, nil, %d, %d);", rec.id, rec.move_type, rec.dir_flag);
+        }
+
+        if(rec.has_character)
+        {
+            fprintf(f, "\nremoveAllItems(%d);", rec.id);
+            for(uint16_t j = 0; j < rec.inventory_count; j++)
+            {
+                int32_t item[2];
+                SaveState_Get(&reader, item, sizeof(item));
+                fprintf(f, "\naddItem(%d, %d, %d);", rec.id, item[0], item[1]);
+            }
+            if(reader.error || (reader.ptr + rec.params_count * 2 * sizeof(float) > reader.end))
+            {
+                return 0;
+            }
+            const float *params = (const float*)reader.ptr;
+            for(uint16_t j = 0; j < rec.params_count; j++)
+            {
+                fprintf(f, "\nsetCharacterParam(%d, %d, %.2f, %.2f);", rec.id, j, params[j], params[rec.params_count + j]);
+            }
+            reader.ptr += rec.params_count * 2 * sizeof(float);
+        }
+    }
+
+    if(!reader.error && (((save_state_header_p)data)->version >= 2))
+    {
+        char path[SAVE_LUA_MAX_PATH] = "_G";
+        fprintf(f, "\n");
+        SaveState_ExportLuaTable(&reader, f, path, 2, 0, 0);
+    }
+
+    return !reader.error;
+}
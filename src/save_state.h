@@ -0,0 +1,64 @@
+
+#ifndef SAVE_STATE_H
+#define SAVE_STATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct entity_s;
+
+/*
+ * Binary game state snapshot: one contiguous, versioned and checksummed blob
+ * with level info, secrets, flip maps, all entities (transforms, animation,
+ * flags, trigger layouts, inventories and character params) and plain data
+ * of script globals (numbers, booleans, strings and tables of them).
+ * It is restored directly; the same blob may be exported as Lua commands
+ * text (old save format) for debugging.
+ * Script functions and tasks are not stored: functions come from the level
+ * scripts, tasks are cleared by loading.
+ */
+
+#define SAVE_STATE_MAGIC        (0x5353544F)    // "OTSS"
+#define SAVE_STATE_VERSION      (2)             // 1 - without script globals
+
+typedef struct save_state_header_s
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    header_size;
+    uint32_t    data_size;                  // payload size after header
+    uint32_t    checksum;                   // CRC32 of payload
+}save_state_header_t, *save_state_header_p;
+
+typedef struct save_state_s
+{
+    uint8_t    *data;                       // header + payload
+    uint32_t    size;
+    uint32_t    buffer_size;
+}save_state_t, *save_state_p;
+
+void SaveState_Init(struct save_state_s *state);
+void SaveState_Clear(struct save_state_s *state);
+void SaveState_Append(struct save_state_s *state, const void *src, uint32_t size);
+
+// Serializes current game state into state->data (buffer is reused);
+// script globals are skipped if globals is 0 (their order is not deterministic).
+int  SaveState_Capture(struct save_state_s *state, int globals);
+// Returns 1 if data is a complete snapshot with valid checksum.
+int  SaveState_Check(const uint8_t *data, uint32_t size);
+// Restores game state; level is reloaded (as by loadMap) if reload is set or level differs,
+// otherwise entities, rooms, physics and script globals are restored in place.
+int  SaveState_Restore(const uint8_t *data, uint32_t size, int reload);
+// Writes snapshot as Lua commands, loadable by luaL_dofile.
+int  SaveState_ExportLua(const uint8_t *data, uint32_t size, FILE *f);
+
+// Partial records (rewind deltas): world part (secrets, flip maps) and single entities.
+// Apply functions change state in place and return bytes read, 0 on error.
+void SaveState_PutWorld(struct save_state_s *state);
+void SaveState_PutEntity(struct save_state_s *state, struct entity_s *ent);
+uint32_t SaveState_ApplyWorld(const uint8_t *data, uint32_t size);
+uint32_t SaveState_ApplyEntity(const uint8_t *data, uint32_t size);
+
+uint32_t SaveState_CRC32(uint32_t crc, const void *data, uint32_t size);
+
+#endif
@@ -29,6 +29,8 @@ extern "C" {
 #include "world.h"
 #include "engine.h"
 #include "physics.h"
+#include "rewind.h"
+#include "residency.h"
 #include "controls.h"
 #include "game.h"
 #include "gameflow.h"
@@ -665,6 +667,18 @@ int Script_ParseRender(lua_State *lua, struct render_settings_s *rs)
         rs->texture_border = lua_tonumber(lua, -1);
         lua_pop(lua, 1);
 
+        lua_getfield(lua, -1, "texture_packer");
+        rs->texture_packer = lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+
+        lua_getfield(lua, -1, "texture_compression");
+        rs->texture_compression = lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+
+        lua_getfield(lua, -1, "texture_upscale");
+        rs->texture_upscale = lua_tonumber(lua, -1);
+        lua_pop(lua, 1);
+
         lua_getfield(lua, -1, "z_depth");
         rs->z_depth = lua_tonumber(lua, -1);
         lua_pop(lua, 1);
@@ -751,6 +765,186 @@ int Script_ParseAudio(lua_State *lua, struct audio_settings_s *as)
     return -1;
 }
 
+int Script_ParseSystem(lua_State *lua, struct system_settings_s *ss)
+{
+    if(lua)
+    {
+        int top = lua_gettop(lua);
+
+        lua_getglobal(lua, "system");
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, "worker_threads");
+            if(lua_isnumber(lua, -1))
+            {
+                ss->worker_threads = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "sim_thread");
+            if(lua_isnumber(lua, -1))
+            {
+                ss->sim_thread = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+        }
+
+        lua_settop(lua, top);
+        return 1;
+    }
+
+    return -1;
+}
+
+int Script_ParsePhysics(lua_State *lua, struct physics_settings_s *ps)
+{
+    if(lua)
+    {
+        int top = lua_gettop(lua);
+
+        lua_getglobal(lua, "physics");
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, "multithreaded");
+            if(lua_isnumber(lua, -1))
+            {
+                ps->multithreaded = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "hair_pbd");
+            if(lua_isnumber(lua, -1))
+            {
+                ps->hair_pbd = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "lazy_shapes");
+            if(lua_isnumber(lua, -1))
+            {
+                ps->lazy_shapes = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "bvh_cache");
+            if(lua_isnumber(lua, -1))
+            {
+                ps->bvh_cache = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "merge_statics");
+            if(lua_isnumber(lua, -1))
+            {
+                ps->merge_statics = (int8_t)lua_tonumber(lua, -1);
+            }
+            lua_pop(lua, 1);
+        }
+
+        lua_settop(lua, top);
+        return 1;
+    }
+
+    return -1;
+}
+
+int Script_ParseRewind(lua_State *lua, struct rewind_settings_s *rs)
+{
+    if(lua)
+    {
+        int top = lua_gettop(lua);
+
+        lua_getglobal(lua, "rewind");
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, "length");
+            rs->length = lua_tonumber(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "interval");
+            rs->interval = lua_tonumber(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "keyframe_period");
+            rs->keyframe_period = (uint16_t)lua_tointeger(lua, -1);
+            lua_pop(lua, 1);
+        }
+
+        lua_settop(lua, top);
+        return 1;
+    }
+
+    return -1;
+}
+
+int Script_ParseAnimation(lua_State *lua, struct anim_lod_settings_s *as)
+{
+    if(lua)
+    {
+        int top = lua_gettop(lua);
+
+        lua_getglobal(lua, "animation");
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, "lod");
+            as->enabled = (int8_t)lua_tointeger(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "lod_near_distance");
+            as->near_distance = lua_tonumber(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "lod_far_distance");
+            as->far_distance = lua_tonumber(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "lod_reduced_period");
+            as->reduced_period = (uint16_t)lua_tointeger(lua, -1);
+            as->reduced_period = (as->reduced_period < 1) ? (1) : (as->reduced_period);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "lod_far_period");
+            as->far_period = (uint16_t)lua_tointeger(lua, -1);
+            as->far_period = (as->far_period < 1) ? (1) : (as->far_period);
+            lua_pop(lua, 1);
+        }
+
+        lua_settop(lua, top);
+        return 1;
+    }
+
+    return -1;
+}
+
+int Script_ParseResidency(lua_State *lua, struct residency_settings_s *rs)
+{
+    if(lua)
+    {
+        int top = lua_gettop(lua);
+
+        lua_getglobal(lua, "residency");
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, "enabled");
+            rs->enabled = (int8_t)lua_tointeger(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "hops");
+            rs->hops = (uint16_t)lua_tointeger(lua, -1);
+            lua_pop(lua, 1);
+
+            lua_getfield(lua, -1, "budget");
+            rs->budget = (uint32_t)(lua_tonumber(lua, -1) * 1048576.0);
+            lua_pop(lua, 1);
+        }
+
+        lua_settop(lua, top);
+        return 1;
+    }
+
+    return -1;
+}
+
 int Script_ParseConsole(lua_State *lua)
 {
     if(lua)
@@ -1723,6 +1917,7 @@ int lua_AddEntityRagdoll(lua_State *lua)
             struct rd_setup_s *ragdoll_setup = Ragdoll_GetSetup(lua, setup_index);
             if(ragdoll_setup)
             {
+                Entity_RefreshPose(ent);                                        // ragdoll bodies start from bones
                 if(!Ragdoll_Create(ent->physics, ent->bf, ragdoll_setup))
                 {
                     Con_Warning("can not create ragdoll for entity_id = %d", ent_id);
@@ -2613,14 +2808,7 @@ int lua_SectorTriggerClear(lua_State * lua)
 
     if(rs->trigger)
     {
-        for(trigger_command_p current_command = rs->trigger->commands; current_command; )
-        {
-            trigger_command_p next_command = current_command->next;
-            current_command->next = NULL;
-            free(current_command);
-            current_command = next_command;
-        }
-        free(rs->trigger);
+        Trigger_Delete(rs->trigger);
         rs->trigger = NULL;
     }
 
@@ -2655,13 +2843,8 @@ int lua_SectorAddTrigger(lua_State * lua)
         return 0;
     }
 
-    rs->trigger = (trigger_header_p)malloc(sizeof(trigger_header_t));
-    rs->trigger->commands = NULL;
-    rs->trigger->function_value = lua_tointeger(lua, 4);
-    rs->trigger->sub_function = lua_tointeger(lua, 5);
-    rs->trigger->mask = lua_tointeger(lua, 6);
-    rs->trigger->once = lua_tointeger(lua, 7);
-    rs->trigger->timer = lua_tointeger(lua, 8);
+    rs->trigger = Trigger_Create(lua_tointeger(lua, 4), lua_tointeger(lua, 5), lua_tointeger(lua, 6),
+                                 lua_tointeger(lua, 7), lua_tointeger(lua, 8));
 
     return 0;
 }
@@ -2694,15 +2877,11 @@ int lua_SectorAddTriggerCommand(lua_State * lua)
         return 0;
     }
 
-    trigger_command_p cmd = (trigger_command_p)malloc(sizeof(trigger_command_t));
+    trigger_command_p cmd = Trigger_AddCommand(rs->trigger);
 
-    cmd->next = NULL;
     cmd->function = lua_tointeger(lua, 4);
     cmd->operands = lua_tointeger(lua, 5);
     cmd->once = lua_tointeger(lua, 6);
-    cmd->cam_index = 0;
-    cmd->cam_move = 0;
-    cmd->cam_timer = 0;
 
     if(top >= 9)
     {
@@ -2711,9 +2890,7 @@ int lua_SectorAddTriggerCommand(lua_State * lua)
         cmd->cam_timer = lua_tointeger(lua, 9);
     }
 
-    trigger_command_p *last = &rs->trigger->commands;
-    for(; *last; last = &(*last)->next);
-    *last = cmd;
+    Trigger_Compile(rs->trigger);
 
     return 0;
 }
@@ -3363,6 +3540,7 @@ int lua_SetEntityActivity(lua_State * lua)
     {
         ent->state_flags &= ~ENTITY_STATE_ACTIVE;
     }
+    Trigger_Invalidate();
 
     return 0;
 }
@@ -3405,6 +3583,7 @@ int lua_SetEntityTriggerLayout(lua_State *lua)
     if(top == 2)
     {
         ent->trigger_layout = (uint8_t)lua_tointeger(lua, 2);
+        Trigger_Invalidate();
     }
     else if(top == 4)
     {
@@ -3413,6 +3592,7 @@ int lua_SetEntityTriggerLayout(lua_State *lua)
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_EVENT); trigger_layout ^= ((uint8_t)lua_tointeger(lua, 3)) << 5;   // event - 00100000
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_LOCK);  trigger_layout ^= ((uint8_t)lua_tointeger(lua, 4)) << 6;   // lock  - 01000000
         ent->trigger_layout = trigger_layout;
+        Trigger_Invalidate();
     }
 
     return 0;
@@ -3429,6 +3609,7 @@ int lua_SetEntityLock(lua_State * lua)
         uint8_t trigger_layout = ent->trigger_layout;
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_LOCK);  trigger_layout ^= ((uint8_t)lua_tointeger(lua, 2)) << 6;   // lock  - 01000000
         ent->trigger_layout = trigger_layout;
+        Trigger_Invalidate();
     }
     return 0;
 }
@@ -3459,6 +3640,7 @@ int lua_SetEntityEvent(lua_State * lua)
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_EVENT);
         trigger_layout ^= ((uint8_t)lua_tointeger(lua, 2)) << 5;   // event - 00100000
         ent->trigger_layout = trigger_layout;
+        Trigger_Invalidate();
     }
     return 0;
 }
@@ -3502,6 +3684,7 @@ int lua_SetEntityMask(lua_State * lua)
         uint8_t trigger_layout = ent->trigger_layout;
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_MASK);  trigger_layout ^= (uint8_t)lua_tointeger(lua, 2);   // mask  - 00011111
         ent->trigger_layout = trigger_layout;
+        Trigger_Invalidate();
     }
     return 0;
 }
@@ -3532,6 +3715,7 @@ int lua_SetEntitySectorStatus(lua_State *lua)
         trigger_layout &= ~(uint8_t)(ENTITY_TLAYOUT_SSTATUS);
         trigger_layout ^=  ((uint8_t)lua_tointeger(lua, 2)) << 7;   // sector_status  - 10000000
         ent->trigger_layout = trigger_layout;
+        Trigger_Invalidate();
     }
     return 0;
 }
@@ -3863,7 +4047,12 @@ int lua_SetEntityTimer(lua_State * lua)
         return 0;   // No entity found - return.
     }
 
-    ent->timer = lua_tonumber(lua, 2);
+    float timer = lua_tonumber(lua, 2);
+    if((timer == 0.0f) != (ent->timer == 0.0f))
+    {
+        Trigger_Invalidate();   // timer is engaged or expired
+    }
+    ent->timer = timer;
     return 0;
 }
 
@@ -4836,6 +5025,7 @@ int lua_genUVRotateAnimation(lua_State *lua)
             seq.frame_rate        = 0.025 * 16;    // Should be passed as 1 / FPS.
             seq.frame_time        = 0.0;           // Reset frame time to initial state.
             seq.current_frame     = 0;             // Reset current frame to zero.
+            seq.change_tick       = 0;
             seq.frames_count      = 1;
             seq.frame_list        = (uint32_t*)calloc(seq.frames_count, sizeof(uint32_t));
             seq.frame_list[0]     = 0;
@@ -30,6 +30,11 @@ bool  lua_CallWithError(lua_State *lua, int nargs, int nresults, int errfunc, co
 int Script_ParseScreen(lua_State *lua, struct screen_info_s *sc);
 int Script_ParseRender(lua_State *lua, struct render_settings_s *rs);
 int Script_ParseAudio(lua_State *lua, struct audio_settings_s *as);
+int Script_ParseSystem(lua_State *lua, struct system_settings_s *ss);
+int Script_ParsePhysics(lua_State *lua, struct physics_settings_s *ps);
+int Script_ParseRewind(lua_State *lua, struct rewind_settings_s *rs);
+int Script_ParseAnimation(lua_State *lua, struct anim_lod_settings_s *as);
+int Script_ParseResidency(lua_State *lua, struct residency_settings_s *rs);
 int Script_ParseConsole(lua_State *lua);
 int Script_ParseControls(lua_State *lua, struct control_settings_s *cs);
 
@@ -1,5 +1,8 @@
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL_atomic.h>
 
 #include "core/system.h"
 #include "core/gl_util.h"
@@ -9,11 +12,140 @@
 #include "mesh.h"
 #include "skeletal_model.h"
 
+/*
+ * Shared poses: bone transforms of a model depend only on animation, frames
+ * and lerp, unless the pose is modified per entity (overriding or targeting
+ * animations, move command). Identical entities playing in lockstep (traps,
+ * torches, fishes) reuse the pose evaluated by the first of them.
+ * Every model has own small cache, guarded by model spin lock.
+ */
+#define POSE_CACHE_SIZE             (8)                                         // power of 2
+#define POSE_BONE_FLOATS            (3 + 4 + 16 + 16)                           // offset, qrotate, transform, full_transform
+
+typedef struct pose_cache_entry_s
+{
+    int16_t                     valid;
+    int16_t                     current_animation;
+    int16_t                     current_frame;
+    int16_t                     next_animation;
+    int16_t                     next_frame;
+    float                       lerp;
+    uint16_t                    bones_size;
+    float                      *bones;
+}pose_cache_entry_t, *pose_cache_entry_p;
+
+
+static void PoseCache_Clear(skeletal_model_p model)
+{
+    if(model->pose_cache)
+    {
+        for(int i = 0; i < POSE_CACHE_SIZE; i++)
+        {
+            free(model->pose_cache[i].bones);
+        }
+        free(model->pose_cache);
+        model->pose_cache = NULL;
+    }
+}
+
+
+/*
+ * Returns cache slot of bf pose, or NULL if the pose is entity specific.
+ * Call under model pose_cache_lock.
+ */
+static pose_cache_entry_p PoseCache_GetEntry(struct ss_bone_frame_s *bf, bone_frame_p curr_bf)
+{
+    ss_animation_p ss_anim = &bf->animations;
+    uint32_t hash = 2166136261u;
+    uint32_t lerp_bits;
+
+    if(ss_anim->next || (ss_anim->anim_ext_flags & ANIM_EXT_TARGET_TO) ||
+       (bf->transform && (curr_bf->command & ANIM_CMD_MOVE)))
+    {
+        return NULL;
+    }
+    for(uint16_t k = 0; k < bf->bone_tag_count; k++)
+    {
+        if(bf->bone_tags[k].alt_anim)
+        {
+            return NULL;
+        }
+    }
+
+    if(ss_anim->model->pose_cache == NULL)
+    {
+        ss_anim->model->pose_cache = (pose_cache_entry_p)calloc(POSE_CACHE_SIZE, sizeof(pose_cache_entry_t));
+    }
+
+    memcpy(&lerp_bits, &ss_anim->lerp, sizeof(lerp_bits));
+    hash = (hash ^ (uint16_t)ss_anim->current_animation) * 16777619u;
+    hash = (hash ^ (uint16_t)ss_anim->current_frame) * 16777619u;
+    hash = (hash ^ (uint16_t)ss_anim->next_animation) * 16777619u;
+    hash = (hash ^ (uint16_t)ss_anim->next_frame) * 16777619u;
+    hash = (hash ^ lerp_bits) * 16777619u;
+
+    return ss_anim->model->pose_cache + ((hash ^ (hash >> 16)) & (POSE_CACHE_SIZE - 1));
+}
+
+
+static int PoseCache_Load(pose_cache_entry_p entry, struct ss_bone_frame_s *bf)
+{
+    ss_animation_p ss_anim = &bf->animations;
+    const float *src = entry->bones;
+
+    if(!entry->valid || (entry->lerp != ss_anim->lerp) ||
+       (entry->current_animation != ss_anim->current_animation) || (entry->current_frame != ss_anim->current_frame) ||
+       (entry->next_animation != ss_anim->next_animation) || (entry->next_frame != ss_anim->next_frame))
+    {
+        return 0;
+    }
+
+    for(uint16_t k = 0; k < bf->bone_tag_count; k++, src += POSE_BONE_FLOATS)
+    {
+        ss_bone_tag_p btag = bf->bone_tags + k;
+        vec3_copy(btag->offset, src);
+        vec4_copy(btag->qrotate, src + 3);
+        memcpy(btag->transform, src + 7, 16 * sizeof(float));
+        memcpy(btag->full_transform, src + 23, 16 * sizeof(float));
+    }
+    return 1;
+}
+
+
+static void PoseCache_Store(pose_cache_entry_p entry, struct ss_bone_frame_s *bf)
+{
+    ss_animation_p ss_anim = &bf->animations;
+    float *dst;
+
+    if(entry->bones_size < bf->bone_tag_count)
+    {
+        entry->bones_size = bf->bone_tag_count;
+        entry->bones = (float*)realloc(entry->bones, entry->bones_size * POSE_BONE_FLOATS * sizeof(float));
+    }
+    entry->valid = 1;
+    entry->current_animation = ss_anim->current_animation;
+    entry->current_frame = ss_anim->current_frame;
+    entry->next_animation = ss_anim->next_animation;
+    entry->next_frame = ss_anim->next_frame;
+    entry->lerp = ss_anim->lerp;
+
+    dst = entry->bones;
+    for(uint16_t k = 0; k < bf->bone_tag_count; k++, dst += POSE_BONE_FLOATS)
+    {
+        ss_bone_tag_p btag = bf->bone_tags + k;
+        vec3_copy(dst, btag->offset);
+        vec4_copy(dst + 3, btag->qrotate);
+        memcpy(dst + 7, btag->transform, 16 * sizeof(float));
+        memcpy(dst + 23, btag->full_transform, 16 * sizeof(float));
+    }
+}
+
 
 void SkeletalModel_Clear(skeletal_model_p model)
 {
     if(model != NULL)
     {
+        PoseCache_Clear(model);
         if(model->mesh_tree)
         {
             model->mesh_count = 0;
@@ -66,6 +198,11 @@ void SkeletalModel_Clear(skeletal_model_p model)
             free(model->animations);
             model->animations = NULL;
         }
+
+        free(model->keys_rotations);
+        model->keys_rotations = NULL;
+        model->keys_offsets = NULL;
+        model->keys_count = 0;
     }
 }
 
@@ -100,6 +237,217 @@ void SkeletalModel_GenParentsIndexes(skeletal_model_p model)
 }
 
 
+/*
+ * Animation keys: original keyframes of all model animations are kept in one
+ * block, rotations as smallest three quaternions (three 15-bit components and
+ * 2-bit index of the dropped largest one), offsets as 16-bit integers.
+ * Frames between keyframes are sampled with slerp when they are used.
+ */
+#define ANIM_KEYS_VALIDATE          (0)                                         // compare sampled poses with expanded ones at load
+#define ANIM_KEY_QUAT_MAX           (32767.0f)
+
+typedef struct anim_sample_s
+{
+    const uint16_t     *rotations[2];
+    const int16_t      *offsets[2];
+    float               lerp;
+}anim_sample_t, *anim_sample_p;
+
+
+static void Anim_PackQuat(uint16_t out[3], const float q[4])
+{
+    int largest = 0;
+    float sign;
+
+    for(int i = 1; i < 4; i++)
+    {
+        if(fabs(q[i]) > fabs(q[largest]))
+        {
+            largest = i;
+        }
+    }
+
+    sign = (q[largest] < 0.0f) ? (-1.0f) : (1.0f);
+    for(int i = 0, j = 0; i < 4; i++)
+    {
+        if(i != largest)
+        {
+            float v = (sign * q[i] * M_SQRT2 + 1.0f) * 0.5f;
+            v = (v < 0.0f) ? (0.0f) : ((v > 1.0f) ? (1.0f) : (v));
+            out[j++] = (uint16_t)(v * ANIM_KEY_QUAT_MAX + 0.5f);
+        }
+    }
+    out[0] |= (largest & 1) << 15;
+    out[1] |= (largest >> 1) << 15;
+}
+
+
+static void Anim_UnpackQuat(float q[4], const uint16_t in[3])
+{
+    int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+    float sum = 0.0f;
+
+    for(int i = 0, j = 0; i < 4; i++)
+    {
+        if(i != largest)
+        {
+            q[i] = ((float)(in[j++] & 0x7FFF) / ANIM_KEY_QUAT_MAX * 2.0f - 1.0f) * M_SQRT1_2;
+            sum += q[i] * q[i];
+        }
+    }
+    q[largest] = (sum < 1.0f) ? (sqrtf(1.0f - sum)) : (0.0f);
+}
+
+
+static void Anim_GetSample(anim_sample_p sample, skeletal_model_p model, int animation, int frame)
+{
+    animation_frame_p af = model->animations + animation;
+    uint32_t rate = ((af->keys_count > 1) && (af->original_frame_rate > 1)) ? (af->original_frame_rate) : (1);
+    uint32_t key = frame / rate;
+    uint32_t rem = frame % rate;
+    uint32_t bone_keys = 3 * model->mesh_count;
+
+    if(key + 1 >= af->keys_count)
+    {
+        key = af->keys_count - 1;
+        rem = 0;
+    }
+    key += af->keys_first;
+    sample->lerp = (float)rem / (float)rate;
+    sample->rotations[0] = model->keys_rotations + key * bone_keys;
+    sample->rotations[1] = sample->rotations[0] + ((rem) ? (bone_keys) : (0));
+    sample->offsets[0] = model->keys_offsets + key * bone_keys;
+    sample->offsets[1] = sample->offsets[0] + ((rem) ? (bone_keys) : (0));
+}
+
+
+static void Anim_SampleBone(anim_sample_p sample, skeletal_model_p model, uint16_t bone, float offset[3], float qrotate[4])
+{
+    const int16_t *o0 = sample->offsets[0] + 3 * bone;
+
+    Anim_UnpackQuat(qrotate, sample->rotations[0] + 3 * bone);
+    if(sample->lerp > 0.0f)
+    {
+        const int16_t *o1 = sample->offsets[1] + 3 * bone;
+        float q1[4], t = 1.0f - sample->lerp;
+
+        Anim_UnpackQuat(q1, sample->rotations[1] + 3 * bone);
+        vec4_slerp(qrotate, qrotate, q1, sample->lerp);
+        offset[0] = model->keys_offset_scale * (t * o0[0] + sample->lerp * o1[0]);
+        offset[1] = model->keys_offset_scale * (t * o0[1] + sample->lerp * o1[1]);
+        offset[2] = model->keys_offset_scale * (t * o0[2] + sample->lerp * o1[2]);
+    }
+    else
+    {
+        offset[0] = model->keys_offset_scale * o0[0];
+        offset[1] = model->keys_offset_scale * o0[1];
+        offset[2] = model->keys_offset_scale * o0[2];
+    }
+}
+
+
+void SkeletalModel_GetBoneKey(skeletal_model_p model, int animation, int frame, uint16_t bone, float offset[3], float qrotate[4])
+{
+    anim_sample_t sample;
+    Anim_GetSample(&sample, model, animation, frame);
+    Anim_SampleBone(&sample, model, bone, offset, qrotate);
+}
+
+
+/*
+ * Packs original keyframes bone tags of all animations into model keys.
+ */
+static void SkeletalModel_GenKeys(skeletal_model_p model)
+{
+    animation_frame_p anim = model->animations;
+    size_t bone_keys = 3 * model->mesh_count;
+    float max_offset = 0.0f;
+    uint32_t key = 0;
+
+    model->keys_count = 0;
+    for(uint16_t i = 0; i < model->animation_count; i++, anim++)
+    {
+        model->keys_count += anim->frames_count;
+        for(uint16_t j = 0; j < anim->frames_count; j++)
+        {
+            for(uint16_t k = 0; k < model->mesh_count; k++)
+            {
+                for(int c = 0; c < 3; c++)
+                {
+                    float v = fabs(anim->frames[j].bone_tags[k].offset[c]);
+                    max_offset = (v > max_offset) ? (v) : (max_offset);
+                }
+            }
+        }
+    }
+
+    // TR offsets are integers, they are kept exactly while they fit in 16 bits.
+    model->keys_offset_scale = (max_offset > 32767.0f) ? (max_offset / 32767.0f) : (1.0f);
+    model->keys_rotations = (uint16_t*)malloc(model->keys_count * bone_keys * (sizeof(uint16_t) + sizeof(int16_t)));
+    model->keys_offsets = (int16_t*)(model->keys_rotations + model->keys_count * bone_keys);
+
+    anim = model->animations;
+    for(uint16_t i = 0; i < model->animation_count; i++, anim++)
+    {
+        anim->keys_first = key;
+        anim->keys_count = anim->frames_count;
+        for(uint16_t j = 0; j < anim->frames_count; j++, key++)
+        {
+            for(uint16_t k = 0; k < model->mesh_count; k++)
+            {
+                bone_tag_p btag = anim->frames[j].bone_tags + k;
+                int16_t *offset = model->keys_offsets + key * bone_keys + 3 * k;
+                Anim_PackQuat(model->keys_rotations + key * bone_keys + 3 * k, btag->qrotate);
+                offset[0] = (int16_t)floorf(btag->offset[0] / model->keys_offset_scale + 0.5f);
+                offset[1] = (int16_t)floorf(btag->offset[1] / model->keys_offset_scale + 0.5f);
+                offset[2] = (int16_t)floorf(btag->offset[2] / model->keys_offset_scale + 0.5f);
+            }
+        }
+    }
+}
+
+
+#if ANIM_KEYS_VALIDATE
+/*
+ * Compares sampled bones of every interpolated frame with the expansion of
+ * full precision keyframes, as it was done before keys packing.
+ */
+static void SkeletalModel_ValidateKeys(skeletal_model_p model, animation_frame_p anim, uint16_t anim_index)
+{
+    uint32_t rate = ((anim->keys_count > 1) && (anim->original_frame_rate > 1)) ? (anim->original_frame_rate) : (1);
+    float max_offset_error = 0.0f, max_rotation_error = 0.0f;
+
+    for(uint32_t frame = 0; frame < rate * (anim->keys_count - 1) + 1; frame++)
+    {
+        uint32_t key = frame / rate;
+        float lerp = (float)(frame % rate) / (float)rate;
+        for(uint16_t k = 0; k < model->mesh_count; k++)
+        {
+            bone_tag_p b0 = anim->frames[key].bone_tags + k;
+            bone_tag_p b1 = (lerp > 0.0f) ? (anim->frames[key + 1].bone_tags + k) : (b0);
+            float offset[3], q[4], sampled_offset[3], sampled_q[4], d;
+
+            vec3_interpolate_macro(offset, b0->offset, b1->offset, lerp, 1.0f - lerp);
+            vec4_slerp(q, b0->qrotate, b1->qrotate, lerp);
+            SkeletalModel_GetBoneKey(model, anim_index, frame, k, sampled_offset, sampled_q);
+
+            d = vec3_dist(offset, sampled_offset);
+            max_offset_error = (d > max_offset_error) ? (d) : (max_offset_error);
+            d = 1.0f - fabs(vec4_dot(q, sampled_q));
+            max_rotation_error = (d > max_rotation_error) ? (d) : (max_rotation_error);
+        }
+    }
+
+    Sys_DebugLog(SYS_LOG_FILENAME, "anim keys: model = %d, anim = %d, max offset error = %f, max rotation error = %f",
+                 model->id, anim_index, max_offset_error, max_rotation_error);
+}
+#endif
+
+
+/*
+ * Expands animation frames (position, bounding box, commands) to 1/30 sec
+ * game frames; bone tags are moved into model keys and sampled at runtime.
+ */
 void SkeletalModel_InterpolateFrames(skeletal_model_p model)
 {
     uint16_t new_frames_count;
@@ -107,43 +455,35 @@ void SkeletalModel_InterpolateFrames(skeletal_model_p model)
     bone_frame_p bf, new_bone_frames;
     float lerp, t;
 
+    SkeletalModel_GenKeys(model);
+
     for(uint16_t i = 0; i < model->animation_count; i++, anim++)
     {
+#if ANIM_KEYS_VALIDATE
+        SkeletalModel_ValidateKeys(model, anim, i);
+#endif
         if(anim->frames_count > 1 && anim->original_frame_rate > 1)             // we can't interpolate one frame or rate < 2!
         {
             new_frames_count = (uint16_t)anim->original_frame_rate * (anim->frames_count - 1) + 1;
-            bf = new_bone_frames = (bone_frame_p)malloc(new_frames_count * sizeof(bone_frame_t));
+            bf = new_bone_frames = (bone_frame_p)calloc(new_frames_count, sizeof(bone_frame_t));
 
             /*
              * the first frame does not changes
              */
-            bf->bone_tags = (bone_tag_p)malloc(model->mesh_count * sizeof(bone_tag_t));
             bf->bone_tag_count = model->mesh_count;
-            vec3_set_zero(bf->pos);
-            vec3_set_zero(bf->move);
-            bf->command = 0x00;
             vec3_copy(bf->centre, anim->frames[0].centre);
             vec3_copy(bf->pos, anim->frames[0].pos);
             vec3_copy(bf->bb_max, anim->frames[0].bb_max);
             vec3_copy(bf->bb_min, anim->frames[0].bb_min);
-            for(uint16_t k = 0; k < model->mesh_count; k++)
-            {
-                vec3_copy(bf->bone_tags[k].offset, anim->frames[0].bone_tags[k].offset);
-                vec4_copy(bf->bone_tags[k].qrotate, anim->frames[0].bone_tags[k].qrotate);
-            }
             bf++;
 
             for(uint16_t j = 1; j < anim->frames_count; j++)
             {
                 for(uint16_t lerp_index = 1; lerp_index <= anim->original_frame_rate; lerp_index++)
                 {
-                    vec3_set_zero(bf->pos);
-                    vec3_set_zero(bf->move);
-                    bf->command = 0x00;
                     lerp = ((float)lerp_index) / (float)anim->original_frame_rate;
                     t = 1.0 - lerp;
 
-                    bf->bone_tags = (bone_tag_p)malloc(model->mesh_count * sizeof(bone_tag_t));
                     bf->bone_tag_count = model->mesh_count;
 
                     bf->centre[0] = t * anim->frames[j-1].centre[0] + lerp * anim->frames[j].centre[0];
@@ -161,15 +501,6 @@ void SkeletalModel_InterpolateFrames(skeletal_model_p model)
                     bf->bb_min[0] = t * anim->frames[j-1].bb_min[0] + lerp * anim->frames[j].bb_min[0];
                     bf->bb_min[1] = t * anim->frames[j-1].bb_min[1] + lerp * anim->frames[j].bb_min[1];
                     bf->bb_min[2] = t * anim->frames[j-1].bb_min[2] + lerp * anim->frames[j].bb_min[2];
-
-                    for(uint16_t k = 0; k < model->mesh_count; k++)
-                    {
-                        bf->bone_tags[k].offset[0] = t * anim->frames[j-1].bone_tags[k].offset[0] + lerp * anim->frames[j].bone_tags[k].offset[0];
-                        bf->bone_tags[k].offset[1] = t * anim->frames[j-1].bone_tags[k].offset[1] + lerp * anim->frames[j].bone_tags[k].offset[1];
-                        bf->bone_tags[k].offset[2] = t * anim->frames[j-1].bone_tags[k].offset[2] + lerp * anim->frames[j].bone_tags[k].offset[2];
-
-                        vec4_slerp(bf->bone_tags[k].qrotate, anim->frames[j-1].bone_tags[k].qrotate, anim->frames[j].bone_tags[k].qrotate, lerp);
-                    }
                     bf++;
                 }
             }
@@ -180,17 +511,20 @@ void SkeletalModel_InterpolateFrames(skeletal_model_p model)
              */
             for(uint16_t j = 0; j < anim->frames_count; j++)
             {
-                if(anim->frames[j].bone_tag_count)
-                {
-                    anim->frames[j].bone_tag_count = 0;
-                    free(anim->frames[j].bone_tags);
-                    anim->frames[j].bone_tags = NULL;
-                }
+                free(anim->frames[j].bone_tags);
             }
             free(anim->frames);
             anim->frames = new_bone_frames;
             anim->frames_count = new_frames_count;
         }
+        else
+        {
+            for(uint16_t j = 0; j < anim->frames_count; j++)
+            {
+                free(anim->frames[j].bone_tags);
+                anim->frames[j].bone_tags = NULL;
+            }
+        }
     }
 }
 
@@ -227,6 +561,7 @@ void SkeletalModel_FillSkinnedMeshMap(skeletal_model_p model)
         }
         mesh_base = tree_tag->mesh_base;
         mesh_skin = tree_tag->mesh_skin;
+        free(mesh_skin->skin_map);
         ch = mesh_skin->skin_map = (uint32_t*)malloc(mesh_skin->vertex_count * sizeof(uint32_t));
         v = mesh_skin->vertices;
         for(uint32_t k = 0; k < mesh_skin->vertex_count; k++, v++, ch++)
@@ -253,6 +588,7 @@ void SkeletalModel_FillSkinnedMeshMap(skeletal_model_p model)
                 }
             }
         }
+        BaseMesh_GenSkin(mesh_skin);
     }
 }
 
@@ -293,7 +629,7 @@ void BoneFrame_Copy(bone_frame_p dst, bone_frame_p src)
     dst->command = src->command;
     vec3_copy(dst->move, src->move);
 
-    for(uint16_t i = 0; i < dst->bone_tag_count; i++)
+    for(uint16_t i = 0; src->bone_tags && (i < dst->bone_tag_count); i++)
     {
         vec4_copy(dst->bone_tags[i].qrotate, src->bone_tags[i].qrotate);
         vec3_copy(dst->bone_tags[i].offset, src->bone_tags[i].offset);
@@ -307,6 +643,9 @@ void SSBoneFrame_CreateFromModel(ss_bone_frame_p bf, skeletal_model_p model)
     vec3_set_zero(bf->bb_max);
     vec3_set_zero(bf->centre);
     vec3_set_zero(bf->pos);
+    bf->pose_deferred = 0;
+    bf->pose_lod_valid = 0;
+    bf->pose_serial = 0;
     bf->animations.type = ANIM_TYPE_BASE;
     bf->animations.enabled = 1;
     bf->animations.anim_frame_flags = 0x0000;
@@ -383,11 +722,9 @@ void SSBoneFrame_Clear(ss_bone_frame_p bf)
 }
 
 
-void SSBoneFrame_Update(struct ss_bone_frame_s *bf)
+void SSBoneFrame_UpdateBounds(struct ss_bone_frame_s *bf)
 {
     float cmd_tr[3], tr[3], t;
-    ss_bone_tag_p btag = bf->bone_tags;
-    bone_tag_p src_btag, next_btag;
     skeletal_model_p model = bf->animations.model;
     bone_frame_p curr_bf, next_bf;
 
@@ -415,33 +752,56 @@ void SSBoneFrame_Update(struct ss_bone_frame_s *bf)
 
     vec3_interpolate_macro(bf->pos, curr_bf->pos, next_bf->pos, bf->animations.lerp, t);
     vec3_add(bf->pos, bf->pos, cmd_tr);
-    next_btag = next_bf->bone_tags;
-    src_btag = curr_bf->bone_tags;
-    for(uint16_t k = 0; k < curr_bf->bone_tag_count; k++, btag++, src_btag++, next_btag++)
+}
+
+
+void SSBoneFrame_Update(struct ss_bone_frame_s *bf)
+{
+    float t = 1.0 - bf->animations.lerp;
+    ss_bone_tag_p btag = bf->bone_tags;
+    skeletal_model_p model = bf->animations.model;
+    bone_frame_p curr_bf = model->animations[bf->animations.current_animation].frames + bf->animations.current_frame;
+    anim_sample_t curr_sample, next_sample;
+    pose_cache_entry_p pose;
+
+    SSBoneFrame_UpdateBounds(bf);
+    bf->pose_deferred = 0;
+    bf->pose_serial++;
+
+    SDL_AtomicLock(&model->pose_cache_lock);
+    pose = PoseCache_GetEntry(bf, curr_bf);
+    if(pose && PoseCache_Load(pose, bf))
+    {
+        SDL_AtomicUnlock(&model->pose_cache_lock);
+        return;
+    }
+    SDL_AtomicUnlock(&model->pose_cache_lock);
+
+    Anim_GetSample(&curr_sample, model, bf->animations.current_animation, bf->animations.current_frame);
+    Anim_GetSample(&next_sample, model, bf->animations.next_animation, bf->animations.next_frame);
+    for(uint16_t k = 0; k < curr_bf->bone_tag_count; k++, btag++)
     {
-        vec3_interpolate_macro(btag->offset, src_btag->offset, next_btag->offset, bf->animations.lerp, t);
+        float src_offset[3], next_offset[3], src_q[4], next_q[4];
+        float ov_lerp = bf->animations.lerp;
+        Anim_SampleBone(&curr_sample, model, k, src_offset, src_q);
+        Anim_SampleBone(&next_sample, model, k, next_offset, next_q);
+        vec3_interpolate_macro(btag->offset, src_offset, next_offset, bf->animations.lerp, t);
         vec3_copy(btag->transform+12, btag->offset);
         btag->transform[15] = 1.0;
         if(k == 0)
         {
             vec3_add(btag->transform+12, btag->transform+12, bf->pos);
-            vec4_slerp(btag->qrotate, src_btag->qrotate, next_btag->qrotate, bf->animations.lerp);
         }
-        else
+        else if(btag->alt_anim && btag->alt_anim->model && btag->alt_anim->enabled && (btag->alt_anim->model->mesh_tree[k].replace_anim != 0))
         {
-            bone_tag_p ov_src_btag = src_btag;
-            bone_tag_p ov_next_btag = next_btag;
-            float ov_lerp = bf->animations.lerp;
-            if(btag->alt_anim && btag->alt_anim->model && btag->alt_anim->enabled && (btag->alt_anim->model->mesh_tree[k].replace_anim != 0))
-            {
-                bone_frame_p ov_curr_bf = btag->alt_anim->model->animations[btag->alt_anim->current_animation].frames + btag->alt_anim->current_frame;
-                bone_frame_p ov_next_bf = btag->alt_anim->model->animations[btag->alt_anim->next_animation].frames + btag->alt_anim->next_frame;
-                ov_src_btag = ov_curr_bf->bone_tags + k;
-                ov_next_btag = ov_next_bf->bone_tags + k;
-                ov_lerp = btag->alt_anim->lerp;
-            }
-            vec4_slerp(btag->qrotate, ov_src_btag->qrotate, ov_next_btag->qrotate, ov_lerp);
+            anim_sample_t ov_sample;
+            Anim_GetSample(&ov_sample, btag->alt_anim->model, btag->alt_anim->current_animation, btag->alt_anim->current_frame);
+            Anim_SampleBone(&ov_sample, btag->alt_anim->model, k, src_offset, src_q);
+            Anim_GetSample(&ov_sample, btag->alt_anim->model, btag->alt_anim->next_animation, btag->alt_anim->next_frame);
+            Anim_SampleBone(&ov_sample, btag->alt_anim->model, k, next_offset, next_q);
+            ov_lerp = btag->alt_anim->lerp;
         }
+        vec4_slerp(btag->qrotate, src_q, next_q, ov_lerp);
         Mat4_set_qrotation(btag->transform, btag->qrotate);
     }
 
@@ -456,6 +816,14 @@ void SSBoneFrame_Update(struct ss_bone_frame_s *bf)
         Mat4_Mat4_mul(btag->full_transform, btag->parent->full_transform, btag->transform);
     }
 
+    if(pose)
+    {
+        SDL_AtomicLock(&model->pose_cache_lock);
+        PoseCache_Store(pose, bf);                                              // shared pose has no per entity modifiers
+        SDL_AtomicUnlock(&model->pose_cache_lock);
+        return;
+    }
+
     for(ss_animation_p ss_anim = &bf->animations; ss_anim; ss_anim = ss_anim->next)
     {
         SSBoneFrame_TargetBoneToSlerp(bf, ss_anim);
@@ -463,11 +831,74 @@ void SSBoneFrame_Update(struct ss_bone_frame_s *bf)
 }
 
 
+void SSBoneFrame_StoreLODPose(struct ss_bone_frame_s *bf)
+{
+    ss_bone_tag_p btag = bf->bone_tags;
+
+    for(uint16_t k = 0; k < bf->bone_tag_count; k++, btag++)
+    {
+        if(bf->pose_lod_valid)
+        {
+            vec3_copy(btag->lod_offset[0], btag->lod_offset[1]);
+            vec4_copy(btag->lod_qrotate[0], btag->lod_qrotate[1]);
+        }
+        else
+        {
+            vec3_copy(btag->lod_offset[0], btag->offset);
+            vec4_copy(btag->lod_qrotate[0], btag->qrotate);
+        }
+        vec3_copy(btag->lod_offset[1], btag->offset);
+        vec4_copy(btag->lod_qrotate[1], btag->qrotate);
+    }
+    bf->pose_lod_valid = 1;
+}
+
+
+void SSBoneFrame_BlendLODPose(struct ss_bone_frame_s *bf, float t)
+{
+    float s = 1.0f - t;
+    ss_bone_tag_p btag = bf->bone_tags;
+
+    bf->pose_serial++;
+
+    for(uint16_t k = 0; k < bf->bone_tag_count; k++, btag++)
+    {
+        vec3_interpolate_macro(btag->offset, btag->lod_offset[0], btag->lod_offset[1], t, s);
+        vec3_copy(btag->transform + 12, btag->offset);
+        btag->transform[15] = 1.0;
+        if(k == 0)
+        {
+            vec3_add(btag->transform + 12, btag->transform + 12, bf->pos);
+        }
+        vec4_slerp(btag->qrotate, btag->lod_qrotate[0], btag->lod_qrotate[1], t);
+        Mat4_set_qrotation(btag->transform, btag->qrotate);
+    }
+
+    btag = bf->bone_tags;
+    Mat4_Copy(btag->full_transform, btag->transform);
+    btag++;
+    for(uint16_t k = 1; k < bf->bone_tag_count; k++, btag++)
+    {
+        Mat4_Mat4_mul(btag->full_transform, btag->parent->full_transform, btag->transform);
+    }
+
+    // keep targeting as it was on the last update, do not step its slerp
+    for(ss_animation_p ss_anim = &bf->animations; ss_anim; ss_anim = ss_anim->next)
+    {
+        if(ss_anim->current_mod[3] < 1.0f)
+        {
+            SSBoneFrame_RotateBone(bf, ss_anim->current_mod, ss_anim->targeting_bone);
+        }
+    }
+}
+
+
 void SSBoneFrame_RotateBone(struct ss_bone_frame_s *bf, const float q_rotate[4], int bone)
 {
     float tr[16], q[4];
     ss_bone_tag_p b_tag = b_tag = bf->bone_tags + bone;
     
+    bf->pose_serial++;
     vec4_copy(q, q_rotate);
     Mat4_E(tr);
     Mat4_RotateQuaternion(tr, q);
@@ -56,6 +56,8 @@ typedef struct ss_bone_tag_s
     float                   qrotate[4];                                         // quaternion rotation
     float                   transform[16]      __attribute__((packed, aligned(16)));    // 4x4 OpenGL matrix for stack usage
     float                   full_transform[16] __attribute__((packed, aligned(16)));    // 4x4 OpenGL matrix for global usage
+    float                   lod_offset[2][3];                                   // animation LOD: previous and last evaluated offsets
+    float                   lod_qrotate[2][4];                                  // animation LOD: previous and last evaluated rotations
 
     uint32_t                body_part;                                          // flag: BODY, LEFT_LEG_1, RIGHT_HAND_2, HEAD...
 }ss_bone_tag_t, *ss_bone_tag_p;
@@ -106,6 +108,9 @@ typedef struct ss_bone_frame_s
     float                       bb_max[3];                                      // bounding box max coordinates
     float                       centre[3];                                      // bounding box centre
     float                      *transform;
+    uint8_t                     pose_deferred;                                  // bones are behind animation state (animation LOD)
+    uint8_t                     pose_lod_valid;                                 // bone lod_offset / lod_qrotate are filled
+    uint32_t                    pose_serial;                                    // incremented every time bone transforms are rebuilt
 
     struct ss_animation_s       animations;                                     // animations list
 }ss_bone_frame_t, *ss_bone_frame_p;
@@ -184,7 +189,9 @@ typedef struct animation_frame_s
     uint32_t                    num_anim_commands;
     uint16_t                    state_id;
     uint16_t                    frames_count;           // Number of frames
-    struct bone_frame_s        *frames;                 // Frame data
+    struct bone_frame_s        *frames;                 // Frame data (bone tags are in model keys)
+    uint32_t                    keys_first;             // First original keyframe in model keys
+    uint16_t                    keys_count;             // Number of original keyframes
 
     uint16_t                    state_change_count;     // Number of animation statechanges
     struct state_change_s      *state_change;           // Animation statechanges data
@@ -209,15 +216,24 @@ typedef struct skeletal_model_s
     uint16_t                    animation_count;                                // number of animations
     struct animation_frame_s   *animations;                                     // animations data
 
+    uint32_t                    keys_count;                                     // original keyframes of all animations
+    float                       keys_offset_scale;                              // offset = keys_offsets * scale
+    uint16_t                   *keys_rotations;                                 // [key][bone][3] smallest three quaternions, one block with offsets
+    int16_t                    *keys_offsets;                                   // [key][bone][3]
+
     uint16_t                    mesh_count;                                     // number of model meshes
     struct mesh_tree_tag_s     *mesh_tree;                                      // base mesh tree.
     uint16_t                   *collision_map;
+
+    struct pose_cache_entry_s  *pose_cache;                                     // poses shared by entities of the model
+    int                         pose_cache_lock;                                // SDL_SpinLock, game frame, GUI and renderer update poses
 }skeletal_model_t, *skeletal_model_p;
 
 
 void SkeletalModel_Clear(skeletal_model_p model);
 void SkeletalModel_GenParentsIndexes(skeletal_model_p model);
 void SkeletalModel_InterpolateFrames(skeletal_model_p models);
+void SkeletalModel_GetBoneKey(skeletal_model_p model, int animation, int frame, uint16_t bone, float offset[3], float qrotate[4]);
 
 void SkeletalModel_FillTransparency(skeletal_model_p model);
 void SkeletalModel_FillSkinnedMeshMap(skeletal_model_p model);
@@ -228,6 +244,11 @@ void BoneFrame_Copy(bone_frame_p dst, bone_frame_p src);
 void SSBoneFrame_CreateFromModel(ss_bone_frame_p bf, skeletal_model_p model);
 void SSBoneFrame_Clear(ss_bone_frame_p bf);
 void SSBoneFrame_Update(struct ss_bone_frame_s *bf);
+// Updates only position and bounding box from animation frames, bones are left as is.
+void SSBoneFrame_UpdateBounds(struct ss_bone_frame_s *bf);
+// Animation LOD: remembers evaluated pose and sets bones between the last two of them, t = 1 - last one.
+void SSBoneFrame_StoreLODPose(struct ss_bone_frame_s *bf);
+void SSBoneFrame_BlendLODPose(struct ss_bone_frame_s *bf, float t);
 void SSBoneFrame_RotateBone(struct ss_bone_frame_s *bf, const float q_rotate[4], int bone);
 int  SSBoneFrame_CheckTargetBoneLimit(struct ss_bone_frame_s *bf, struct ss_animation_s *ss_anim);
 void SSBoneFrame_TargetBoneToSlerp(struct ss_bone_frame_s *bf, struct ss_animation_s *ss_anim);
@@ -82,112 +82,222 @@ function playCutscene(cutscene_index)
 end
  */
 
-///@TODO: move here TickEntity with Inversing entity state... see carefully heavy irregular cases
-void Trigger_DoCommands(trigger_header_p trigger, struct entity_s *entity_activator)
+static uint32_t trigger_epoch = 1;
+
+
+trigger_header_p Trigger_Create(uint16_t function_value, uint16_t sub_function, uint16_t mask, uint16_t once, uint16_t timer)
 {
-    if(trigger && entity_activator)
+    trigger_header_p ret = (trigger_header_p)malloc(sizeof(trigger_header_t));
+
+    ret->function_value = function_value;
+    ret->sub_function = sub_function;
+    ret->mask = mask;
+    ret->once = once;
+    ret->timer = timer;
+    ret->commands_count = 0;
+    ret->commands = NULL;
+    Trigger_Compile(ret);
+
+    return ret;
+}
+
+
+void Trigger_Delete(trigger_header_p trigger)
+{
+    if(trigger)
     {
-        int activator           = TR_ACTIVATOR_NORMAL;      // Activator is normal by default.
-        int action_type         = TR_ACTIONTYPE_NORMAL;     // Action type is normal by default.
-        int header_condition    = 1;                        // by default condition = true
-        int mask_mode           = TRIGGER_OP_OR;            // Activation mask by default.
+        free(trigger->commands);
+        trigger->commands = NULL;
+        trigger->commands_count = 0;
+        free(trigger);
+    }
+}
 
-        // Activator type is LARA for all triggers except HEAVY ones, which are triggered by
-        // some specific entity classes.
-        // entity_activator_type  == TR_ACTIVATORTYPE_LARA and
-        // trigger_activator_type == TR_ACTIVATORTYPE_MISC
-        switch(trigger->sub_function)
+
+trigger_command_p Trigger_AddCommand(trigger_header_p trigger)
+{
+    trigger_command_p ret;
+
+    trigger->commands = (trigger_command_p)realloc(trigger->commands, (trigger->commands_count + 1) * sizeof(trigger_command_t));
+    ret = trigger->commands + trigger->commands_count;
+    trigger->commands_count++;
+    ret->function = 0;
+    ret->operands = 0;
+    ret->once = 0;
+    ret->cam_index = 0;
+    ret->cam_timer = 0;
+    ret->cam_move = 0;
+
+    return ret;
+}
+
+
+void Trigger_Compile(trigger_header_p trigger)
+{
+    trigger->activator = TR_ACTIVATOR_NORMAL;       // Activator is normal by default.
+    trigger->action_type = TR_ACTIONTYPE_NORMAL;    // Action type is normal by default.
+    trigger->mask_mode = TRIGGER_OP_OR;             // Activation mask by default.
+    trigger->condition = TRIGGER_CONDITION_NONE;
+
+    // Activator type is LARA for all triggers except HEAVY ones, which are triggered by
+    // some specific entity classes.
+    trigger->heavy = (trigger->sub_function == TR_FD_TRIGTYPE_HEAVY) ||
+                     (trigger->sub_function == TR_FD_TRIGTYPE_HEAVYANTITRIGGER) ||
+                     (trigger->sub_function == TR_FD_TRIGTYPE_HEAVYSWITCH);
+
+    switch(trigger->sub_function)
+    {
+        case TR_FD_TRIGTYPE_PAD:
+        case TR_FD_TRIGTYPE_ANTIPAD:
+            if(trigger->sub_function == TR_FD_TRIGTYPE_ANTIPAD)
+            {
+                trigger->action_type = TR_ACTIONTYPE_ANTI;
+            }
+            // Check move type for triggering entity.
+            trigger->condition = TRIGGER_CONDITION_ON_FLOOR;
+            break;
+
+        case TR_FD_TRIGTYPE_SWITCH:
+            // Set activator and action type for now; conditions are linked with first item in operand chain.
+            trigger->activator = TR_ACTIVATOR_SWITCH;
+            trigger->action_type = TR_ACTIONTYPE_SWITCH;
+            trigger->mask_mode = TRIGGER_OP_XOR;
+            break;
+
+        case TR_FD_TRIGTYPE_HEAVYSWITCH:
+            // Action type remains normal, as HEAVYSWITCH acts as "heavy trigger" with activator mask filter.
+            trigger->activator = TR_ACTIVATOR_SWITCH;
+            trigger->mask_mode = TRIGGER_OP_XOR;
+            break;
+
+        case TR_FD_TRIGTYPE_KEY:
+            // Action type remains normal, as key acts one-way (no need in switch routines).
+            trigger->activator = TR_ACTIVATOR_KEY;
+            break;
+
+        case TR_FD_TRIGTYPE_PICKUP:
+            // Action type remains normal, as pick-up acts one-way (no need in switch routines).
+            trigger->activator = TR_ACTIVATOR_PICKUP;
+            break;
+
+        case TR_FD_TRIGTYPE_COMBAT:
+            // Check weapon status for triggering entity.
+            trigger->condition = TRIGGER_CONDITION_COMBAT;
+            break;
+
+        case TR_FD_TRIGTYPE_DUMMY:
+        case TR_FD_TRIGTYPE_SKELETON:   ///@FIXME: Find the meaning later!!!
+            // These triggers are being parsed, but not added to trigger script!
+            trigger->action_type = TR_ACTIONTYPE_BYPASS;
+            break;
+
+        case TR_FD_TRIGTYPE_ANTITRIGGER:
+        case TR_FD_TRIGTYPE_HEAVYANTITRIGGER:
+            trigger->action_type = TR_ACTIONTYPE_ANTI;
+            break;
+
+        case TR_FD_TRIGTYPE_MONKEY:
+            trigger->condition = TRIGGER_CONDITION_MONKEY;
+            break;
+
+        case TR_FD_TRIGTYPE_CLIMB:
+            trigger->condition = TRIGGER_CONDITION_CLIMB;
+            break;
+
+        case TR_FD_TRIGTYPE_TIGHTROPE:
+            trigger->condition = TRIGGER_CONDITION_TIGHTROPE;
+            break;
+
+        case TR_FD_TRIGTYPE_CRAWLDUCK:
+            trigger->condition = TRIGGER_CONDITION_CRAWLDUCK;
+            break;
+    }
+
+    // Switches depend on activator's animation, timed triggers must keep entity
+    // timer engaged while activator stays on sector; some commands act every frame.
+    trigger->continuous = (trigger->activator != TR_ACTIVATOR_NORMAL) || (trigger->timer != 0);
+    for(uint16_t i = 0; i < trigger->commands_count; i++)
+    {
+        switch(trigger->commands[i].function)
         {
-            case TR_FD_TRIGTYPE_HEAVY:
-            case TR_FD_TRIGTYPE_HEAVYANTITRIGGER:
-            case TR_FD_TRIGTYPE_HEAVYSWITCH:
-                if((entity_activator->type_flags & ENTITY_TYPE_HEAVYTRIGGER_ACTIVATOR) == 0)
-                {
-                    return;
-                }
+            case TR_FD_TRIGFUNC_UWCURRENT:
+            case TR_FD_TRIGFUNC_SET_CAMERA:
+            case TR_FD_TRIGFUNC_SET_TARGET:
+            case TR_FD_TRIGFUNC_FLYBY:
+            case TR_FD_TRIGFUNC_ENDLEVEL:
+                trigger->continuous = 0x01;
                 break;
         }
+    }
 
-        switch(trigger->sub_function)
-        {
-            case TR_FD_TRIGTYPE_TRIGGER:
-            case TR_FD_TRIGTYPE_HEAVY:
-                activator = TR_ACTIVATOR_NORMAL;
-                break;
+    // Trigger may be changed by script in game.
+    Trigger_Invalidate();
+}
 
-            case TR_FD_TRIGTYPE_PAD:
-            case TR_FD_TRIGTYPE_ANTIPAD:
-                if(trigger->sub_function == TR_FD_TRIGTYPE_ANTIPAD)
-                {
-                    action_type = TR_ACTIONTYPE_ANTI;
-                }
-                // Check move type for triggering entity.
-                header_condition = (entity_activator->move_type == MOVE_ON_FLOOR);  // Set additional condition.
-                break;
 
-            case TR_FD_TRIGTYPE_SWITCH:
-                // Set activator and action type for now; conditions are linked with first item in operand chain.
-                activator = TR_ACTIVATOR_SWITCH;
-                action_type = TR_ACTIONTYPE_SWITCH;
-                mask_mode = TRIGGER_OP_XOR;
-                break;
+void Trigger_Invalidate()
+{
+    trigger_epoch++;
+    if(trigger_epoch == 0)
+    {
+        trigger_epoch = 1;
+    }
+}
 
-            case TR_FD_TRIGTYPE_HEAVYSWITCH:
-                // Action type remains normal, as HEAVYSWITCH acts as "heavy trigger" with activator mask filter.
-                activator = TR_ACTIVATOR_SWITCH;
-                mask_mode = TRIGGER_OP_XOR;
-                break;
 
-            case TR_FD_TRIGTYPE_KEY:
-                // Action type remains normal, as key acts one-way (no need in switch routines).
-                activator = TR_ACTIVATOR_KEY;
-                break;
+uint32_t Trigger_GetEpoch()
+{
+    return trigger_epoch;
+}
 
-            case TR_FD_TRIGTYPE_PICKUP:
-                // Action type remains normal, as pick-up acts one-way (no need in switch routines).
-                activator = TR_ACTIVATOR_PICKUP;
-                break;
 
-            case TR_FD_TRIGTYPE_COMBAT:
-                // Check weapon status for triggering entity.
-                header_condition = entity_activator->character && (entity_activator->character->weapon_current_state > 0);
-                break;
+static int Trigger_CheckCondition(trigger_header_p trigger, struct entity_s *entity_activator)
+{
+    switch(trigger->condition)
+    {
+        case TRIGGER_CONDITION_ON_FLOOR:
+            return entity_activator->move_type == MOVE_ON_FLOOR;
 
-            case TR_FD_TRIGTYPE_DUMMY:
-            case TR_FD_TRIGTYPE_SKELETON:   ///@FIXME: Find the meaning later!!!
-                // These triggers are being parsed, but not added to trigger script!
-                action_type = TR_ACTIONTYPE_BYPASS;
-                break;
+        case TRIGGER_CONDITION_COMBAT:
+            return entity_activator->character && (entity_activator->character->weapon_current_state > 0);
 
-            case TR_FD_TRIGTYPE_ANTITRIGGER:
-            case TR_FD_TRIGTYPE_HEAVYANTITRIGGER:
-                action_type = TR_ACTIONTYPE_ANTI;
-                break;
+        case TRIGGER_CONDITION_MONKEY:
+            return entity_activator->move_type == MOVE_MONKEYSWING;
 
-            case TR_FD_TRIGTYPE_MONKEY:
-            case TR_FD_TRIGTYPE_CLIMB:
-                // Check move type for triggering entity.
-                header_condition = ((trigger->sub_function == TR_FD_TRIGTYPE_MONKEY) ? (entity_activator->move_type == MOVE_MONKEYSWING) : (entity_activator->move_type == MOVE_CLIMBING));  // Set additional condition.
-                break;
+        case TRIGGER_CONDITION_CLIMB:
+            return entity_activator->move_type == MOVE_CLIMBING;
 
-            case TR_FD_TRIGTYPE_TIGHTROPE:
-                // Check state range for triggering entity.
-                header_condition = ((entity_activator->state_flags >= TR_STATE_LARA_TIGHTROPE_IDLE) && (entity_activator->state_flags <= TR_STATE_LARA_TIGHTROPE_EXIT));
-                break;
+        case TRIGGER_CONDITION_TIGHTROPE:
+            return (entity_activator->state_flags >= TR_STATE_LARA_TIGHTROPE_IDLE) && (entity_activator->state_flags <= TR_STATE_LARA_TIGHTROPE_EXIT);
 
-            case TR_FD_TRIGTYPE_CRAWLDUCK:
-                // Check state range for triggering entity.
-                header_condition = ((entity_activator->state_flags >= TR_ANIMATION_LARA_CROUCH_ROLL_FORWARD_BEGIN) && (entity_activator->state_flags <= TR_ANIMATION_LARA_CRAWL_SMASH_LEFT));
-                break;
-        }
+        case TRIGGER_CONDITION_CRAWLDUCK:
+            return (entity_activator->state_flags >= TR_ANIMATION_LARA_CROUCH_ROLL_FORWARD_BEGIN) && (entity_activator->state_flags <= TR_ANIMATION_LARA_CRAWL_SMASH_LEFT);
+    }
+
+    return 1;
+}
 
-        if(!header_condition)
+///@TODO: move here TickEntity with Inversing entity state... see carefully heavy irregular cases
+void Trigger_DoCommands(trigger_header_p trigger, struct entity_s *entity_activator)
+{
+    if(trigger && entity_activator)
+    {
+        int activator           = trigger->activator;
+        int action_type         = trigger->action_type;
+        int mask_mode           = trigger->mask_mode;
+        trigger_command_p commands_end = trigger->commands + trigger->commands_count;
+
+        if(trigger->heavy && ((entity_activator->type_flags & ENTITY_TYPE_HEAVYTRIGGER_ACTIVATOR) == 0))
+        {
+            return;
+        }
+        if(!Trigger_CheckCondition(trigger, entity_activator))
         {
             return;
         }
         if((activator == TR_ACTIVATOR_NORMAL) && (Entity_GetSectorStatus(entity_activator) == 1))
         {
-            for(trigger_command_p command = trigger->commands; command; command = command->next)
+            for(trigger_command_p command = trigger->commands; command < commands_end; command++)
             {
                 if(command->function == TR_FD_TRIGFUNC_UWCURRENT)
                 {
@@ -212,7 +322,7 @@ void Trigger_DoCommands(trigger_header_p trigger, struct entity_s *entity_activa
         int first_command = 1;
         int switch_sectorstatus = 0;
         uint32_t switch_mask = 0;
-        for(trigger_command_p command = trigger->commands; command; command = command->next)
+        for(trigger_command_p command = trigger->commands; command < commands_end; command++)
         {
             entity_p trig_entity = World_GetEntityByID(command->operands);
 
@@ -571,7 +681,8 @@ void Trigger_BuildScripts(trigger_header_p trigger, uint32_t trigger_index, cons
         // Now parse operand chain for trigger function!
         int argn = 0;
         trigger_command_p prev_command = NULL;
-        for(trigger_command_p command = trigger->commands; command; command = command->next)
+        trigger_command_p commands_end = trigger->commands + trigger->commands_count;
+        for(trigger_command_p command = trigger->commands; command < commands_end; command++)
         {
             switch(command->function)
             {
@@ -107,6 +107,15 @@
 // Entity activation response
 #define ENTITY_TRIGGERING_NOT_READY    (2)
 
+// Pre-decoded trigger header conditions (checked against activator state).
+#define TRIGGER_CONDITION_NONE      (0)
+#define TRIGGER_CONDITION_ON_FLOOR  (1)
+#define TRIGGER_CONDITION_COMBAT    (2)
+#define TRIGGER_CONDITION_MONKEY    (3)
+#define TRIGGER_CONDITION_CLIMB     (4)
+#define TRIGGER_CONDITION_TIGHTROPE (5)
+#define TRIGGER_CONDITION_CRAWLDUCK (6)
+
 struct lua_State;
 
 typedef struct trigger_command_s
@@ -117,7 +126,6 @@ typedef struct trigger_command_s
     uint8_t                         cam_index;
     uint8_t                         cam_timer;
     uint8_t                         cam_move;
-    struct trigger_command_s       *next;
 }trigger_command_t, *trigger_command_p;
 
 
@@ -128,10 +136,31 @@ typedef struct trigger_header_s
     uint16_t    once : 2;
     uint16_t    timer;
     uint16_t    mask;
-    struct trigger_command_s       *commands;
+    // decoded from sub_function and commands by Trigger_Compile
+    uint8_t     activator;
+    uint8_t     action_type;
+    uint8_t     mask_mode;
+    uint8_t     condition;
+    uint8_t     heavy;
+    uint8_t     continuous;                 // must be evaluated every frame, not only on events
+    uint16_t    commands_count;
+    struct trigger_command_s       *commands;   // contiguous array
 }trigger_header_t, *trigger_header_p;
 
 
+trigger_header_p Trigger_Create(uint16_t function_value, uint16_t sub_function, uint16_t mask, uint16_t once, uint16_t timer);
+void Trigger_Delete(trigger_header_p trigger);
+trigger_command_p Trigger_AddCommand(trigger_header_p trigger);
+void Trigger_Compile(trigger_header_p trigger);
+
+/*
+ * Triggers are re-evaluated only on events: activator sector or state change, or
+ * any change of trigger related world state (entity trigger layouts, flipmaps),
+ * reported by Trigger_Invalidate. Continuous triggers are evaluated every frame.
+ */
+void Trigger_Invalidate();
+uint32_t Trigger_GetEpoch();
+
 void Trigger_BuildScripts(trigger_header_p trigger, uint32_t trigger_index, const char *file_name);
 void Trigger_DoCommands(trigger_header_p trigger, struct entity_s *ent);
 
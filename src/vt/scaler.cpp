@@ -1,5 +1,6 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_endian.h>
+#include "scaler.h"
 
 static unsigned int colorMask = 0xF7DEF7DE;
 static unsigned int lowPixelMask = 0x08210821;
@@ -384,3 +385,75 @@ void Super2xSaI(unsigned char *src, unsigned int src_pitch, int src_bytes_per_pi
         }
     }
 }
+
+
+/*
+ * 32-bit Scale2x (AdvMAME2x) and Scale3x of RGBA images; pitches are in pixels.
+ * Only source rows [first_row, last_row) are scaled, so a picture may be
+ * split between threads by row bands. Edges are clamped.
+ */
+void Scale2x_32(const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch, int width, int height, int first_row, int last_row)
+{
+    int x, y;
+
+    for (y = first_row; y < last_row; y++) {
+        const uint32_t *line = src + y * src_pitch;
+        const uint32_t *up = (y > 0) ? (line - src_pitch) : (line);
+        const uint32_t *down = (y < height - 1) ? (line + src_pitch) : (line);
+        uint32_t *dst0 = dst + 2 * y * dst_pitch;
+        uint32_t *dst1 = dst0 + dst_pitch;
+
+        for (x = 0; x < width; x++) {
+            uint32_t B = up[x];
+            uint32_t D = line[(x > 0) ? (x - 1) : (x)];
+            uint32_t E = line[x];
+            uint32_t F = line[(x < width - 1) ? (x + 1) : (x)];
+            uint32_t H = down[x];
+            int edge = (B != H) && (D != F);
+
+            dst0[2 * x]     = (edge && (D == B)) ? (D) : (E);
+            dst0[2 * x + 1] = (edge && (B == F)) ? (F) : (E);
+            dst1[2 * x]     = (edge && (D == H)) ? (D) : (E);
+            dst1[2 * x + 1] = (edge && (H == F)) ? (F) : (E);
+        }
+    }
+}
+
+
+void Scale3x_32(const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch, int width, int height, int first_row, int last_row)
+{
+    int x, y;
+
+    for (y = first_row; y < last_row; y++) {
+        const uint32_t *line = src + y * src_pitch;
+        const uint32_t *up = (y > 0) ? (line - src_pitch) : (line);
+        const uint32_t *down = (y < height - 1) ? (line + src_pitch) : (line);
+        uint32_t *dst0 = dst + 3 * y * dst_pitch;
+        uint32_t *dst1 = dst0 + dst_pitch;
+        uint32_t *dst2 = dst1 + dst_pitch;
+
+        for (x = 0; x < width; x++) {
+            int xl = (x > 0) ? (x - 1) : (x);
+            int xr = (x < width - 1) ? (x + 1) : (x);
+            uint32_t A = up[xl], B = up[x], C = up[xr];
+            uint32_t D = line[xl], E = line[x], F = line[xr];
+            uint32_t G = down[xl], H = down[x], I = down[xr];
+
+            if ((B != H) && (D != F)) {
+                dst0[3 * x]     = (D == B) ? (D) : (E);
+                dst0[3 * x + 1] = (((D == B) && (E != C)) || ((B == F) && (E != A))) ? (B) : (E);
+                dst0[3 * x + 2] = (B == F) ? (F) : (E);
+                dst1[3 * x]     = (((D == B) && (E != G)) || ((D == H) && (E != A))) ? (D) : (E);
+                dst1[3 * x + 1] = E;
+                dst1[3 * x + 2] = (((B == F) && (E != I)) || ((H == F) && (E != C))) ? (F) : (E);
+                dst2[3 * x]     = (D == H) ? (D) : (E);
+                dst2[3 * x + 1] = (((D == H) && (E != I)) || ((H == F) && (E != G))) ? (H) : (E);
+                dst2[3 * x + 2] = (H == F) ? (F) : (E);
+            } else {
+                dst0[3 * x] = dst0[3 * x + 1] = dst0[3 * x + 2] = E;
+                dst1[3 * x] = dst1[3 * x + 1] = dst1[3 * x + 2] = E;
+                dst2[3 * x] = dst2[3 * x + 1] = dst2[3 * x + 2] = E;
+            }
+        }
+    }
+}
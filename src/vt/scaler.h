@@ -1,6 +1,12 @@
 #ifndef _SCALER_H_
 #define _SCALER_H_
 
+#include <stdint.h>
+
 void Super2xSaI(unsigned char *src, unsigned int src_pitch, int src_bytes_per_pixel, unsigned char *dst, unsigned int dst_pitch, int dst_bytes_per_pixel, int width, int height, int pal[256]);
 
+// 32-bit pixel art scalers; pitches are in pixels, source rows [first_row, last_row) are processed.
+void Scale2x_32(const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch, int width, int height, int first_row, int last_row);
+void Scale3x_32(const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch, int width, int height, int first_row, int last_row);
+
 #endif // _SCALER_H_
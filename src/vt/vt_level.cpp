@@ -3,8 +3,24 @@
 #include <stdio.h>
 #include "tr_versions.h"
 #include "vt_level.h"
+#include "scaler.h"
+#include "../core/jobs.h"
+#include "../core/system.h"
+#include "../core/tex_compress.h"
 #include <ctype.h>
 
+#define UPSCALE_CACHE_MAGIC         (0x5355544F)    // "OTUS"
+#define UPSCALE_CACHE_VERSION       (1)
+#define UPSCALE_BANDS               (8)             // jobs per textile
+
+typedef struct upscale_job_s
+{
+    const uint32_t *src;
+    uint32_t       *dst;
+    int             src_size;                       // textile edge in source
+    int             scale;                          // 2 or 3
+} upscale_job_t, *upscale_job_p;
+
 //#define RCSID "$Id: vt_level.cpp,v 1.1 2002/09/20 15:59:02 crow Exp $"
 
 int VT_Level::get_level_format(const char *name)
@@ -308,6 +324,101 @@ void WriteTGAfile(const char *filename, const uint8_t *data, const int width, co
     }
 }
 
+static void UpscaleJob(void *data, int index, int thread)
+{
+    upscale_job_p job = (upscale_job_p)data;
+    int textile = index / UPSCALE_BANDS;
+    int band = index % UPSCALE_BANDS;
+    int dst_size = job->scale * job->src_size;
+    const uint32_t *src = job->src + (size_t)textile * job->src_size * job->src_size;
+    uint32_t *dst = job->dst + (size_t)textile * dst_size * dst_size;
+    int first_row = band * job->src_size / UPSCALE_BANDS;
+    int last_row = (band + 1) * job->src_size / UPSCALE_BANDS;
+
+    if(job->scale == 3)
+        Scale3x_32(src, job->src_size, dst, dst_size, job->src_size, job->src_size, first_row, last_row);
+    else
+        Scale2x_32(src, job->src_size, dst, dst_size, job->src_size, job->src_size, first_row, last_row);
+}
+
+static void UpscalePass(const uint32_t *src, uint32_t *dst, int src_size, int scale, int count)
+{
+    upscale_job_t job;
+
+    job.src = src;
+    job.dst = dst;
+    job.src_size = src_size;
+    job.scale = scale;
+    Jobs_ParallelFor(UpscaleJob, &job, count * UPSCALE_BANDS);
+}
+
+/*
+ * Upscaled textiles are kept in cache/textiles_x<scale>_<hash>.raw: header
+ * (magic, version, scale, count) and pixels; hash is taken from source textiles.
+ */
+static int UpscaleCacheIO(const char *name, uint32_t *pixels, size_t pixels_size, int scale, int count, int write)
+{
+    uint32_t header[4] = {UPSCALE_CACHE_MAGIC, UPSCALE_CACHE_VERSION, (uint32_t)scale, (uint32_t)count};
+    uint32_t file_header[4];
+    SDL_RWops *f;
+    int ret;
+
+    if(write)
+    {
+        // partial file is never visible under the cache name
+        char tmp_name[96];
+        FILE *tf = Sys_OpenTempFile(name, tmp_name, sizeof(tmp_name));
+        if(tf == NULL)
+            return 0;
+        ret = (fwrite(header, sizeof(header), 1, tf) == 1) && (fwrite(pixels, pixels_size, 1, tf) == 1);
+        return Sys_CommitTempFile(tf, tmp_name, name, ret);
+    }
+
+    f = SDL_RWFromFile(name, "rb");
+    if(f == NULL)
+        return 0;
+    ret = (SDL_RWread(f, file_header, sizeof(file_header), 1) == 1) && (memcmp(header, file_header, sizeof(header)) == 0) &&
+          (SDL_RWread(f, pixels, pixels_size, 1) == 1);
+    SDL_RWclose(f);
+
+    return ret;
+}
+
+void VT_Level::upscale_textiles(int scale)
+{
+    int size = 256 * scale;
+    size_t pixels_size;
+    char name[64];
+
+    free(textile32_scaled);
+    textile32_scaled = NULL;
+    textile32_scale = 1;
+    if(((scale != 2) && (scale != 3) && (scale != 4)) || (textile32_count == 0))
+        return;
+
+    pixels_size = (size_t)textile32_count * size * size * sizeof(uint32_t);
+    textile32_scaled = (uint32_t*)malloc(pixels_size);
+    textile32_scale = scale;
+
+    snprintf(name, sizeof(name), "cache/textiles_x%d_%.16llX.raw", scale,
+             (unsigned long long)TexCompress_Hash((const uint8_t*)textile32, textile32_count * sizeof(tr4_textile32_t)));
+    if(UpscaleCacheIO(name, textile32_scaled, pixels_size, scale, textile32_count, 0))
+        return;
+
+    if(scale == 4)
+    {
+        uint32_t *half = (uint32_t*)malloc((size_t)textile32_count * 512 * 512 * sizeof(uint32_t));
+        UpscalePass(&textile32[0].pixels[0][0], half, 256, 2, textile32_count);
+        UpscalePass(half, textile32_scaled, 512, 2, textile32_count);
+        free(half);
+    }
+    else
+    {
+        UpscalePass(&textile32[0].pixels[0][0], textile32_scaled, 256, scale, textile32_count);
+    }
+    UpscaleCacheIO(name, textile32_scaled, pixels_size, scale, textile32_count, 1);
+}
+
 void VT_Level::dump_textures()
 {
     uint32_t i;
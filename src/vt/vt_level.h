@@ -14,9 +14,26 @@ void WriteTGAfile(const char *filename, const uint8_t *data, const int width, co
 class VT_Level : public TR_Level 
 {
     public:
+    VT_Level()
+    {
+        textile32_scale = 1;
+        textile32_scaled = NULL;
+    }
+
+    ~VT_Level()
+    {
+        free(textile32_scaled);
+        textile32_scaled = NULL;
+    }
+
+    // Pixel art upscaled copy of textile32 (Scale2x, Scale3x, Scale2x twice for 4), (256 * scale)^2 pixels per textile.
+    int textile32_scale;
+    uint32_t *textile32_scaled;
+
     static int get_level_format(const char *name);
     static int get_PC_level_version(const char *name);
     void prepare_level();
+    void upscale_textiles(int scale);               // 1 - off, 2, 3 or 4; results are cached on disk
     void dump_textures();
     tr_staticmesh_t *find_staticmesh_id(uint32_t object_id);
     tr2_item_t *find_item_id(int32_t object_id);
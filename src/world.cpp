@@ -38,6 +38,7 @@ extern "C" {
 #include "resource.h"
 #include "inventory.h"
 #include "trigger.h"
+#include "residency.h"
 
 
  struct world_s
@@ -128,7 +129,6 @@ void World_GenRoomFlipMap();
 void World_GenSkeletalModels(class VT_Level *tr);
 void World_GenEntities(class VT_Level *tr);
 void World_GenBaseItems();
-void World_GenSpritesBuffer();
 void World_GenRoomProperties(class VT_Level *tr);
 void World_GenRoomCollision();
 void World_FixRooms();
@@ -231,10 +231,6 @@ void World_Open(class VT_Level *tr)
     World_GenBaseItems();               // Generate inventory item entries.
     Gui_DrawLoadScreen(680);
 
-    // Generate sprite buffers. Only now because entity generation adds new sprites
-    World_GenSpritesBuffer();
-    Gui_DrawLoadScreen(700);
-
     World_GenRoomProperties(tr);
     Gui_DrawLoadScreen(750);
 
@@ -298,6 +294,7 @@ void World_Clear()
         global_world.Character->self->room = NULL;
         global_world.Character->self->next = NULL;
         global_world.Character->current_sector = NULL;
+        global_world.Character->trigger_sector = NULL;
     }
 
     /* entity empty must be done before rooms destroy */
@@ -307,6 +304,8 @@ void World_Clear()
     /* Now we can delete physics misc objects */
     Physics_CleanUpObjects();
 
+    Residency_Clear();
+    Physics_ClearRoomShapes();
     for(uint32_t i = 0; i < global_world.rooms_count; i++)
     {
         Room_Clear(global_world.rooms + i);
@@ -988,6 +987,10 @@ int World_SetFlipState(uint32_t flip_index, uint32_t flip_state)
                 }
             }
         }
+        if(global_world.flip_state[flip_index] != flip_state)
+        {
+            Trigger_Invalidate();
+        }
         global_world.flip_state[flip_index] = flip_state;
     }
 
@@ -1005,6 +1008,7 @@ int World_SetFlipMap(uint32_t flip_index, uint8_t flip_mask, uint8_t flip_operat
         return 0;
     }
 
+    uint8_t flip_map = global_world.flip_map[flip_index];
     if(flip_operation == TRIGGER_OP_XOR)
     {
         global_world.flip_map[flip_index] ^= flip_mask;
@@ -1013,6 +1017,10 @@ int World_SetFlipMap(uint32_t flip_index, uint8_t flip_mask, uint8_t flip_operat
     {
         global_world.flip_map[flip_index] |= flip_mask;
     }
+    if(flip_map != global_world.flip_map[flip_index])
+    {
+        Trigger_Invalidate();
+    }
 
     return 0;
 }
@@ -1491,20 +1499,27 @@ void World_GenTextures(class VT_Level *tr)
     int border_size = renderer.settings.texture_border;
     border_size = (border_size < 0) ? (0) : (border_size);
     border_size = (border_size > 128) ? (128) : (border_size);
+    tr->upscale_textiles(renderer.settings.texture_upscale);
     global_world.tex_atlas = new bordered_texture_atlas(border_size,
+                                                  renderer.settings.texture_packer,
                                                   tr->textile32_count,
                                                   tr->textile32,
                                                   tr->object_textures_count,
                                                   tr->object_textures,
                                                   tr->sprite_textures_count,
-                                                  tr->sprite_textures);
+                                                  tr->sprite_textures,
+                                                  tr->textile32_scaled,
+                                                  tr->textile32_scale);
 
     global_world.tex_count = (uint32_t) global_world.tex_atlas->getNumAtlasPages();
+    Con_Printf("texture atlas: version = %d, packer = %d, pages = %d, fill = %.1f%%, time = %.1f ms",
+               tr->game_version, renderer.settings.texture_packer, global_world.tex_count,
+               100.0f * global_world.tex_atlas->getPackingFillRatio(), 1000.0f * global_world.tex_atlas->getPackingTime());
     global_world.textures = (GLuint*)malloc(global_world.tex_count * sizeof(GLuint));
 
     qglPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     qglPixelZoom(1, 1);
-    global_world.tex_atlas->createTextures(global_world.textures);
+    global_world.tex_atlas->createTextures(global_world.textures, renderer.settings.texture_compression != 0, renderer.settings.mipmaps);
 
     qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   // Mag filter is always linear.
 
@@ -1589,6 +1604,7 @@ void World_GenAnimTextures(class VT_Level *tr)
             seq->frame_rate        = 0.05;  // Should be passed as 1 / FPS.
             seq->frame_time        = 0.0;   // Reset frame time to initial state.
             seq->current_frame     = 0;     // Reset current frame to zero.
+            seq->change_tick       = 0;
 
             for(uint16_t j = 0; j < seq->frames_count; j++)
             {
@@ -1849,7 +1865,6 @@ void World_GenRoom(struct room_s *room, class VT_Level *tr)
     room->content->mesh = NULL;
     room->content->static_mesh = NULL;
     room->content->sprites = NULL;
-    room->content->sprites_vertices = NULL;
     room->content->lights_count = 0;
     room->content->lights = NULL;
     room->content->light_mode = tr->rooms[room->id].light_mode;
@@ -1860,11 +1875,8 @@ void World_GenRoom(struct room_s *room, class VT_Level *tr)
     room->content->ambient_lighting[1] = tr->rooms[room->id].light_colour.g * 2;
     room->content->ambient_lighting[2] = tr->rooms[room->id].light_colour.b * 2;
 
+    // faces and vbo are made later by Residency_Init
     TR_GenRoomMesh(room, room->id, global_world.anim_sequences, global_world.anim_sequences_count, global_world.tex_atlas, tr);
-    if(room->content->mesh)
-    {
-        BaseMesh_GenFaces(room->content->mesh);
-    }
     /*
      *  let us load static room meshes
      */
@@ -1946,8 +1958,7 @@ void World_GenRoom(struct room_s *room, class VT_Level *tr)
 
         World_SetStaticMeshProperties(r_static);
 
-        // Set static mesh collision.
-        Physics_GenStaticMeshRigidBody(r_static);
+        // Static mesh collision is made together with room collision.
     }
 
     /*
@@ -2222,6 +2233,8 @@ void World_GenRooms(class VT_Level *tr)
         r->id = i;
         World_GenRoom(r, tr);
     }
+
+    Residency_Init(global_world.rooms, global_world.rooms_count);
 }
 
 
@@ -2469,15 +2482,6 @@ void World_GenBaseItems()
 }
 
 
-void World_GenSpritesBuffer()
-{
-    for (uint32_t i = 0; i < global_world.rooms_count; i++)
-    {
-        Room_GenSpritesBuffer(&global_world.rooms[i]);
-    }
-}
-
-
 void World_GenRoomProperties(class VT_Level *tr)
 {
     const char *script_dump_name = "scripts_dump.lua";      ///@DEBUG
@@ -2515,8 +2519,6 @@ void World_GenRoomProperties(class VT_Level *tr)
 
 void World_GenRoomCollision()
 {
-    room_p r = global_world.rooms;
-
     /*
     if(level_script != NULL)
     {
@@ -2524,37 +2526,7 @@ void World_GenRoomCollision()
     }
     */
 
-    for(uint32_t i = 0; i < global_world.rooms_count; i++, r++)
-    {
-        // Inbetween polygons array is later filled by loop which scans adjacent
-        // sector heightmaps and fills the gaps between them, thus creating inbetween
-        // polygon. Inbetweens can be either quad (if all four corner heights are
-        // different), triangle (if one corner height is similar to adjacent) or
-        // ghost (if corner heights are completely similar). In case of quad inbetween,
-        // two triangles are added to collisional trimesh, in case of triangle inbetween,
-        // we add only one, and in case of ghost inbetween, we ignore it.
-
-        int num_heightmaps = (r->sectors_x * r->sectors_y);
-        int num_tweens = (num_heightmaps * 4);
-        sector_tween_s *room_tween   = new sector_tween_s[num_tweens];
-
-        // Clear tween array.
-
-        for(int j = 0; j < num_tweens; j++)
-        {
-            room_tween[j].ceiling_tween_type = TR_SECTOR_TWEEN_TYPE_NONE;
-            room_tween[j].floor_tween_type   = TR_SECTOR_TWEEN_TYPE_NONE;
-        }
-
-        // Most difficult task with converting floordata collision to trimesh collision is
-        // building inbetween polygons which will block out gaps between sector heights.
-        Res_Sector_GenTweens(r, room_tween);
-
-        // Final step is sending actual sectors to Bullet collision model. We do it here.
-        Physics_GenRoomRigidBody(r, room_tween, num_tweens);
-
-        delete[] room_tween;
-    }
+    Physics_InitRoomShapes(global_world.rooms, global_world.rooms_count);
 }
 
 